@@ -0,0 +1,64 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+// BENCHMARK() registers a function that calls Benchmark::Measure() for the
+// variants it compares. Measure() repeats a variant until it ran for a while
+// and prints the time of one run and, if given, the throughput.
+
+namespace Benchmark
+{
+using BenchmarkFunc = void (*)();
+
+bool Register(const char* name, BenchmarkFunc func);
+
+/// keeps the compiler from optimizing away results that aren't used
+void Use(size_t value);
+
+/// a text that looks like source code: lines of words, numbers and
+/// punctuation, with some non-ASCII characters. The same for the same seed.
+std::string SourceText(size_t size, unsigned int seed = 42);
+
+template <typename Func>
+void Measure(const char* variant, size_t bytes, Func func)
+{
+    using Clock = std::chrono::steady_clock;
+    func(); // warm up caches and lazy initializations
+    int  runs  = 0;
+    auto start = Clock::now();
+    auto now   = start;
+    do
+    {
+        func();
+        ++runs;
+        now = Clock::now();
+    } while (now - start < std::chrono::milliseconds(500) && runs < 1000);
+    double ms = std::chrono::duration<double, std::milli>(now - start).count() / runs;
+    if (bytes)
+        printf("  %-44s %10.3f ms %10.1f MB/s\n", variant, ms, bytes / (1024.0 * 1024.0) / (ms / 1000.0));
+    else
+        printf("  %-44s %10.3f ms\n", variant, ms);
+}
+} // namespace Benchmark
+
+#define BENCHMARK(name)                                                    \
+    static void benchmark_##name();                                        \
+    static bool benchmark_##name##_registered = Benchmark::Register(#name, benchmark_##name); \
+    static void benchmark_##name()
@@ -0,0 +1,95 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <vector>
+
+namespace
+{
+struct Entry
+{
+    std::string              name;
+    Benchmark::BenchmarkFunc func;
+};
+
+std::vector<Entry>& Registry()
+{
+    static std::vector<Entry> benchmarks;
+    return benchmarks;
+}
+
+std::atomic<size_t> g_sink;
+} // namespace
+
+namespace Benchmark
+{
+bool Register(const char* name, BenchmarkFunc func)
+{
+    Registry().push_back({name, func});
+    return true;
+}
+
+void Use(size_t value)
+{
+    g_sink.fetch_add(value, std::memory_order_relaxed);
+}
+
+std::string SourceText(size_t size, unsigned int seed)
+{
+    static const char* const words[]      = {"if", "else", "for", "return", "int", "auto", "const", "std::string", "value", "result",
+                                           "m_count", "GetText", "pos", "0", "42", "1024", "nullptr", "true", "i", "len", "text",
+                                           "buffer", "line", "Find", "Replace"};
+    static const char* const foreign[]    = {"\xc3\xa9t\xc3\xa9", "Stra\xc3\x9f" "e", "\xe6\x97\xa5\xe6\x9c\xac"};
+    static const char* const separators[] = {" ", " ", " ", ", ", "(", ")", " = ", "; ", ".", "->", " + ", " < "};
+    std::mt19937             rng(seed);
+    std::string              text;
+    text.reserve(size + 100);
+    while (text.size() < size)
+    {
+        text.append(rng() % 4 * 4, ' ');
+        for (auto count = 2 + rng() % 10; count > 0; --count)
+        {
+            // mostly ASCII, like most source code
+            text += rng() % 64 ? words[rng() % std::size(words)] : foreign[rng() % std::size(foreign)];
+            text += separators[rng() % std::size(separators)];
+        }
+        text += rng() % 8 ? "\n" : "\r\n";
+    }
+    text.resize(size);
+    return text;
+}
+} // namespace Benchmark
+
+// runs all benchmarks, or the ones whose name starts with an argument
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> filters(argv + 1, argv + argc);
+    for (const auto& benchmark : Registry())
+    {
+        if (!filters.empty() && std::none_of(filters.begin(), filters.end(), [&](const std::string& filter) {
+                return benchmark.name.compare(0, filter.size(), filter) == 0;
+            }))
+            continue;
+        printf("%s\n", benchmark.name.c_str());
+        benchmark.func();
+    }
+    return 0;
+}
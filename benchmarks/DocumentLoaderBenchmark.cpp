@@ -0,0 +1,145 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// CDocumentManager loads files through LoadFromHandle(), which detects the
+// encoding, converts the text to UTF-8 and passes it on to a Scintilla
+// document. This loads a file in each encoding into a document, once read
+// with ReadFile() in blocks and once from a mapped view, the way files above
+// the "mappedloadthreshold" are loaded. The throughput is of the file size.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "DocumentLoader.h"
+#include "TextEncoding.h"
+
+// the Scintilla headers need these first
+#include <memory>
+#include <regex>
+#include "../ext/scintilla/lexlib/CharacterCategory.h"
+#include "../ext/scintilla/src/Position.h"
+#include "UTF8DocumentIterator.h"
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#ifndef _WIN32
+#    include <fcntl.h>
+#endif
+
+using namespace Scintilla;
+
+namespace
+{
+constexpr size_t TextSize = 32 * 1024 * 1024;
+
+struct FileEncoding
+{
+    const char* name;
+    int         encoding; // passed to LoadFromHandle(), -1 to detect it
+    std::string content;
+};
+
+std::vector<FileEncoding> EncodedFiles(const std::string& text)
+{
+    std::vector<FileEncoding> files;
+    files.push_back({"UTF-8", -1, text});
+
+    const std::pair<const char*, bool> utf16[] = {{"UTF-16 LE", false}, {"UTF-16 BE", true}};
+    for (const auto& [name, bigEndian] : utf16)
+    {
+        std::string content(2 + text.size() * 2, '\0');
+        content[0] = bigEndian ? '\xFE' : '\xFF';
+        content[1] = bigEndian ? '\xFF' : '\xFE';
+        content.resize(2 + CTextEncoding::Utf8ToUtf16(text.data(), text.size(), bigEndian, content.data() + 2));
+        files.push_back({name, -1, std::move(content)});
+    }
+
+    const std::pair<const char*, bool> utf32[] = {{"UTF-32 LE", false}, {"UTF-32 BE", true}};
+    for (const auto& [name, bigEndian] : utf32)
+    {
+        std::string content(4 + text.size() * 4, '\0');
+        const char  bom[] = {'\xFF', '\xFE', '\0', '\0'};
+        for (int i = 0; i < 4; ++i)
+            content[i] = bom[bigEndian ? 3 - i : i];
+        content.resize(4 + CTextEncoding::Utf8ToUtf32(text.data(), text.size(), bigEndian, content.data() + 4));
+        files.push_back({name, -1, std::move(content)});
+    }
+
+    std::vector<wchar_t> wide(text.size());
+    int                  wideLen = MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), wide.data(), static_cast<int>(wide.size()));
+    std::string          ansi(wideLen, '\0');
+    ansi.resize(WideCharToMultiByte(CP_ACP, 0, wide.data(), wideLen, ansi.data(), static_cast<int>(ansi.size()), nullptr, nullptr));
+    files.push_back({"ANSI", CP_ACP, std::move(ansi)});
+    return files;
+}
+
+HANDLE OpenForReading(const std::filesystem::path& path)
+{
+#ifdef _WIN32
+    return CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+#else
+    return FileHandle(open(path.c_str(), O_RDONLY));
+#endif
+}
+
+void CloseFile(HANDLE hFile)
+{
+#ifdef _WIN32
+    CloseHandle(hFile);
+#else
+    close(FileDescriptor(hFile));
+#endif
+}
+
+// loads the file into a new document like SCI_CREATELOADER does
+size_t LoadDocument(const std::filesystem::path& path, size_t fileSize, unsigned __int64 mappedThreshold, int encoding)
+{
+    auto* doc = new Document(SC_DOCUMENTOPTION_DEFAULT);
+    doc->AddRef();
+    doc->Allocate(static_cast<Sci::Position>(fileSize));
+    doc->SetUndoCollection(false);
+
+    HANDLE       hFile = OpenForReading(path);
+    LoadedFormat format;
+    DWORD        err    = LoadFromHandle(hFile, fileSize, mappedThreshold, encoding, *doc, format);
+    size_t       length = err ? 0 : static_cast<size_t>(doc->Length());
+    CloseFile(hFile);
+    doc->Release();
+    return length;
+}
+} // namespace
+
+BENCHMARK(DocumentLoader)
+{
+    auto path = std::filesystem::temp_directory_path() / "bowpad_load_benchmark.txt";
+    for (const auto& file : EncodedFiles(Benchmark::SourceText(TextSize)))
+    {
+        std::ofstream(path, std::ios::binary | std::ios::trunc).write(file.content.data(), file.content.size());
+
+        const size_t fileSize = file.content.size();
+        std::string  variant  = std::string(file.name) + ", ReadFile() in blocks";
+        Benchmark::Measure(variant.c_str(), fileSize, [&]() {
+            Benchmark::Use(LoadDocument(path, fileSize, 0, file.encoding));
+        });
+        variant = std::string(file.name) + ", mapped view";
+        Benchmark::Measure(variant.c_str(), fileSize, [&]() {
+            Benchmark::Use(LoadDocument(path, fileSize, 1, file.encoding));
+        });
+    }
+    std::filesystem::remove(path);
+}
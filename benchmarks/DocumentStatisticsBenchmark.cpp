@@ -0,0 +1,55 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// The status bar shows the characters, words and paragraphs of the document
+// after every edit. CDocumentStatistics keeps the counts of blocks of the
+// document and only counts the blocks that were edited again. These count
+// a whole document, and count it again after an edit in it.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "DocumentStatistics.h"
+
+namespace
+{
+constexpr size_t TextSize = 16 * 1024 * 1024;
+} // namespace
+
+BENCHMARK(DocumentStatistics)
+{
+    auto text    = Benchmark::SourceText(TextSize);
+    auto getText = [&](size_t pos, size_t length) {
+        return std::string_view(text).substr(pos, length);
+    };
+
+    CDocumentStatistics statistics;
+    Benchmark::Measure("whole document", text.size(), [&]() {
+        statistics.Reset(text.size());
+        Benchmark::Use(statistics.Get(getText).words);
+    });
+
+    // an edit that replaces a character with the same one, so the text
+    // stays the same for every run
+    auto middle = text.size() / 2;
+    Benchmark::Measure("after an edit", 0, [&]() {
+        statistics.Deleted(middle, 1);
+        statistics.Inserted(middle, 1);
+        Benchmark::Use(statistics.Get(getText).words);
+    });
+    auto counts = statistics.Get(getText);
+    printf("  %-44s %10zu characters, %zu words, %zu lines\n", "counts", counts.characters, counts.words, counts.lines);
+}
@@ -0,0 +1,137 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// CDocumentWriter saves documents, converting them on one thread while the
+// blocks converted before are written on another. These compare it with
+// converting and writing one block after the other on the same thread, like
+// BowPad saved before, for each encoding a document can be saved in.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "DocumentWriter.h"
+#include "TextEncoding.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+namespace
+{
+constexpr size_t TextSize  = 64 * 1024 * 1024;
+constexpr size_t BlockSize = 4 * 1024 * 1024;
+// the bandwidth of the simulated disk in bytes per millisecond
+constexpr size_t DiskBandwidth = 1024 * 1024; // 1 GB/s
+
+struct Encoding
+{
+    const char* name;
+    int         codepage;
+};
+
+constexpr Encoding Encodings[] = {
+    {"UTF-8", 65001},
+    {"UTF-16LE", 1200},
+    {"UTF-16BE", 1201},
+    {"UTF-32LE", 12000},
+    {"UTF-32BE", 12001},
+#ifdef _WIN32
+    // the conversion to other codepages needs the Windows API
+    {"ANSI", -1},
+#endif
+};
+
+// converts and writes the blocks one after the other
+DWORD WriteSerial(const std::string& text, int codepage, char* out, const CDocumentWriter::WriteFunc& write)
+{
+    for (size_t pos = 0; pos < text.size();)
+    {
+        size_t len = std::min<size_t>(BlockSize, text.size() - pos);
+        // don't split characters between blocks
+        while (pos + len < text.size() && (static_cast<unsigned char>(text[pos + len]) & 0xC0) == 0x80)
+            --len;
+        DWORD err = 0;
+        switch (codepage)
+        {
+            case 1200:
+            case 1201:
+                err = write(out, CTextEncoding::Utf8ToUtf16(text.data() + pos, len, codepage == 1201, out));
+                break;
+            case 12000:
+            case 12001:
+                err = write(out, CTextEncoding::Utf8ToUtf32(text.data() + pos, len, codepage == 12001, out));
+                break;
+            default:
+                err = write(text.data() + pos, len);
+                break;
+        }
+        if (err)
+            return err;
+        pos += len;
+    }
+    return 0;
+}
+
+void MeasureEncodings(const std::string& text, const CDocumentWriter::WriteFunc& write, const std::function<void()>& reset)
+{
+    auto out = std::make_unique<char[]>(BlockSize * 4);
+    for (const auto& encoding : Encodings)
+    {
+        printf(" %s\n", encoding.name);
+        if (encoding.codepage != -1)
+        {
+            Benchmark::Measure("convert and write one block at a time", text.size(), [&]() {
+                reset();
+                Benchmark::Use(WriteSerial(text, encoding.codepage, out.get(), write));
+            });
+        }
+        Benchmark::Measure("CDocumentWriter", text.size(), [&]() {
+            reset();
+            Benchmark::Use(CDocumentWriter::Write(text.data(), text.size(), encoding.codepage, false, write));
+        });
+    }
+}
+} // namespace
+
+BENCHMARK(DocumentWriter)
+{
+    std::string text = Benchmark::SourceText(TextSize);
+    // the file system cache takes these writes, so this is mostly the
+    // conversion and copying, not the disk
+    std::unique_ptr<FILE, decltype(&fclose)> file(tmpfile(), &fclose);
+    if (!file)
+    {
+        printf("  no temporary file\n");
+        return;
+    }
+    printf(" to a temporary file\n");
+    MeasureEncodings(
+        text, [&](const char* data, size_t len) -> DWORD { return fwrite(data, 1, len, file.get()) == len ? 0 : 1; },
+        [&]() { rewind(file.get()); });
+
+    // a disk that is busy for a while with each write, like it is once the
+    // file system cache is full: converting the next block while the disk
+    // writes the last one is what the pipeline is for
+    printf(" to a disk writing 1 GB/s\n");
+    MeasureEncodings(
+        text, [](const char* /*data*/, size_t len) -> DWORD {
+            std::this_thread::sleep_for(std::chrono::microseconds(len * 1000 / DiskBandwidth));
+            return 0;
+        },
+        []() {});
+}
@@ -0,0 +1,133 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// Sorting lines used to convert them to utf16 and call CompareStringEx for
+// every comparison of std::sort. CLineSorter computes a sort key for every
+// line once and sorts the keys on all cores. These sort the lines of a
+// text both ways, with the flags of a case insensitive sort with digits as
+// numbers. Without CompareStringEx, the lines are compared by folding their
+// characters and reading their numbers on every comparison instead.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "LineSorter.h"
+#include "UnicodeUtils.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifndef _WIN32
+#    include "CaseConvert.h"
+#    include "UniConversion.h"
+#endif
+
+namespace
+{
+constexpr size_t TextSize = 8 * 1024 * 1024;
+constexpr DWORD  CmpFlags = LINGUISTIC_IGNORECASE | SORT_DIGITSASNUMBERS;
+
+#ifdef _WIN32
+bool CompareLess(const std::wstring& lhs, const std::wstring& rhs)
+{
+    return CompareStringEx(nullptr, CmpFlags, lhs.data(), static_cast<int>(lhs.length()),
+                           rhs.data(), static_cast<int>(rhs.length()), nullptr, nullptr, 0) == CSTR_LESS_THAN;
+}
+#else
+unsigned int Fold(wchar_t ch)
+{
+    const char* folded = Scintilla::CaseConvert(ch, Scintilla::CaseConversionFold);
+    return folded ? Scintilla::UnicodeFromUTF8(reinterpret_cast<const unsigned char*>(folded)) : ch;
+}
+
+bool IsDigit(const std::wstring& text, size_t pos)
+{
+    return pos < text.size() && text[pos] >= '0' && text[pos] <= '9';
+}
+
+// orders like the sort keys of CLineSorter do on the first level
+bool CompareLess(const std::wstring& lhs, const std::wstring& rhs)
+{
+    size_t l = 0;
+    size_t r = 0;
+    while (l < lhs.size() && r < rhs.size())
+    {
+        if (IsDigit(lhs, l) && IsDigit(rhs, r))
+        {
+            while (lhs[l] == '0' && IsDigit(lhs, l + 1))
+                ++l;
+            while (rhs[r] == '0' && IsDigit(rhs, r + 1))
+                ++r;
+            size_t lEnd = l;
+            size_t rEnd = r;
+            while (IsDigit(lhs, lEnd))
+                ++lEnd;
+            while (IsDigit(rhs, rEnd))
+                ++rEnd;
+            if (lEnd - l != rEnd - r)
+                return lEnd - l < rEnd - r;
+            int cmp = lhs.compare(l, lEnd - l, rhs, r, rEnd - r);
+            if (cmp)
+                return cmp < 0;
+            l = lEnd;
+            r = rEnd;
+            continue;
+        }
+        unsigned int lch = Fold(lhs[l++]);
+        unsigned int rch = Fold(rhs[r++]);
+        if (lch != rch)
+            return lch < rch;
+    }
+    return l == lhs.size() && r < rhs.size();
+}
+#endif
+
+size_t SortCompareString(const std::vector<std::string_view>& lines)
+{
+    std::vector<std::wstring> wideLines;
+    wideLines.reserve(lines.size());
+    for (const auto& line : lines)
+        wideLines.push_back(CUnicodeUtils::StdGetUnicode(std::string(line)));
+    std::sort(wideLines.begin(), wideLines.end(), CompareLess);
+    return wideLines.size();
+}
+} // namespace
+
+BENCHMARK(LineSorter)
+{
+    auto text  = Benchmark::SourceText(TextSize);
+    auto lines = CLineSorter::SplitLines(text);
+    printf(" %zu lines\n", lines.size());
+
+    CLineSorter sorter(CmpFlags);
+#ifdef _WIN32
+    Benchmark::Measure("std::sort with CompareStringEx", text.size(), [&]() {
+#else
+    Benchmark::Measure("std::sort comparing the folded lines", text.size(), [&]() {
+#endif
+        Benchmark::Use(SortCompareString(lines));
+    });
+    Benchmark::Measure("CLineSorter::Sort", text.size(), [&]() {
+        Benchmark::Use(sorter.Sort(lines, false, false).size());
+    });
+    Benchmark::Measure("CLineSorter::Sort, duplicates removed", text.size(), [&]() {
+        Benchmark::Use(sorter.Sort(lines, false, true).size());
+    });
+    auto order = sorter.Sort(lines, false, false);
+    Benchmark::Measure("split and join the lines", text.size(), [&]() {
+        Benchmark::Use(CLineSorter::JoinLines(CLineSorter::SplitLines(text), order, "\r\n").size());
+    });
+}
@@ -0,0 +1,91 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// Find all with several terms used to search the text once per term.
+// CMultiTermSearch finds all of them with a single pass over the text.
+// These find the matches of growing numbers of terms both ways, case
+// sensitive and not.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "BufferSearch.h"
+
+#include <vector>
+
+namespace
+{
+constexpr size_t TextSize = 4 * 1024 * 1024;
+
+// some terms that are in the text, the others are made up identifiers
+std::vector<std::string> MakeTerms(size_t count)
+{
+    static const char* const found[] = {"GetText", "nullptr", "m_count", "buffer", "Replace", "Stra\xc3\x9f" "e", "return", "value"};
+    std::vector<std::string> terms;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (i < std::size(found))
+            terms.emplace_back(found[i]);
+        else
+            terms.push_back("Name" + std::to_string(i));
+    }
+    return terms;
+}
+
+size_t CountPerTerm(std::string_view text, const std::vector<CBufferSearch>& searches)
+{
+    size_t count = 0;
+    for (const auto& search : searches)
+    {
+        auto   length = static_cast<sptr_t>(text.size());
+        sptr_t end    = 0;
+        for (sptr_t pos = 0; pos < length;)
+        {
+            auto found = search.FindText(text, pos, length, end);
+            if (found < 0)
+                break;
+            ++count;
+            pos = end;
+        }
+    }
+    return count;
+}
+} // namespace
+
+BENCHMARK(MultiTermSearch)
+{
+    auto text = Benchmark::SourceText(TextSize);
+    for (size_t termCount : {8, 64, 256})
+    {
+        auto terms = MakeTerms(termCount);
+        for (int flags : {0, SCFIND_MATCHCASE})
+        {
+            printf(" %zu terms, %s\n", termCount, flags ? "case sensitive" : "case insensitive");
+            std::vector<CBufferSearch> searches;
+            searches.reserve(terms.size());
+            for (const auto& term : terms)
+                searches.emplace_back(term, flags);
+            CMultiTermSearch multiSearch(terms, flags);
+            Benchmark::Measure("one CBufferSearch per term", text.size(), [&]() {
+                Benchmark::Use(CountPerTerm(text, searches));
+            });
+            Benchmark::Measure("CMultiTermSearch", text.size(), [&]() {
+                Benchmark::Use(multiSearch.FindAll(text).size());
+            });
+            printf("  %-44s %10zu / %zu\n", "matches", CountPerTerm(text, searches), multiSearch.FindAll(text).size());
+        }
+    }
+}
@@ -0,0 +1,121 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// Regex searches in Scintilla documents used to run std::wregex over the
+// document through UTF8DocumentIterator. Now CRegexEngine searches the UTF-8
+// buffer directly. These find all matches in a document both ways, and
+// through Document::FindText, which is what the editor calls.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "RegexEngine.h"
+
+// the Scintilla headers need these first
+#include <memory>
+#include <regex>
+#include "../ext/scintilla/lexlib/CharacterCategory.h"
+#include "../ext/scintilla/src/Position.h"
+#include "UTF8DocumentIterator.h"
+
+#undef FindText
+
+using namespace Scintilla;
+
+namespace
+{
+// std::wregex is too slow for more
+constexpr size_t TextSize = 4 * 1024 * 1024;
+
+size_t CountWRegex(const Document& doc, const std::wregex& regex)
+{
+    std::match_results<UTF8DocumentIterator> match;
+    UTF8DocumentIterator                     end(&doc, doc.Length());
+    size_t                                   count = 0;
+    for (Sci::Position pos = 0; pos <= doc.Length();)
+    {
+        if (!std::regex_search(UTF8DocumentIterator(&doc, pos), end, match, regex))
+            break;
+        ++count;
+        auto matchEnd = match[0].second.Pos();
+        pos           = matchEnd > match[0].first.Pos() ? matchEnd : doc.NextPosition(matchEnd, 1) + (matchEnd == doc.Length());
+    }
+    return count;
+}
+
+size_t CountEngine(std::string_view text, const CRegexEngine& engine)
+{
+    CRegexMatch match;
+    size_t      count = 0;
+    for (size_t pos = 0; pos <= text.size() && engine.Search(text, pos, text.size(), match);)
+    {
+        ++count;
+        pos = match.End() > match.Start() ? match.End() : match.End() + 1;
+    }
+    return count;
+}
+
+size_t CountFindText(Document& doc, const std::string& pattern)
+{
+    size_t count = 0;
+    for (Sci::Position pos = 0; pos <= doc.Length();)
+    {
+        // the length of the pattern goes in, the length of the match comes out
+        Sci::Position length = pattern.size();
+        auto          found  = doc.FindText(pos, doc.Length(), pattern.c_str(), SCFIND_REGEXP | SCFIND_CXX11REGEX | SCFIND_MATCHCASE, &length);
+        if (found < 0)
+            break;
+        ++count;
+        pos = length ? found + length : found + 1;
+    }
+    return count;
+}
+} // namespace
+
+BENCHMARK(RegexEngine)
+{
+    auto text = Benchmark::SourceText(TextSize);
+    auto doc  = std::make_unique<Document>(SC_DOCUMENTOPTION_DEFAULT);
+    doc->SetDBCSCodePage(SC_CP_UTF8);
+    doc->SetCaseFolder(new CaseFolderUnicode());
+    doc->InsertString(0, text.c_str(), text.size());
+    std::string_view buffer(doc->BufferPointer(), doc->Length());
+
+    const char* const patterns[] = {
+        "GetText\\(pos",
+        "nullptr|m_count",
+        "\\b[A-Z]\\w+\\(",
+        "^ *return .*;$",
+        "Foo\\d+Bar",
+    };
+    for (const char* pattern : patterns)
+    {
+        printf(" %s\n", pattern);
+        std::wstring wpattern(pattern, pattern + strlen(pattern));
+        std::wregex  wregex(wpattern, std::regex_constants::ECMAScript | std::regex_constants::multiline);
+        CRegexEngine engine;
+        engine.Compile(pattern, true);
+        Benchmark::Measure("std::wregex over the document", text.size(), [&]() {
+            Benchmark::Use(CountWRegex(*doc, wregex));
+        });
+        Benchmark::Measure("CRegexEngine on the buffer", text.size(), [&]() {
+            Benchmark::Use(CountEngine(buffer, engine));
+        });
+        Benchmark::Measure("Document::FindText", text.size(), [&]() {
+            Benchmark::Use(CountFindText(*doc, pattern));
+        });
+    }
+}
@@ -0,0 +1,98 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// A regex replace all fills in the replacement format for every match.
+// CRegexFormat parses the format once and appends the groups straight from
+// the utf8 text. These fill in the format for all matches of a document
+// with the format parsed again for every match and parsed once, and
+// replace all through CBufferSearch::ReplaceAll, which replace in tabs and
+// in files use, search included.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "BufferSearch.h"
+#include "RegexEngine.h"
+
+#include <vector>
+
+namespace
+{
+constexpr size_t TextSize = 4 * 1024 * 1024;
+
+const char* const Pattern = "(\\w+)(\\.|->)(\\w+)";
+const char* const Format  = "$3$2$1 ($&) $$";
+
+std::vector<CRegexMatch> FindAll(std::string_view text, const CRegexEngine& engine)
+{
+    std::vector<CRegexMatch> matches;
+    CRegexMatch              match;
+    for (size_t pos = 0; pos <= text.size() && engine.Search(text, pos, text.size(), match);)
+    {
+        matches.push_back(match);
+        pos = match.End() > match.Start() ? match.End() : match.End() + 1;
+    }
+    return matches;
+}
+
+// builds the replaced text the way CBufferSearch does, with the format
+// filled in by \c format
+template <typename FormatFunc>
+size_t Replace(std::string_view text, const std::vector<CRegexMatch>& matches, std::string& result, FormatFunc format)
+{
+    size_t copied = 0;
+    result.clear();
+    for (const auto& match : matches)
+    {
+        result.append(text, copied, match.Start() - copied);
+        format(match, result);
+        copied = match.End();
+    }
+    result.append(text, copied);
+    return result.size();
+}
+} // namespace
+
+BENCHMARK(RegexFormat)
+{
+    auto             text = Benchmark::SourceText(TextSize);
+    std::string_view buffer(text);
+
+    CRegexEngine engine;
+    engine.Compile(Pattern, true);
+    auto          matches = FindAll(buffer, engine);
+    CRegexFormat  format(Format, engine.GroupCount());
+    CBufferSearch search(Pattern, SCFIND_REGEXP | SCFIND_CXX11REGEX | SCFIND_MATCHCASE);
+    printf(" %zu matches\n", matches.size());
+
+    std::string parsedEveryTime;
+    std::string parsedOnce;
+    std::string replaced;
+    Benchmark::Measure("format parsed for every match", text.size(), [&]() {
+        Benchmark::Use(Replace(buffer, matches, parsedEveryTime, [&](const CRegexMatch& match, std::string& result) {
+            result += CRegexEngine::Format(buffer, match, Format);
+        }));
+    });
+    Benchmark::Measure("format parsed once", text.size(), [&]() {
+        Benchmark::Use(Replace(buffer, matches, parsedOnce, [&](const CRegexMatch& match, std::string& result) {
+            format.Apply(buffer, match, result);
+        }));
+    });
+    Benchmark::Measure("CBufferSearch::ReplaceAll, with the search", text.size(), [&]() {
+        Benchmark::Use(static_cast<size_t>(search.ReplaceAll(buffer, Format, replaced)));
+    });
+    printf("  %-44s %10s\n", "same output", parsedEveryTime == parsedOnce && parsedOnce == replaced ? "yes" : "no");
+}
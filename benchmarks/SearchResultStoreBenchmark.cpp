@@ -0,0 +1,97 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+// CSearchResultStore keeps only the positions of the results, the texts
+// shown for them are made from the searched text when they're drawn. These
+// measure filling the store with a million results, the memory they take,
+// and making the texts of a page of results.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "BufferSearch.h"
+#include "SearchResultStore.h"
+
+#include <vector>
+
+namespace
+{
+constexpr size_t ResultCount = 1000000;
+constexpr size_t FileCount   = 10000;
+constexpr size_t FolderCount = 100;
+constexpr size_t TextSize    = 4 * 1024 * 1024;
+constexpr size_t RowsPerPage = 40;
+constexpr int    MatchLength = 8;
+} // namespace
+
+BENCHMARK(SearchResultStore)
+{
+    // the results are found in the lines of a source text, every file
+    // has the same number of them
+    std::string text = Benchmark::SourceText(TextSize);
+    CTextLines  lines(text);
+    sptr_t      lineCount = lines.LineFromPosition(lines.GetLength()) + 1;
+
+    std::vector<std::wstring> paths;
+    for (size_t i = 0; i < FileCount; ++i)
+        paths.push_back(L"C:\\src\\module" + std::to_wstring(i % FolderCount) + L"\\file" + std::to_wstring(i) + L".cpp");
+
+    auto fill = [&](CSearchResultStore& store) {
+        int pathIndex = -1;
+        for (size_t i = 0; i < ResultCount; ++i)
+        {
+            if (i % (ResultCount / FileCount) == 0)
+                pathIndex = store.AddPath(paths[i / (ResultCount / FileCount)]);
+            CSearchResult result;
+            result.pathIndex = pathIndex;
+            result.line      = static_cast<sptr_t>(i % lineCount);
+            result.posBegin  = lines.PositionFromLine(result.line);
+            result.posEnd    = result.posBegin + MatchLength;
+            store.Add(result);
+        }
+    };
+    Benchmark::Measure("fill the store with 1M results", 0, [&]() {
+        CSearchResultStore store;
+        fill(store);
+        Benchmark::Use(store.size());
+    });
+
+    // the texts of the lines, which the results don't have to keep
+    CSearchResultStore store;
+    fill(store);
+    size_t lineTextBytes = 0;
+    for (const auto& result : store)
+        lineTextBytes += std::min<size_t>(lines.GetLine(result.line).size(), 255) * sizeof(wchar_t);
+    printf("  %-44s %10zu bytes\n", "result size", sizeof(CSearchResult));
+    printf("  %-44s %10.1f MB\n", "memory of the results", store.size() * sizeof(CSearchResult) / (1024.0 * 1024.0));
+    printf("  %-44s %10.1f MB\n", "memory of their line texts as utf16", lineTextBytes / (1024.0 * 1024.0));
+
+    // what drawing a page of the results list takes
+    size_t pageBytes = 0;
+    for (size_t row = 0; row < RowsPerPage; ++row)
+        pageBytes += lines.GetLine(store[row].line).size();
+    Benchmark::Measure("make the texts of a page of results", pageBytes, [&]() {
+        size_t length = 0;
+        for (size_t row = 0; row < RowsPerPage; ++row)
+        {
+            const auto& result     = store[row];
+            auto        lineStart  = lines.PositionFromLine(result.line);
+            int         matchStart = static_cast<int>(result.posBegin - lineStart);
+            int         matchEnd   = static_cast<int>(result.posEnd - lineStart);
+            length += CSearchResultStore::MakeLineText(lines.GetLine(result.line), matchStart, matchEnd).size();
+        }
+        Benchmark::Use(length);
+    });
+}
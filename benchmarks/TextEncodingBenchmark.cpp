@@ -0,0 +1,127 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// CTextEncoding converts the text of files that are not UTF-8 when they are
+// loaded and saved. These compare it with a plain loop over the characters,
+// and with the Windows API BowPad used before where it's available.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "TextEncoding.h"
+
+#include <vector>
+
+namespace
+{
+constexpr size_t TextSize = 16 * 1024 * 1024;
+
+// UTF-16LE to UTF-8 one code unit at a time, without any validation
+size_t Utf16ToUtf8Scalar(const char* src, size_t len, char* dest)
+{
+    const auto* s   = reinterpret_cast<const unsigned char*>(src);
+    char*       out = dest;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        unsigned int ch = s[i] | (s[i + 1] << 8);
+        if (ch >= 0xD800 && ch < 0xDC00 && i + 3 < len)
+        {
+            ch = 0x10000 + ((ch - 0xD800) << 10) + ((s[i + 2] | (s[i + 3] << 8)) - 0xDC00);
+            i += 2;
+        }
+        if (ch < 0x80)
+            *out++ = static_cast<char>(ch);
+        else if (ch < 0x800)
+        {
+            *out++ = static_cast<char>(0xC0 | (ch >> 6));
+            *out++ = static_cast<char>(0x80 | (ch & 0x3F));
+        }
+        else if (ch < 0x10000)
+        {
+            *out++ = static_cast<char>(0xE0 | (ch >> 12));
+            *out++ = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (ch & 0x3F));
+        }
+        else
+        {
+            *out++ = static_cast<char>(0xF0 | (ch >> 18));
+            *out++ = static_cast<char>(0x80 | ((ch >> 12) & 0x3F));
+            *out++ = static_cast<char>(0x80 | ((ch >> 6) & 0x3F));
+            *out++ = static_cast<char>(0x80 | (ch & 0x3F));
+        }
+    }
+    return out - dest;
+}
+
+void MeasureText(const char* kind, const std::string& text)
+{
+    printf(" %s\n", kind);
+    std::vector<char> utf16(text.size() * 2);
+    std::vector<char> utf16be(text.size() * 2);
+    std::vector<char> utf32(text.size() * 4);
+    std::vector<char> utf8(text.size() * 2);
+    size_t            utf16Len = CTextEncoding::Utf8ToUtf16(text.data(), text.size(), false, utf16.data());
+    CTextEncoding::Utf8ToUtf16(text.data(), text.size(), true, utf16be.data());
+    size_t            utf32Len = CTextEncoding::Utf8ToUtf32(text.data(), text.size(), false, utf32.data());
+
+    Benchmark::Measure("Utf8ValidLength", text.size(), [&]() {
+        Benchmark::Use(CTextEncoding::Utf8ValidLength(text.data(), text.size()));
+    });
+    Benchmark::Measure("DetectCodepage", text.size(), [&]() {
+        bool hasBOM       = false;
+        bool inconclusive = false;
+        Benchmark::Use(CTextEncoding::DetectCodepage(text.data(), text.size(), hasBOM, inconclusive));
+    });
+    Benchmark::Measure("UTF-16LE to UTF-8, scalar loop", utf16Len, [&]() {
+        Benchmark::Use(Utf16ToUtf8Scalar(utf16.data(), utf16Len, utf8.data()));
+    });
+#ifdef _WIN32
+    std::vector<wchar_t> wide(utf16Len / 2);
+    memcpy(wide.data(), utf16.data(), utf16Len);
+    Benchmark::Measure("UTF-16LE to UTF-8, WideCharToMultiByte", utf16Len, [&]() {
+        Benchmark::Use(WideCharToMultiByte(CP_UTF8, 0, wide.data(), static_cast<int>(wide.size()), utf8.data(), static_cast<int>(utf8.size()), nullptr, nullptr));
+    });
+#endif
+    Benchmark::Measure("UTF-16LE to UTF-8", utf16Len, [&]() {
+        Benchmark::Use(CTextEncoding::Utf16ToUtf8(utf16.data(), utf16Len, false, utf8.data()));
+    });
+    Benchmark::Measure("UTF-16BE to UTF-8", utf16Len, [&]() {
+        Benchmark::Use(CTextEncoding::Utf16ToUtf8(utf16be.data(), utf16Len, true, utf8.data()));
+    });
+    Benchmark::Measure("UTF-32LE to UTF-8", utf32Len, [&]() {
+        Benchmark::Use(CTextEncoding::Utf32ToUtf8(utf32.data(), utf32Len, false, utf8.data()));
+    });
+    Benchmark::Measure("UTF-8 to UTF-16LE", text.size(), [&]() {
+        Benchmark::Use(CTextEncoding::Utf8ToUtf16(text.data(), text.size(), false, utf16.data()));
+    });
+    Benchmark::Measure("UTF-8 to UTF-16BE", text.size(), [&]() {
+        Benchmark::Use(CTextEncoding::Utf8ToUtf16(text.data(), text.size(), true, utf16be.data()));
+    });
+    Benchmark::Measure("UTF-8 to UTF-32LE", text.size(), [&]() {
+        Benchmark::Use(CTextEncoding::Utf8ToUtf32(text.data(), text.size(), false, utf32.data()));
+    });
+}
+} // namespace
+
+BENCHMARK(TextEncoding)
+{
+    MeasureText("source code", Benchmark::SourceText(TextSize));
+    // the vectorized ASCII runs don't help here
+    std::string japanese;
+    while (japanese.size() < TextSize)
+        japanese += "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe7\xab\xa0\xe3\x80\x82\n";
+    MeasureText("Japanese", japanese);
+}
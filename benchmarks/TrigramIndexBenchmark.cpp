@@ -0,0 +1,94 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// CTrigramIndex lets find in files skip the files that can't contain the
+// search string without reading them. These measure building the index and
+// a search with it compared to searching every file.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "BufferSearch.h"
+#include "TrigramIndex.h"
+
+#include <vector>
+
+namespace
+{
+constexpr size_t FileCount = 2000;
+constexpr size_t FileSize  = 32 * 1024;
+
+struct File
+{
+    std::wstring             path;
+    CTrigramIndex::FileStamp stamp;
+    std::string              text;
+};
+
+void MeasureSearch(const std::vector<File>& files, size_t totalSize, CTrigramIndex& index, const std::string& searchFor, int searchFlags)
+{
+    CBufferSearch searcher(searchFor, searchFlags);
+    auto          search = [&](const File& file) {
+        sptr_t end = 0;
+        return searcher.FindText(file.text, 0, static_cast<sptr_t>(file.text.size()), end) >= 0;
+    };
+    printf(" %s\n", searchFor.c_str());
+    Benchmark::Measure("search every file", totalSize, [&]() {
+        size_t found = 0;
+        for (const auto& file : files)
+            found += search(file);
+        Benchmark::Use(found);
+    });
+    Benchmark::Measure("search the files the index can't rule out", totalSize, [&]() {
+        auto   query = CTrigramIndex::GetQuery(searchFor, searchFlags);
+        size_t found = 0;
+        for (const auto& file : files)
+        {
+            if (index.Lookup(file.path, file.stamp, query) != CTrigramIndex::LookupResult::NoMatch)
+                found += search(file);
+        }
+        Benchmark::Use(found);
+    });
+}
+} // namespace
+
+BENCHMARK(TrigramIndex)
+{
+    // every hundredth file contains the identifier that is searched for
+    std::vector<File> files(FileCount);
+    size_t            totalSize = 0;
+    for (size_t i = 0; i < FileCount; ++i)
+    {
+        files[i].path       = L"C:\\src\\file" + std::to_wstring(i) + L".cpp";
+        files[i].stamp.size = FileSize;
+        files[i].text       = Benchmark::SourceText(FileSize, static_cast<unsigned int>(i));
+        if (i % 100 == 0)
+            files[i].text.replace(FileSize / 2, 16, "m_rareIdentifier");
+        totalSize += files[i].text.size();
+    }
+
+    CTrigramIndex index(L"C:\\src");
+    Benchmark::Measure("build the index", totalSize, [&]() {
+        CTrigramIndex fresh(L"C:\\src");
+        for (const auto& file : files)
+            fresh.Update(file.path, file.stamp, file.text);
+    });
+    for (const auto& file : files)
+        index.Update(file.path, file.stamp, file.text);
+
+    MeasureSearch(files, totalSize, index, "m_rareIdentifier", SCFIND_MATCHCASE);
+    MeasureSearch(files, totalSize, index, "rare[A-Z]\\w+fier", SCFIND_MATCHCASE | SCFIND_REGEXP | SCFIND_CXX11REGEX);
+}
@@ -0,0 +1,95 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// Removing duplicate lines without sorting looks every line up in a hash
+// set. These find the unique lines of a selection with about half of its
+// lines repeated, with std::unordered_set and with CUniqueLines, which
+// hashes all lines first and compares byte-identical lines before it
+// builds keys for the case and whitespace options.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "UniqueLines.h"
+
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+namespace
+{
+constexpr size_t TextSize  = 24 * 1024 * 1024;
+constexpr size_t PoolSize  = 500000;
+constexpr size_t LineCount = 1000000;
+
+std::vector<std::string_view> SplitLines(std::string_view text)
+{
+    std::vector<std::string_view> lines;
+    for (size_t start = 0; start < text.size();)
+    {
+        auto end = text.find('\n', start);
+        if (end == std::string_view::npos)
+            end = text.size();
+        auto line = text.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        lines.push_back(line);
+        start = end + 1;
+    }
+    return lines;
+}
+
+std::vector<size_t> FindUnorderedSet(const std::vector<std::string_view>& lines)
+{
+    std::unordered_set<std::string_view> seen;
+    std::vector<size_t>                  unique;
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        if (seen.insert(lines[i]).second)
+            unique.push_back(i);
+    }
+    return unique;
+}
+} // namespace
+
+BENCHMARK(UniqueLines)
+{
+    // lines picked at random from a pool, so many of them are repeated
+    auto text = Benchmark::SourceText(TextSize);
+    auto pool = SplitLines(text);
+    pool.resize(std::min<size_t>(pool.size(), PoolSize));
+    std::mt19937                  rng(42);
+    std::vector<std::string_view> lines(LineCount);
+    for (auto& line : lines)
+        line = pool[rng() % pool.size()];
+
+    CUniqueLines exact(false, false);
+    CUniqueLines ignoreCase(true, false);
+    CUniqueLines ignoreBoth(true, true);
+    printf(" %zu lines, %zu unique\n", lines.size(), exact.Find(lines).size());
+    Benchmark::Measure("std::unordered_set<std::string_view>", 0, [&]() {
+        Benchmark::Use(FindUnorderedSet(lines).size());
+    });
+    Benchmark::Measure("CUniqueLines", 0, [&]() {
+        Benchmark::Use(exact.Find(lines).size());
+    });
+    Benchmark::Measure("CUniqueLines, ignoring case", 0, [&]() {
+        Benchmark::Use(ignoreCase.Find(lines).size());
+    });
+    Benchmark::Measure("CUniqueLines, ignoring case and whitespace", 0, [&]() {
+        Benchmark::Use(ignoreBoth.Find(lines).size());
+    });
+}
@@ -0,0 +1,76 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// The find in files runs one task per file on a CWorkStealingPool. These
+// measure the overhead of the pool for tasks as small as the ones for tiny
+// files, and how well it spreads uneven tasks that are all submitted from
+// one thread.
+
+#include "stdafx.h"
+#include "Benchmark.h"
+#include "WorkStealingPool.h"
+
+#include <thread>
+
+namespace
+{
+size_t Work(size_t amount)
+{
+    size_t value = amount;
+    for (size_t i = 0; i < amount; ++i)
+        value = value * 6364136223846793005ULL + 1442695040888963407ULL;
+    return value;
+}
+} // namespace
+
+BENCHMARK(WorkStealingPool)
+{
+    constexpr size_t smallTasks = 100000;
+    Benchmark::Measure("small tasks, one thread", 0, [&]() {
+        size_t sum = 0;
+        for (size_t i = 0; i < smallTasks; ++i)
+            sum += Work(100);
+        Benchmark::Use(sum);
+    });
+    CWorkStealingPool<> pool;
+    Benchmark::Measure("small tasks, pool", 0, [&]() {
+        std::atomic<size_t> sum{0};
+        for (size_t i = 0; i < smallTasks; ++i)
+            pool.Submit([&sum](NoWorkerContext&) { sum += Work(100); });
+        pool.Wait();
+        Benchmark::Use(sum);
+    });
+
+    // every 16th task takes 100 times as long as the others
+    constexpr size_t unevenTasks = 4000;
+    auto             amount      = [](size_t i) { return i % 16 ? 2000 : 200000; };
+    Benchmark::Measure("uneven tasks, one thread", 0, [&]() {
+        size_t sum = 0;
+        for (size_t i = 0; i < unevenTasks; ++i)
+            sum += Work(amount(i));
+        Benchmark::Use(sum);
+    });
+    Benchmark::Measure("uneven tasks, pool, submitted by a worker", 0, [&]() {
+        std::atomic<size_t> sum{0};
+        pool.Submit([&](NoWorkerContext&) {
+            for (size_t i = 0; i < unevenTasks; ++i)
+                pool.Submit([&sum, work = amount(i)](NoWorkerContext&) { sum += Work(work); });
+        });
+        pool.Wait();
+        Benchmark::Use(sum);
+    });
+}
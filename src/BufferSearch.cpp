@@ -0,0 +1,847 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "BufferSearch.h"
+#include "UnicodeUtils.h"
+#include "RegexCache.h"
+#include "../ext/scintilla/src/UniConversion.h"
+#include "../ext/scintilla/lexlib/CharacterCategory.h"
+
+#include <algorithm>
+#include <functional>
+#include <optional>
+
+using namespace Scintilla;
+
+namespace
+{
+// the same classes Scintilla uses for word boundaries
+enum class WordClass
+{
+    Space,
+    NewLine,
+    Word,
+    Punctuation
+};
+
+inline unsigned char UCharAt(std::string_view text, sptr_t pos)
+{
+    if (pos < 0 || pos >= static_cast<sptr_t>(text.size()))
+        return 0;
+    return static_cast<unsigned char>(text[pos]);
+}
+
+// these functions mirror the Scintilla document functions with the same name,
+// for a document in UTF-8 mode with the default character classes.
+
+bool InGoodUTF8(std::string_view text, sptr_t pos, sptr_t& start, sptr_t& end)
+{
+    sptr_t trail = pos;
+    while ((trail > 0) && (pos - trail < UTF8MaxBytes) && UTF8IsTrailByte(UCharAt(text, trail - 1)))
+        trail--;
+    start = (trail > 0) ? trail - 1 : trail;
+
+    const unsigned char leadByte       = UCharAt(text, start);
+    const int           widthCharBytes = UTF8BytesOfLead[leadByte];
+    if (widthCharBytes == 1)
+        return false;
+    const int    trailBytes = widthCharBytes - 1;
+    const sptr_t len        = pos - start;
+    if (len > trailBytes)
+        return false;
+    unsigned char charBytes[UTF8MaxBytes] = {leadByte, 0, 0, 0};
+    for (sptr_t b = 1; b < widthCharBytes && ((start + b) < static_cast<sptr_t>(text.size())); b++)
+        charBytes[b] = UCharAt(text, start + b);
+    const int utf8status = UTF8Classify(charBytes, widthCharBytes);
+    if (utf8status & UTF8MaskInvalid)
+        return false;
+    end = start + widthCharBytes;
+    return true;
+}
+
+sptr_t MovePositionOutsideChar(std::string_view text, sptr_t pos)
+{
+    if (pos <= 0)
+        return 0;
+    if (pos >= static_cast<sptr_t>(text.size()))
+        return static_cast<sptr_t>(text.size());
+    if (UTF8IsTrailByte(UCharAt(text, pos)))
+    {
+        sptr_t startUTF = pos;
+        sptr_t endUTF   = pos;
+        if (InGoodUTF8(text, pos, startUTF, endUTF))
+            pos = endUTF;
+    }
+    return pos;
+}
+
+// returns the character at pos and its width in bytes
+int ExtractCharacter(std::string_view text, sptr_t pos, int& width)
+{
+    const unsigned char leadByte = UCharAt(text, pos);
+    width                        = 1;
+    if (UTF8IsAscii(leadByte))
+        return leadByte;
+    const int     widthCharBytes          = UTF8BytesOfLead[leadByte];
+    unsigned char charBytes[UTF8MaxBytes] = {leadByte, 0, 0, 0};
+    for (int b = 1; b < widthCharBytes; b++)
+        charBytes[b] = UCharAt(text, pos + b);
+    const int utf8status = UTF8Classify(charBytes, widthCharBytes);
+    if (utf8status & UTF8MaskInvalid)
+        return unicodeReplacementChar;
+    width = utf8status & UTF8MaskWidth;
+    return UnicodeFromUTF8(charBytes);
+}
+
+int CharacterBefore(std::string_view text, sptr_t pos)
+{
+    if (pos <= 0)
+        return unicodeReplacementChar;
+    const unsigned char previousByte = UCharAt(text, pos - 1);
+    if (UTF8IsAscii(previousByte))
+        return previousByte;
+    pos--;
+    if (UTF8IsTrailByte(previousByte))
+    {
+        sptr_t startUTF = pos;
+        sptr_t endUTF   = pos;
+        if (InGoodUTF8(text, pos, startUTF, endUTF))
+        {
+            int width = 0;
+            return ExtractCharacter(text, startUTF, width);
+        }
+    }
+    return unicodeReplacementChar;
+}
+
+sptr_t PreviousPosition(std::string_view text, sptr_t pos)
+{
+    if (pos <= 0)
+        return 0;
+    pos--;
+    if (UTF8IsTrailByte(UCharAt(text, pos)))
+    {
+        sptr_t startUTF = pos;
+        sptr_t endUTF   = pos;
+        if (InGoodUTF8(text, pos, startUTF, endUTF))
+            pos = startUTF;
+    }
+    return pos;
+}
+
+WordClass WordCharacterClass(int ch)
+{
+    if (!UTF8IsAscii(ch))
+    {
+        switch (CategoriseCharacter(ch))
+        {
+            case ccZl:
+            case ccZp:
+                return WordClass::NewLine;
+            case ccZs:
+            case ccCc:
+            case ccCf:
+            case ccCs:
+            case ccCo:
+            case ccCn:
+                return WordClass::Space;
+            case ccLu:
+            case ccLl:
+            case ccLt:
+            case ccLm:
+            case ccLo:
+            case ccNd:
+            case ccNl:
+            case ccNo:
+            case ccMn:
+            case ccMc:
+            case ccMe:
+                return WordClass::Word;
+            default:
+                return WordClass::Punctuation;
+        }
+    }
+    if (ch == '\r' || ch == '\n')
+        return WordClass::NewLine;
+    if (ch < 0x20 || ch == ' ')
+        return WordClass::Space;
+    if (isalnum(ch) || ch == '_')
+        return WordClass::Word;
+    return WordClass::Punctuation;
+}
+
+bool IsWordStartAt(std::string_view text, sptr_t pos)
+{
+    if (pos >= static_cast<sptr_t>(text.size()))
+        return false;
+    if (pos > 0)
+    {
+        int        width  = 0;
+        const auto ccPos  = WordCharacterClass(ExtractCharacter(text, pos, width));
+        const auto ccPrev = WordCharacterClass(CharacterBefore(text, pos));
+        return (ccPos == WordClass::Word || ccPos == WordClass::Punctuation) && (ccPos != ccPrev);
+    }
+    return true;
+}
+
+bool IsWordEndAt(std::string_view text, sptr_t pos)
+{
+    if (pos <= 0)
+        return false;
+    if (pos < static_cast<sptr_t>(text.size()))
+    {
+        int        width  = 0;
+        const auto ccPos  = WordCharacterClass(ExtractCharacter(text, pos, width));
+        const auto ccPrev = WordCharacterClass(CharacterBefore(text, pos));
+        return (ccPrev == WordClass::Word || ccPrev == WordClass::Punctuation) && (ccPrev != ccPos);
+    }
+    return true;
+}
+
+/// Iterates over a UTF-8 buffer and returns UTF-16 characters, the same way
+/// UTF8DocumentIterator does for a Scintilla document.
+class UTF8BufferIterator
+{
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type        = wchar_t;
+    using difference_type   = ptrdiff_t;
+    using pointer           = wchar_t*;
+    using reference         = wchar_t&;
+
+    UTF8BufferIterator() = default;
+    UTF8BufferIterator(std::string_view text, sptr_t position)
+        : m_text(text)
+        , m_position(position)
+    {
+        ReadCharacter();
+    }
+
+    wchar_t operator*() const
+    {
+        return m_buffered[m_characterIndex];
+    }
+    UTF8BufferIterator& operator++()
+    {
+        if ((m_characterIndex + 1) < m_lenCharacters)
+            m_characterIndex++;
+        else
+        {
+            m_position += m_lenBytes;
+            ReadCharacter();
+            m_characterIndex = 0;
+        }
+        return *this;
+    }
+    UTF8BufferIterator operator++(int)
+    {
+        UTF8BufferIterator retVal(*this);
+        ++(*this);
+        return retVal;
+    }
+    UTF8BufferIterator& operator--()
+    {
+        if (m_characterIndex)
+            m_characterIndex--;
+        else
+        {
+            m_position = PreviousPosition(m_text, m_position);
+            ReadCharacter();
+            m_characterIndex = m_lenCharacters - 1;
+        }
+        return *this;
+    }
+    UTF8BufferIterator operator--(int)
+    {
+        UTF8BufferIterator retVal(*this);
+        --(*this);
+        return retVal;
+    }
+    bool operator==(const UTF8BufferIterator& other) const
+    {
+        return m_text.data() == other.m_text.data() &&
+               m_position == other.m_position &&
+               m_characterIndex == other.m_characterIndex;
+    }
+    bool operator!=(const UTF8BufferIterator& other) const
+    {
+        return !(*this == other);
+    }
+    sptr_t Pos() const
+    {
+        return m_position;
+    }
+
+private:
+    void ReadCharacter()
+    {
+        int width   = 0;
+        int ch      = ExtractCharacter(m_text, m_position, width);
+        m_lenBytes  = width;
+        if (ch == unicodeReplacementChar)
+        {
+            m_lenCharacters = 1;
+            m_buffered[0]   = static_cast<wchar_t>(ch);
+        }
+        else
+            m_lenCharacters = UTF16FromUTF32Character(ch, m_buffered);
+    }
+
+    std::string_view m_text;
+    sptr_t           m_position       = 0;
+    size_t           m_characterIndex = 0;
+    int              m_lenBytes       = 0;
+    size_t           m_lenCharacters  = 0;
+    wchar_t          m_buffered[2]    = {};
+};
+
+bool MatchesWordOptions(std::string_view text, sptr_t pos, sptr_t length, bool wholeWord, bool wordStart)
+{
+    return (!wholeWord && !wordStart) ||
+           (wholeWord && length > 0 && IsWordStartAt(text, pos) && IsWordEndAt(text, pos + length)) ||
+           (wordStart && IsWordStartAt(text, pos));
+}
+
+// case folding can turn one character into up to this many
+constexpr size_t maxFoldingExpansion = 4;
+} // namespace
+
+CTextLines::CTextLines(std::string_view text)
+    : m_text(text)
+{
+    m_lineStarts.push_back(0);
+    auto cr  = static_cast<const char*>(memchr(m_text.data(), '\r', m_text.size()));
+    auto lf  = static_cast<const char*>(memchr(m_text.data(), '\n', m_text.size()));
+    m_nextCR = cr ? cr - m_text.data() : m_text.size();
+    m_nextLF = lf ? lf - m_text.data() : m_text.size();
+}
+
+char CTextLines::CharAt(sptr_t pos) const
+{
+    return static_cast<char>(UCharAt(m_text, pos));
+}
+
+bool CTextLines::IndexNextLine()
+{
+    if (m_indexComplete)
+        return false;
+    size_t lineStart = m_lineStarts.back();
+    if (m_nextCR < lineStart)
+    {
+        auto cr  = static_cast<const char*>(memchr(m_text.data() + lineStart, '\r', m_text.size() - lineStart));
+        m_nextCR = cr ? cr - m_text.data() : m_text.size();
+    }
+    if (m_nextLF < lineStart)
+    {
+        auto lf  = static_cast<const char*>(memchr(m_text.data() + lineStart, '\n', m_text.size() - lineStart));
+        m_nextLF = lf ? lf - m_text.data() : m_text.size();
+    }
+    size_t lineEnd = std::min(m_nextCR, m_nextLF);
+    if (lineEnd >= m_text.size())
+    {
+        m_indexComplete = true;
+        return false;
+    }
+    // a "\r\n" counts as one line ending
+    if (lineEnd == m_nextCR && m_nextLF == lineEnd + 1 && m_nextLF < m_text.size())
+        ++lineEnd;
+    m_lineStarts.push_back(static_cast<sptr_t>(lineEnd + 1));
+    return true;
+}
+
+sptr_t CTextLines::LineFromPosition(sptr_t pos)
+{
+    while (!m_indexComplete && m_lineStarts.back() <= pos)
+        IndexNextLine();
+    auto it = std::upper_bound(m_lineStarts.begin(), m_lineStarts.end(), pos);
+    return static_cast<sptr_t>(it - m_lineStarts.begin()) - 1;
+}
+
+sptr_t CTextLines::PositionFromLine(sptr_t line)
+{
+    while (!m_indexComplete && line >= static_cast<sptr_t>(m_lineStarts.size()))
+        IndexNextLine();
+    if (line < 0)
+        return 0;
+    if (line < static_cast<sptr_t>(m_lineStarts.size()))
+        return m_lineStarts[line];
+    return GetLength();
+}
+
+std::string_view CTextLines::GetLine(sptr_t line)
+{
+    auto start = PositionFromLine(line);
+    auto end   = PositionFromLine(line + 1);
+    return m_text.substr(start, end - start);
+}
+
+CBufferSearch::CBufferSearch(const std::string& searchFor, int searchFlags)
+    : m_searchFor(searchFor)
+    , m_caseSensitive((searchFlags & SCFIND_MATCHCASE) != 0)
+    , m_wholeWord((searchFlags & SCFIND_WHOLEWORD) != 0)
+    , m_wordStart((searchFlags & SCFIND_WORDSTART) != 0)
+    , m_regex((searchFlags & SCFIND_REGEXP) != 0)
+{
+    if (m_searchFor.empty())
+        return;
+    if (m_regex)
+    {
+        CRegexEngine::CompileResult result;
+        m_regexEngine = CRegexCache::Instance().GetEngine(m_searchFor, m_caseSensitive, result);
+        m_useEngine   = result == CRegexEngine::CompileResult::Ok;
+        if (m_useEngine)
+            return;
+        try
+        {
+            auto flags = std::regex_constants::ECMAScript;
+            if (!m_caseSensitive)
+                flags |= std::regex_constants::icase;
+            m_wregex = CRegexCache::Instance().GetWRegex(CUnicodeUtils::StdGetUnicode(m_searchFor), flags);
+        }
+        catch (const std::regex_error&)
+        {
+            m_valid = false;
+        }
+    }
+    else if (!m_caseSensitive)
+    {
+        // the folded string is padded: matching compares a whole folded
+        // character even if that reads past the end of the folded search string
+        m_foldedSearchFor.resize((m_searchFor.size() + 1) * UTF8MaxBytes * maxFoldingExpansion + 1);
+        m_foldedLength = m_caseFolder.Fold(m_foldedSearchFor.data(), m_foldedSearchFor.size(), m_searchFor.c_str(), m_searchFor.size());
+        for (int i = 0; i < 0x80; ++i)
+        {
+            char ch = static_cast<char>(i);
+            m_caseFolder.Fold(&m_asciiFolded[i], 1, &ch, 1);
+        }
+    }
+}
+
+sptr_t CBufferSearch::FindText(std::string_view text, sptr_t minPos, sptr_t maxPos, sptr_t& matchEnd) const
+{
+    if (!m_valid)
+        return -2;
+    // an empty search string matches right away, same as in Scintilla
+    if (m_searchFor.empty())
+    {
+        matchEnd = minPos;
+        return minPos;
+    }
+    // only forward searches are supported
+    if (minPos > maxPos)
+        return -1;
+    const sptr_t startPos = MovePositionOutsideChar(text, minPos);
+    const sptr_t endPos   = MovePositionOutsideChar(text, maxPos);
+    if (m_regex)
+        return FindRegex(text, startPos, endPos, matchEnd);
+    if (m_caseSensitive)
+        return FindLiteral(text, startPos, endPos, matchEnd);
+    return FindFolded(text, startPos, endPos, matchEnd);
+}
+
+int CBufferSearch::ReplaceAll(std::string_view text, const std::string& replaceWith, std::string& result) const
+{
+    result.clear();
+    if (!m_valid || m_searchFor.empty())
+        return 0;
+    const sptr_t length    = static_cast<sptr_t>(text.size());
+    sptr_t       copied    = 0;
+    sptr_t       pos       = 0;
+    int          count     = 0;
+    std::string  formatted; // Reduce memory reallocations by keeping this out of the loop.
+    // the replacement is parsed only once, not for every match
+    std::optional<CRegexFormat> format;
+    if (m_regex)
+        format.emplace(replaceWith, m_useEngine ? m_regexEngine->GroupCount() : m_wregex->mark_count() + 1);
+    while (pos <= length)
+    {
+        sptr_t matchEnd = 0;
+        sptr_t found    = m_regex ? FindRegex(text, MovePositionOutsideChar(text, pos), length, matchEnd, &*format, &formatted)
+                                  : FindText(text, pos, length, matchEnd);
+        if (found < 0)
+            break;
+        if (count == 0)
+            result.reserve(text.size() + text.size() / 8);
+        result.append(text.data() + copied, found - copied);
+        result.append(m_regex ? formatted : replaceWith);
+        copied = matchEnd;
+        ++count;
+        if (matchEnd > found)
+            pos = matchEnd;
+        else
+        {
+            // an empty match would be found again
+            if (matchEnd >= length)
+                break;
+            int width = 1;
+            ExtractCharacter(text, matchEnd, width);
+            pos = matchEnd + width;
+        }
+    }
+    if (count)
+        result.append(text.data() + copied, length - copied);
+    return count;
+}
+
+sptr_t CBufferSearch::FindLiteral(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd) const
+{
+    // UTF-8 is self synchronizing: a valid UTF-8 search string can only match
+    // at character boundaries, so there's no need to step through the text
+    // character by character.
+    const sptr_t lengthFind = static_cast<sptr_t>(m_searchFor.size());
+    const sptr_t endSearch  = endPos - lengthFind + 1;
+    const char*  base       = text.data();
+    const char   firstChar  = m_searchFor[0];
+    sptr_t       pos        = startPos;
+    while (pos < endSearch)
+    {
+        auto found = static_cast<const char*>(memchr(base + pos, firstChar, endSearch - pos));
+        if (found == nullptr)
+            return -1;
+        pos = found - base;
+        if (memcmp(base + pos + 1, m_searchFor.c_str() + 1, lengthFind - 1) == 0 &&
+            MatchesWordOptions(text, pos, lengthFind))
+        {
+            matchEnd = pos + lengthFind;
+            return pos;
+        }
+        ++pos;
+    }
+    return -1;
+}
+
+sptr_t CBufferSearch::FindFolded(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd) const
+{
+    const size_t lenSearch  = m_foldedLength;
+    const char*  searchData = m_foldedSearchFor.data();
+    const char   firstChar  = searchData[0];
+    const sptr_t limitPos   = endPos;
+    char         bytes[UTF8MaxBytes + 1]                         = "";
+    char         folded[UTF8MaxBytes * maxFoldingExpansion + 1] = "";
+    sptr_t       pos                                             = startPos;
+    while (pos < endPos)
+    {
+        // quickly skip ASCII characters which can't start a match
+        while (pos < endPos && UTF8IsAscii(static_cast<unsigned char>(text[pos])) && m_asciiFolded[static_cast<unsigned char>(text[pos])] != firstChar)
+            ++pos;
+        if (pos >= endPos)
+            break;
+
+        int    widthFirstCharacter = 0;
+        sptr_t posIndexDocument    = pos;
+        size_t indexSearch         = 0;
+        bool   characterMatches    = true;
+        for (;;)
+        {
+            const unsigned char leadByte = UCharAt(text, posIndexDocument);
+            bytes[0]                     = leadByte;
+            int widthChar                = 1;
+            if (!UTF8IsAscii(leadByte))
+            {
+                const int widthCharBytes = UTF8BytesOfLead[leadByte];
+                for (int b = 1; b < widthCharBytes; b++)
+                    bytes[b] = static_cast<char>(UCharAt(text, posIndexDocument + b));
+                widthChar = UTF8Classify(reinterpret_cast<const unsigned char*>(bytes), widthCharBytes) & UTF8MaskWidth;
+            }
+            if (!widthFirstCharacter)
+                widthFirstCharacter = widthChar;
+            if ((posIndexDocument + widthChar) > limitPos)
+                break;
+            const size_t lenFlat = m_caseFolder.Fold(folded, sizeof(folded), bytes, widthChar);
+            // the search string buffer is padded, see the constructor
+            characterMatches = 0 == memcmp(folded, searchData + indexSearch, lenFlat);
+            if (!characterMatches)
+                break;
+            posIndexDocument += widthChar;
+            indexSearch += lenFlat;
+            if (indexSearch >= lenSearch)
+                break;
+        }
+        if (characterMatches && (indexSearch == lenSearch))
+        {
+            if (MatchesWordOptions(text, pos, posIndexDocument - pos))
+            {
+                matchEnd = posIndexDocument;
+                return pos;
+            }
+        }
+        pos += widthFirstCharacter;
+    }
+    return -1;
+}
+
+sptr_t CBufferSearch::FindRegex(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd,
+                                const CRegexFormat* format, std::string* formatted) const
+{
+    // same as in StdRegexSearch: the regex is matched against the whole
+    // range, by the regex engine if it supports the regex and by std::wregex
+    // otherwise.
+    if (m_useEngine)
+    {
+        CRegexMatch match;
+        if (!m_regexEngine->Search(text, startPos, endPos, match))
+            return -1;
+        matchEnd = match.End();
+        if (format)
+        {
+            formatted->clear();
+            format->Apply(text, match, *formatted);
+        }
+        return match.Start();
+    }
+    try
+    {
+        std::match_results<UTF8BufferIterator> match;
+        UTF8BufferIterator                     endIterator(text, endPos);
+        if (std::regex_search(UTF8BufferIterator(text, startPos), endIterator, match, *m_wregex, std::regex_constants::format_first_only))
+        {
+            matchEnd = match[0].second.Pos();
+            if (format)
+            {
+                // the groups are copied from the utf8 text directly, without
+                // converting anything to and from utf16
+                formatted->clear();
+                format->Apply(*formatted, [&](std::string& result, size_t group) {
+                    const auto& sub = group == CRegexFormat::PrefixGroup   ? match.prefix()
+                                      : group == CRegexFormat::SuffixGroup ? match.suffix()
+                                                                           : match[group];
+                    if (sub.matched)
+                        result.append(text.substr(sub.first.Pos(), sub.second.Pos() - sub.first.Pos()));
+                });
+            }
+            return match[0].first.Pos();
+        }
+    }
+    catch (const std::regex_error&)
+    {
+        return -2;
+    }
+    return -1;
+}
+
+bool CBufferSearch::MatchesWordOptions(std::string_view text, sptr_t pos, sptr_t length) const
+{
+    return ::MatchesWordOptions(text, pos, length, m_wholeWord, m_wordStart);
+}
+
+CMultiTermSearch::CMultiTermSearch(const std::vector<std::string>& terms, int searchFlags)
+    : m_caseSensitive((searchFlags & SCFIND_MATCHCASE) != 0)
+    , m_wholeWord((searchFlags & SCFIND_WHOLEWORD) != 0)
+    , m_wordStart((searchFlags & SCFIND_WORDSTART) != 0)
+{
+    for (int i = 0; i < 0x80; ++i)
+    {
+        char ch = static_cast<char>(i);
+        if (m_caseSensitive)
+            m_asciiFolded[i] = ch;
+        else
+            m_caseFolder.Fold(&m_asciiFolded[i], 1, &ch, 1);
+    }
+    std::vector<std::string> patterns;
+    for (const auto& term : terms)
+    {
+        if (m_caseSensitive || term.empty())
+        {
+            patterns.push_back(term);
+            continue;
+        }
+        std::string folded((term.size() + 1) * UTF8MaxBytes * maxFoldingExpansion + 1, '\0');
+        folded.resize(m_caseFolder.Fold(folded.data(), folded.size(), term.c_str(), term.size()));
+        patterns.push_back(std::move(folded));
+    }
+    for (const auto& pattern : patterns)
+    {
+        for (auto c : pattern)
+        {
+            auto& byteClass = m_byteClasses[static_cast<unsigned char>(c)];
+            if (byteClass == 0)
+                byteClass = static_cast<unsigned short>(m_classCount++);
+        }
+    }
+
+    // the trie of all patterns, -1 marks missing transitions
+    m_transitions.assign(m_classCount, -1);
+    m_stateTerm.assign(1, -1);
+    m_depth.assign(1, 0);
+    m_sameTerm.assign(patterns.size(), -1);
+    m_stateCount = 1;
+    for (int term = 0; term < static_cast<int>(patterns.size()); ++term)
+    {
+        if (patterns[term].empty())
+            continue;
+        int state = 0;
+        for (auto c : patterns[term])
+        {
+            auto& next = m_transitions[state * m_classCount + m_byteClasses[static_cast<unsigned char>(c)]];
+            if (next < 0)
+            {
+                next = static_cast<int>(m_stateCount++);
+                m_transitions.resize(m_stateCount * m_classCount, -1);
+                m_stateTerm.push_back(-1);
+                m_depth.push_back(m_depth[state] + 1);
+            }
+            // the vector may have moved
+            state = m_transitions[state * m_classCount + m_byteClasses[static_cast<unsigned char>(c)]];
+        }
+        // terms that fold to the same bytes end in the same state
+        int* last = &m_stateTerm[state];
+        while (*last >= 0)
+            last = &m_sameTerm[*last];
+        *last      = term;
+        m_maxDepth = std::max(m_maxDepth, m_depth[state]);
+    }
+
+    // turn the trie into a DFA: missing transitions follow the failure
+    // links, which are computed breadth first
+    std::vector<int> failure(m_stateCount, 0);
+    m_matchLink.assign(m_stateCount, -1);
+    std::vector<int> queue;
+    queue.reserve(m_stateCount);
+    for (size_t c = 0; c < m_classCount; ++c)
+    {
+        auto& next = m_transitions[c];
+        if (next < 0)
+            next = 0;
+        else
+            queue.push_back(next);
+    }
+    for (size_t i = 0; i < queue.size(); ++i)
+    {
+        int state = queue[i];
+        for (size_t c = 0; c < m_classCount; ++c)
+        {
+            auto& next         = m_transitions[state * m_classCount + c];
+            int   failureState = m_transitions[failure[state] * m_classCount + c];
+            if (next < 0)
+            {
+                next = failureState;
+                continue;
+            }
+            failure[next]     = failureState;
+            m_matchLink[next] = m_stateTerm[failureState] >= 0 ? failureState : m_matchLink[failureState];
+            queue.push_back(next);
+        }
+    }
+    // the transitions go straight to the row of the next state, and the
+    // sign bit tells whether terms end in it: that saves work on every byte
+    for (auto& next : m_transitions)
+    {
+        bool hasMatches = m_stateTerm[next] >= 0 || m_matchLink[next] >= 0;
+        next            = static_cast<int>(next * m_classCount) | (hasMatches ? MatchFlag : 0);
+    }
+}
+
+std::vector<CMultiTermSearch::Match> CMultiTermSearch::FindAll(std::string_view text, const std::atomic<bool>* stop) const
+{
+    std::vector<Match> matches;
+    if (!IsValid())
+        return matches;
+    // the end of the last match of every term: a term is searched for again
+    // after the end of its last match
+    std::vector<sptr_t> termEnds(m_sameTerm.size(), 0);
+    // adds the matches of the terms that end with the state. \c startOf
+    // returns the start of a match of the given length in folded bytes,
+    // or -1 if it doesn't start at a character
+    auto addMatches = [&](int row, sptr_t end, auto startOf) {
+        int state = static_cast<int>((row & ~MatchFlag) / m_classCount);
+        for (int s = m_stateTerm[state] >= 0 ? state : m_matchLink[state]; s >= 0; s = m_matchLink[s])
+        {
+            sptr_t start = startOf(m_depth[s]);
+            if (start < 0 || !::MatchesWordOptions(text, start, end - start, m_wholeWord, m_wordStart))
+                continue;
+            for (int term = m_stateTerm[s]; term >= 0; term = m_sameTerm[term])
+            {
+                if (start < termEnds[term])
+                    continue;
+                termEnds[term] = end;
+                matches.push_back({start, end, term});
+            }
+        }
+    };
+
+    const sptr_t length = static_cast<sptr_t>(text.size());
+    // check for the stop flag every this many bytes
+    constexpr sptr_t stopCheckInterval = 64 * 1024;
+    int              state             = 0;
+    if (m_caseSensitive)
+    {
+        // valid UTF-8 terms can only match whole characters, see FindLiteral()
+        for (sptr_t pos = 0; pos < length; ++pos)
+        {
+            if (stop && (pos % stopCheckInterval) == 0 && *stop)
+                break;
+            state = Step(state, static_cast<unsigned char>(text[pos]));
+            if (state & MatchFlag)
+                addMatches(state, pos + 1, [&](size_t matchLength) { return pos + 1 - static_cast<sptr_t>(matchLength); });
+        }
+    }
+    else
+    {
+        // the position in the text of the last folded bytes, by their index
+        // in the folded text. Bytes that are not the first of the folding of
+        // their character are -1.
+        size_t ringSize = 1;
+        while (ringSize <= m_maxDepth)
+            ringSize *= 2;
+        std::vector<sptr_t> positions(ringSize);
+        const size_t        ringMask      = ringSize - 1;
+        size_t              foldedCount   = 0;
+        sptr_t              nextStopCheck = 0;
+        auto                startOf       = [&](size_t matchLength) {
+            return positions[(foldedCount - matchLength) & ringMask];
+        };
+        char bytes[UTF8MaxBytes + 1]                         = "";
+        char folded[UTF8MaxBytes * maxFoldingExpansion + 1] = "";
+        for (sptr_t pos = 0; pos < length;)
+        {
+            if (stop && pos >= nextStopCheck)
+            {
+                if (*stop)
+                    break;
+                nextStopCheck = pos + stopCheckInterval;
+            }
+            const unsigned char leadByte = static_cast<unsigned char>(text[pos]);
+            if (UTF8IsAscii(leadByte))
+            {
+                state                               = Step(state, static_cast<unsigned char>(m_asciiFolded[leadByte]));
+                positions[foldedCount++ & ringMask] = pos++;
+                if (state & MatchFlag)
+                    addMatches(state, pos, startOf);
+                continue;
+            }
+            // same as in FindFolded()
+            bytes[0]                 = leadByte;
+            const int widthCharBytes = UTF8BytesOfLead[leadByte];
+            for (int b = 1; b < widthCharBytes; b++)
+                bytes[b] = static_cast<char>(UCharAt(text, pos + b));
+            const int    widthChar = UTF8Classify(reinterpret_cast<const unsigned char*>(bytes), widthCharBytes) & UTF8MaskWidth;
+            const size_t lenFlat   = m_caseFolder.Fold(folded, sizeof(folded), bytes, widthChar);
+            for (size_t i = 0; i < lenFlat; ++i)
+            {
+                state                               = Step(state, static_cast<unsigned char>(folded[i]));
+                positions[foldedCount++ & ringMask] = i == 0 ? pos : -1;
+            }
+            pos += widthChar;
+            // matches have to end with a whole character
+            if (lenFlat && (state & MatchFlag))
+                addMatches(state, pos, startOf);
+        }
+    }
+    std::stable_sort(matches.begin(), matches.end(), [](const Match& a, const Match& b) { return a.start < b.start; });
+    return matches;
+}
@@ -0,0 +1,171 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "scintilla.h"
+#include "../ext/scintilla/src/CaseFolder.h"
+#include "RegexEngine.h"
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <regex>
+#include <memory>
+#include <climits>
+
+/// A UTF-8 text with line information, like a Scintilla document provides it.
+/// The line starts are only indexed as far as they're needed.
+class CTextLines
+{
+public:
+    explicit CTextLines(std::string_view text);
+
+    sptr_t           GetLength() const { return static_cast<sptr_t>(m_text.size()); }
+    std::string_view GetText() const { return m_text; }
+    /// returns 0 for positions outside the text, same as SCI_GETCHARAT
+    char             CharAt(sptr_t pos) const;
+
+    sptr_t           LineFromPosition(sptr_t pos);
+    sptr_t           PositionFromLine(sptr_t line);
+    /// returns the line including its line ending, same as SCI_GETLINE
+    std::string_view GetLine(sptr_t line);
+
+private:
+    bool IndexNextLine();
+
+    std::string_view    m_text;
+    std::vector<sptr_t> m_lineStarts;
+    bool                m_indexComplete = false;
+    // position of the next '\r' and '\n' after the indexed lines
+    size_t              m_nextCR = 0;
+    size_t              m_nextLF = 0;
+};
+
+/// Finds text in a UTF-8 buffer without the need for a Scintilla document.
+/// The results are the same as the ones SCI_FINDTEXT returns for a forward
+/// search on a document with the same content, i.e. the same case folding,
+/// the same word boundaries and the same regex engine are used.
+///
+/// Once constructed, FindText() can be called from multiple threads.
+class CBufferSearch
+{
+public:
+    CBufferSearch(const std::string& searchFor, int searchFlags);
+
+    /// false if the search string is an invalid regex
+    bool   IsValid() const { return m_valid; }
+
+    /// searches forward from \c minPos to \c maxPos.
+    /// Returns the start of the match and sets \c matchEnd, or returns
+    /// -1 if nothing was found and -2 if the regex is invalid.
+    sptr_t FindText(std::string_view text, sptr_t minPos, sptr_t maxPos, sptr_t& matchEnd) const;
+    /// replaces all matches in \c text with \c replaceWith. For regex
+    /// searches, \c replaceWith can refer to the groups of the match the
+    /// same way it can for SCI_REPLACETARGETRE. The matches are searched in
+    /// the original text, after an empty match the search goes on at the
+    /// next character.
+    /// Returns the number of replacements, \c result is only filled if
+    /// there were any.
+    int    ReplaceAll(std::string_view text, const std::string& replaceWith, std::string& result) const;
+
+private:
+    sptr_t FindLiteral(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd) const;
+    sptr_t FindFolded(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd) const;
+    /// if \c format is given, \c formatted is set to it with the groups of the match filled in
+    sptr_t FindRegex(std::string_view text, sptr_t startPos, sptr_t endPos, sptr_t& matchEnd,
+                     const CRegexFormat* format = nullptr, std::string* formatted = nullptr) const;
+    bool   MatchesWordOptions(std::string_view text, sptr_t pos, sptr_t length) const;
+
+    std::string                          m_searchFor;
+    std::string                          m_foldedSearchFor;
+    size_t                               m_foldedLength = 0;
+    char                                 m_asciiFolded[0x80] = {};
+    bool                                 m_caseSensitive = false;
+    bool                                 m_wholeWord     = false;
+    bool                                 m_wordStart     = false;
+    bool                                 m_regex         = false;
+    bool                                 m_valid         = true;
+    bool                                 m_useEngine     = false;
+    // shared with the other users of the regex cache
+    std::shared_ptr<const CRegexEngine>  m_regexEngine;
+    std::shared_ptr<const std::wregex>   m_wregex;
+    // Fold() does not modify the folder, it's just not declared const
+    mutable Scintilla::CaseFolderUnicode m_caseFolder;
+};
+
+/// Finds the matches of several search terms in a UTF-8 buffer with a
+/// single pass over the text.
+///
+/// The terms are literal strings. They are compiled into an Aho-Corasick
+/// automaton over their bytes, folded for case insensitive searches, and
+/// the text is folded the same way CBufferSearch folds it while it's run
+/// through the automaton. Every term is found where a CBufferSearch for
+/// just that term would find it if it went on searching after the end of
+/// each match, so matches of different terms can overlap.
+///
+/// Once constructed, FindAll() can be called from multiple threads.
+class CMultiTermSearch
+{
+public:
+    struct Match
+    {
+        sptr_t start = 0;
+        sptr_t end   = 0;
+        /// the index of the term in the list passed to the constructor
+        int    term  = -1;
+    };
+
+    /// of the \c searchFlags, only SCFIND_MATCHCASE, SCFIND_WHOLEWORD and
+    /// SCFIND_WORDSTART are used. Empty terms are never found.
+    CMultiTermSearch(const std::vector<std::string>& terms, int searchFlags);
+
+    /// false if there's no term to search for
+    bool               IsValid() const { return m_stateCount > 1; }
+
+    /// returns the matches in \c text, sorted by their start. If \c stop is
+    /// set while searching, only the matches found so far are returned.
+    std::vector<Match> FindAll(std::string_view text, const std::atomic<bool>* stop = nullptr) const;
+
+private:
+    static constexpr int MatchFlag = INT_MIN;
+
+    /// \c row is the start of the transitions of the current state, with
+    /// MatchFlag set if terms end in that state
+    int Step(int row, unsigned char c) const { return m_transitions[(row & ~MatchFlag) + m_byteClasses[c]]; }
+
+    // the bytes that don't appear in any term all share class 0
+    unsigned short                       m_byteClasses[256] = {};
+    size_t                               m_classCount       = 1;
+    size_t                               m_stateCount       = 0;
+    // the transitions of all states, in rows of m_classCount entries.
+    // Each one is the row of the next state, see Step()
+    std::vector<int>                     m_transitions;
+    // the first term that ends in a state, or -1
+    std::vector<int>                     m_stateTerm;
+    // the next state along the failure links that has terms, or -1
+    std::vector<int>                     m_matchLink;
+    // the next term with the same (folded) bytes, or -1
+    std::vector<int>                     m_sameTerm;
+    // the length of the state's (folded) bytes
+    std::vector<size_t>                  m_depth;
+    size_t                               m_maxDepth = 0;
+    char                                 m_asciiFolded[0x80] = {};
+    bool                                 m_caseSensitive     = false;
+    bool                                 m_wholeWord         = false;
+    bool                                 m_wordStart         = false;
+    mutable Scintilla::CaseFolderUnicode m_caseFolder;
+};
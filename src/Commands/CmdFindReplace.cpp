@@ -26,15 +26,21 @@
 #include "DirFileEnum.h"
 #include "BrowseFolder.h"
 #include "LexStyles.h"
+#include "FunctionIndex.h"
 #include "OnOutOfScope.h"
 #include "ResString.h"
 #include "Theme.h"
+#include "WorkStealingPool.h"
+#include "BufferSearch.h"
+#include "TrigramIndex.h"
+#include "SearchFileFilter.h"
 
 #include <regex>
 #include <thread>
 #include <algorithm>
 #include <utility>
 #include <memory>
+#include <set>
 
 static std::string g_findString;
 std::string        g_sHighlightString;
@@ -49,8 +55,10 @@ namespace
 {
 const int          TIMER_INFOSTRING      = 100;
 const int          TIMER_SUGGESTION      = 101;
+const int          TIMER_RESULTS         = 102;
 const unsigned int SF_SEARCHSUBFOLDERS   = 1;
 const unsigned int SF_SEARCHFORFUNCTIONS = 2;
+const unsigned int SF_MULTITERMS         = 4;
 // Limit the max search results so as not to crash by running out of memory or allowed memory.
 const int MAX_SEARCHRESULTS = 10000;
 
@@ -65,12 +73,18 @@ const int DEFAULT_MAX_SEARCHFILE_STRINGS   = 20;
 // If the time limit is too high it may appear like nothing is happening
 // for search patterns that take a long time to find results.
 // If the batch size is too high, excessive memory use may occur.
-// If the interval time or batch size is too low, performance may be affected
-// because the message delivery and progress reporting mechanism may
-// become more of a bottle-neck in performance than time taken to find results.
-constexpr auto PROGRESS_UPDATE_INTERVAL = std::chrono::seconds(3);
+// The search threads never wait for the UI thread to take the batches, the
+// UI thread takes them every RESULTS_DRAIN_INTERVAL milliseconds.
+constexpr auto PROGRESS_UPDATE_INTERVAL = std::chrono::milliseconds(500);
 const size_t   MAX_DATA_BATCH_SIZE      = 1000;
+const UINT     RESULTS_DRAIN_INTERVAL   = 100;
 constexpr auto MATCH_COLOR              = RGB(0xFF, 0, 0); // Red.
+// When searching in files, this many files can be queued or searched on the
+// worker threads before the enumeration waits for results to be handed on.
+const size_t MAX_FILES_IN_FLIGHT = 512;
+// When searching in tabs, the documents are copied for the worker threads
+// until this many bytes are copied and not yet searched.
+const size_t MAX_SNAPSHOT_BYTES_IN_FLIGHT = 64 * 1024 * 1024;
 
 // A couple of functions here are similar to those in CmdFunctions.cpp.
 // Code sharing is possible but for now the preference is not to do that
@@ -98,14 +112,14 @@ bool ParseSignature(std::wstring& name, const std::wstring& sig)
     return !name.empty();
 }
 
-void Normalize(CSearchResult& sr)
+void Normalize(std::wstring& lineText)
 {
-    std::wstring normalized        = sr.lineText;
+    std::wstring normalized        = lineText;
     bool         bLastCharWasSpace = false;
     size_t       sLen              = 0;
-    for (sptr_t i = 0; i < (sptr_t)sr.lineText.size(); ++i)
+    for (sptr_t i = 0; i < (sptr_t)lineText.size(); ++i)
     {
-        switch (sr.lineText[i])
+        switch (lineText[i])
         {
             case ' ':
             {
@@ -113,23 +127,12 @@ void Normalize(CSearchResult& sr)
                 {
                     normalized[sLen++] = ' ';
                 }
-                else
-                {
-                    if (i < sr.posInLineEnd)
-                        --sr.posInLineEnd;
-                    if (i < sr.posInLineStart)
-                        --sr.posInLineStart;
-                }
                 bLastCharWasSpace = true;
             }
             break;
             // remove carriage return and '{'
             case '\r':
             case '{':
-                if (i < sr.posInLineEnd)
-                    --sr.posInLineEnd;
-                if (i < sr.posInLineStart)
-                    --sr.posInLineStart;
                 bLastCharWasSpace = false;
                 break;
             // replace newlines and tabs with spaces
@@ -139,12 +142,12 @@ void Normalize(CSearchResult& sr)
                 bLastCharWasSpace  = false;
                 break;
             default:
-                normalized[sLen++] = sr.lineText[i];
+                normalized[sLen++] = lineText[i];
                 bLastCharWasSpace  = false;
                 break;
         }
     }
-    sr.lineText.assign(normalized, 0, sLen);
+    lineText.assign(normalized, 0, sLen);
 }
 
 // Given "a,b" or "a  ,  b"  or "a,b ," or "a,,b" this routine will yield v[0] "a", v[1] "b" for all.
@@ -178,21 +181,72 @@ void split(std::vector<std::wstring>& v, const std::wstring& s, wchar_t delimite
     }
 }
 
-// Will work with vector or deque.
-template <typename T>
-static inline void move_append(T& dst, T& src)
+// The terms of a multi term search: the search string is split at '|', or
+// if it is '@' followed by the path of a file, every line of that file is a term.
+std::vector<std::string> GetSearchTerms(const std::string& searchfor)
 {
-    if (dst.empty())
-        dst = std::move(src);
-    else
+    std::vector<std::string> terms;
+    std::string              text      = searchfor;
+    char                     delimiter = '|';
+    if (text.size() > 1 && text[0] == '@')
     {
-        dst.insert(dst.end(),
-                   std::make_move_iterator(src.begin()),
-                   std::make_move_iterator(src.end()));
-        src.clear();
+        auto        path = CUnicodeUtils::StdGetUnicode(text.substr(1));
+        std::string content;
+        if (PathFileExists(path.c_str()) && CDocumentManager::LoadFileUtf8(path, content))
+        {
+            text      = std::move(content);
+            delimiter = '\n';
+        }
     }
+    for (size_t start = 0; start <= text.size();)
+    {
+        auto end = text.find(delimiter, start);
+        if (end == std::string::npos)
+            end = text.size();
+        auto termEnd = end;
+        if (termEnd > start && text[termEnd - 1] == '\r')
+            --termEnd;
+        if (termEnd > start)
+            terms.push_back(text.substr(start, termEnd - start));
+        start = end + 1;
+    }
+    return terms;
 }
 
+// Every search worker thread needs its own Scintilla objects, created on the
+// thread that uses them.
+struct SearchWorkerContext
+{
+    SearchWorkerContext()
+        : searchWnd(g_hRes)
+    {
+        searchWnd.InitScratch(g_hRes);
+    }
+    CScintillaWnd    searchWnd;
+    CDocumentManager manager;
+};
+
+// The results of one file. Kept until all files enumerated before
+// this one are done.
+struct FileSearchResult
+{
+    std::wstring       path;
+    CSearchResultStore results;
+    bool               done = false;
+};
+
+// A file with replacements, written to a temporary file next to it.
+// The temporary file only replaces the original once all files are done.
+struct ReplacedFile
+{
+    std::wstring             path;
+    std::wstring             tempPath;
+    std::wstring             backupPath;
+    // the file as it was read, it's only replaced if it's still the same
+    CTrigramIndex::FileStamp stamp;
+    int                      count = 0;
+};
+
 std::wstring GetHomeFolder()
 {
     std::wstring homeFolder;
@@ -205,6 +259,15 @@ std::wstring GetHomeFolder()
 
 }; // unnamed namespace
 
+// The text of a file with results. The texts shown for the results are
+// made from it when they're drawn.
+struct ResultFileText
+{
+    std::wstring path;
+    std::string  text;
+    CTextLines   lines{std::string_view()};
+};
+
 CFindReplaceDlg::CFindReplaceDlg(void* obj)
     : ICommand(obj)
     , CBPBaseDialog()
@@ -279,6 +342,8 @@ void CFindReplaceDlg::HandleButtonDropDown(const NMBCDROPDOWN* pDropDown)
 
         ResString sReplaceAllInTabs(g_hRes, IDS_REPLACEALLINTABS);
         AppendMenu(hSplitMenu, MF_STRING, IDC_REPLACEALLINTABSBTN, sReplaceAllInTabs);
+        ResString sReplaceAllInDir(g_hRes, IDS_REPLACEALLINDIR);
+        AppendMenu(hSplitMenu, MF_STRING, IDC_REPLACEALLINDIRBTN, sReplaceAllInDir);
     }
     // Display the menu.
     TrackPopupMenu(hSplitMenu, TPM_LEFTALIGN | TPM_TOPALIGN, pt.x, pt.y, 0, *this, nullptr);
@@ -408,9 +473,12 @@ LRESULT CFindReplaceDlg::DlgFunc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
                 KillTimer(*this, TIMER_INFOSTRING);
                 Clear(IDC_SEARCHINFO);
             }
-            break;
-        case WM_THREADRESULTREADY:
-            OnSearchResultsReady(wParam != 0);
+            else if (wParam == TIMER_RESULTS)
+            {
+                if (m_searchType == IDC_FINDALLINTABS)
+                    SnapshotTabs();
+                OnSearchResultsReady();
+            }
             break;
         case WM_NOTIFY:
             switch (wParam)
@@ -444,6 +512,7 @@ void CFindReplaceDlg::InitSizing()
     AdjustControlSize(IDC_MATCHCASE);
     AdjustControlSize(IDC_MATCHREGEX);
     AdjustControlSize(IDC_FUNCTIONS);
+    AdjustControlSize(IDC_MULTITERMS);
     m_resizer.Init(hwndDlg);
     m_resizer.UseSizeGrip(!CTheme::Instance().IsDarkTheme());
     m_resizer.AddControl(hwndDlg, IDC_SEARCHFORLABEL, RESIZER_TOPLEFT);
@@ -454,6 +523,7 @@ void CFindReplaceDlg::InitSizing()
     m_resizer.AddControl(hwndDlg, IDC_MATCHCASE, RESIZER_TOPLEFT);
     m_resizer.AddControl(hwndDlg, IDC_MATCHREGEX, RESIZER_TOPLEFT);
     m_resizer.AddControl(hwndDlg, IDC_FUNCTIONS, RESIZER_TOPLEFT);
+    m_resizer.AddControl(hwndDlg, IDC_MULTITERMS, RESIZER_TOPLEFT);
     m_resizer.AddControl(hwndDlg, IDC_SEARCHSUBFOLDERS, RESIZER_TOPRIGHT);
     m_resizer.AddControl(hwndDlg, IDC_FINDBTN, RESIZER_TOPRIGHT);
     m_resizer.AddControl(hwndDlg, IDC_FINDPREVIOUS, RESIZER_TOPRIGHT);
@@ -511,6 +581,8 @@ void CFindReplaceDlg::DoInitDialog(HWND hwndDlg)
     AddToolTip(IDC_SETSEARCHFOLDERTOPARENT, setSearchFolderToParentTip);
     ResString setSearchFolderTip(g_hRes, IDS_TT_SETSEARCHFOLDER);
     AddToolTip(IDC_SETSEARCHFOLDER, setSearchFolderTip);
+    ResString multiTermsTip(g_hRes, IDS_TT_MULTITERMS);
+    AddToolTip(IDC_MULTITERMS, multiTermsTip);
 
     InitSizing();
     GetWindowRect(hwndDlg, &rcDlg);
@@ -700,17 +772,20 @@ LRESULT CFindReplaceDlg::DoListNotify(LPNMITEMACTIVATE lpNMItemActivate)
                 assert(false);
                 return 0;
             }
-            const auto& sr = m_searchResults[itemIndex];
+            const auto&  sr = m_searchResults[itemIndex];
+            std::wstring term;
+            if (sr.term >= 0 && sr.term < (int)m_searchTerms.size())
+                term = L" [" + CUnicodeUtils::StdGetUnicode(m_searchTerms[sr.term]) + L"]";
             if (sr.docID.IsValid())
             {
                 const auto& doc = GetDocumentFromID(sr.docID);
-                _snwprintf_s(tip->pszText, tip->cchTextMax, _TRUNCATE, L"%s (#%d)",
-                             doc.m_path.c_str(), itemIndex);
+                _snwprintf_s(tip->pszText, tip->cchTextMax, _TRUNCATE, L"%s (#%d)%s",
+                             doc.m_path.c_str(), itemIndex, term.c_str());
             }
             else if (sr.hasPath())
             {
-                _snwprintf_s(tip->pszText, tip->cchTextMax, _TRUNCATE, L"%s (#%d)",
-                             m_foundPaths[sr.pathIndex].c_str(), itemIndex);
+                _snwprintf_s(tip->pszText, tip->cchTextMax, _TRUNCATE, L"%s (#%d)%s",
+                             m_searchResults.GetPath(sr.pathIndex).c_str(), itemIndex, term.c_str());
             }
             break;
         }
@@ -763,12 +838,14 @@ LRESULT CFindReplaceDlg::GetListItemDispInfo(NMLVDISPINFO* pDispInfo)
             return 0;
 
         std::wstring sTemp;
-        const auto&  item = m_searchResults[itemIndex];
+        const auto&  item       = m_searchResults[itemIndex];
+        int          matchStart = 0;
+        int          matchEnd   = 0;
         switch (pDispInfo->item.iSubItem)
         {
             case 0: // file
                 if (!item.docID.IsValid())
-                    sTemp = CPathUtils::GetFileName(m_foundPaths[item.pathIndex]);
+                    sTemp = CPathUtils::GetFileName(m_searchResults.GetPath(item.pathIndex));
                 else
                     sTemp = GetTitleForDocID(item.docID);
                 lstrcpyn(pDispInfo->item.pszText, sTemp.c_str(), pDispInfo->item.cchTextMax);
@@ -780,13 +857,16 @@ LRESULT CFindReplaceDlg::GetListItemDispInfo(NMLVDISPINFO* pDispInfo)
                 break;
 
             case 2: // line text
-                if (m_searchType == IDC_FINDFILES)
+                if (m_searchType == IDC_FINDFILES || m_searchType == IDC_REPLACEALLINDIRBTN)
                 {
-                    auto parent = CPathUtils::GetParentDirectory(m_foundPaths[item.pathIndex]);
+                    auto parent = CPathUtils::GetParentDirectory(m_searchResults.GetPath(item.pathIndex));
                     lstrcpyn(pDispInfo->item.pszText, parent.c_str(), pDispInfo->item.cchTextMax);
                 }
                 else
-                    lstrcpyn(pDispInfo->item.pszText, item.lineText.c_str(), pDispInfo->item.cchTextMax);
+                {
+                    sTemp = GetResultLineText(item, matchStart, matchEnd);
+                    lstrcpyn(pDispInfo->item.pszText, sTemp.c_str(), pDispInfo->item.cchTextMax);
+                }
                 break;
         }
     }
@@ -828,10 +908,14 @@ LRESULT CFindReplaceDlg::DrawListItemWithMatches(NMLVCUSTOMDRAW* pLVCD)
     if (/*m_ThreadsRunning ||*/ itemIndex >= (int)m_searchResults.size())
         return CDRF_DODEFAULT;
 
+    // the results of a search for files show the folder of the file
+    if (m_searchType == IDC_FINDFILES || m_searchType == IDC_REPLACEALLINDIRBTN)
+        return CDRF_DODEFAULT;
+
     const CSearchResult& searchResult = m_searchResults[itemIndex];
-    const std::wstring&  text         = searchResult.lineText;
-    size_t               matchStart   = searchResult.posInLineStart;
-    size_t               matchEnd     = searchResult.posInLineEnd;
+    int                  matchStart   = 0;
+    int                  matchEnd     = 0;
+    const std::wstring   text         = GetResultLineText(searchResult, matchStart, matchEnd);
 
     constexpr auto mainDrawFlags = DT_SINGLELINE | DT_VCENTER | DT_NOPREFIX | DT_END_ELLIPSIS;
 
@@ -960,7 +1044,7 @@ LRESULT CFindReplaceDlg::DrawListItemWithMatches(NMLVCUSTOMDRAW* pLVCD)
         return CDRF_SKIPDEFAULT;
     }
 
-    bool invalid = (matchStart >= text.size() || matchEnd > text.size() || matchEnd < matchStart);
+    bool invalid = (matchStart >= static_cast<int>(text.size()) || matchEnd > static_cast<int>(text.size()) || matchEnd < matchStart);
     // Functions are a kind of match but we don't know where exactly.
     // Same is true of anything with invalid data.
     if (m_resultsType == ResultsType::Functions || invalid)
@@ -1119,7 +1203,7 @@ void CFindReplaceDlg::DoListItemAction(int itemIndex)
     }
     else if (item.hasPath())
     {
-        path = m_foundPaths[item.pathIndex];
+        path = m_searchResults.GetPath(item.pathIndex);
     }
     if (path.empty())
         TabActivateAt(GetTabIndexFromDocID(item.docID));
@@ -1191,7 +1275,13 @@ LRESULT CFindReplaceDlg::DoCommand(int id, int msg)
         }
         case IDC_FINDBTN:
             if (msg == BN_CLICKED)
-                DoFind();
+            {
+                // multiple terms can only be searched for all at once
+                if (IsDlgButtonChecked(*this, IDC_MULTITERMS) == BST_CHECKED)
+                    DoSearchAll(IDC_FINDALL);
+                else
+                    DoFind();
+            }
             break;
         case IDC_FINDPREVIOUS:
             if (msg == BN_CLICKED)
@@ -1227,6 +1317,14 @@ LRESULT CFindReplaceDlg::DoCommand(int id, int msg)
                 DoReplace(id);
             }
             break;
+        case IDC_REPLACEALLINDIRBTN:
+            if (msg == BN_CLICKED)
+            {
+                if (m_ThreadsRunning)
+                    return 1;
+                DoReplaceInFiles();
+            }
+            break;
         case IDC_MATCHREGEX:
             if (msg == BN_CLICKED)
             {
@@ -1296,6 +1394,10 @@ LRESULT CFindReplaceDlg::DoCommand(int id, int msg)
                 CheckSearchOptions();
             }
             break;
+        case IDC_MULTITERMS:
+            if (msg == BN_CLICKED)
+                CheckSearchOptions();
+            break;
         case IDC_SEARCHFILES:
             if (msg == CBN_SETFOCUS)
                 SetDefaultButton(IDC_FINDFILES, true);
@@ -1501,6 +1603,10 @@ void CFindReplaceDlg::DoReplace(int id)
             int   rcount = ReplaceDocument(doc, g_findString, sReplaceString, g_searchFlags);
             if (rcount)
             {
+                // edits through the scratch window are not reported to the index,
+                // nor to the document statistics unless the document is active
+                CFunctionIndex::Instance().Invalidate(docID);
+                doc.m_statistics.reset();
                 replaceCount += rcount;
                 UpdateTab(i);
             }
@@ -1573,6 +1679,91 @@ void CFindReplaceDlg::DoReplace(int id)
     }
 }
 
+void CFindReplaceDlg::DoReplaceInFiles()
+{
+    // Should have stopped before replacing again.
+    APPVERIFY(m_ThreadsRunning == 0);
+    if (m_ThreadsRunning)
+        return;
+    Clear(IDC_SEARCHINFO);
+
+    if (IsDlgButtonChecked(*this, IDC_FUNCTIONS) == BST_CHECKED)
+    {
+        SetInfoText(IDS_NOFUNCTIONFINDORREPLACE);
+        return;
+    }
+
+    std::wstring findText    = GetDlgItemText(IDC_SEARCHCOMBO).get();
+    std::wstring replaceText = GetDlgItemText(IDC_REPLACECOMBO).get();
+    UpdateSearchStrings(findText);
+    UpdateReplaceStrings(replaceText);
+
+    std::string searchfor = CUnicodeUtils::StdGetUTF8(findText);
+    if (searchfor.empty())
+    {
+        SearchStringNotFound();
+        return; // Empty search term, nothing to find.
+    }
+    int         searchflags    = GetScintillaOptions();
+    std::string sReplaceString = CUnicodeUtils::StdGetUTF8(replaceText);
+    if ((searchflags & SCFIND_REGEXP) != 0)
+        sReplaceString = UnEscape(sReplaceString);
+    unsigned int exSearchFlags = 0;
+    if (IsDlgButtonChecked(*this, IDC_SEARCHSUBFOLDERS) == BST_CHECKED)
+        exSearchFlags |= SF_SEARCHSUBFOLDERS;
+
+    std::wstring searchFolder = GetDlgItemText(IDC_SEARCHFOLDER).get();
+    if (searchFolder.empty())
+    {
+        SetInfoText(IDS_NOSEARCHFOLDER);
+        FocusOn(IDC_SEARCHFOLDER);
+        return;
+    }
+    if (!PathFileExists(searchFolder.c_str()))
+    {
+        SetInfoText(IDS_SEARCHFOLDERNOTFOUND);
+        return;
+    }
+    UpdateSearchFolderStrings(searchFolder);
+    std::wstring              filesString = GetDlgItemText(IDC_SEARCHFILES).get();
+    std::vector<std::wstring> filesToFind;
+    split(filesToFind, filesString, L';');
+    if (filesToFind.size() > 0)
+        UpdateSearchFilesStrings(filesString);
+
+    // the files that have unsaved changes in a tab are not what the user
+    // sees, those are left alone
+    std::vector<std::wstring> modifiedPaths;
+    int                       tabcount = GetTabCount();
+    for (int i = 0; i < tabcount; ++i)
+    {
+        const auto& doc = GetDocumentFromID(GetDocIDFromTabIndex(i));
+        if (doc.m_bIsDirty && !doc.m_path.empty())
+            modifiedPaths.push_back(doc.m_path);
+    }
+
+    m_searchType = IDC_REPLACEALLINDIRBTN;
+    m_searchResults.clear();
+    m_resultFileTexts.clear();
+    m_bStop       = false;
+    m_foundsize   = 0;
+    m_resultsType = ResultsType::Filenames;
+    InitResultsList();
+    EnableControls(false);
+    ShowResults(true);
+
+    UpdateMatchCount(false);
+    FocusOn(IDC_FINDRESULTS);
+    InterlockedIncrement(&m_ThreadsRunning);
+    m_searchFinished = false;
+    SetTimer(*this, TIMER_RESULTS, RESULTS_DRAIN_INTERVAL, nullptr);
+    std::thread(&CFindReplaceDlg::ReplaceThread,
+                this, searchFolder, searchfor, sReplaceString, searchflags, exSearchFlags, filesToFind, modifiedPaths)
+        .detach();
+    // Operation will be completed in OnSearchResultsReady which will be
+    // called in the UI thread so screens results can be updated etc.
+}
+
 bool CFindReplaceDlg::DoSearch(bool replaceMode)
 {
     Clear(IDC_SEARCHINFO);
@@ -1613,6 +1804,14 @@ bool CFindReplaceDlg::DoSearch(bool replaceMode)
     auto findRet = ScintillaCall(SCI_FINDTEXT, g_searchFlags, (sptr_t)&ttf);
     if (findRet == -1)
     {
+        // search the rest of a large file before wrapping around in the loaded part
+        bool wrapped = false;
+        if (FindInLargeFile(g_findString, g_searchFlags, wrapped))
+        {
+            if (wrapped)
+                SetInfoText(IDS_FINDRETRYWRAP);
+            return true;
+        }
         // Retry from the start of the doc.
         ttf.chrg.cpMax = ttf.chrg.cpMin;
         ttf.chrg.cpMin = 0;
@@ -1686,16 +1885,16 @@ void CFindReplaceDlg::SortResults()
                   {
                       assert(rhs.hasPath());
                       result = CPathUtils::PathCompare(GetTitleForDocID(lhs.docID),
-                                                       CPathUtils::GetFileName(m_foundPaths[rhs.pathIndex]));
+                                                       CPathUtils::GetFileName(m_searchResults.GetPath(rhs.pathIndex)));
                   }
                   else if (rhs.docID.IsValid())
                   {
                       assert(lhs.hasPath());
                       result = CPathUtils::PathCompare(
-                          CPathUtils::GetFileName(m_foundPaths[lhs.pathIndex]), GetTitleForDocID(rhs.docID));
+                          CPathUtils::GetFileName(m_searchResults.GetPath(lhs.pathIndex)), GetTitleForDocID(rhs.docID));
                   }
                   else if (lhs.hasPath() && rhs.hasPath())
-                      result = CPathUtils::PathCompare(m_foundPaths[lhs.pathIndex], m_foundPaths[rhs.pathIndex]);
+                      result = CPathUtils::PathCompare(m_searchResults.GetPath(lhs.pathIndex), m_searchResults.GetPath(rhs.pathIndex));
                   else
                       assert(false);
                   if (result == 0)
@@ -1717,21 +1916,32 @@ void CFindReplaceDlg::DoSearchAll(int id)
     Clear(IDC_SEARCHINFO);
     m_searchType = id;
     m_searchResults.clear();
-    m_foundPaths.clear();
+    m_resultFileTexts.clear();
     m_bStop     = false;
     m_foundsize = 0;
 
     std::wstring findText = GetDlgItemText(IDC_SEARCHCOMBO).get();
     if (id != IDC_FINDFILES)
         UpdateSearchStrings(findText);
-    std::string searchfor = CUnicodeUtils::StdGetUTF8(findText);
-    g_findString          = searchfor;
+    std::string searchfor  = CUnicodeUtils::StdGetUTF8(findText);
+    bool        multiTerms = id != IDC_FINDFILES && IsDlgButtonChecked(*this, IDC_MULTITERMS) == BST_CHECKED;
+    // find next can't search for multiple terms
+    if (!multiTerms)
+        g_findString = searchfor;
 
     int          searchflags        = GetScintillaOptions();
     unsigned int exSearchFlags      = 0;
-    bool         searchForFunctions = IsDlgButtonChecked(*this, IDC_FUNCTIONS) == BST_CHECKED;
+    bool         searchForFunctions = !multiTerms && IsDlgButtonChecked(*this, IDC_FUNCTIONS) == BST_CHECKED;
     if (searchForFunctions)
         exSearchFlags |= SF_SEARCHFORFUNCTIONS;
+    m_searchTerms.clear();
+    if (multiTerms)
+    {
+        // the terms are plain strings, never regexes
+        searchflags &= ~(SCFIND_REGEXP | SCFIND_CXX11REGEX);
+        exSearchFlags |= SF_MULTITERMS;
+        m_searchTerms = GetSearchTerms(searchfor);
+    }
     bool searchSubFolders = IsDlgButtonChecked(*this, IDC_SEARCHSUBFOLDERS) == BST_CHECKED;
     if (searchSubFolders)
         exSearchFlags |= SF_SEARCHSUBFOLDERS;
@@ -1759,6 +1969,51 @@ void CFindReplaceDlg::DoSearchAll(int id)
             SetInfoText(IDS_FINDNOTFOUND);
             return;
         }
+        std::unique_ptr<CMultiTermSearch> termSearch;
+        if (multiTerms)
+        {
+            termSearch = std::make_unique<CMultiTermSearch>(m_searchTerms, searchflags);
+            if (!termSearch->IsValid())
+            {
+                SetInfoText(IDS_FINDNOTFOUND);
+                return;
+            }
+        }
+
+        if (id == IDC_FINDALLINTABS && !searchForFunctions)
+        {
+            // Searching hundreds of tabs takes a while. The documents are searched
+            // on worker threads so the editor stays responsive. They are copied
+            // with every tick of the results timer, only as far as the workers
+            // keep up, so there are never copies of all of them at once.
+            // Searches for functions need the lexers and stay on this thread.
+            int tabcount = GetTabCount();
+            m_tabsToSnapshot.resize(tabcount);
+            for (int i = 0; i < tabcount; ++i)
+                m_tabsToSnapshot[i] = GetDocIDFromTabIndex(i);
+            m_nextSnapshot = 0;
+            {
+                std::lock_guard<std::mutex> lk(m_snapshotMutex);
+                m_snapshots.clear();
+                m_snapshotBytes = 0;
+            }
+            m_searchedTabCount = tabcount;
+            m_closedWhileSearching.clear();
+
+            EnableControls(false);
+            ShowResults(true);
+            UpdateMatchCount(false);
+            FocusOn(IDC_FINDRESULTS);
+            InterlockedIncrement(&m_ThreadsRunning);
+            m_searchFinished = false;
+            SetTimer(*this, TIMER_RESULTS, RESULTS_DRAIN_INTERVAL, nullptr);
+            SnapshotTabs();
+            std::thread(&CFindReplaceDlg::SearchTabsThread,
+                        this, m_tabsToSnapshot.size(), searchfor, searchflags, exSearchFlags)
+                .detach();
+            // Operation will be completed in OnSearchResultsReady.
+            return;
+        }
 
         if (id == IDC_FINDALL && HasActiveDocument())
         {
@@ -1767,9 +2022,14 @@ void CFindReplaceDlg::DoSearchAll(int id)
             ResString   rInfo(g_hRes, IDS_SEARCHING_FILE);
             auto        sInfo = CStringUtils::Format(rInfo, CPathUtils::GetFileName(doc.m_path).c_str());
             SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
-            SearchDocument(m_searchWnd, docId, doc, searchfor, searchflags, exSearchFlags,
-                           m_searchResults, m_foundPaths);
+            if (termSearch)
+                SearchDocument(m_searchWnd, docId, doc, *termSearch, m_searchResults);
+            else
+                SearchDocument(m_searchWnd, docId, doc, searchfor, searchflags, exSearchFlags,
+                               m_searchResults);
             SortResults();
+            if (termSearch)
+                MarkSearchTerms();
         }
         else if (id == IDC_FINDALLINTABS)
         {
@@ -1783,7 +2043,7 @@ void CFindReplaceDlg::DoSearchAll(int id)
                 SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
                 UpdateWindow(*this);
                 SearchDocument(m_searchWnd, docID, doc, searchfor, searchflags, exSearchFlags,
-                               m_searchResults, m_foundPaths);
+                               m_searchResults);
                 if (m_foundsize >= m_maxSearchResults)
                 {
                     ResString rInfoMax(g_hRes, IDS_SEARCHING_FILE_MAX);
@@ -1864,6 +2124,8 @@ void CFindReplaceDlg::DoSearchAll(int id)
         UpdateMatchCount(false);
         FocusOn(IDC_FINDRESULTS);
         InterlockedIncrement(&m_ThreadsRunning);
+        m_searchFinished = false;
+        SetTimer(*this, TIMER_RESULTS, RESULTS_DRAIN_INTERVAL, nullptr);
         // Start a new thread to search all files.
         std::thread(&CFindReplaceDlg::SearchThread,
                     this, id, searchFolder, searchfor, searchflags, exSearchFlags, filesToFind)
@@ -1941,18 +2203,70 @@ void CFindReplaceDlg::SearchThread(
     bool searchSubFolders = (exSearchFlags & SF_SEARCHSUBFOLDERS) != 0;
 
     m_pendingSearchResults.clear();
-    m_pendingFoundPaths.clear();
 
-    // We need a Scintilla object created on the same thread as it will be used,
-    // that's why we can't use the m_searchWnd object.
-    CScintillaWnd searchWnd(g_hRes);
-    searchWnd.InitScratch(g_hRes);
-
-    CDirFileEnum     enumerator(searchpath);
-    bool             bIsDir = false;
-    std::wstring     path;
-    CDocumentManager manager;
-    bool             searchSubFoldersFlag = searchSubFolders;
+    CDirFileEnum enumerator(searchpath);
+    bool         bIsDir = false;
+    std::wstring path;
+    bool         searchSubFoldersFlag = searchSubFolders;
+    // skips ignored, binary and too big files before they're loaded
+    CSearchFileFilter fileFilter(searchpath);
+
+    // When searching in files, the files are loaded and searched on a pool of
+    // worker threads while this thread keeps enumerating. The results of every
+    // file are kept in enumeration order and only handed on once all the files
+    // enumerated before it are done: NewData() and AcceptData() rely on the
+    // results of a file being complete and in order.
+    std::mutex                                    inFlightMutex;
+    std::condition_variable                       inFlightCondition;
+    std::deque<std::unique_ptr<FileSearchResult>> inFlight;
+    // hand on the results of all files that are done, as long as no earlier
+    // file is still being searched. Blocks while more than maxInFlight
+    // files are queued.
+    auto handOnResults = [&](size_t maxInFlight) {
+        for (;;)
+        {
+            std::unique_ptr<FileSearchResult> fileResult;
+            {
+                std::unique_lock<std::mutex> lk(inFlightMutex);
+                inFlightCondition.wait(lk, [&]() { return inFlight.size() <= maxInFlight || inFlight.front()->done; });
+                if (inFlight.empty() || !inFlight.front()->done)
+                    return;
+                fileResult = std::move(inFlight.front());
+                inFlight.pop_front();
+            }
+            if (!fileResult->results.empty())
+            {
+                int pathIndex = fileResult->results.AddPath(fileResult->path);
+                for (auto& result : fileResult->results)
+                    result.pathIndex = pathIndex;
+                m_pendingSearchResults.Append(fileResult->results);
+            }
+            NewData(timeOfLastProgressUpdate, false);
+        }
+    };
+    std::unique_ptr<CWorkStealingPool<SearchWorkerContext>> pool;
+    if (id == IDC_FINDALLINDIR)
+    {
+        auto threadCount = CIniSettings::Instance().GetInt64(L"searchreplace", L"searchthreads", 0);
+        pool             = std::make_unique<CWorkStealingPool<SearchWorkerContext>>(static_cast<size_t>(max(0, threadCount)));
+    }
+    // searches for functions need the lexer of a Scintilla document,
+    // all other searches can be done on the plain file content
+    std::unique_ptr<CBufferSearch>    bufferSearch;
+    std::unique_ptr<CMultiTermSearch> termSearch;
+    if (id == IDC_FINDALLINDIR && (exSearchFlags & SF_MULTITERMS) != 0 && !searchfor.empty())
+        termSearch = std::make_unique<CMultiTermSearch>(m_searchTerms, flags);
+    else if (id == IDC_FINDALLINDIR && (exSearchFlags & SF_SEARCHFORFUNCTIONS) == 0)
+        bufferSearch = std::make_unique<CBufferSearch>(searchfor, flags);
+    // the trigram index of the search folder lets plain searches skip
+    // the files that can't contain the search string
+    std::shared_ptr<CTrigramIndex> index;
+    std::vector<unsigned int>      indexQuery;
+    if (bufferSearch && bufferSearch->IsValid() && CIniSettings::Instance().GetInt64(L"searchreplace", L"searchindex", 0))
+    {
+        index      = CTrigramIndex::Get(searchpath);
+        indexQuery = CTrigramIndex::GetQuery(searchfor, flags);
+    }
 
     // Note that on some versions of Windows, e.g. Window 7, paths like "*.cpp" will
     // actually match "*.cpp*" which is strange but it's seems a quirk of the OS not CDirFileEnum.
@@ -1960,10 +2274,12 @@ void CFindReplaceDlg::SearchThread(
     {
         if (bIsDir)
         {
-            searchSubFoldersFlag = IsExcludedFolder(path) ? false : searchSubFolders;
+            searchSubFoldersFlag = (IsExcludedFolder(path) || fileFilter.IsIgnored(path, true)) ? false : searchSubFolders;
             continue;
         }
         searchSubFoldersFlag = searchSubFolders;
+        if (fileFilter.IsIgnored(path, false))
+            continue;
 
         // We must continue to the top of the loop and onto the next file
         // if we don't want the current file.
@@ -1986,9 +2302,8 @@ void CFindReplaceDlg::SearchThread(
         {
             // If finding OF files, only the name is of interest so our job is done.
             CSearchResult result;
-            result.pathIndex = m_pendingFoundPaths.size();
-            m_pendingFoundPaths.push_back(std::move(path));
-            m_pendingSearchResults.push_back(std::move(result));
+            result.pathIndex = m_pendingSearchResults.AddPath(path);
+            m_pendingSearchResults.Add(result);
             NewData(timeOfLastProgressUpdate, false);
             if (++m_foundsize >= m_maxSearchResults)
                 break;
@@ -1998,58 +2313,445 @@ void CFindReplaceDlg::SearchThread(
         // Else if finding IN files... search for matches in the file of interest.
         assert(id == IDC_FINDALLINDIR);
 
-        // TODO! Ideally we need a means to check for cancellation during load so that
-        // BowPad doesn't appear hung while loading large files.
-        CDocument doc = manager.LoadFile(nullptr, path, -1, false);
-        // Don't crash if the document cannot be loaded. .e.g. if it is locked.
-        if (doc.m_document != Document(0))
+        CTrigramIndex::FileStamp stamp;
+        bool                     hasStamp  = CTrigramIndex::GetFileStamp(path, stamp);
+        bool                     indexFile = false;
+        if (hasStamp && fileFilter.IsTooBig(stamp.size))
+            continue;
+        if (index && hasStamp)
+        {
+            auto lookup = index->Lookup(path, stamp, indexQuery);
+            if (lookup == CTrigramIndex::LookupResult::NoMatch)
+                continue;
+            indexFile = lookup == CTrigramIndex::LookupResult::NotIndexed;
+        }
+
+        auto  fileResult = std::make_unique<FileSearchResult>();
+        auto* pResult    = fileResult.get();
+        pResult->path    = std::move(path);
+        {
+            std::lock_guard<std::mutex> lk(inFlightMutex);
+            inFlight.push_back(std::move(fileResult));
+        }
+        pool->Submit([&, pResult, stamp, indexFile](SearchWorkerContext& context) {
+            // files still queued when the search is stopped are just marked as done,
+            // and so are files that turn out to be binary
+            if (!m_bStop && m_foundsize < m_maxSearchResults && !fileFilter.IsBinaryFile(pResult->path))
+            {
+                if (termSearch)
+                {
+                    // all terms are found with a single pass over the file content
+                    std::string text;
+                    if (termSearch->IsValid() && CDocumentManager::LoadFileUtf8(pResult->path, text, nullptr, nullptr, &m_bStop))
+                        SearchBuffer(text, *termSearch, pResult->results);
+                }
+                else if (bufferSearch)
+                {
+                    // plain text searches don't need a Scintilla document:
+                    // the file is decoded into a utf8 buffer and searched directly
+                    std::string text;
+                    // an invalid regex can't find anything, so don't even load the file.
+                    // Don't crash if the file cannot be loaded. .e.g. if it is locked.
+                    if (bufferSearch->IsValid() && CDocumentManager::LoadFileUtf8(pResult->path, text, nullptr, nullptr, &m_bStop))
+                    {
+                        if (indexFile)
+                            index->Update(pResult->path, stamp, text);
+                        SearchBuffer(text, *bufferSearch, pResult->results);
+                    }
+                }
+                else
+                {
+                    // stopping the search also stops loading big files
+                    CDocument doc = context.manager.LoadFile(nullptr, pResult->path, -1, false, nullptr, &m_bStop);
+                    // Don't crash if the document cannot be loaded. .e.g. if it is locked.
+                    if (doc.m_document != Document(0))
+                    {
+                        DocID did(1);
+                        context.manager.AddDocumentAtEnd(doc, did);
+                        OnOutOfScope(context.manager.RemoveDocument(did););
+                        SearchDocument(context.searchWnd, DocID(), doc, searchfor, flags, exSearchFlags,
+                                       pResult->results);
+                    }
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lk(inFlightMutex);
+                pResult->done = true;
+            }
+            inFlightCondition.notify_all();
+        });
+        handOnResults(MAX_FILES_IN_FLIGHT - 1);
+        if (m_foundsize >= m_maxSearchResults)
+            break;
+    }
+    if (pool)
+    {
+        handOnResults(0);
+        pool.reset();
+    }
+    // files not seen by a search that got through the whole folder might
+    // have been deleted
+    if (index)
+        index->Save(!m_bStop && m_foundsize < m_maxSearchResults);
+    // The UI thread counts the thread as done once it took the last
+    // results, this must not touch any members after this.
+    NewData(timeOfLastProgressUpdate, true);
+}
+
+void CFindReplaceDlg::SnapshotTabs()
+{
+    size_t inFlight = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_snapshotMutex);
+        inFlight = m_snapshotBytes;
+    }
+    // once the search stops, the tabs left are only handed on as skipped
+    bool                          stopped = m_bStop || m_foundsize >= m_maxSearchResults;
+    size_t                        copied  = 0;
+    std::vector<DocumentSnapshot> snapshots;
+    while (m_nextSnapshot < m_tabsToSnapshot.size() && (stopped || inFlight + copied < MAX_SNAPSHOT_BYTES_IN_FLIGHT))
+    {
+        DocumentSnapshot snapshot;
+        snapshot.docID = m_tabsToSnapshot[m_nextSnapshot++];
+        if (stopped || !HasDocumentID(snapshot.docID))
+            snapshot.skipped = true;
+        else
         {
-            DocID did(1);
-            manager.AddDocumentAtEnd(doc, did);
-            OnOutOfScope(manager.RemoveDocument(did););
-            if (!m_bStop)
+            const auto& doc = GetDocumentFromID(snapshot.docID);
+            m_searchWnd.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+            auto pText = reinterpret_cast<const char*>(m_searchWnd.Call(SCI_GETCHARACTERPOINTER));
+            snapshot.text.assign(pText, m_searchWnd.Call(SCI_GETLENGTH));
+            copied += snapshot.text.size();
+        }
+        snapshots.push_back(std::move(snapshot));
+    }
+    if (snapshots.empty())
+        return;
+    m_searchWnd.Call(SCI_SETDOCPOINTER, 0, 0);
+    {
+        std::lock_guard<std::mutex> lk(m_snapshotMutex);
+        m_snapshotBytes += copied;
+        for (auto& snapshot : snapshots)
+            m_snapshots.push_back(std::move(snapshot));
+    }
+    m_snapshotCondition.notify_all();
+}
+
+void CFindReplaceDlg::SearchTabsThread(
+    size_t tabCount, const std::string& searchfor,
+    int flags, unsigned int exSearchFlags)
+{
+    auto timeOfLastProgressUpdate = std::chrono::steady_clock::now();
+    m_pendingSearchResults.clear();
+
+    std::unique_ptr<CBufferSearch>    bufferSearch;
+    std::unique_ptr<CMultiTermSearch> termSearch;
+    if ((exSearchFlags & SF_MULTITERMS) != 0)
+        termSearch = std::make_unique<CMultiTermSearch>(m_searchTerms, flags);
+    else
+        bufferSearch = std::make_unique<CBufferSearch>(searchfor, flags);
+
+    // The UI thread copies the documents in tab order as the workers keep
+    // up. They are searched on a pool of worker threads, but their results
+    // are handed on in tab order.
+    std::vector<DocumentSnapshot>   snapshots(tabCount);
+    std::vector<CSearchResultStore> results(tabCount);
+    std::vector<bool>               done(tabCount, false);
+    {
+        auto                threadCount = CIniSettings::Instance().GetInt64(L"searchreplace", L"searchthreads", 0);
+        CWorkStealingPool<> pool(static_cast<size_t>(max(0, threadCount)));
+        size_t              submitted = 0;
+        for (size_t handedOn = 0; handedOn < tabCount;)
+        {
+            std::deque<DocumentSnapshot> copied;
+            bool                         ready = false;
+            {
+                std::unique_lock<std::mutex> lk(m_snapshotMutex);
+                // the UI thread doesn't copy anything more once the dialog
+                // closes, so a stop is polled for
+                m_snapshotCondition.wait_for(lk, std::chrono::milliseconds(RESULTS_DRAIN_INTERVAL), [&]() {
+                    return !m_snapshots.empty() || done[handedOn] || (m_bStop && submitted == handedOn);
+                });
+                copied.swap(m_snapshots);
+                ready = done[handedOn];
+            }
+            for (auto& snapshot : copied)
+            {
+                size_t i     = submitted++;
+                snapshots[i] = std::move(snapshot);
+                pool.Submit([&, i](NoWorkerContext&) {
+                    if (!snapshots[i].skipped && !m_bStop && m_foundsize < m_maxSearchResults)
+                    {
+                        if (termSearch)
+                            SearchBuffer(snapshots[i].text, *termSearch, results[i]);
+                        else if (bufferSearch->IsValid())
+                            SearchBuffer(snapshots[i].text, *bufferSearch, results[i]);
+                        for (auto& result : results[i])
+                            result.docID = snapshots[i].docID;
+                    }
+                    // release the copy as soon as it's searched
+                    auto size = snapshots[i].text.size();
+                    std::string().swap(snapshots[i].text);
+                    {
+                        std::lock_guard<std::mutex> lk(m_snapshotMutex);
+                        m_snapshotBytes -= size;
+                        done[i] = true;
+                    }
+                    m_snapshotCondition.notify_all();
+                });
+            }
+            if (ready)
             {
-                size_t resultSizeBefore = m_pendingSearchResults.size();
-                SearchDocument(searchWnd, DocID(), doc, searchfor, flags, exSearchFlags,
-                               m_pendingSearchResults, m_pendingFoundPaths);
-                if (m_pendingSearchResults.size() - resultSizeBefore > 0)
-                    m_pendingFoundPaths.push_back(std::move(path));
+                m_pendingSearchResults.Append(results[handedOn]);
                 NewData(timeOfLastProgressUpdate, false);
-                if (m_foundsize >= m_maxSearchResults)
-                    break;
+                ++handedOn;
             }
+            else if (m_bStop && submitted == handedOn)
+                break;
         }
     }
+    // The UI thread counts the thread as done once it took the last
+    // results, this must not touch any members after this.
     NewData(timeOfLastProgressUpdate, true);
-
-    InterlockedDecrement(&m_ThreadsRunning);
 }
 
-void CFindReplaceDlg::AcceptData()
+void CFindReplaceDlg::ReplaceThread(
+    const std::wstring& searchpath, const std::string& searchfor, const std::string& replaceWith,
+    int flags, unsigned int exSearchFlags, const std::vector<std::wstring>& filesToFind,
+    const std::vector<std::wstring>& modifiedPaths)
 {
-    std::unique_lock<std::mutex> lk(m_waitingDataMutex);
-    auto                         dataReadyPred = [&]() { return m_dataReady; };
-    m_dataExchangeCondition.wait(lk, dataReadyPred);
-    // Patch up the index so it's makes sense in the list it is
-    // appending into rather than the list it moving from.
-    for (auto& item : m_pendingSearchResults)
-        item.pathIndex += m_foundPaths.size();
-    move_append(m_searchResults, m_pendingSearchResults);
-    // Enable this if something suspect occurs.
-    //for (const auto& item : m_pendingSearchResults)
-    //if (item.pathIndex < 0 || item.pathIndex >= m_foundPaths.size())
-    //APPVERIFY(false);
-    move_append(m_foundPaths, m_pendingFoundPaths);
+    auto timeOfLastProgressUpdate = std::chrono::steady_clock::now();
+    bool searchSubFolders         = (exSearchFlags & SF_SEARCHSUBFOLDERS) != 0;
+
+    m_pendingSearchResults.clear();
+    m_replaceCount        = 0;
+    m_replaceFileCount    = 0;
+    m_replaceSkippedCount = 0;
+    m_replaceFailedPath.clear();
+    m_replaceStopped = false;
+
+    // The files are loaded, replaced in and written to a temporary file next
+    // to them on a pool of worker threads. The originals are only replaced
+    // once all files are done: if writing a file fails or the user stops,
+    // no file is changed at all, and if replacing one of the originals fails,
+    // the ones replaced before it are restored from their backups. Files that
+    // changed since they were read are skipped.
+    CBufferSearch             searcher(searchfor, flags);
+    std::mutex                replacedMutex;
+    std::vector<ReplacedFile> replacedFiles;
+    // the temporary files are written next to the files that are still
+    // enumerated, they must not be replaced in themselves
+    std::set<std::wstring>    tempPaths;
+    std::wstring              failedPath;
+    std::atomic<bool>         failed = false;
+    {
+        CSearchFileFilter   fileFilter(searchpath);
+        auto                threadCount = CIniSettings::Instance().GetInt64(L"searchreplace", L"searchthreads", 0);
+        CWorkStealingPool<> pool(static_cast<size_t>(max(0, threadCount)));
+        CDirFileEnum        enumerator(searchpath);
+        bool                bIsDir = false;
+        std::wstring        path;
+        bool                searchSubFoldersFlag = searchSubFolders;
+        while (searcher.IsValid() && enumerator.NextFile(path, &bIsDir, searchSubFoldersFlag) && !m_bStop && !failed)
+        {
+            if (bIsDir)
+            {
+                searchSubFoldersFlag = (IsExcludedFolder(path) || fileFilter.IsIgnored(path, true)) ? false : searchSubFolders;
+                continue;
+            }
+            searchSubFoldersFlag = searchSubFolders;
+
+            bool match = filesToFind.empty() ? !IsExcludedFile(path) : IsMatchingFile(path, filesToFind);
+            if (!match || fileFilter.IsIgnored(path, false))
+                continue;
+            CTrigramIndex::FileStamp stamp;
+            if (CTrigramIndex::GetFileStamp(path, stamp) && fileFilter.IsTooBig(stamp.size))
+                continue;
+            auto modified = std::find_if(modifiedPaths.begin(), modifiedPaths.end(), [&](const std::wstring& modifiedPath) {
+                return _wcsicmp(modifiedPath.c_str(), path.c_str()) == 0;
+            });
+            if (modified != modifiedPaths.end())
+                continue;
+
+            pool.Submit([&, path](NoWorkerContext&) {
+                // files still queued when the replace is stopped or failed are skipped,
+                // binary files are never touched
+                if (m_bStop || failed || fileFilter.IsBinaryFile(path))
+                    return;
+                {
+                    std::lock_guard<std::mutex> lk(replacedMutex);
+                    if (tempPaths.count(path))
+                        return;
+                }
+                ReplacedFile file;
+                if (!CTrigramIndex::GetFileStamp(path, file.stamp))
+                    return;
+                std::string text;
+                int         encoding = CP_UTF8;
+                bool        hasBOM   = false;
+                // files that can't be loaded, e.g. because they are locked, are skipped
+                if (!CDocumentManager::LoadFileUtf8(path, text, &encoding, &hasBOM, &m_bStop))
+                    return;
+                std::string replaced;
+                int         count = searcher.ReplaceAll(text, replaceWith, replaced);
+                if (count == 0)
+                    return;
+                text.clear();
+                text.shrink_to_fit();
+
+                file.path     = path;
+                file.tempPath = CDocumentManager::CreateTempFileNextTo(path);
+                file.count    = count;
+                if (!file.tempPath.empty())
+                {
+                    std::lock_guard<std::mutex> lk(replacedMutex);
+                    tempPaths.insert(file.tempPath);
+                }
+                DWORD err     = file.tempPath.empty() ? GetLastError() : CDocumentManager::SaveFileUtf8(file.tempPath, replaced, encoding, hasBOM);
+                if (err && !file.tempPath.empty())
+                    DeleteFile(file.tempPath.c_str());
+                std::lock_guard<std::mutex> lk(replacedMutex);
+                if (err)
+                {
+                    if (!failed)
+                        failedPath = path;
+                    failed = true;
+                }
+                else
+                    replacedFiles.push_back(std::move(file));
+            });
+        }
+        // the pool waits for the files in progress when it's destroyed
+    }
+
+    std::sort(replacedFiles.begin(), replacedFiles.end(), [](const ReplacedFile& lhs, const ReplacedFile& rhs) {
+        return _wcsicmp(lhs.path.c_str(), rhs.path.c_str()) < 0;
+    });
+    bool commit = !failed && !m_bStop;
+    if (commit)
+    {
+        size_t replaced = 0;
+        for (; replaced < replacedFiles.size(); ++replaced)
+        {
+            auto& file = replacedFiles[replaced];
+            // a file that was changed after it was read, e.g. by an editor
+            // that saved it, would lose that change
+            CTrigramIndex::FileStamp stamp;
+            if (!CTrigramIndex::GetFileStamp(file.path, stamp) || stamp.size != file.stamp.size || stamp.writeTime != file.stamp.writeTime)
+            {
+                DeleteFile(file.tempPath.c_str());
+                file.tempPath.clear();
+                ++m_replaceSkippedCount;
+                continue;
+            }
+            // ReplaceFile() replaces an existing backup file
+            file.backupPath = CDocumentManager::CreateTempFileNextTo(file.path);
+            if (file.backupPath.empty() ||
+                !ReplaceFile(file.path.c_str(), file.tempPath.c_str(), file.backupPath.c_str(),
+                             REPLACEFILE_IGNORE_MERGE_ERRORS | REPLACEFILE_IGNORE_ACL_ERRORS, nullptr, nullptr))
+            {
+                // for these errors the original was already moved to the backup
+                auto err = GetLastError();
+                if (err == ERROR_UNABLE_TO_MOVE_REPLACEMENT || err == ERROR_UNABLE_TO_MOVE_REPLACEMENT_2)
+                    MoveFileEx(file.backupPath.c_str(), file.path.c_str(), MOVEFILE_REPLACE_EXISTING);
+                else if (!file.backupPath.empty())
+                    DeleteFile(file.backupPath.c_str());
+                file.backupPath.clear();
+                failedPath = file.path;
+                failed     = true;
+                break;
+            }
+        }
+        if (failed)
+        {
+            for (size_t i = 0; i < replaced; ++i)
+            {
+                const auto& file = replacedFiles[i];
+                if (!file.backupPath.empty())
+                    MoveFileEx(file.backupPath.c_str(), file.path.c_str(), MOVEFILE_REPLACE_EXISTING);
+            }
+            m_replaceSkippedCount = 0;
+            commit                = false;
+        }
+    }
+    for (const auto& file : replacedFiles)
+    {
+        if (!commit)
+        {
+            if (!file.tempPath.empty())
+                DeleteFile(file.tempPath.c_str());
+            continue;
+        }
+        // skipped because it changed
+        if (file.backupPath.empty())
+            continue;
+        DeleteFile(file.backupPath.c_str());
+        m_replaceCount += file.count;
+        if (m_pendingSearchResults.size() < m_maxSearchResults)
+        {
+            CSearchResult result;
+            result.pathIndex = m_pendingSearchResults.AddPath(file.path);
+            m_pendingSearchResults.Add(result);
+        }
+    }
+    m_replaceFileCount  = commit ? static_cast<int>(replacedFiles.size()) - m_replaceSkippedCount : 0;
+    m_replaceFailedPath = failedPath;
+    m_replaceStopped    = !failed && !commit;
+    // The UI thread counts the thread as done once it took the last
+    // results, this must not touch any members after this.
+    NewData(timeOfLastProgressUpdate, true);
+}
 
-    m_dataAccepted = true;
-    lk.unlock();
-    m_dataExchangeCondition.notify_one();
+bool CFindReplaceDlg::AcceptData(bool finished)
+{
+    bool               newData  = false;
+    size_t             firstNew = m_searchResults.size();
+    CSearchResultStore batch;
+    // Appending patches up the path indexes so they make sense in the
+    // list they're appended to rather than the batch they're moved from.
+    while (m_resultBatches.TryPop(batch))
+    {
+        m_searchResults.Append(batch);
+        newData = true;
+    }
+    // All batches were queued before the search finished, so the last
+    // results are only appended after them.
+    if (finished && !m_lastResultBatch.empty())
+    {
+        m_searchResults.Append(m_lastResultBatch);
+        newData = true;
+    }
+    // the results of documents closed while they were searched are fixed
+    // up like NotifyOnDocumentClose() fixes up the ones already listed
+    for (const auto& [docID, path] : m_closedWhileSearching)
+    {
+        auto first = m_searchResults.begin() + firstNew;
+        if (path.empty())
+        {
+            auto newEnd = std::remove_if(first, m_searchResults.end(), [&](const CSearchResult& item) {
+                return item.docID == docID;
+            });
+            m_searchResults.erase(newEnd, m_searchResults.end());
+            continue;
+        }
+        int pathIndex = -1;
+        for (auto it = first; it != m_searchResults.end(); ++it)
+        {
+            if (it->docID != docID)
+                continue;
+            if (pathIndex == -1)
+                pathIndex = m_searchResults.AddPath(path);
+            it->docID     = DocID();
+            it->pathIndex = pathIndex;
+        }
+    }
+    return newData;
 }
 
 void CFindReplaceDlg::SearchDocument(
     CScintillaWnd& searchWnd, DocID docID, const CDocument& doc,
     const std::string& searchfor, int searchflags, unsigned int exSearchFlags,
-    SearchResults& searchResults, SearchPaths& foundPaths)
+    CSearchResultStore& searchResults)
 {
     bool searchForFunctions = (exSearchFlags & SF_SEARCHFORFUNCTIONS) != 0;
 
@@ -2078,7 +2780,11 @@ void CFindReplaceDlg::SearchDocument(
     std::string funcregex;
     if (searchForFunctions)
     {
-        auto lang = doc.GetLanguage();
+        // the search workers run this concurrently, but CLexStyles
+        // updates its path list on lookups
+        static std::mutex           lexStylesMutex;
+        std::lock_guard<std::mutex> lk(lexStylesMutex);
+        auto                        lang = doc.GetLanguage();
         if (lang.empty())
             lang = CLexStyles::Instance().GetLanguageForDocument(doc, searchWnd);
         if (lang.empty())
@@ -2090,13 +2796,30 @@ void CFindReplaceDlg::SearchDocument(
     }
     else
         ttf.lpstrText = searchfor.c_str();
+    // the functions of the open documents are already known, only the
+    // edited parts have to be searched again
+    const std::vector<CFunctionIndex::Function>* functions     = nullptr;
+    size_t                                       functionIndex = 0;
+    if (searchForFunctions && docID.IsValid() && !doc.GetLanguage().empty())
+        functions = CFunctionIndex::Instance().GetFunctions(docID, doc);
 
     std::wstring funcName;
     sptr_t       findRet = -1;
-    std::string  line; // Reduce memory reallocations by keeping this out of the loop.
     do
     {
-        findRet = searchWnd.Call(SCI_FINDTEXT, searchflags, (sptr_t)&ttf);
+        if (functions)
+        {
+            findRet = -1;
+            if (functionIndex < functions->size())
+            {
+                const auto& function = (*functions)[functionIndex++];
+                ttf.chrgText.cpMin   = (Sci_PositionCR)function.start;
+                ttf.chrgText.cpMax   = (Sci_PositionCR)function.end;
+                findRet              = function.start;
+            }
+        }
+        else
+            findRet = searchWnd.Call(SCI_FINDTEXT, searchflags, (sptr_t)&ttf);
         if (findRet >= 0)
         {
             CSearchResult result;
@@ -2114,56 +2837,22 @@ void CFindReplaceDlg::SearchDocument(
                 ++result.posBegin;
                 c = (char)searchWnd.Call(SCI_GETCHARAT, result.posBegin);
             }
-            result.line  = searchWnd.Call(SCI_LINEFROMPOSITION, result.posBegin);
-            auto linepos = searchWnd.Call(SCI_POSITIONFROMLINE, result.line);
-            if (searchForFunctions)
+            result.line = searchWnd.Call(SCI_LINEFROMPOSITION, result.posBegin);
+            if (!searchForFunctions)
             {
-                result.lineText = CUnicodeUtils::StdGetUnicode(searchWnd.GetTextRange(ttf.chrgText.cpMin, ttf.chrgText.cpMax));
-                size_t linesize = result.lineText.length();
-                while (linesize > 0 && (result.lineText[linesize - 1] == L'\n' || result.lineText[linesize - 1] == L'\r'))
-                    --linesize;
-                result.lineText.resize(linesize);
-                result.posInLineStart = 0;
-                result.posInLineEnd   = 0;
+                searchResults.Add(result);
+                if (++m_foundsize >= m_maxSearchResults)
+                    break;
             }
             else
             {
-                result.posInLineStart = linepos >= 0 ? result.posBegin - linepos : 0;
-                result.posInLineEnd   = linepos >= 0 ? ttf.chrgText.cpMax - linepos : 0;
-                auto matchLen         = result.posInLineEnd - result.posInLineStart;
-                auto linesize         = searchWnd.Call(SCI_LINELENGTH, result.line);
-                line.resize(linesize);
-                searchWnd.Call(SCI_GETLINE, result.line, reinterpret_cast<sptr_t>(line.data()));
-                // remove EOLs
-                while (linesize > 0 && (line[linesize - 1] == '\n' || line[linesize - 1] == '\r'))
+                // When searching for functions, we have to narrow the match down by name ourself.
+                std::wstring lineText = CUnicodeUtils::StdGetUnicode(searchWnd.GetTextRange(ttf.chrgText.cpMin, ttf.chrgText.cpMax));
+                size_t       linesize = lineText.length();
+                while (linesize > 0 && (lineText[linesize - 1] == L'\n' || lineText[linesize - 1] == L'\r'))
                     --linesize;
-                line.resize(linesize);
-                result.lineText = CUnicodeUtils::StdGetUnicode(line, false);
-                // adjust the line positions: Scintilla uses utf8, but utf8 converted to
-                // utf16 can have different char sizes so the positions won't match anymore
-                result.posInLineStart          = UTF8Helper::UTF16PosFromUTF8Pos(line.c_str(), result.posInLineStart);
-                result.posInLineEnd            = UTF8Helper::UTF16PosFromUTF8Pos(line.c_str(), result.posInLineEnd);
-                linesize                       = result.posInLineEnd - result.posInLineStart;
-                constexpr int maxResultLineLen = 255;
-                if ((sptr_t)result.lineText.size() > max(linesize + 40, maxResultLineLen))
-                {
-                    auto index      = max(0, (int)result.posInLineStart - (maxResultLineLen - matchLen - 40));
-                    result.lineText = (index ? L"... " : L"") + result.lineText.substr(index, maxResultLineLen);
-                    result.lineText.shrink_to_fit();
-                    if (index)
-                        index -= 4; // adjust for the "... " we inserted at the beginning
-                    result.posInLineStart -= index;
-                    result.posInLineEnd -= index;
-                }
-            }
-
-            // When searching for functions, we have to narrow the match down by name ourself.
-            bool matched = false;
-            if (!searchForFunctions)
-                matched = true;
-            else
-            {
-                Normalize(result);
+                lineText.resize(linesize);
+                Normalize(lineText);
                 // The set of regexp expressions we use to find functions
                 // don't allow us to identify a specifically named function.
                 // They just find any function definitions.
@@ -2174,23 +2863,23 @@ void CFindReplaceDlg::SearchDocument(
                 // by default without requiring the "use regexp" checkbox to be checked
                 // because a function name can't include * or ? so the meaning
                 // of those two characters is never ambiguous.
+                bool matched = false;
                 if (searchfor.empty())
                     matched = true;
                 else
                 {
-                    if (ParseSignature(funcName, result.lineText))
+                    if (ParseSignature(funcName, lineText))
                     {
                         matched = wcswildicmp(wsearchfor.c_str(), funcName.c_str()) != 0;
                     }
                 }
-            }
-            if (matched)
-            {
-                if (!docID.IsValid())
-                    result.pathIndex = foundPaths.size();
-                searchResults.push_back(std::move(result));
-                if (++m_foundsize >= m_maxSearchResults)
-                    break;
+                if (matched)
+                {
+                    result.function = true;
+                    searchResults.Add(result);
+                    if (++m_foundsize >= m_maxSearchResults)
+                        break;
+                }
             }
 
             if (ttf.chrg.cpMin >= ttf.chrgText.cpMax)
@@ -2200,44 +2889,199 @@ void CFindReplaceDlg::SearchDocument(
     } while (findRet >= 0 && !m_bStop);
 }
 
+void CFindReplaceDlg::SearchBuffer(std::string_view text, const CBufferSearch& searcher,
+                                   CSearchResultStore& searchResults)
+{
+    CTextLines lines(text);
+    sptr_t     minPos = 0;
+    sptr_t     maxPos = lines.GetLength();
+    while (!m_bStop)
+    {
+        sptr_t matchEnd = 0;
+        sptr_t findRet  = searcher.FindText(text, minPos, maxPos, matchEnd);
+        if (findRet < 0)
+            break;
+        if (!AddBufferResult(lines, findRet, matchEnd, -1, searchResults))
+            break;
+
+        if (minPos >= matchEnd)
+            break;
+        minPos = matchEnd + 1;
+    }
+}
+
+void CFindReplaceDlg::SearchBuffer(std::string_view text, const CMultiTermSearch& searcher,
+                                   CSearchResultStore& searchResults)
+{
+    CTextLines lines(text);
+    for (const auto& match : searcher.FindAll(text, &m_bStop))
+    {
+        if (m_bStop || !AddBufferResult(lines, match.start, match.end, match.term, searchResults))
+            break;
+    }
+}
+
+void CFindReplaceDlg::SearchDocument(CScintillaWnd& searchWnd, DocID docID, const CDocument& doc,
+                                     const CMultiTermSearch& searcher, CSearchResultStore& searchResults)
+{
+    searchWnd.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+    OnOutOfScope(searchWnd.Call(SCI_SETDOCPOINTER, 0, 0););
+    // the document text is searched in place
+    auto   pText       = reinterpret_cast<const char*>(searchWnd.Call(SCI_GETCHARACTERPOINTER));
+    auto   length      = searchWnd.Call(SCI_GETLENGTH);
+    size_t firstResult = searchResults.size();
+    SearchBuffer(std::string_view(pText, length), searcher, searchResults);
+    for (size_t i = firstResult; i < searchResults.size(); ++i)
+        searchResults[i].docID = docID;
+}
+
+bool CFindReplaceDlg::AddBufferResult(CTextLines& lines, sptr_t start, sptr_t end, int term,
+                                      CSearchResultStore& searchResults)
+{
+    CSearchResult result;
+    result.posBegin = start;
+    result.posEnd   = end;
+    result.term     = term;
+    char c          = lines.CharAt(result.posBegin);
+    while (c == '\n' || c == '\r')
+    {
+        ++result.posBegin;
+        c = lines.CharAt(result.posBegin);
+    }
+    result.line = lines.LineFromPosition(result.posBegin);
+    searchResults.Add(result);
+    return ++m_foundsize < m_maxSearchResults;
+}
+
+std::wstring CFindReplaceDlg::GetResultLineText(const CSearchResult& result, int& matchStart, int& matchEnd)
+{
+    matchStart = 0;
+    matchEnd   = 0;
+    // the line, or the signature of a function
+    std::string text;
+    sptr_t      lineStart = 0;
+    if (result.docID.IsValid())
+    {
+        if (!HasDocumentID(result.docID))
+            return {};
+        const auto& doc = GetDocumentFromID(result.docID);
+        m_searchWnd.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+        OnOutOfScope(m_searchWnd.Call(SCI_SETDOCPOINTER, 0, 0););
+        if (result.function)
+            text = m_searchWnd.GetTextRange(result.posBegin, result.posEnd);
+        else
+        {
+            lineStart = m_searchWnd.Call(SCI_POSITIONFROMLINE, result.line);
+            if (lineStart < 0)
+                return {};
+            text = m_searchWnd.GetTextRange(lineStart, m_searchWnd.Call(SCI_GETLINEENDPOSITION, result.line));
+        }
+    }
+    else if (result.hasPath())
+    {
+        auto& file = GetResultFileText(m_searchResults.GetPath(result.pathIndex));
+        if (result.function)
+        {
+            auto begin = std::min<sptr_t>(result.posBegin, file.text.size());
+            text.assign(file.text, begin, std::max<sptr_t>(0, result.posEnd - begin));
+        }
+        else
+        {
+            lineStart = file.lines.PositionFromLine(result.line);
+            text      = file.lines.GetLine(result.line);
+        }
+    }
+    if (result.function)
+    {
+        auto   lineText = CUnicodeUtils::StdGetUnicode(text);
+        size_t linesize = lineText.length();
+        while (linesize > 0 && (lineText[linesize - 1] == L'\n' || lineText[linesize - 1] == L'\r'))
+            --linesize;
+        lineText.resize(linesize);
+        Normalize(lineText);
+        return lineText;
+    }
+    matchStart = static_cast<int>(result.posBegin - lineStart);
+    matchEnd   = static_cast<int>(result.posEnd - lineStart);
+    return CSearchResultStore::MakeLineText(text, matchStart, matchEnd);
+}
+
+ResultFileText& CFindReplaceDlg::GetResultFileText(const std::wstring& path)
+{
+    // the results of a file are next to each other, so only the files of
+    // the results shown at the same time are kept
+    constexpr size_t maxFiles = 8;
+    auto             found    = std::find_if(m_resultFileTexts.begin(), m_resultFileTexts.end(), [&](const auto& file) {
+        return file->path == path;
+    });
+    if (found != m_resultFileTexts.end())
+    {
+        auto file = *found;
+        m_resultFileTexts.erase(found);
+        m_resultFileTexts.push_front(file);
+        return *file;
+    }
+    auto file  = std::make_shared<ResultFileText>();
+    file->path = path;
+    // a file that can't be loaded anymore just has no text
+    if (!CDocumentManager::LoadFileUtf8(path, file->text))
+        file->text.clear();
+    file->lines = CTextLines(file->text);
+    m_resultFileTexts.push_front(file);
+    if (m_resultFileTexts.size() > maxFiles)
+        m_resultFileTexts.pop_back();
+    return *file;
+}
+
+void CFindReplaceDlg::MarkSearchTerms()
+{
+    size_t lengthDoc = ScintillaCall(SCI_GETLENGTH);
+    for (int i = INDIC_REGEXCAPTURE; i < INDIC_REGEXCAPTURE_END; ++i)
+    {
+        ScintillaCall(SCI_SETINDICATORCURRENT, i);
+        ScintillaCall(SCI_INDICATORCLEARRANGE, 0, lengthDoc);
+    }
+    if (CIniSettings::Instance().GetInt64(L"searchreplace", L"multitermmarks", 1) == 0)
+        return;
+    // every term gets the color of one of the regex capture indicators
+    for (const auto& result : m_searchResults)
+    {
+        ScintillaCall(SCI_SETINDICATORCURRENT, INDIC_REGEXCAPTURE + result.term % (INDIC_REGEXCAPTURE_END - INDIC_REGEXCAPTURE));
+        ScintillaCall(SCI_INDICATORFILLRANGE, result.posBegin, result.posEnd - result.posBegin);
+    }
+}
+
 void CFindReplaceDlg::NewData(
     std::chrono::steady_clock::time_point& timeOfLastProgressUpdate,
     bool                                   finished)
 {
     // Only async functions that should be doing this.
-    assert(m_searchType == IDC_FINDALLINDIR || m_searchType == IDC_FINDFILES);
+    assert(m_searchType == IDC_FINDALLINDIR || m_searchType == IDC_FINDFILES || m_searchType == IDC_FINDALLINTABS || m_searchType == IDC_REPLACEALLINDIRBTN);
+    if (finished)
+    {
+        // The queue might be full, the last results are handed on
+        // separately so the search never waits for the UI thread.
+        m_lastResultBatch = std::move(m_pendingSearchResults);
+        m_pendingSearchResults.clear();
+        m_searchFinished = true;
+        return;
+    }
     std::chrono::steady_clock::time_point timeNow                     = std::chrono::steady_clock::now();
     std::chrono::steady_clock::duration   durationSinceLastDataUpdate = timeNow - timeOfLastProgressUpdate;
-    // Exchange data if we are finished or we have batched enough data
-    // or it has been a while since we reported any data and we have some to report.
-    if (finished ||
-        m_pendingSearchResults.size() >= MAX_DATA_BATCH_SIZE ||
-        (durationSinceLastDataUpdate >= PROGRESS_UPDATE_INTERVAL && (m_pendingFoundPaths.size() > 0 || m_pendingSearchResults.size() > 0)))
-    {
-        // Hopefully safe to touch the size field.
-        if (m_searchResults.size() >= m_maxSearchResults)
-            finished = true;
-        // NOTE!! It's essential that data isn't sent to the client until
-        // it's a full contained unit, i.e. search results must be complete
-        // for a given file. Otherwise the file indexes won't match/fixup properly
-        // when they are moved from the pending results to the real results.
-        timeOfLastProgressUpdate = timeNow;
-        {
-            std::lock_guard<std::mutex> lk(m_waitingDataMutex);
-            m_dataReady = true;
-        }
-        m_dataExchangeCondition.notify_one();
-        SendMessage(*this, WM_THREADRESULTREADY, finished ? WPARAM(1) : WPARAM(0), LPARAM(0));
-
+    // Hand on the data if we have batched enough data or it has been a
+    // while since we handed on any data and we have some.
+    if (m_pendingSearchResults.size() >= MAX_DATA_BATCH_SIZE ||
+        (durationSinceLastDataUpdate >= PROGRESS_UPDATE_INTERVAL && m_pendingSearchResults.size() > 0))
+    {
+        // NOTE!! The results of a file are only added to the pending results
+        // once they're complete, so a batch never has only part of them.
+        // If the UI thread is behind and the queue is full, the results are
+        // just batched up until there's room again.
+        if (m_resultBatches.TryPush(std::move(m_pendingSearchResults)))
         {
-            std::unique_lock<std::mutex> lk(m_waitingDataMutex);
-            auto                         dataAcceptedPred = [&]() { return this->m_dataAccepted; };
-            m_dataExchangeCondition.wait(lk, dataAcceptedPred);
-            m_dataAccepted = false;
-            m_dataReady    = false;
+            m_pendingSearchResults.clear();
+            timeOfLastProgressUpdate = timeNow;
         }
-        assert(m_pendingSearchResults.empty());
-        assert(m_pendingFoundPaths.empty());
     }
 }
 
@@ -2353,6 +3197,7 @@ void CFindReplaceDlg::EnableControls(bool bEnable)
     DialogEnableWindow(IDC_MATCHREGEX, bEnable);
     DialogEnableWindow(IDC_MATCHCASE, bEnable);
     DialogEnableWindow(IDC_FUNCTIONS, bEnable);
+    DialogEnableWindow(IDC_MULTITERMS, bEnable);
     DialogEnableWindow(IDC_SETSEARCHFOLDER, bEnable);
     DialogEnableWindow(IDC_SETSEARCHFOLDERCURRENT, bEnable);
     DialogEnableWindow(IDC_SEARCHFOLDERFOLLOWTAB, bEnable);
@@ -2361,6 +3206,8 @@ void CFindReplaceDlg::EnableControls(bool bEnable)
     DialogEnableWindow(IDC_FINDFILES, bEnable);
     DialogEnableWindow(IDC_SEARCHFOLDER, bEnable);
     DialogEnableWindow(IDC_SEARCHFILES, bEnable);
+    if (bEnable)
+        CheckSearchOptions();
 }
 
 void CFindReplaceDlg::DoClose()
@@ -2379,21 +3226,9 @@ void CFindReplaceDlg::DoClose()
     // so ensure the results are discarded when the dialog is closed.
     // Modeless dialogs are hidden and not destroyed on close so we don't want results
     // still taking up memory.
-    // Note: at this time shrink_to_fit doesn't appear to be as effective as swap.
-
-    // Intentional use of scope is to encourage early destruction.
-    {
-        SearchResults esr;
-        std::swap(m_searchResults, esr);
-        SearchPaths esp;
-        std::swap(m_foundPaths, esp);
-    }
-    {
-        SearchResults esr;
-        std::swap(m_pendingSearchResults, esr);
-        SearchPaths esp;
-        std::swap(m_pendingFoundPaths, esp);
-    }
+    m_searchResults.clear();
+    m_pendingSearchResults.clear();
+    m_resultFileTexts.clear();
     // Reset the window to it's starting size.
     // Most users will probably find resetting the size helpful.
     // Resetting the position is more subjective and could be irritating so we don't do that.
@@ -2407,7 +3242,9 @@ void CFindReplaceDlg::OnClose()
 {
     m_bStop    = true;
     auto start = GetTickCount64();
-    while (m_ThreadsRunning && (GetTickCount64() - start < 5000))
+    // the thread is done once it handed on its last results, even if the
+    // UI thread didn't take them yet
+    while (m_ThreadsRunning && !m_searchFinished && (GetTickCount64() - start < 5000))
         Sleep(10);
 }
 
@@ -2417,6 +3254,14 @@ void CFindReplaceDlg::CheckSearchOptions()
     bool haveSearchFolder = GetDlgItemTextLength(IDC_SEARCHFOLDER) > 0 || ComboBox_GetCurSel(hSearchFolder) != CB_ERR;
     // Don't offer to find files or in files if there are no folder and files specified.
     EnableWindow(GetDlgItem(*this, IDC_FINDALLINDIR), haveSearchFolder);
+    // multiple terms are only searched for with find all, never as a regex
+    // or as function names, and can't be replaced
+    bool multiTerms = IsDlgButtonChecked(*this, IDC_MULTITERMS) == BST_CHECKED;
+    DialogEnableWindow(IDC_FINDPREVIOUS, !multiTerms);
+    DialogEnableWindow(IDC_REPLACEBTN, !multiTerms);
+    DialogEnableWindow(IDC_REPLACEALLBTN, !multiTerms);
+    DialogEnableWindow(IDC_MATCHREGEX, !multiTerms);
+    DialogEnableWindow(IDC_FUNCTIONS, !multiTerms);
 }
 
 void CFindReplaceDlg::SetSearchFolder(const std::wstring& folder)
@@ -2590,6 +3435,10 @@ void CFindReplaceDlg::NotifyOnDocumentClose(DocID id)
     // via it's result if it never persisted and is now gone.
 
     const auto& doc = GetDocumentFromID(id);
+    // results of the document that are still on the way are fixed up
+    // once they arrive
+    if (m_ThreadsRunning && m_searchType == IDC_FINDALLINTABS)
+        m_closedWhileSearching.emplace_back(id, doc.m_path);
     if (doc.m_path.empty())
     {
         // This is a "new" document that has never been saved, delete it's results
@@ -2615,10 +3464,10 @@ void CFindReplaceDlg::NotifyOnDocumentClose(DocID id)
         // 4. We know we have found all results relating to the closing document id,
         //    after we've found one and then failed to match another.
         //    All document id's relating to the same document are contiguous.
-        bool   found         = false;
-        int    firstToRedraw = -1;
-        int    redrawCount   = 0;
-        size_t newPathIndex  = (size_t)-1;
+        bool found         = false;
+        int  firstToRedraw = -1;
+        int  redrawCount   = 0;
+        int  newPathIndex  = -1;
         for (int itemIndex = 0; itemIndex < (int)m_searchResults.size(); ++itemIndex)
         {
             auto& item = m_searchResults[itemIndex];
@@ -2628,16 +3477,13 @@ void CFindReplaceDlg::NotifyOnDocumentClose(DocID id)
                 {
                     firstToRedraw = itemIndex;
                     if (item.hasPath())
-                        m_foundPaths[item.pathIndex] = doc.m_path; // Fixes all.
+                        m_searchResults.SetPath(item.pathIndex, doc.m_path); // Fixes all.
                     else
-                    {
-                        m_foundPaths.push_back(doc.m_path);
-                        newPathIndex = m_foundPaths.size() - 1; // Set so we go on to fix all others.
-                    }
+                        newPathIndex = m_searchResults.AddPath(doc.m_path); // Set so we go on to fix all others.
                     found = true;
                 }
                 item.docID = DocID();
-                if (newPathIndex != size_t(-1))
+                if (newPathIndex != -1)
                     item.pathIndex = newPathIndex;
                 ++redrawCount;
             }
@@ -2702,14 +3548,22 @@ void CFindReplaceDlg::OnListItemChanged(LPNMLISTVIEW pListView)
     }
 }
 
-void CFindReplaceDlg::OnSearchResultsReady(bool finished)
+void CFindReplaceDlg::OnSearchResultsReady()
 {
     // If the user was at the end of the list before the items arrived,
     // ensure they remain at the end of the list after the new items have been added.
     HWND hFindResults = GetDlgItem(*this, IDC_FINDRESULTS);
     bool hadSome      = (m_searchResults.size() > 0);
+    bool finished     = m_searchFinished;
 
-    AcceptData();
+    if (!AcceptData(finished) && !finished)
+        return;
+    if (finished)
+    {
+        KillTimer(*this, TIMER_RESULTS);
+        m_searchFinished = false;
+        InterlockedDecrement(&m_ThreadsRunning);
+    }
 
     ListView_SetItemCountEx(hFindResults, m_searchResults.size(), 0);
     if (m_trackingOn)
@@ -2724,6 +3578,46 @@ void CFindReplaceDlg::OnSearchResultsReady(bool finished)
     UpdateMatchCount(finished);
     if (finished)
         EnableControls(true);
+    if (finished && m_searchType == IDC_FINDALLINTABS)
+    {
+        std::wstring sInfo;
+        if (m_searchResults.size() >= m_maxSearchResults)
+        {
+            ResString rInfoMax(g_hRes, IDS_SEARCHING_FILE_MAX);
+            sInfo = CStringUtils::Format(rInfoMax, m_maxSearchResults);
+        }
+        else
+        {
+            ResString rInfo(g_hRes, IDS_FINDRESULT_COUNTALL);
+            sInfo = CStringUtils::Format(rInfo, (int)m_searchResults.size(), m_searchedTabCount);
+        }
+        SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
+    }
+    if (finished && m_searchType == IDC_REPLACEALLINDIRBTN)
+    {
+        if (!m_replaceFailedPath.empty())
+        {
+            ResString rInfo(g_hRes, IDS_REPLACEINFILESFAILED);
+            auto      sInfo = CStringUtils::Format(rInfo, m_replaceFailedPath.c_str());
+            SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
+        }
+        else if (m_replaceStopped)
+            SetInfoText(IDS_REPLACEINFILESSTOPPED, AlertMode::None);
+        else if (m_replaceSkippedCount > 0)
+        {
+            ResString rInfo(g_hRes, IDS_REPLACEDCOUNTINFILESSKIPPED);
+            auto      sInfo = CStringUtils::Format(rInfo, m_replaceCount, m_replaceFileCount, m_replaceSkippedCount);
+            SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
+        }
+        else if (m_replaceCount > 0)
+        {
+            ResString rInfo(g_hRes, IDS_REPLACEDCOUNTINFILES);
+            auto      sInfo = CStringUtils::Format(rInfo, m_replaceCount, m_replaceFileCount);
+            SetDlgItemText(*this, IDC_SEARCHINFO, sInfo.c_str());
+        }
+        else
+            SearchStringNotFound();
+    }
     // The first time data arrives focus on the first item.
     // If no results were found make it easy for the user change the search criteria,
     // but don't drag the focus away though from anywhere important to do so.
@@ -2876,6 +3770,10 @@ bool CCmdFindNext::Execute()
     auto findRet       = ScintillaCall(SCI_FINDTEXT, g_searchFlags, (sptr_t)&ttf);
     if (findRet == -1)
     {
+        // search the rest of a large file before wrapping around in the loaded part
+        bool wrapped = false;
+        if (FindInLargeFile(g_findString, g_searchFlags, wrapped))
+            return true;
         // Retry from the start of the doc.
         ttf.chrg.cpMax = ttf.chrg.cpMin;
         ttf.chrg.cpMin = 0;
@@ -21,32 +21,24 @@
 #include "DlgResizer.h"
 #include "ScintillaWnd.h"
 #include "BPBaseDialog.h"
+#include "SearchResultStore.h"
+#include "SPSCQueue.h"
 
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <utility>
 
-class CSearchResult
-{
-public:
-    DocID        docID;
-    std::wstring lineText;
-    sptr_t       pathIndex      = -1;
-    sptr_t       posBegin       = 0;
-    sptr_t       posEnd         = 0;
-    sptr_t       line           = 0;
-    sptr_t       posInLineStart = 0;
-    sptr_t       posInLineEnd   = 0;
-
-    inline bool hasPath() const
-    {
-        return pathIndex != -1;
-    }
-};
+class CBufferSearch;
+class CMultiTermSearch;
+class CTextLines;
+struct ResultFileText;
 
 enum class ResultsType
 {
@@ -57,6 +49,16 @@ enum class ResultsType
     FirstLines
 };
 
+/// A copy of the text of an open document, so it can be searched on a
+/// worker thread while the document is edited. Documents closed before
+/// they were copied are skipped.
+struct DocumentSnapshot
+{
+    DocID       docID;
+    std::string text;
+    bool        skipped = false;
+};
+
 enum class FindMode
 {
     FindText,
@@ -72,10 +74,8 @@ void FindReplace_FindFunction(void* mainWnd, const std::wstring& functionName);
 class CFindReplaceDlg : public CBPBaseDialog
     , public ICommand
 {
-    // vector or deque should work here. Usage pattern suggests deque
-    // might be better but simple tests didn't reveal much difference.
-    using SearchResults = std::deque<CSearchResult>;
-    using SearchPaths   = std::deque<std::wstring>;
+    // the batches of results the search threads hand on to the UI thread
+    using ResultQueue = CSPSCQueue<CSearchResultStore, 16>;
 
 public:
     CFindReplaceDlg(void* obj);
@@ -108,17 +108,42 @@ protected:
     void    DoFind();
     void    DoFindPrevious();
     void    DoReplace(int id);
+    void    DoReplaceInFiles();
 
     void SearchDocument(CScintillaWnd& searchWnd, DocID docID, const CDocument& doc,
                         const std::string& searchfor, int searchflags, unsigned int exSearchFlags,
-                        SearchResults& searchResults,
-                        SearchPaths&   foundPaths);
+                        CSearchResultStore& searchResults);
+    void SearchBuffer(std::string_view text, const CBufferSearch& searcher,
+                      CSearchResultStore& searchResults);
+    /// searches for all terms at once, tagging every result with its term
+    void SearchBuffer(std::string_view text, const CMultiTermSearch& searcher,
+                      CSearchResultStore& searchResults);
+    void SearchDocument(CScintillaWnd& searchWnd, DocID docID, const CDocument& doc,
+                        const CMultiTermSearch& searcher, CSearchResultStore& searchResults);
+    /// returns false once the maximum number of results is reached
+    bool AddBufferResult(CTextLines& lines, sptr_t start, sptr_t end, int term,
+                         CSearchResultStore& searchResults);
+    /// returns the text shown for a result, made from the document or file
+    /// it was found in, and the position of the match in it
+    std::wstring GetResultLineText(const CSearchResult& result, int& matchStart, int& matchEnd);
+    /// returns the text of a file with results, loaded once for all of them
+    ResultFileText& GetResultFileText(const std::wstring& path);
+    /// marks the results of a multi term search in the active document,
+    /// with a color for every term
+    void MarkSearchTerms();
 
     int ReplaceDocument(CDocument& doc, const std::string& sFindstring,
                         const std::string& sReplaceString, int searchflags);
 
     void SearchThread(int id, const std::wstring& searchpath, const std::string& searchfor,
                       int flags, unsigned int exSearchFlags, const std::vector<std::wstring>& filesToFind);
+    void SearchTabsThread(size_t tabCount, const std::string& searchfor,
+                          int flags, unsigned int exSearchFlags);
+    /// copies the next tabs of a find all in tabs for the search thread
+    void SnapshotTabs();
+    void ReplaceThread(const std::wstring& searchpath, const std::string& searchfor, const std::string& replaceWith,
+                       int flags, unsigned int exSearchFlags, const std::vector<std::wstring>& filesToFind,
+                       const std::vector<std::wstring>& modifiedPaths);
 
     void    SortResults();
     void    CheckRegex();
@@ -166,14 +191,14 @@ protected:
                                      bool                searchSubFolders,
                                      const std::wstring& currentValue) const;
 
-    void AcceptData();
+    bool AcceptData(bool finished);
     void NewData(std::chrono::steady_clock::time_point& timeOfLastDataUpdate, bool finished);
     void UpdateMatchCount(bool finished = true);
     void DoListItemAction(int itemIndex);
     void DoInitDialog(HWND hwndDlg);
     void DoClose();
     void InitSizing();
-    void OnSearchResultsReady(bool finished);
+    void OnSearchResultsReady();
     void FocusOnFirstListItem(bool keepAnyExistingSelection = false);
     int  GetScintillaOptions() const;
     void CheckSearchOptions();
@@ -196,15 +221,17 @@ private:
     CDlgResizer             m_resizer;
     bool                    m_freeresize = false;
     CScintillaWnd           m_searchWnd;
-    SearchResults           m_searchResults;
-    SearchPaths             m_foundPaths;
-    SearchResults           m_pendingSearchResults;
-    SearchPaths             m_pendingFoundPaths;
-    bool                    m_dataAccepted = false;
-    bool                    m_dataReady    = false;
-    std::mutex              m_waitingDataMutex;
-    std::condition_variable m_dataExchangeCondition;
-    volatile bool           m_bStop                  = false;
+    CSearchResultStore      m_searchResults;
+    CSearchResultStore      m_pendingSearchResults;
+    ResultQueue             m_resultBatches;
+    // the last results of a search, only handed on once the search is
+    // finished so the search thread never has to wait for room in the queue
+    CSearchResultStore      m_lastResultBatch;
+    // the files the results that were shown last were found in, the most
+    // recently used first
+    std::deque<std::shared_ptr<ResultFileText>> m_resultFileTexts;
+    std::atomic<bool>       m_searchFinished         = false;
+    std::atomic<bool>       m_bStop                  = false;
     volatile LONG           m_ThreadsRunning         = false;
     int                     m_searchType             = 0;
     ResultsType             m_resultsType            = ResultsType::Unknown;
@@ -218,10 +245,38 @@ private:
     size_t                  m_maxSearchResults       = 10000;
     SIZE                    m_originalSize           = {0};
     bool                    m_open                   = false;
-    volatile size_t         m_foundsize              = 0;
+    std::atomic<size_t>     m_foundsize              = 0;
     int                     m_themeCallbackId        = 0;
     bool                    m_resultsListInitialized = false;
 
+    // the outcome of the last replace in files, set by the replace thread
+    int                     m_replaceCount     = 0;
+    int                     m_replaceFileCount = 0;
+    // files that changed between reading and replacing them
+    int                     m_replaceSkippedCount = 0;
+    std::wstring            m_replaceFailedPath;
+    bool                    m_replaceStopped = false;
+
+    // the terms of the last multi term search, indexed by CSearchResult::term
+    std::vector<std::string> m_searchTerms;
+    // the number of tabs searched by find all in tabs
+    int                      m_searchedTabCount = 0;
+
+    // find all in tabs copies the documents only shortly before they are
+    // searched. The UI thread copies the tabs in m_tabsToSnapshot in order
+    // and queues the copies in m_snapshots, m_snapshotBytes counts the
+    // bytes copied and not yet searched.
+    std::vector<DocID>           m_tabsToSnapshot;
+    size_t                       m_nextSnapshot = 0;
+    std::mutex                   m_snapshotMutex;
+    std::condition_variable      m_snapshotCondition;
+    std::deque<DocumentSnapshot> m_snapshots;
+    size_t                       m_snapshotBytes = 0;
+
+    // the documents closed while the results of a search in tabs were
+    // still on the way, with their paths
+    std::vector<std::pair<DocID, std::wstring>> m_closedWhileSearching;
+
     // Some types usually best avoided while searching.
     // The user can explicitly override these if they want them though.
     // REVIEW: consider making this list configurable?
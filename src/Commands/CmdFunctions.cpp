@@ -22,6 +22,7 @@
 #include "StringUtils.h"
 #include "UnicodeUtils.h"
 #include "LexStyles.h"
+#include "FunctionIndex.h"
 #include "PathUtils.h"
 #include "AppUtils.h"
 #include "OnOutOfScope.h"
@@ -29,55 +30,11 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-#include <regex>
 
 // IMPORTANT: Testing this module can be difficult because debug mode
 // performance can be drastically slower than release builds.
 // Regex in particular can also be slower.
 
-// Turns "Hello/* there */world" into "Helloworld"
-static void StripComments(std::string& f)
-{
-    constexpr char   comment_begin[]   = {"/*"};
-    constexpr char   comment_end[]     = {"*/"};
-    constexpr size_t comment_begin_len = std::size(comment_begin) - 1;
-    constexpr size_t comment_end_len   = std::size(comment_end) - 1;
-    size_t           comment_begin_pos = 0;
-    for (;;)
-    {
-        comment_begin_pos = f.find(comment_begin, comment_begin_pos);
-        if (comment_begin_pos == std::string::npos)
-            break;
-        auto comment_end_pos = f.find(comment_end,
-                                      comment_begin_pos + comment_begin_len);
-        if (comment_end_pos == std::string::npos)
-            break;
-        auto e     = f.erase(f.begin() + comment_begin_pos,
-                         f.begin() + comment_end_pos + comment_end_len);
-        auto trash = std::remove(e, f.end(), '\0');
-        f.erase(trash, f.end());
-    }
-}
-
-static void Normalize(std::string& f)
-{
-    // Remove certain chars and replace adjacent whitespace inside the string.
-    // Remember to patch up the size to reflect what we remove.
-    auto e = std::remove_if(f.begin(), f.end(), [](auto c) {
-        return c == '\r' || c == '{';
-    });
-    f.erase(e, f.end());
-    std::replace_if(
-        f.begin(), f.end(), [](auto c) {
-            return c == '\n' || c == '\t';
-        },
-        ' ');
-    auto new_end = std::unique(f.begin(), f.end(), [](auto lhs, auto rhs) -> bool {
-        return (lhs == ' ' && rhs == ' ');
-    });
-    f.erase(new_end, f.end());
-}
-
 static bool ParseSignature(const std::string& sig, std::string& name, std::string& name_and_args)
 {
     bool parsed = false;
@@ -130,37 +87,6 @@ static inline bool ParseName(const std::string& sig, std::string& name)
     return false;
 }
 
-static bool FindNext(CScintillaWnd& edit, const Sci_TextToFind& ttf,
-                     std::string& foundText, sptr_t* lineNum)
-{
-    if (ttf.chrg.cpMax - ttf.chrg.cpMin <= 0)
-        return false;
-    // In debug mode, regex takes a *long* time.
-    auto findRet = edit.Call(SCI_FINDTEXT, SCFIND_REGEXP | SCFIND_CXX11REGEX, (sptr_t)&ttf);
-    if (findRet < 0)
-        return false;
-    // Skip newlines, whitespaces and possible leftover closing braces from
-    // the start of the matched function text.
-    char c     = (char)edit.Call(SCI_GETCHARAT, ttf.chrgText.cpMin);
-    auto cpmin = ttf.chrgText.cpMin;
-    while ((cpmin < ttf.chrgText.cpMax) &&
-           (c == '\r' || c == '\n' || c == ';' || c == '}' || c == ' ' || c == '\t'))
-    {
-        ++cpmin;
-        c = (char)edit.Call(SCI_GETCHARAT, cpmin);
-    }
-    auto len = ttf.chrgText.cpMax - cpmin;
-    if (len < 0)
-        return false;
-    foundText.resize(len + 1);
-    Sci_TextRange r{cpmin, ttf.chrgText.cpMax, &foundText[0]};
-    edit.Call(SCI_GETTEXTRANGE, 0, (sptr_t)&r);
-    foundText.resize(len);
-
-    *lineNum = (int)edit.Call(SCI_LINEFROMPOSITION, cpmin);
-    return true;
-}
-
 CCmdFunctions::CCmdFunctions(void* obj)
     : ICommand(obj)
     , m_autoscanlimit((size_t)-1)
@@ -178,11 +104,11 @@ CCmdFunctions::CCmdFunctions(void* obj)
 
     m_edit.InitScratch(g_hRes);
 
-    InterlockedExchange(&m_bThreadRunning, FALSE);
-
-    InterlockedExchange(&m_bRunThread, TRUE);
-    m_thread = std::thread(&CCmdFunctions::ThreadFunc, this);
-    m_thread.detach();
+    // once the functions of a document were searched on the worker
+    // thread, the timer picks them up
+    m_onFunctionsFound = [hWnd = GetHwnd(), timerID = m_timerID]() {
+        SetTimer(hWnd, timerID, 0, nullptr);
+    };
 }
 
 HRESULT CCmdFunctions::IUICommandHandlerUpdateProperty(REFPROPERTYKEY key, const PROPVARIANT* ppropvarCurrentValue, PROPVARIANT* ppropvarNewValue)
@@ -321,18 +247,15 @@ void CCmdFunctions::ScintillaNotify(SCNotification* pScn)
         case SCN_MODIFIED:
             if ((pScn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)) != 0)
             {
+                // The function index has to know about every edit, it only
+                // searches the edited parts of the document again.
+                auto docID = GetDocIdOfCurrentTab();
+                CFunctionIndex::Instance().OnModified(docID, pScn->position, pScn->length,
+                                                      (pScn->modificationType & SC_MOD_INSERTTEXT) != 0);
                 // We ignore modifications that occur before the document is dirty
                 // on the assumption that the modifications are just the result of
                 // loading the file initially.
-                //
-                // We could process modifications a bit more optimally i.e.
-                // parse within the change area or something but we risk missing
-                // data by only seeing a narrow part of the whole picture then.
-                // Performance issues don't seem to warrant missing data yet
-                // (at least on my machine) during release mode testing but
-                // it is close to warranting it.
-                auto        docID = GetDocIdOfCurrentTab();
-                const auto& doc   = GetDocumentFromID(docID);
+                const auto& doc = GetDocumentFromID(docID);
                 if (doc.m_bIsDirty)
                 {
                     m_eventData.insert(docID);
@@ -348,78 +271,60 @@ void CCmdFunctions::OnTimer(UINT id)
 {
     if (id == m_timerID)
     {
-        // first go through all events and create a WorkItem
-        // for each of them, and add them to the thread data list
-        // if necessary.
-        // If data is added to the thread data list, wake up the thread.
-        bool bWakeupThread = false;
+        // killed first: the worker thread of the function index sets it
+        // again when it's done with a document
+        KillTimer(GetHwnd(), m_timerID);
+        // add the names of the functions in the documents with events
+        // to the user keywords of their language. The function index
+        // only searches the parts of the documents that were edited
+        // since the last time.
+        std::unordered_set<DocID> searching;
         for (const auto& docid : m_eventData)
         {
             const auto& doc = GetDocumentFromID(docid);
-            m_edit.Call(SCI_SETSTATUS, SC_STATUS_OK);
-            m_edit.Call(SCI_CLEARALL);
-            m_edit.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
-            OnOutOfScope(
-                m_edit.Call(SCI_SETDOCPOINTER, 0, 0););
-
-            WorkItem w;
-            w.m_lang = doc.GetLanguage();
-            w.m_id   = docid;
-            if (!w.m_lang.empty())
+            if (doc.GetLanguage().empty())
+                continue;
+            auto langData = CLexStyles::Instance().GetLanguageData(doc.GetLanguage());
+            if (langData == nullptr || langData->functionregex.empty() || langData->userfunctions <= 0)
+                continue;
+
+            size_t lengthDoc = 0;
             {
-                auto langData = CLexStyles::Instance().GetLanguageData(w.m_lang);
-                if (langData != nullptr)
-                {
-                    if (!langData->functionregex.empty() && langData->userfunctions > 0)
-                    {
-                        w.m_regex      = langData->functionregex;
-                        w.m_trimtokens = langData->functionregextrim;
-
-                        ProfileTimer p(L"getting doc content");
-                        size_t       lengthDoc = m_edit.Call(SCI_GETLENGTH);
-                        if ((lengthDoc <= m_autoscanlimit) || (m_autoscanlimit == (size_t)-1))
-                        {
-                            // get characters directly from Scintilla buffer
-                            char* buf = (char*)m_edit.Call(SCI_GETCHARACTERPOINTER);
-                            w.m_data  = std::string(buf, lengthDoc);
-
-                            std::unique_lock<std::mutex> lock(m_filedatamutex);
-                            // if there's already a work item queued up for this document,
-                            // remove it and add the new one
-                            auto found = std::find_if(m_fileData.begin(), m_fileData.end(), [w](const WorkItem& wi) {
-                                return wi.m_id == w.m_id;
-                            });
-                            if (found != m_fileData.end())
-                                m_fileData.erase(found);
-
-                            m_fileData.push_back(std::move(w));
-                            bWakeupThread = true;
-                        }
-                    }
-                }
+                m_edit.Call(SCI_SETSTATUS, SC_STATUS_OK);
+                m_edit.Call(SCI_CLEARALL);
+                m_edit.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+                OnOutOfScope(
+                    m_edit.Call(SCI_SETDOCPOINTER, 0, 0););
+                lengthDoc = m_edit.Call(SCI_GETLENGTH);
             }
-        }
-        m_eventData.clear();
-        if (bWakeupThread)
-            m_filedatacv.notify_one();
+            if ((lengthDoc > m_autoscanlimit) && (m_autoscanlimit != (size_t)-1))
+                continue;
 
-        // now go through the lang data and see if we have to update those.
-        {
-            std::lock_guard<std::recursive_mutex> lock(m_langdatamutex);
-            for (const auto& data : m_langdata)
+            const auto* functions = CFunctionIndex::Instance().GetFunctions(docid, doc, m_onFunctionsFound);
+            if (functions == nullptr)
             {
-                auto langData = CLexStyles::Instance().GetLanguageData(data.first);
-                if (langData)
-                {
-                    auto size1 = langData->userkeywords.size();
-                    langData->userkeywords.insert(data.second.begin(), data.second.end());
-                    auto size2 = langData->userkeywords.size();
-                    if (size1 != size2)
-                        langData->userkeywordsupdated = true;
-                }
+                if (CFunctionIndex::Instance().IsSearching(docid))
+                    searching.insert(docid);
+                continue;
+            }
+            auto size1 = langData->userkeywords.size();
+            for (const auto& function : *functions)
+            {
+                auto sig = function.signature;
+                for (const auto& token : langData->functionregextrim)
+                    SearchRemoveAll(sig, token);
+                CStringUtils::trim(sig);
+                std::string name;
+                if (ParseName(sig, name))
+                    langData->userkeywords.insert(std::move(name));
             }
-            m_langdata.clear();
+            auto size2 = langData->userkeywords.size();
+            if (size1 != size2)
+                langData->userkeywordsupdated = true;
         }
+        // the documents still searched on the worker thread are done
+        // the next time
+        m_eventData = std::move(searching);
 
         // check if the userkeywords were updated for the active document:
         // if it was, then update the lexer data
@@ -430,7 +335,9 @@ void CCmdFunctions::OnTimer(UINT id)
             if (langData != nullptr && langData->userkeywordsupdated)
                 SetupLexerForLang(activeDoc.GetLanguage());
         }
-        KillTimer(GetHwnd(), m_timerID);
+        // the dropdown might have been shown while the functions of the
+        // active document were still searched
+        InvalidateFunctionsSource();
     }
 }
 
@@ -478,19 +385,7 @@ void CCmdFunctions::OnDocumentClose(DocID id)
         }
     }
     m_eventData.erase(id);
-}
-
-void CCmdFunctions::OnClose()
-{
-    InterlockedExchange(&m_bRunThread, FALSE);
-    {
-        std::unique_lock<std::mutex> lock(m_filedatamutex);
-        m_fileData.push_back(WorkItem());
-        m_filedatacv.notify_one();
-    }
-    int count = 200;
-    while (InterlockedExchange(&m_bThreadRunning, m_bThreadRunning) && --count)
-        Sleep(10);
+    CFunctionIndex::Instance().Remove(id);
 }
 
 void CCmdFunctions::OnDocumentSave(DocID id, bool bSaveAs)
@@ -515,81 +410,24 @@ void CCmdFunctions::SetWorkTimer(int ms) // 0 means as fast as possible, not nev
     SetTimer(GetHwnd(), m_timerID, ms, nullptr);
 }
 
-void CCmdFunctions::ThreadFunc()
-{
-    InterlockedExchange(&m_bThreadRunning, TRUE);
-    do
-    {
-        WorkItem work;
-        {
-            std::unique_lock<std::mutex> lock(m_filedatamutex);
-            m_filedatacv.wait(lock, [&] {
-                return !m_fileData.empty();
-            });
-            if (!m_fileData.empty())
-            {
-                work = std::move(m_fileData.front());
-                m_fileData.pop_front();
-            }
-        }
-        if (!InterlockedExchange(&m_bRunThread, m_bRunThread))
-            break;
-        if (!work.m_regex.empty())
-        {
-            auto sRegex = CUnicodeUtils::StdGetUnicode(work.m_regex);
-            auto sData  = CUnicodeUtils::StdGetUnicode(work.m_data);
-
-            try
-            {
-                std::wregex                       regex(sRegex, std::regex_constants::icase | std::regex_constants::ECMAScript);
-                const std::wsregex_token_iterator End;
-                ProfileTimer                      timer(L"parsing functions");
-                for (std::wsregex_token_iterator match(sData.begin(), sData.end(), regex, 0); match != End; ++match)
-                {
-                    if (!InterlockedExchange(&m_bRunThread, m_bRunThread))
-                        break;
-
-                    auto sig = CUnicodeUtils::StdGetUTF8(match->str());
-
-                    StripComments(sig);
-                    Normalize(sig);
-                    for (const auto& token : work.m_trimtokens)
-                        SearchRemoveAll(sig, token);
-                    CStringUtils::trim(sig);
-                    std::string name;
-                    if (ParseName(sig, name))
-                    {
-                        std::lock_guard<std::recursive_mutex> lock(m_langdatamutex);
-                        m_langdata[work.m_lang].insert(std::move(name));
-                    }
-                }
-            }
-            catch (const std::exception&)
-            {
-            }
-        }
-        SetWorkTimer(0);
-
-    } while (InterlockedExchange(&m_bRunThread, m_bRunThread));
-    InterlockedExchange(&m_bThreadRunning, FALSE);
-}
-
 std::vector<FunctionInfo> CCmdFunctions::FindFunctionsNow() const
 {
     std::vector<FunctionInfo> functions;
     if (!HasActiveDocument())
         return functions;
 
-    std::function<bool(const std::string&, sptr_t)> f = [&functions](const std::string& sig, sptr_t lineNum) -> bool {
+    const auto& doc   = GetActiveDocument();
+    const auto* found = CFunctionIndex::Instance().GetFunctions(GetDocIdOfCurrentTab(), doc, m_onFunctionsFound);
+    if (found == nullptr)
+        return functions;
+    functions.reserve(found->size());
+    for (const auto& function : *found)
+    {
         std::string name;
         std::string nameAndArgs;
-        bool        parsed = ParseSignature(sig, name, nameAndArgs);
-        if (parsed)
-            functions.emplace_back(lineNum, std::move(name), std::move(nameAndArgs));
-        return true;
-    };
-    const auto& doc = GetActiveDocument();
-    FindFunctions(doc, f);
+        if (ParseSignature(function.signature, name, nameAndArgs))
+            functions.emplace_back(function.line, std::move(name), std::move(nameAndArgs));
+    }
     // Sort by name then line number.
     std::sort(functions.begin(), functions.end(),
               [](const FunctionInfo& lhs, const FunctionInfo& rhs) {
@@ -602,53 +440,6 @@ std::vector<FunctionInfo> CCmdFunctions::FindFunctionsNow() const
     return functions;
 }
 
-void CCmdFunctions::FindFunctions(const CDocument& doc, std::function<bool(const std::string&, sptr_t lineNum)>& callback) const
-{
-    const auto& docLang = doc.GetLanguage();
-    if (docLang.empty())
-        return;
-    auto* langData = CLexStyles::Instance().GetLanguageData(docLang);
-    if (!langData)
-        return;
-
-    if (langData->functionregex.empty())
-        return;
-
-    CScintillaWnd edit(g_hRes);
-    edit.InitScratch(g_hRes);
-
-    edit.Call(SCI_SETDOCPOINTER, 0, 0);
-    edit.Call(SCI_SETSTATUS, SC_STATUS_OK);
-    edit.Call(SCI_CLEARALL);
-    edit.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
-    OnOutOfScope(
-        edit.Call(SCI_SETDOCPOINTER, 0, 0););
-
-    sptr_t      lineNum;
-    std::string sig;
-
-    Sci_TextToFind ttf{};
-    Sci_PositionCR length = (Sci_PositionCR)edit.Call(SCI_GETLENGTH);
-    ttf.chrg.cpMax        = length;
-    ttf.lpstrText         = const_cast<char*>(langData->functionregex.c_str());
-
-    for (;;)
-    {
-        if (!FindNext(edit, ttf, sig, &lineNum))
-            break;
-        ttf.chrg.cpMin = ttf.chrgText.cpMax + 1;
-
-        StripComments(sig);
-        Normalize(sig);
-        if (langData->functionregextrim.empty())
-            for (const auto& token : langData->functionregextrim)
-                SearchRemoveAll(sig, token);
-        CStringUtils::trim(sig);
-        if (!callback(sig, lineNum))
-            break;
-    }
-}
-
 void CCmdFunctions::InvalidateFunctionsSource()
 {
     HRESULT hr = InvalidateUICommand(UI_INVALIDATIONS_PROPERTY, &UI_PKEY_ItemsSource);
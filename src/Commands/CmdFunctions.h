@@ -28,9 +28,6 @@
 #include <functional>
 #include <unordered_set>
 #include <unordered_map>
-#include <deque>
-#include <thread>
-#include <mutex>
 
 struct FunctionInfo
 {
@@ -67,15 +64,6 @@ enum class DocEventType
     // the process? If so the function list needs to be rebuilt.
 };
 
-struct WorkItem
-{
-    DocID                    m_id;
-    std::string              m_lang;
-    std::string              m_regex;
-    std::string              m_data;
-    std::vector<std::string> m_trimtokens;
-};
-
 class CCmdFunctions final : public ICommand
 {
 public:
@@ -96,15 +84,12 @@ private:
     void OnDocumentSave(DocID id, bool bSaveAs) override;
     void OnLangChanged() override;
     void OnDocumentClose(DocID id) override;
-    void OnClose() override;
 
     std::vector<FunctionInfo> FindFunctionsNow() const;
     void                      InvalidateFunctionsEnabled();
     void                      InvalidateFunctionsSource();
     HRESULT                   PopulateFunctions(IUICollectionPtr& collection);
-    void                      FindFunctions(const CDocument& doc, std::function<bool(const std::string&, sptr_t lineNum)>& callback) const;
     void                      SetWorkTimer(int ms);
-    void                      ThreadFunc();
 
 private:
     bool                                               m_autoscan;
@@ -113,14 +98,7 @@ private:
     std::vector<sptr_t>                                m_menuData;
     std::chrono::time_point<std::chrono::steady_clock> m_funcProcessingStartTime;
     CScintillaWnd                                      m_edit;
-
-    std::unordered_set<DocID>                                        m_eventData;
-    std::list<WorkItem>                                              m_fileData;
-    std::unordered_map<std::string, std::unordered_set<std::string>> m_langdata;
-    std::thread                                                      m_thread;
-    std::mutex                                                       m_filedatamutex;
-    std::condition_variable                                          m_filedatacv;
-    std::recursive_mutex                                             m_langdatamutex;
-    volatile long                                                    m_bRunThread;
-    volatile long                                                    m_bThreadRunning;
+    std::unordered_set<DocID>                          m_eventData;
+    // called from the worker thread of the function index
+    std::function<void()>                              m_onFunctionsFound;
 };
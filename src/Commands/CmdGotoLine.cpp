@@ -21,6 +21,7 @@
 #include "UnicodeUtils.h"
 #include "StringUtils.h"
 #include "Theme.h"
+#include "LargeFile.h"
 
 CGotoLineDlg::CGotoLineDlg()
     : line(0)
@@ -61,7 +62,7 @@ LRESULT CGotoLineDlg::DoCommand(int id, int /*msg*/)
     case IDOK:
         {
             auto sLine = GetDlgItemText(IDC_LINE);
-            line = _wtol(sLine.get());
+            line = _wtoi64(sLine.get());
             EndDialog(*this, id);
         }
     }
@@ -74,11 +75,23 @@ bool CCmdGotoLine::Execute()
     dlg.line   = GetCurrentLineNumber() + 1;
     auto first = ScintillaCall(SCI_LINEFROMPOSITION, 0)+1;
     auto last  = ScintillaCall(SCI_LINEFROMPOSITION, ScintillaCall(SCI_GETLENGTH))+1;
+    // large files are only loaded partially, use the lines of the whole file
+    std::shared_ptr<CLargeFile> largeFile;
+    if (HasActiveDocument())
+        largeFile = GetActiveDocument().m_largeFile;
+    if (largeFile)
+    {
+        dlg.line += static_cast<sptr_t>(largeFile->GetWindowFirstLine());
+        last = static_cast<sptr_t>(largeFile->GetLineCount());
+    }
     ResString lineformat(g_hRes, IDS_GOTOLINEINFO);
     dlg.lineinfo = CStringUtils::Format(lineformat, first, last);
     if (dlg.DoModal(g_hRes, IDD_GOTOLINE, GetHwnd())==IDOK)
     {
-        GotoLine(dlg.line - 1);
+        if (largeFile)
+            GotoLargeFileLine(dlg.line - 1);
+        else
+            GotoLine(dlg.line - 1);
     }
 
     return true;
@@ -150,6 +150,9 @@ bool CCmdWriteProtect::Execute()
         return false;
 
     auto& doc = GetModActiveDocument();
+    // only a part of large files is loaded, they can't be edited
+    if (doc.m_largeFile)
+        return false;
     doc.m_bIsWriteProtected = !(doc.m_bIsWriteProtected || doc.m_bIsReadonly);
     if (!doc.m_bIsWriteProtected && doc.m_bIsReadonly)
         doc.m_bIsReadonly = false;
@@ -39,6 +39,8 @@ bool CCmdNewCopy::Execute()
         docnew = doc;
         docnew.m_path.clear();
         docnew.m_document = d;
+        // the copy gets its own counts
+        docnew.m_statistics.reset();
         docnew.m_bDoSaveAs = true;
         docnew.m_bIsDirty = true;
         docnew.m_bNeedsSaving = true;
@@ -24,13 +24,20 @@
 #include "OnOutOfScope.h"
 #include "ResString.h"
 #include "Theme.h"
+#include "RegexCache.h"
+#include "RegexEngine.h"
 
 #include <regex>
 #include <algorithm>
 #include <memory>
+#include <thread>
 
 constexpr auto DEFAULT_MAX_SEARCH_STRINGS = 20;
 constexpr auto TIMER_INFOSTRING           = 100;
+// the capture thread hands on its output at most this often, or once it
+// has this much of it
+constexpr auto CAPTURE_BATCH_INTERVAL     = std::chrono::milliseconds(100);
+constexpr auto CAPTURE_BATCH_SIZE         = 4 * 1024 * 1024;
 
 std::unique_ptr<CRegexCaptureDlg> g_pRegexCaptureDlg;
 
@@ -45,6 +52,8 @@ CRegexCaptureDlg::CRegexCaptureDlg(void* obj)
     , m_themeCallbackId(-1)
     , m_maxRegexStrings(DEFAULT_MAX_SEARCH_STRINGS)
     , m_maxCaptureStrings(DEFAULT_MAX_SEARCH_STRINGS)
+    , m_captureFlags(std::regex_constants::match_default)
+    , m_captureCount(0)
 {
 }
 
@@ -98,6 +107,9 @@ LRESULT CRegexCaptureDlg::DlgFunc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM
                 SetDlgItemText(*this, IDC_INFOLABEL, L"");
             }
             break;
+        case WM_REGEXCAPTUREBATCH:
+            OnCaptureBatch();
+            break;
     }
     return FALSE;
 }
@@ -108,6 +120,7 @@ LRESULT CRegexCaptureDlg::DoCommand(int id, int /*msg*/)
     {
         case IDCANCEL:
         {
+            CancelCapture();
             m_captureWnd.Call(SCI_CLEARALL);
             size_t lengthDoc = ScintillaCall(SCI_GETLENGTH);
             for (int i = INDIC_REGEXCAPTURE; i < INDIC_REGEXCAPTURE_END; ++i)
@@ -192,6 +205,8 @@ void CRegexCaptureDlg::SetTheme(bool bDark)
 
 void CRegexCaptureDlg::DoCapture()
 {
+    CancelCapture();
+    KillTimer(*this, TIMER_INFOSTRING);
     SetDlgItemText(*this, IDC_INFOLABEL, L"");
 
     std::wstring sRegexW = GetDlgItemText(IDC_REGEXCOMBO).get();
@@ -203,8 +218,7 @@ void CRegexCaptureDlg::DoCapture()
     auto sCapture = UnEscape(CUnicodeUtils::StdGetUTF8(sCaptureW));
     try
     {
-        auto                  findText = GetDlgItemText(IDC_SEARCHCOMBO);
-        std::regex::flag_type rxFlags  = std::regex_constants::ECMAScript;
+        std::regex::flag_type rxFlags = std::regex_constants::ECMAScript;
         if (IsDlgButtonChecked(*this, IDC_ICASE))
             rxFlags |= std::regex_constants::icase;
         // replace all "\n" chars with "(?:\n|\r\n|\n\r)"
@@ -213,7 +227,16 @@ void CRegexCaptureDlg::DoCapture()
             SearchReplace(sRegex, "\\n", "(!:\\n|\\r\\n|\\n\\r)");
         }
 
-        const std::regex rx(sRegex, rxFlags);
+        // the utf8 regex engine can't get stuck backtracking. std::regex only
+        // runs what the engine can't: back references, and the dot newline
+        // option, which keeps $ from matching at the end of the text
+        auto                                engineResult = CRegexEngine::CompileResult::Unsupported;
+        std::shared_ptr<const CRegexEngine> engine;
+        if (!IsDlgButtonChecked(*this, IDC_DOTNEWLINE))
+            engine = CRegexCache::Instance().GetEngine(sRegex, !IsDlgButtonChecked(*this, IDC_ICASE), engineResult);
+        std::shared_ptr<const std::regex> rx;
+        if (!engine)
+            rx = CRegexCache::Instance().GetRegex(sRegex, rxFlags);
 
         m_captureWnd.Call(SCI_CLEARALL);
 
@@ -224,28 +247,114 @@ void CRegexCaptureDlg::DoCapture()
             ScintillaCall(SCI_INDICATORCLEARRANGE, 0, lengthDoc);
         }
 
-        const char*                                          pText = (const char*)ScintillaCall(SCI_GETCHARACTERPOINTER);
-        std::string_view                                     searchText(pText, lengthDoc);
-        std::match_results<std::string_view::const_iterator> whatc;
-        std::regex_constants::match_flag_type                flags = std::regex_constants::match_flag_type::match_default | std::regex_constants::match_flag_type::match_not_null;
+        std::regex_constants::match_flag_type flags = std::regex_constants::match_flag_type::match_default | std::regex_constants::match_flag_type::match_not_null;
         if (IsDlgButtonChecked(*this, IDC_DOTNEWLINE))
             flags |= std::regex_constants::match_flag_type::match_not_eol;
-        auto                                         start = searchText.cbegin();
-        auto                                         end   = searchText.cend();
-        std::vector<std::tuple<sptr_t, size_t, size_t>> capturePositions;
-        while (std::regex_search(start, end, whatc, rx, flags))
+
+        m_captureDocID  = GetDocIdOfCurrentTab();
+        m_captureEngine = engine;
+        m_captureRegex  = rx;
+        m_captureFlags  = flags;
+        m_matchStarts.clear();
+        m_matchMarked.clear();
+        m_captureCount = 0;
+
+        // the capture runs on a copy of the text, so the document can be
+        // edited meanwhile
+        const char* pText = (const char*)ScintillaCall(SCI_GETCHARACTERPOINTER);
+        m_job             = std::make_shared<CaptureJob>();
+        std::thread(&CRegexCaptureDlg::CaptureThread, static_cast<HWND>(*this), m_job, std::string(pText, lengthDoc), engine, rx, sCapture, flags)
+            .detach();
+
+        std::vector<std::wstring> regexStrings;
+        SaveCombo(IDC_REGEXCOMBO, regexStrings);
+        SaveData(regexStrings, L"regexcapture", L"maxsearch", L"regex%d");
+        std::vector<std::wstring> captureStrings;
+        SaveCombo(IDC_CAPTURECOMBO, captureStrings);
+        SaveData(captureStrings, L"regexcapture", L"maxsearch", L"capture%d");
+    }
+    catch (const std::exception&)
+    {
+        SetInfoText(IDS_REGEX_NOTOK, AlertMode::Flash);
+    }
+}
+
+void CRegexCaptureDlg::CancelCapture()
+{
+    // the thread only sees the cancel flag once the current search
+    // returns, it's not waited for
+    if (m_job)
+        m_job->cancel = true;
+    m_job.reset();
+}
+
+void CRegexCaptureDlg::CaptureThread(HWND hWnd, std::shared_ptr<CaptureJob> job, std::string text, std::shared_ptr<const CRegexEngine> engine,
+                                     std::shared_ptr<const std::regex> rx, std::string capture, std::regex_constants::match_flag_type flags)
+{
+    // the capture expression is parsed only once for all matches
+    CRegexFormat                                         format(capture, engine ? engine->GroupCount() : rx->mark_count() + 1);
+    std::string_view                                     searchText(text);
+    std::match_results<std::string_view::const_iterator> whatc;
+    std::string                                          output;
+    std::vector<sptr_t>                                  matchStarts;
+    auto                                                 lastHandOn = std::chrono::steady_clock::now();
+    auto                                                 handOn     = [&](bool done) {
         {
-            if (whatc[0].matched)
+            std::lock_guard<std::mutex> lk(job->mutex);
+            job->output.append(output);
+            job->matchStarts.insert(job->matchStarts.end(), matchStarts.begin(), matchStarts.end());
+            job->done = done;
+        }
+        output.clear();
+        matchStarts.clear();
+        lastHandOn = std::chrono::steady_clock::now();
+        PostMessage(hWnd, WM_REGEXCAPTUREBATCH, 0, 0);
+    };
+
+    if (engine)
+    {
+        // every search scans the text once at most, so a cancel is seen soon
+        CRegexMatch match;
+        for (size_t pos = 0; !job->cancel && pos <= searchText.size() && engine->Search(searchText, pos, searchText.size(), match);)
+        {
+            if (match.End() > match.Start())
+            {
+                format.Apply(searchText, match, output);
+                matchStarts.push_back(match.Start());
+                pos = match.End();
+            }
+            else
             {
-                auto out = whatc.format(sCapture, flags);
-                m_captureWnd.Call(SCI_APPENDTEXT, out.size(), (sptr_t)out.c_str());
+                // empty matches are skipped like match_not_null does, the
+                // search goes on at the next character
+                pos = match.End() + 1;
+                while (pos < searchText.size() && (searchText[pos] & 0xC0) == 0x80)
+                    ++pos;
+            }
+            if (output.size() >= CAPTURE_BATCH_SIZE || std::chrono::steady_clock::now() - lastHandOn >= CAPTURE_BATCH_INTERVAL)
+                handOn(false);
+        }
+        if (!job->cancel)
+            handOn(true);
+        return;
+    }
 
-                sptr_t captureCount = 0;
-                for (const auto& w : whatc)
-                {
-                    capturePositions.push_back(std::make_tuple(captureCount, w.first - searchText.cbegin(), w.length()));
-                    ++captureCount;
-                }
+    auto start = searchText.cbegin();
+    auto end   = searchText.cend();
+    try
+    {
+        while (!job->cancel && std::regex_search(start, end, whatc, *rx, flags))
+        {
+            if (whatc[0].matched)
+            {
+                format.Apply(output, [&](std::string& out, size_t group) {
+                    const auto& sub = group == CRegexFormat::PrefixGroup   ? whatc.prefix()
+                                      : group == CRegexFormat::SuffixGroup ? whatc.suffix()
+                                                                           : whatc[group];
+                    if (sub.matched)
+                        out.append(sub.first, sub.second);
+                });
+                matchStarts.push_back(whatc[0].first - searchText.cbegin());
             }
             // update search position:
             if (start == whatc[0].second)
@@ -258,25 +367,151 @@ void CRegexCaptureDlg::DoCapture()
                 start = whatc[0].second;
             // update flags for continuation
             flags |= std::regex_constants::match_flag_type::match_prev_avail;
+
+            if (output.size() >= CAPTURE_BATCH_SIZE || std::chrono::steady_clock::now() - lastHandOn >= CAPTURE_BATCH_INTERVAL)
+                handOn(false);
         }
-        m_captureWnd.UpdateLineNumberWidth();
+    }
+    catch (const std::exception&)
+    {
+        // std::regex throws if a regex gets too complex for the text,
+        // what was captured up to there is still shown
+    }
+    if (!job->cancel)
+        handOn(true);
+}
 
-        for (const auto& [num, begin, length] : capturePositions)
+void CRegexCaptureDlg::OnCaptureBatch()
+{
+    if (!m_job)
+        return;
+    std::string         output;
+    std::vector<sptr_t> matchStarts;
+    bool                done = false;
+    {
+        std::lock_guard<std::mutex> lk(m_job->mutex);
+        output.swap(m_job->output);
+        matchStarts.swap(m_job->matchStarts);
+        done = m_job->done;
+    }
+    // a single append per batch, not one per match
+    if (!output.empty())
+        m_captureWnd.Call(SCI_APPENDTEXT, output.size(), (sptr_t)output.c_str());
+    if (m_captureEngine || m_captureRegex)
+    {
+        m_matchStarts.insert(m_matchStarts.end(), matchStarts.begin(), matchStarts.end());
+        m_matchMarked.resize(m_matchStarts.size());
+        FillVisibleIndicators();
+    }
+    m_captureWnd.UpdateLineNumberWidth();
+
+    ResString rInfo(g_hRes, done ? IDS_REGEXCAPTURE_DONE : IDS_REGEXCAPTURE_RUNNING);
+    m_captureCount += matchStarts.size();
+    SetDlgItemText(*this, IDC_INFOLABEL, CStringUtils::Format(rInfo, m_captureCount).c_str());
+    if (done)
+    {
+        m_job.reset();
+        SetTimer(*this, TIMER_INFOSTRING, 5000, nullptr);
+    }
+}
+
+void CRegexCaptureDlg::FillVisibleIndicators()
+{
+    if ((!m_captureEngine && !m_captureRegex) || m_matchStarts.empty() || GetDocIdOfCurrentTab() != m_captureDocID)
+        return;
+    auto firstLine = ScintillaCall(SCI_DOCLINEFROMVISIBLE, ScintillaCall(SCI_GETFIRSTVISIBLELINE));
+    auto lastLine  = ScintillaCall(SCI_DOCLINEFROMVISIBLE, ScintillaCall(SCI_GETFIRSTVISIBLELINE) + ScintillaCall(SCI_LINESONSCREEN));
+    auto startPos  = ScintillaCall(SCI_POSITIONFROMLINE, firstLine);
+    auto endPos    = ScintillaCall(SCI_GETLINEENDPOSITION, lastLine);
+
+    // the match before the visible part may reach into it
+    auto it = std::lower_bound(m_matchStarts.begin(), m_matchStarts.end(), startPos);
+    if (it != m_matchStarts.begin())
+        --it;
+    if (it == m_matchStarts.end() || *it > endPos)
+        return;
+
+    // only the matches themselves are remembered, their groups are found
+    // again by matching the regex right at the start of the match
+    size_t                                               lengthDoc = ScintillaCall(SCI_GETLENGTH);
+    const char*                                          pText     = (const char*)ScintillaCall(SCI_GETCHARACTERPOINTER);
+    std::string_view                                     searchText(pText, lengthDoc);
+    std::match_results<std::string_view::const_iterator> whatc;
+    try
+    {
+        for (; it != m_matchStarts.end() && *it <= endPos; ++it)
         {
-            ScintillaCall(SCI_SETINDICATORCURRENT, INDIC_REGEXCAPTURE + num);
-            ScintillaCall(SCI_INDICATORFILLRANGE, begin, length);
+            auto index = it - m_matchStarts.begin();
+            if (m_matchMarked[index] || *it > static_cast<sptr_t>(lengthDoc))
+                continue;
+            m_matchMarked[index] = true;
+            if (m_captureEngine)
+            {
+                // the match is the first one found from its start
+                CRegexMatch match;
+                if (!m_captureEngine->Search(searchText, *it, lengthDoc, match) || match.Start() != *it)
+                    continue;
+                auto groupCount = std::min<size_t>(match.GroupCount(), INDIC_REGEXCAPTURE_END - INDIC_REGEXCAPTURE);
+                for (size_t group = 0; group < groupCount; ++group)
+                {
+                    if (match.Matched(group))
+                    {
+                        ScintillaCall(SCI_SETINDICATORCURRENT, INDIC_REGEXCAPTURE + group);
+                        ScintillaCall(SCI_INDICATORFILLRANGE, match.Start(group), match.End(group) - match.Start(group));
+                    }
+                }
+                continue;
+            }
+            auto flags = m_captureFlags | std::regex_constants::match_flag_type::match_continuous;
+            if (*it > 0)
+                flags |= std::regex_constants::match_flag_type::match_prev_avail;
+            if (!std::regex_search(searchText.cbegin() + *it, searchText.cend(), whatc, *m_captureRegex, flags))
+                continue;
+            int indicator = INDIC_REGEXCAPTURE;
+            for (const auto& w : whatc)
+            {
+                if (indicator >= INDIC_REGEXCAPTURE_END)
+                    break;
+                if (w.matched)
+                {
+                    ScintillaCall(SCI_SETINDICATORCURRENT, indicator);
+                    ScintillaCall(SCI_INDICATORFILLRANGE, w.first - searchText.cbegin(), w.length());
+                }
+                ++indicator;
+            }
         }
-
-        std::vector<std::wstring> regexStrings;
-        SaveCombo(IDC_REGEXCOMBO, regexStrings);
-        SaveData(regexStrings, L"regexcapture", L"maxsearch", L"regex%d");
-        std::vector<std::wstring> captureStrings;
-        SaveCombo(IDC_CAPTURECOMBO, captureStrings);
-        SaveData(captureStrings, L"regexcapture", L"maxsearch", L"capture%d");
     }
     catch (const std::exception&)
     {
-        SetInfoText(IDS_REGEX_NOTOK, AlertMode::Flash);
+    }
+}
+
+void CRegexCaptureDlg::NotifyOnUpdateUI()
+{
+    FillVisibleIndicators();
+}
+
+void CRegexCaptureDlg::NotifyOnDocumentModified()
+{
+    // the remembered match positions don't fit the text anymore. The
+    // indicators already there are moved by Scintilla, no new ones are added.
+    if ((m_captureEngine || m_captureRegex) && GetDocIdOfCurrentTab() == m_captureDocID)
+    {
+        m_captureEngine.reset();
+        m_captureRegex.reset();
+        m_matchStarts.clear();
+        m_matchMarked.clear();
+    }
+}
+
+void CRegexCaptureDlg::NotifyOnDocumentClose(DocID id)
+{
+    if (id == m_captureDocID)
+    {
+        m_captureEngine.reset();
+        m_captureRegex.reset();
+        m_matchStarts.clear();
+        m_matchMarked.clear();
     }
 }
 
@@ -302,3 +537,19 @@ bool CCmdRegexCapture::Execute()
     g_pRegexCaptureDlg->Show();
     return true;
 }
+
+void CCmdRegexCapture::ScintillaNotify(SCNotification* pScn)
+{
+    if (!g_pRegexCaptureDlg)
+        return;
+    if (pScn->nmhdr.code == SCN_UPDATEUI)
+        g_pRegexCaptureDlg->NotifyOnUpdateUI();
+    else if (pScn->nmhdr.code == SCN_MODIFIED && (pScn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT)))
+        g_pRegexCaptureDlg->NotifyOnDocumentModified();
+}
+
+void CCmdRegexCapture::OnDocumentClose(DocID id)
+{
+    if (g_pRegexCaptureDlg)
+        g_pRegexCaptureDlg->NotifyOnDocumentClose(id);
+}
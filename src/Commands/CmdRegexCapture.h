@@ -20,11 +20,15 @@
 #include "DlgResizer.h"
 #include "ScintillaWnd.h"
 #include "BPBaseDialog.h"
+#include "RegexEngine.h"
 
+#include <atomic>
 #include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <deque>
+#include <memory>
+#include <regex>
 #include <vector>
 #include <string>
 #include <utility>
@@ -39,6 +43,10 @@ public:
 
     void Show();
 
+    void NotifyOnUpdateUI();
+    void NotifyOnDocumentModified();
+    void NotifyOnDocumentClose(DocID id);
+
 protected: // override
     bool Execute() override { return true; }
     UINT GetCmdId() override { return 0; }
@@ -56,14 +64,42 @@ protected:
     void    DoInitDialog(HWND hwndDlg);
     void    SetTheme(bool bDark);
     void    DoCapture();
+    void    CancelCapture();
+    void    OnCaptureBatch();
+    void    FillVisibleIndicators();
     void    SetInfoText(UINT resid, AlertMode alertMode);
 
 private:
-    CDlgResizer   m_resizer;
-    CScintillaWnd m_captureWnd;
-    int           m_themeCallbackId;
-    int           m_maxRegexStrings;
-    int           m_maxCaptureStrings;
+    // the state shared with the capture thread
+    struct CaptureJob
+    {
+        std::atomic<bool>   cancel = false;
+        std::mutex          mutex;
+        // the output and the match positions not yet taken by the UI thread
+        std::string         output;
+        std::vector<sptr_t> matchStarts;
+        bool                done = false;
+    };
+
+    /// captures with \c engine, or with \c rx if the engine can't run the regex
+    static void CaptureThread(HWND hWnd, std::shared_ptr<CaptureJob> job, std::string text, std::shared_ptr<const CRegexEngine> engine,
+                              std::shared_ptr<const std::regex> rx, std::string capture, std::regex_constants::match_flag_type flags);
+
+    CDlgResizer                           m_resizer;
+    CScintillaWnd                         m_captureWnd;
+    int                                   m_themeCallbackId;
+    int                                   m_maxRegexStrings;
+    int                                   m_maxCaptureStrings;
+    std::shared_ptr<CaptureJob>           m_job;
+    // the captures of the document are only marked with indicators once
+    // they are scrolled into view
+    DocID                                 m_captureDocID;
+    std::shared_ptr<const CRegexEngine>   m_captureEngine;
+    std::shared_ptr<const std::regex>     m_captureRegex;
+    std::regex_constants::match_flag_type m_captureFlags;
+    std::vector<sptr_t>                   m_matchStarts;
+    std::vector<bool>                     m_matchMarked;
+    size_t                                m_captureCount;
 };
 
 class CCmdRegexCapture : public ICommand
@@ -86,10 +122,10 @@ public:
         return E_NOTIMPL;
     }
 
-    //void ScintillaNotify(SCNotification* pScn) override;
+    void ScintillaNotify(SCNotification* pScn) override;
 
     //void TabNotify(TBHDR* ptbhdr) override;
 
-    //void OnDocumentClose(DocID id) override;
+    void OnDocumentClose(DocID id) override;
     //void OnDocumentSave(DocID id, bool saveAs) override;
 };
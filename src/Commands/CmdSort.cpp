@@ -22,8 +22,17 @@
 #include "Resource.h"
 #include "BaseDialog.h"
 #include "Theme.h"
+#include "LineSorter.h"
+#include "FileSorter.h"
+#include "UniqueLines.h"
+#include "LargeFile.h"
+#include "PathUtils.h"
+#include "ResString.h"
+#include "FormatMessageWrapper.h"
+#include "ProgressDlg.h"
 
 #include <algorithm>
+#include <thread>
 
 extern HINSTANCE g_hRes;
 
@@ -110,6 +119,20 @@ public:
     bool removeDuplicateLines;
 };
 
+class CRemoveDuplicatesDlg : public CDialog
+{
+public:
+    CRemoveDuplicatesDlg() = default;
+
+protected:
+    LRESULT CALLBACK DlgFunc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM lParam);
+    LRESULT          DoCommand(int id, int msg);
+
+public:
+    bool ignoreCase       = false;
+    bool ignoreWhitespace = false;
+};
+
 }; // anonymous namespace
 
 CSortDlg::CSortDlg()
@@ -167,12 +190,97 @@ LRESULT CSortDlg::DoCommand(int id, int /*msg*/)
     return 1;
 }
 
+LRESULT CRemoveDuplicatesDlg::DlgFunc(HWND hwndDlg, UINT uMsg, WPARAM wParam, LPARAM /*lParam*/)
+{
+    switch (uMsg)
+    {
+        case WM_INITDIALOG:
+            InitDialog(hwndDlg, IDI_BOWPAD);
+            CTheme::Instance().SetThemeForDialog(*this, CTheme::Instance().IsDarkTheme());
+            return TRUE;
+        case WM_COMMAND:
+            return DoCommand(LOWORD(wParam), HIWORD(wParam));
+        default:
+            return FALSE;
+    }
+}
+
+LRESULT CRemoveDuplicatesDlg::DoCommand(int id, int /*msg*/)
+{
+    switch (id)
+    {
+        case IDOK:
+            ignoreCase       = IsDlgButtonChecked(*this, IDC_DEDUPE_CASE_CHECK) != FALSE;
+            ignoreWhitespace = IsDlgButtonChecked(*this, IDC_DEDUPE_WHITESPACE_CHECK) != FALSE;
+            EndDialog(*this, id);
+            break;
+        case IDCANCEL:
+            EndDialog(*this, id);
+            break;
+    }
+    return 1;
+}
+
+static std::string GetEOLString(sptr_t eolMode)
+{
+    switch (eolMode)
+    {
+        case SC_EOL_CRLF:
+            return "\r\n";
+        case SC_EOL_LF:
+            return "\n";
+        case SC_EOL_CR:
+            return "\r";
+        default:
+            APPVERIFY(false); // Shouldn't happen.
+            return "\r\n";
+    }
+}
+
+static SortOptions GetSortOptions(HWND hWnd)
+{
+    CSortDlg sortDlg;
+
+    auto result = sortDlg.DoModal(g_hRes, IDD_SORTDLG, hWnd);
+
+    if (result == IDOK)
+        return SortOptions(SortAction::Sort,
+                           sortDlg.sortDescending ? SortOrder::Descending : SortOrder::Ascending,
+                           sortDlg.sortCaseInsensitive ? SortCase::Insensitive : SortCase::Sensitive,
+                           sortDlg.sortDigitsAsNumbers ? SortDigits::AsNumbers : SortDigits::AsDigits,
+                           sortDlg.removeDuplicateLines);
+
+    return SortOptions(); // Means don't sort.
+}
+
+CCmdSort::CCmdSort(void* obj)
+    : ICommand(obj)
+{
+    m_timerID = GetTimerID();
+}
+
+CCmdSort::~CCmdSort() = default;
+
 bool CCmdSort::Execute()
 {
     // Could provide error messages here but have chosen
     // not to bother.
     if (!HasActiveDocument())
         return false; // Need a document.
+
+    // Determine the line endings used/to use.
+    std::string eol = GetEOLString(ScintillaCall(SCI_GETEOLMODE));
+
+    // Only a window of a large file is in the editor, so the whole
+    // file is sorted into a new one instead of sorting the selection.
+    if (GetActiveDocument().m_largeFile)
+    {
+        // one large file is sorted at a time
+        if (m_fileSort)
+            return false;
+        return SortFile(eol);
+    }
+
     bool bSelEmpty = !!ScintillaCall(SCI_GETSELECTIONEMPTY);
     if (bSelEmpty) // Need a non empty selection.
         return false;
@@ -183,24 +291,6 @@ bool CCmdSort::Execute()
     if (ScintillaCall(SCI_GETSELECTIONS) > 1 && !isRectangular)
         return false;
 
-    // Determine the line endings used/to use.
-    std::wstring eol;
-    switch (ScintillaCall(SCI_GETEOLMODE))
-    {
-        case SC_EOL_CRLF:
-            eol = L"\r\n";
-            break;
-        case SC_EOL_LF:
-            eol = L"\n";
-            break;
-        case SC_EOL_CR:
-            eol = L"\r";
-            break;
-        default:
-            eol = L"\r\n";
-            APPVERIFY(false); // Shouldn't happen.
-    }
-
     auto selStart       = ScintillaCall(SCI_GETSELECTIONSTART);
     auto selEnd         = ScintillaCall(SCI_GETSELECTIONEND);
     auto selEndOriginal = selEnd;
@@ -211,35 +301,48 @@ bool CCmdSort::Execute()
     if (lineCount <= 1)
         return true;
 
+    SortOptions so = GetSortOptions(GetHwnd());
+    if (so.sortAction == SortAction::None)
+        return true;
+
+    DWORD cmpFlags = 0;
+    if (so.sortCase == SortCase::Insensitive)
+        cmpFlags |= LINGUISTIC_IGNORECASE;
+    if (so.sortDigits == SortDigits::AsNumbers)
+        cmpFlags |= SORT_DIGITSASNUMBERS;
+    CLineSorter sorter(cmpFlags);
+    bool        descending = so.sortOrder == SortOrder::Descending;
+
     if (isRectangular) // Find and sort lines in rectangular selections.
     {
-        std::vector<std::wstring> lines;
-        std::vector<sptr_t>       positions;
+        std::vector<std::string>               lineTexts;
+        std::vector<std::pair<sptr_t, sptr_t>> ranges;
         for (sptr_t lineNum = lineStart; lineNum <= lineEnd; ++lineNum)
         {
-            auto         lineSelStart = ScintillaCall(SCI_GETLINESELSTARTPOSITION, lineNum);
-            auto         lineSelEnd   = ScintillaCall(SCI_GETLINESELENDPOSITION, lineNum);
-            std::wstring line         = CUnicodeUtils::StdGetUnicode(GetTextRange(lineSelStart, lineSelEnd));
-            lines.push_back(std::move(line));
-            positions.push_back(lineSelStart);
+            auto lineSelStart = ScintillaCall(SCI_GETLINESELSTARTPOSITION, lineNum);
+            auto lineSelEnd   = ScintillaCall(SCI_GETLINESELENDPOSITION, lineNum);
+            lineTexts.push_back(GetTextRange(lineSelStart, lineSelEnd));
+            ranges.push_back({lineSelStart, lineSelEnd});
         }
 
         // The all important sort bit. Doesn't effect the document yet.
-        if (Sort(lines))
-        {
-            // Use may want to undo this so make it possible
-            // We're changing the document from here on in.
+        std::vector<std::string_view> lines(lineTexts.begin(), lineTexts.end());
+        auto                          order = sorter.Sort(lines, descending, so.removeDuplicateLines);
 
-            ScintillaCall(SCI_BEGINUNDOACTION);
-            size_t ln = 0;
-            for (sptr_t line = lineStart; line <= lineEnd; ++line, ++ln)
-            {
-                const auto& lineText = CUnicodeUtils::StdGetUTF8(lines[ln]);
-                ScintillaCall(SCI_DELETERANGE, positions[ln], lineText.length());
-                ScintillaCall(SCI_INSERTTEXT, positions[ln], sptr_t(lineText.c_str()));
-            }
-            ScintillaCall(SCI_ENDUNDOACTION);
+        // Use may want to undo this so make it possible
+        // We're changing the document from here on in.
+
+        ScintillaCall(SCI_BEGINUNDOACTION);
+        // Going from the last line up keeps the positions of the lines
+        // not replaced yet valid.
+        for (size_t ln = lines.size(); ln-- > 0;)
+        {
+            // The lines left over after removing duplicates are emptied.
+            std::string_view lineText = ln < order.size() ? lines[order[ln]] : std::string_view();
+            ScintillaCall(SCI_SETTARGETRANGE, ranges[ln].first, ranges[ln].second);
+            ScintillaCall(SCI_REPLACETARGET, lineText.size(), sptr_t(lineText.data()));
         }
+        ScintillaCall(SCI_ENDUNDOACTION);
     }
     else // Find an sort lines for regular (non rectangular selections).
     {
@@ -249,41 +352,136 @@ bool CCmdSort::Execute()
             --lineEnd;
             selEnd = ScintillaCall(SCI_GETLINEENDPOSITION, lineEnd);
         }
-        std::wstring selText = CUnicodeUtils::StdGetUnicode(GetSelectedText());
-        // Whatever the line breaks type is current, standardize on "\n".
-        // When re-inserting the lines later we'll use whatever line
-        // break type is appropriate for the document.
-        SearchReplace(selText, L"\r\n", L"\n");
-        SearchReplace(selText, L"\r", L"\n");
-        std::vector<std::wstring> lines;
-        stringtok(lines, selText, false, L"\n");
+        // Whatever the line breaks type is current, the lines are split
+        // at all of them. When re-inserting the lines we'll use whatever
+        // line break type is appropriate for the document.
+        std::string selText = GetSelectedText();
+        auto        lines   = CLineSorter::SplitLines(selText);
 
         // The all important sort bit. Doesn't effect the document yet.
-        if (Sort(lines))
-        {
-            selText.clear();
-            for (size_t lineNum = 0; lineNum < lines.size(); ++lineNum)
+        auto        order       = sorter.Sort(lines, descending, so.removeDuplicateLines);
+        std::string sSortedText = CLineSorter::JoinLines(lines, order, eol);
+
+        // Use may want to undo this so make it possible
+        // We're changing the document from here on in.
+
+        ScintillaCall(SCI_BEGINUNDOACTION);
+        ScintillaCall(SCI_SETSEL, selStart, selEnd);
+        ScintillaCall(SCI_REPLACESEL, 0, sptr_t(sSortedText.c_str()));
+        // Put the selection back where it was so the user
+        // can see still see what they sorted and possibly do more with it.
+        ScintillaCall(SCI_SETSEL, selStart, selEndOriginal);
+        ScintillaCall(SCI_ENDUNDOACTION);
+    }
+
+    return true;
+}
+
+bool CCmdSort::SortFile(const std::string& eol)
+{
+    // The file may be closed while the options dialog is shown.
+    auto contentStart = GetActiveDocument().m_largeFile->GetContentStart();
+    auto path         = GetActiveDocument().m_path;
+
+    SortOptions so = GetSortOptions(GetHwnd());
+    if (so.sortAction == SortAction::None)
+        return true;
+
+    DWORD cmpFlags = 0;
+    if (so.sortCase == SortCase::Insensitive)
+        cmpFlags |= LINGUISTIC_IGNORECASE;
+    if (so.sortDigits == SortDigits::AsNumbers)
+        cmpFlags |= SORT_DIGITSASNUMBERS;
+    bool descending       = so.sortOrder == SortOrder::Descending;
+    bool removeDuplicates = so.removeDuplicateLines;
+
+    // The sorted lines go into a new file next to the original one,
+    // "name.sorted.ext" or "name.sorted2.ext" and so on if that exists.
+    auto ext    = CPathUtils::GetFileExtension(path);
+    auto stem   = CPathUtils::GetParentDirectory(path) + L"\\" + CPathUtils::GetFileNameWithoutExtension(path) + L".sorted";
+    auto target = stem + (ext.empty() ? L"" : L"." + ext);
+    for (int i = 2; PathFileExists(target.c_str()); ++i)
+        target = stem + std::to_wstring(i) + (ext.empty() ? L"" : L"." + ext);
+
+    // Sorting a big file takes a while. It runs on a worker thread, so the
+    // editor stays usable, and the progress dialog has a button to cancel it.
+    ResString rTitle(g_hRes, IDS_APP_TITLE);
+    ResString rSorting(g_hRes, IDS_SORTINGFILE);
+    m_progressDlg = std::make_unique<CProgressDlg>();
+    m_progressDlg->SetTitle((LPCWSTR)rTitle);
+    m_progressDlg->SetLine(1, CStringUtils::Format(rSorting, CPathUtils::GetFileName(path).c_str()).c_str());
+    m_progressDlg->SetTime();
+    m_progressDlg->ShowModeless(GetHwnd());
+    // the cancel button is checked even while the thread reports nothing
+    SetTimer(GetHwnd(), m_timerID, 200, nullptr);
+
+    m_fileSort         = std::make_shared<FileSort>();
+    m_fileSort->target = target;
+    std::thread([hWnd = GetHwnd(), fileSort = m_fileSort, path, contentStart, eol, cmpFlags, descending, removeDuplicates]() {
+        CFileSorter sorter(cmpFlags, descending, removeDuplicates);
+        // a message for every per mille is plenty
+        unsigned __int64 lastPerMille = 0;
+        auto             progress     = [&](unsigned __int64 pos, unsigned __int64 end) {
+            fileSort->pos = pos;
+            fileSort->end = end;
+            auto perMille = pos * 1000 / std::max<unsigned __int64>(end, 1);
+            if (perMille != lastPerMille)
             {
-                selText += lines[lineNum];
-                if (lineNum < lines.size() - 1) // No new line on the last line.
-                    selText += eol;
+                lastPerMille = perMille;
+                PostMessage(hWnd, WM_SORTFILEPROGRESS, 0, 0);
             }
+        };
+        fileSort->err  = sorter.Sort(path, contentStart, fileSort->target, eol, progress, &fileSort->cancel);
+        fileSort->done = true;
+        PostMessage(hWnd, WM_SORTFILEPROGRESS, 0, 0);
+    }).detach();
+    return true;
+}
 
-            // Use may want to undo this so make it possible
-            // We're changing the document from here on in.
-
-            ScintillaCall(SCI_BEGINUNDOACTION);
-            ScintillaCall(SCI_SETSEL, selStart, selEnd);
-            std::string sSortedText = CUnicodeUtils::StdGetUTF8(selText);
-            ScintillaCall(SCI_REPLACESEL, 0, sptr_t(sSortedText.c_str()));
-            // Put the selection back where it was so the user
-            // can see still see what they sorted and possibly do more with it.
-            ScintillaCall(SCI_SETSEL, selStart, selEndOriginal);
-            ScintillaCall(SCI_ENDUNDOACTION);
-        }
+void CCmdSort::OnSortFileProgress()
+{
+    if (!m_fileSort)
+        return;
+    if (m_progressDlg->HasUserCancelled())
+        m_fileSort->cancel = true;
+    if (!m_fileSort->done)
+    {
+        m_progressDlg->SetProgress64(m_fileSort->pos, m_fileSort->end);
+        return;
     }
 
-    return true;
+    KillTimer(GetHwnd(), m_timerID);
+    m_progressDlg->Stop();
+    m_progressDlg.reset();
+    auto fileSort = std::move(m_fileSort);
+    if (fileSort->err == ERROR_CANCELLED)
+        return;
+    if (fileSort->err)
+    {
+        ResString             rTitle(g_hRes, IDS_APP_TITLE);
+        ResString             rSaveErr(g_hRes, IDS_FAILEDTOSAVEFILE);
+        CFormatMessageWrapper errMsg(fileSort->err);
+        MessageBox(GetHwnd(), CStringUtils::Format(rSaveErr, fileSort->target.c_str(), (LPCWSTR)errMsg).c_str(), (LPCWSTR)rTitle, MB_ICONERROR);
+        return;
+    }
+    OpenFile(fileSort->target.c_str(), OpenFlags::AddToMRU);
+}
+
+void CCmdSort::OnTimer(UINT id)
+{
+    if (id == m_timerID)
+        OnSortFileProgress();
+}
+
+void CCmdSort::OnClose()
+{
+    // the sort deletes its unfinished file once it sees the cancel
+    if (!m_fileSort)
+        return;
+    m_fileSort->cancel = true;
+    auto start         = GetTickCount64();
+    while (!m_fileSort->done && (GetTickCount64() - start < 5000))
+        Sleep(10);
 }
 
 void CCmdSort::ScintillaNotify(SCNotification* pScn)
@@ -300,48 +498,56 @@ HRESULT CCmdSort::IUICommandHandlerUpdateProperty(REFPROPERTYKEY key, const PROP
     // Enabled if there's something to go back to.
     if (UI_PKEY_Enabled == key)
     {
-        return UIInitPropertyFromBoolean(UI_PKEY_Enabled, (ScintillaCall(SCI_GETSELECTIONEMPTY) == 0), ppropvarNewValue);
+        // A large file is always sorted as a whole.
+        bool largeFile = HasActiveDocument() && GetActiveDocument().m_largeFile;
+        return UIInitPropertyFromBoolean(UI_PKEY_Enabled, largeFile || (ScintillaCall(SCI_GETSELECTIONEMPTY) == 0), ppropvarNewValue);
     }
     return E_NOTIMPL;
 }
 
-static SortOptions GetSortOptions(HWND hWnd)
-{
-    CSortDlg sortDlg;
-
-    auto result = sortDlg.DoModal(g_hRes, IDD_SORTDLG, hWnd);
-
-    if (result == IDOK)
-        return SortOptions(SortAction::Sort,
-                           sortDlg.sortDescending ? SortOrder::Descending : SortOrder::Ascending,
-                           sortDlg.sortCaseInsensitive ? SortCase::Insensitive : SortCase::Sensitive,
-                           sortDlg.sortDigitsAsNumbers ? SortDigits::AsNumbers : SortDigits::AsDigits,
-                           sortDlg.removeDuplicateLines);
-
-    return SortOptions(); // Means don't sort.
-}
-
-bool CCmdSort::Sort(std::vector<std::wstring>& lines) const
+bool CCmdRemoveDuplicates::Execute()
 {
-    SortOptions so = GetSortOptions(GetHwnd());
-    if (so.sortAction == SortAction::None)
+    if (!HasActiveDocument())
+        return false;
+    // Only a window of a large file is in the editor, and it's read only.
+    if (GetActiveDocument().m_largeFile)
+        return false;
+    // Don't handle multiple selections.
+    if (ScintillaCall(SCI_GETSELECTIONS) > 1)
         return false;
 
-    DWORD cmpFlags = 0;
-    if (so.sortCase == SortCase::Insensitive)
-        cmpFlags |= LINGUISTIC_IGNORECASE;
-    if (so.sortDigits == SortDigits::AsNumbers)
-        cmpFlags |= SORT_DIGITSASNUMBERS;
+    CRemoveDuplicatesDlg dlg;
+    if (dlg.DoModal(g_hRes, IDD_REMOVEDUPLICATESDLG, GetHwnd()) != IDOK)
+        return true;
+
+    // Without a selection, the whole document is handled.
+    bool   hasSelection = ScintillaCall(SCI_GETSELECTIONEMPTY) == 0;
+    sptr_t lineStart    = 0;
+    sptr_t lineEnd      = ScintillaCall(SCI_GETLINECOUNT) - 1;
+    if (hasSelection)
+    {
+        auto selEnd = ScintillaCall(SCI_GETSELECTIONEND);
+        lineStart   = ScintillaCall(SCI_LINEFROMPOSITION, ScintillaCall(SCI_GETSELECTIONSTART));
+        lineEnd     = ScintillaCall(SCI_LINEFROMPOSITION, selEnd);
+        // Avoid any trailing blank line in the users selection.
+        if (lineEnd > lineStart && ScintillaCall(SCI_POSITIONFROMLINE, lineEnd) == selEnd)
+            --lineEnd;
+    }
+    auto start = ScintillaCall(SCI_POSITIONFROMLINE, lineStart);
+    auto end   = ScintillaCall(SCI_GETLINEENDPOSITION, lineEnd);
 
-    std::sort(std::begin(lines), std::end(lines),
-              [&](const std::wstring& lhs, const std::wstring& rhs) -> bool {
-                  auto res = CompareStringEx(nullptr, cmpFlags,
-                                             lhs.data(), (int)lhs.length(),
-                                             rhs.data(), (int)rhs.length(),
-                                             nullptr, nullptr, 0);
-                  return so.sortOrder == SortOrder::Ascending ? res == CSTR_LESS_THAN : res == CSTR_GREATER_THAN;
-              });
-    if (so.removeDuplicateLines)
-        lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    std::string text   = GetTextRange(start, end);
+    auto        lines  = CLineSorter::SplitLines(text);
+    auto        unique = CUniqueLines(dlg.ignoreCase, dlg.ignoreWhitespace).Find(lines);
+    if (unique.size() == lines.size())
+        return true;
+    std::string result = CLineSorter::JoinLines(lines, unique, GetEOLString(ScintillaCall(SCI_GETEOLMODE)));
+
+    ScintillaCall(SCI_BEGINUNDOACTION);
+    ScintillaCall(SCI_SETTARGETRANGE, start, end);
+    ScintillaCall(SCI_REPLACETARGET, result.size(), sptr_t(result.data()));
+    if (hasSelection)
+        ScintillaCall(SCI_SETSEL, start, start + sptr_t(result.size()));
+    ScintillaCall(SCI_ENDUNDOACTION);
     return true;
 }
@@ -19,24 +19,61 @@
 #include "ICommand.h"
 #include "BowPadUI.h"
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
+class CProgressDlg;
+
 class CCmdSort : public ICommand
 {
 public:
-    CCmdSort(void* obj)
-        : ICommand(obj)
-    {
-    }
-    ~CCmdSort() = default;
+    CCmdSort(void* obj);
+    ~CCmdSort();
 
     UINT GetCmdId() override { return cmdSort; }
     bool Execute() override;
 
     void    ScintillaNotify(SCNotification* pScn) override;
     HRESULT IUICommandHandlerUpdateProperty(REFPROPERTYKEY key, const PROPVARIANT* ppropvarCurrentValue, PROPVARIANT* ppropvarNewValue) override;
+    void    OnTimer(UINT id) override;
+    void    OnClose() override;
+
+    /// called with WM_SORTFILEPROGRESS, which the thread sorting a large
+    /// file posts when its progress changes and when it's done
+    void OnSortFileProgress();
 
 private:
-    bool Sort(std::vector<std::wstring>& lines) const;
+    // the state shared with the thread sorting a large file
+    struct FileSort
+    {
+        std::wstring                  target;
+        std::atomic<unsigned __int64> pos    = 0;
+        std::atomic<unsigned __int64> end    = 0;
+        std::atomic<bool>             cancel = false;
+        std::atomic<bool>             done   = false;
+        // set before done
+        DWORD                         err    = 0;
+    };
+
+    // sorts the whole large file of the active document into a new file
+    bool SortFile(const std::string& eol);
+
+    std::shared_ptr<FileSort>     m_fileSort;
+    std::unique_ptr<CProgressDlg> m_progressDlg;
+    UINT                          m_timerID;
+};
+
+class CCmdRemoveDuplicates : public ICommand
+{
+public:
+    CCmdRemoveDuplicates(void* obj)
+        : ICommand(obj)
+    {
+    }
+    ~CCmdRemoveDuplicates() = default;
+
+    UINT GetCmdId() override { return cmdRemoveDuplicates; }
+    bool Execute() override;
 };
@@ -103,95 +103,17 @@ bool CCmdSummary::Execute()
     if (!HasActiveDocument())
         return false;
 
-    auto   len           = ScintillaCall(SCI_GETLENGTH);
-    char*  str           = (char*)ScintillaCall(SCI_GETCHARACTERPOINTER);
-    bool   inSpaces      = true;
-    bool   inLine        = false;
-    bool   inParagraph   = true;
-    sptr_t numWords      = 0;
-    sptr_t numParagraphs = 0;
-    sptr_t numEmptyLines = 0;
-
-    while (len)
-    {
-        --len;
-        switch (*str)
-        {
-            case '\r':
-                if (*(str + 1) == '\n')
-                    ++str;
-                [[fallthrough]];
-            case '\n':
-                inSpaces = true;
-                if (!inLine)
-                {
-                    ++numEmptyLines;
-                    if (inParagraph)
-                        ++numParagraphs;
-                    inParagraph = false;
-                }
-                inLine = false;
-                break;
-            case ' ':
-            case '\t':
-                inSpaces = true;
-                break;
-            // non-word chars - anything that can split up text into words (tokens)
-            case ';':
-            case '.':
-            case ':':
-            case ',':
-            case '?':
-            case '!':
-            case '^':
-            case '(':
-            case ')':
-            case '"':
-            case '\'':
-            case '{':
-            case '}':
-            case '[':
-            case ']':
-            case '&':
-            case '%':
-            case '$':
-            case '/':
-            case '*':
-            case '-':
-            case '+':
-            case '=':
-            case '|':
-            case '\\':
-                inSpaces    = true;
-                inLine      = true;
-                inParagraph = true;
-                break;
-            default:
-                if (inSpaces)
-                    ++numWords;
-                inSpaces    = false;
-                inLine      = true;
-                inParagraph = true;
-                break;
-        }
-        ++str;
-    }
-    if (!inLine)
-    {
-        ++numEmptyLines;
-        if (inParagraph)
-            ++numParagraphs;
-    }
-
-    const auto& doc = GetActiveDocument();
+    const auto& doc    = GetActiveDocument();
+    auto        counts = GetDocumentStatistics();
 
     ResString    rSummary(g_hRes, IDS_SUMMARY);
     std::wstring sSummary = CStringUtils::Format(rSummary,
                                                  doc.m_path.c_str(),
-                                                 numWords,
-                                                 (long)ScintillaCall(SCI_GETLINECOUNT),
-                                                 numEmptyLines,
-                                                 numParagraphs);
+                                                 counts.characters,
+                                                 counts.words,
+                                                 counts.lines,
+                                                 counts.emptyLines,
+                                                 counts.paragraphs);
 
     CSummaryDlg dlg;
     dlg.m_sSummary = sSummary;
@@ -190,6 +190,7 @@ void CCommandHandler::Init(void* obj)
     Add<CCmdLineUp>(obj);
     Add<CCmdLineDown>(obj);
     Add<CCmdSort>(obj);
+    Add<CCmdRemoveDuplicates>(obj);
     Add<CCmdEditSelection>(obj);
     Add<CCmdInitFoldingMargin>(obj);
     Add<CCmdFoldingOn>(obj);
@@ -334,6 +334,16 @@ void ICommand::Center(sptr_t startPos, sptr_t endPos )
     m_pMainWindow->m_editor.Center(startPos, endPos);
 }
 
+void ICommand::GotoLargeFileLine(unsigned __int64 line)
+{
+    m_pMainWindow->GotoLargeFileLine(line);
+}
+
+bool ICommand::FindInLargeFile(const std::string& searchFor, int searchFlags, bool& wrapped)
+{
+    return m_pMainWindow->FindInLargeFile(searchFor, searchFlags, wrapped);
+}
+
 void ICommand::GotoBrace()
 {
     m_pMainWindow->m_editor.GotoBrace();
@@ -399,6 +409,11 @@ std::string ICommand::GetWordChars() const
     return m_pMainWindow->m_editor.GetWordChars();
 }
 
+CDocumentStatistics::Counts ICommand::GetDocumentStatistics()
+{
+    return m_pMainWindow->GetDocumentStatistics();
+}
+
 void ICommand::MarkSelectedWord(bool clear, bool edit) const
 {
     return m_pMainWindow->m_editor.MarkSelectedWord(clear, edit);
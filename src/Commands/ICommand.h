@@ -18,6 +18,7 @@
 #include "Scintilla.h"
 #include "TabBar.h"
 #include "Document.h"
+#include "DocumentStatistics.h"
 
 #include <vector>
 #include <string>
@@ -109,6 +110,8 @@ protected:
     void                UpdateLineNumberWidth();
     void                GotoLine(sptr_t line);
     void                Center(sptr_t startPos, sptr_t endPos);
+    void                GotoLargeFileLine(unsigned __int64 line);
+    bool                FindInLargeFile(const std::string& searchFor, int searchFlags, bool& wrapped);
     void                GotoBrace();
     std::string         GetLine(sptr_t line) const;
     std::string         GetTextRange(sptr_t startpos, sptr_t endpos) const;
@@ -117,6 +120,7 @@ protected:
     std::string         GetCurrentWord() const;
     std::string         GetCurrentLine() const;
     std::string         GetWordChars() const;
+    CDocumentStatistics::Counts GetDocumentStatistics();
     void                MarkSelectedWord(bool clear, bool edit) const;
     void                ShowFileTree(bool bShow);
     bool                IsFileTreeShown() const;
@@ -17,6 +17,10 @@
 #pragma once
 #include "Scintilla.h"
 #include <functional>
+#include <memory>
+
+class CLargeFile;
+class CDocumentStatistics;
 
 typedef uptr_t Document;
 
@@ -123,6 +127,13 @@ public:
     ReadDirection         m_ReadDir;
     std::function<void()> m_saveCallback;
 
+    /// set for files too big to be loaded as a whole,
+    /// m_document then only contains a part of the file
+    std::shared_ptr<CLargeFile> m_largeFile;
+    /// the counts of the document, kept up to date while it's edited in the
+    /// editor. Created once they're first needed.
+    std::shared_ptr<CDocumentStatistics> m_statistics;
+
 private:
     std::string m_language;
 };
@@ -0,0 +1,290 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2013-2018, 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "DocumentLoader.h"
+#include "MappedFile.h"
+#include "TextEncoding.h"
+#include "ILoader.h"
+
+#include <algorithm>
+#include <memory>
+
+constexpr int ReadBlockSize = 128 * 1024; //128 kB
+// mapped UTF-8 data is passed to Scintilla in slices of this size
+constexpr size_t MappedSliceSize = 16 * 1024 * 1024; // 16 MB
+
+// the line endings are not known before the first one is found
+constexpr int UnknownEOL = -1;
+
+static int SenseEOLFormat(const char* data, DWORD len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (data[i] == '\r')
+        {
+            if (i + 1 < len && data[i + 1] == '\n')
+                return SC_EOL_CRLF;
+            else
+                return SC_EOL_CR;
+        }
+        if (data[i] == '\n')
+            return SC_EOL_LF;
+    }
+    return UnknownEOL;
+}
+
+static void LoadSomeUtf8(ILoader& edit, bool hasBOM, bool bFirst, DWORD& lenFile, char* data, int& eolformat)
+{
+    char* pData = data;
+    // Nothing to convert, just pass it to Scintilla
+    if (bFirst && hasBOM)
+    {
+        pData += 3;
+        lenFile -= 3;
+    }
+    if (eolformat == UnknownEOL)
+        eolformat = SenseEOLFormat(pData, lenFile);
+    edit.AddData(pData, lenFile);
+    if (bFirst && hasBOM)
+        lenFile += 3;
+}
+
+struct MappedUtf8Context
+{
+    ILoader*    edit;
+    const char* data;
+    size_t      len;
+    int*        eolformat;
+    int         status;
+};
+
+static void AddMappedUtf8(void* ctx)
+{
+    auto* c = static_cast<MappedUtf8Context*>(ctx);
+    if (*c->eolformat == UnknownEOL)
+        *c->eolformat = SenseEOLFormat(c->data, static_cast<DWORD>(c->len));
+    c->status = c->edit->AddData(c->data, c->len);
+}
+
+// Passes UTF-8 data directly from the mapped view to Scintilla, without
+// copying it to an intermediate buffer first.
+// Returns a win32 error code, or 0 on success.
+static DWORD LoadMappedUtf8(ILoader& edit, CMappedFile& mappedFile, unsigned __int64 offset, int& eolformat,
+                            const LoadProgressFunc& progress, const std::atomic<bool>* cancel)
+{
+    while (offset < mappedFile.GetSize())
+    {
+        if (progress)
+            progress(offset, mappedFile.GetSize());
+        if (cancel && *cancel)
+            return ERROR_CANCELLED;
+        size_t      len  = MappedSliceSize;
+        const char* data = mappedFile.GetData(offset, len);
+        if (data == nullptr)
+            return GetLastError();
+        MappedUtf8Context ctx = {&edit, data, len, &eolformat, SC_STATUS_OK};
+        if (!GuardedMappedAccess(AddMappedUtf8, &ctx))
+            return ERROR_READ_FAULT;
+        if (ctx.status != SC_STATUS_OK)
+            return ERROR_NOT_ENOUGH_MEMORY;
+        offset += len;
+    }
+    return 0;
+}
+
+static void LoadSomeUtf16(ILoader& edit, bool bigEndian, bool hasBOM, bool bFirst, DWORD lenFile,
+                          int& incompleteMultibyteChar, char* data, char* charbuf, int& eolformat)
+{
+    // a lead surrogate at the end of a full block is converted together
+    // with its trail surrogate at the start of the next block
+    bool  moreData = lenFile == ReadBlockSize;
+    char* pData    = data;
+    if (bFirst && hasBOM)
+    {
+        pData += 2;
+        lenFile -= 2;
+    }
+    size_t used     = 0;
+    size_t charlen  = CTextEncoding::Utf16ToUtf8(pData, lenFile, bigEndian, charbuf, moreData ? &used : nullptr);
+    incompleteMultibyteChar = moreData ? static_cast<int>(lenFile - used) : 0;
+    if (eolformat == UnknownEOL)
+        eolformat = SenseEOLFormat(charbuf, static_cast<DWORD>(charlen));
+    edit.AddData(charbuf, charlen);
+}
+
+static void LoadSomeUtf32(ILoader& edit, bool bigEndian, bool hasBOM, bool bFirst, DWORD lenFile,
+                          char* data, char* charbuf, int& eolformat)
+{
+    char* pData = data;
+    if (bFirst && hasBOM)
+    {
+        pData += 4;
+        lenFile -= 4;
+    }
+    size_t charlen = CTextEncoding::Utf32ToUtf8(pData, lenFile, bigEndian, charbuf);
+    if (eolformat == UnknownEOL)
+        eolformat = SenseEOLFormat(charbuf, static_cast<DWORD>(charlen));
+    edit.AddData(charbuf, charlen);
+}
+
+static void LoadSomeOther(ILoader& edit, int encoding, DWORD lenFile,
+                          int& incompleteMultibyteChar, char* data, char* charbuf, int charbufSize, wchar_t* widebuf, int& eolformat)
+{
+    // For other encodings, ask system if there are any invalid characters; note that it will
+    // not correctly know if the last character is cut when there are invalid characters inside the text
+    int wideLen = MultiByteToWideChar(encoding, (lenFile == -1) ? 0 : MB_ERR_INVALID_CHARS, data, lenFile, nullptr, 0);
+    if (wideLen == 0 && GetLastError() == ERROR_NO_UNICODE_TRANSLATION)
+    {
+        // Test without last byte
+        if (lenFile > 1)
+            wideLen = MultiByteToWideChar(encoding, MB_ERR_INVALID_CHARS, data, lenFile - 1, nullptr, 0);
+        if (wideLen == 0)
+        {
+            // don't have to check that the error is still ERROR_NO_UNICODE_TRANSLATION,
+            // since only the length parameter changed
+
+            // TODO: should warn user about incorrect loading due to invalid characters
+            // We still load the file, but the system will either strip or replace invalid characters
+            // (including the last character, if cut in half)
+            wideLen = MultiByteToWideChar(encoding, 0, data, lenFile, nullptr, 0);
+        }
+        else
+        {
+            // We found a valid text by removing one byte.
+            incompleteMultibyteChar = 1;
+        }
+    }
+    if (wideLen > 0)
+    {
+        MultiByteToWideChar(encoding, 0, data, lenFile - incompleteMultibyteChar, widebuf, wideLen);
+        int charlen = WideCharToMultiByte(CP_UTF8, 0, widebuf, wideLen, charbuf, charbufSize, 0, nullptr);
+        if (eolformat == UnknownEOL)
+            eolformat = SenseEOLFormat(charbuf, charlen);
+        edit.AddData(charbuf, charlen);
+    }
+}
+
+DWORD LoadFromHandle(HANDLE hFile, unsigned __int64 fileSize, unsigned __int64 mappedThreshold, int encoding,
+                     ILoader& edit, LoadedFormat& format,
+                     const LoadProgressFunc& progress, const std::atomic<bool>* cancel)
+{
+    char      data[ReadBlockSize + 8] = {};
+    const int widebufSize             = ReadBlockSize * 2;
+    auto      widebuf                 = std::make_unique<wchar_t[]>(widebufSize);
+    const int charbufSize             = widebufSize * 2;
+    auto      charbuf                 = std::make_unique<char[]>(charbufSize);
+
+    // big files are read from a mapped view: the encoding is detected on the
+    // first block as usual, but UTF-8 data is then handed to Scintilla directly
+    // from the view. Other encodings still need converting block by block, but
+    // at least avoid the ReadFile calls.
+    CMappedFile      mappedFile;
+    unsigned __int64 filePos = 0;
+    if (mappedThreshold > 0 && fileSize >= mappedThreshold)
+        mappedFile.Open(hFile, fileSize);
+    auto readBlock = [&](char* buf, DWORD toRead, DWORD& read) -> bool {
+        if (!mappedFile.IsOpen())
+        {
+            if (!ReadFile(hFile, buf, toRead, &read, nullptr))
+                return false;
+            filePos += read;
+            return true;
+        }
+        read = static_cast<DWORD>(std::min<unsigned __int64>(toRead, fileSize - filePos));
+        if (!mappedFile.Copy(buf, filePos, read))
+            return false;
+        filePos += read;
+        return true;
+    };
+
+    DWORD lenFile                 = 0;
+    int   incompleteMultibyteChar = 0;
+    bool  bFirst                  = true;
+    bool  preferutf8              = CIniSettings::Instance().GetInt64(L"Defaults", L"encodingutf8overansi", 0) != 0;
+    bool  inconclusive            = false;
+    bool  encodingset             = encoding != -1;
+    int   eolMode                 = UnknownEOL;
+    do
+    {
+        if (!bFirst)
+        {
+            if (progress)
+                progress(filePos, fileSize);
+            if (cancel && *cancel)
+                return ERROR_CANCELLED;
+        }
+        if (!readBlock(data + incompleteMultibyteChar, ReadBlockSize - incompleteMultibyteChar, lenFile))
+        {
+            // the view can't be read, e.g. an in-page error: the file
+            // would otherwise be loaded truncated
+            if (mappedFile.IsOpen())
+                return ERROR_READ_FAULT;
+            lenFile = 0;
+        }
+        else
+            lenFile += incompleteMultibyteChar;
+
+        if ((!encodingset) || (inconclusive && encoding == CP_ACP))
+        {
+            encoding = CTextEncoding::DetectCodepage(data, lenFile, format.hasBOM, inconclusive);
+        }
+        encodingset = true;
+
+        format.encoding = encoding;
+
+        switch (encoding)
+        {
+            case -1:
+            case CP_UTF8:
+                LoadSomeUtf8(edit, format.hasBOM, bFirst, lenFile, data, eolMode);
+                break;
+            case 1200: // UTF16_LE
+            case 1201: // UTF16_BE
+                LoadSomeUtf16(edit, encoding == 1201, format.hasBOM, bFirst, lenFile, incompleteMultibyteChar, data, charbuf.get(), eolMode);
+                break;
+            case 12000: // UTF32_LE
+            case 12001: // UTF32_BE
+                LoadSomeUtf32(edit, encoding == 12001, format.hasBOM, bFirst, lenFile, data, charbuf.get(), eolMode);
+                break;
+            default:
+                LoadSomeOther(edit, encoding, lenFile, incompleteMultibyteChar, data, charbuf.get(), charbufSize, widebuf.get(), eolMode);
+                break;
+        }
+
+        if (incompleteMultibyteChar != 0) // copy bytes to next buffer
+            memcpy(data, data + ReadBlockSize - incompleteMultibyteChar, incompleteMultibyteChar);
+
+        bFirst = false;
+
+        if (mappedFile.IsOpen() && lenFile == ReadBlockSize && (encoding == -1 || encoding == CP_UTF8))
+        {
+            // the rest of the file can be passed on without conversion
+            DWORD err = LoadMappedUtf8(edit, mappedFile, filePos, eolMode, progress, cancel);
+            if (err)
+                return err;
+            break;
+        }
+    } while (lenFile == ReadBlockSize);
+
+    if (preferutf8 && inconclusive && format.encoding == CP_ACP)
+        format.encoding = CP_UTF8;
+
+    format.eolMode = eolMode == UnknownEOL ? SC_EOL_CRLF : eolMode;
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "Scintilla.h"
+
+#include <atomic>
+#include <functional>
+
+class ILoader;
+
+/// called while a document is loaded with the number of bytes read so far
+using LoadProgressFunc = std::function<void(unsigned __int64 pos, unsigned __int64 end)>;
+
+/// what loading a file found out about its content
+struct LoadedFormat
+{
+    int  encoding = -1;          ///< the codepage, -1 for UTF-8 without a BOM
+    bool hasBOM   = false;
+    int  eolMode  = SC_EOL_CRLF; ///< SC_EOL_*, CRLF if the file has no line ending
+};
+
+/// Reads the file, detects its encoding and line endings and passes the
+/// content converted to UTF-8 on to the loader. Pass -1 as \c encoding to
+/// detect it. Files of at least \c mappedThreshold bytes are read from a
+/// mapped view, 0 always uses ReadFile().
+/// The progress is reported and \c cancel is checked between blocks.
+/// Returns a win32 error code, ERROR_CANCELLED if cancelled, or 0 on success.
+DWORD LoadFromHandle(HANDLE hFile, unsigned __int64 fileSize, unsigned __int64 mappedThreshold, int encoding,
+                     ILoader& edit, LoadedFormat& format,
+                     const LoadProgressFunc& progress = nullptr, const std::atomic<bool>* cancel = nullptr);
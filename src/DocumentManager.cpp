@@ -25,6 +25,9 @@
 #include "PathUtils.h"
 #include "TempFile.h"
 #include "AppUtils.h"
+#include "TextEncoding.h"
+#include "DocumentWriter.h"
+#include "LargeFile.h"
 #include "ILexer.h"
 #include "ILoader.h"
 
@@ -33,204 +36,20 @@
 #include <Shobjidl.h>
 
 constexpr int ReadBlockSize  = 128 * 1024; //128 kB
-constexpr int WriteBlockSize = 128 * 1024; //128 kB
+// files bigger than this are saved to a temporary file which then replaces the original
+constexpr __int64 ReplaceSaveThreshold = 32 * 1024 * 1024; // 32 MB
+// files bigger than this are only loaded partially, see CLargeFile
+constexpr __int64 LargeFileThreshold = 512 * 1024 * 1024; // 512 MB
+// files bigger than this are loaded through a mapped view instead of ReadFile
+constexpr __int64 MappedLoadThreshold = 32 * 1024 * 1024; // 32 MB
 
 static CDocument g_EmptyDoc;
 
-static wchar_t inline WideCharSwap(wchar_t nValue)
+// files of at least this size are loaded through a mapped view, 0 for never
+static unsigned __int64 GetMappedLoadThreshold()
 {
-    return (((nValue >> 8)) | (nValue << 8));
-}
-
-static UINT64 inline WordSwapBytes(UINT64 nValue)
-{
-    return ((nValue & 0xff00ff00ff00ff) << 8) | ((nValue >> 8) & 0xff00ff00ff00ff); // swap BYTESs in WORDs
-}
-
-static UINT32 inline DwordSwapBytes(UINT32 nValue)
-{
-    UINT32 nRet = (nValue << 16) | (nValue >> 16);                     // swap WORDs
-    nRet        = ((nRet & 0xff00ff) << 8) | ((nRet >> 8) & 0xff00ff); // swap BYTESs in WORDs
-    return nRet;
-}
-
-static UINT64 inline DwordSwapBytes(UINT64 nValue)
-{
-    UINT64 nRet = ((nValue & 0xffff0000ffffL) << 16) | ((nValue >> 16) & 0xffff0000ffffL); // swap WORDs in DWORDs
-    nRet        = ((nRet & 0xff00ff00ff00ff) << 8) | ((nRet >> 8) & 0xff00ff00ff00ff);     // swap BYTESs in WORDs
-    return nRet;
-}
-
-static EOLFormat SenseEOLFormat(const char* data, DWORD len)
-{
-    for (size_t i = 0; i < len; i++)
-    {
-        if (data[i] == '\r')
-        {
-            if (i + 1 < len && data[i + 1] == '\n')
-                return EOLFormat::WIN_FORMAT;
-            else
-                return EOLFormat::MAC_FORMAT;
-        }
-        if (data[i] == '\n')
-            return EOLFormat::UNIX_FORMAT;
-    }
-    return EOLFormat::UNKNOWN_FORMAT;
-}
-
-static void LoadSomeUtf8(ILoader& edit, bool hasBOM, bool bFirst, DWORD& lenFile, char* data, EOLFormat& eolformat)
-{
-    char* pData = data;
-    // Nothing to convert, just pass it to Scintilla
-    if (bFirst && hasBOM)
-    {
-        pData += 3;
-        lenFile -= 3;
-    }
-    if (eolformat == EOLFormat::UNKNOWN_FORMAT)
-        eolformat = SenseEOLFormat(pData, lenFile);
-    edit.AddData(pData, lenFile);
-    if (bFirst && hasBOM)
-        lenFile += 3;
-}
-
-static void LoadSomeUtf16le(ILoader& edit, bool hasBOM, bool bFirst, DWORD& lenFile,
-                            char* data, char* charbuf, int charbufSize, wchar_t* widebuf, EOLFormat& eolformat)
-{
-    char* pData = data;
-    if (bFirst && hasBOM)
-    {
-        pData += 2;
-        lenFile -= 2;
-    }
-    memcpy(widebuf, pData, lenFile);
-    int charlen = WideCharToMultiByte(CP_UTF8, 0, widebuf, lenFile / 2, charbuf, charbufSize, 0, nullptr);
-    if (eolformat == EOLFormat::UNKNOWN_FORMAT)
-        eolformat = SenseEOLFormat(charbuf, charlen);
-    edit.AddData(charbuf, charlen);
-    if (bFirst && hasBOM)
-        lenFile += 2;
-}
-
-static void LoadSomeUtf16be(ILoader& edit, bool hasBOM, bool bFirst, DWORD& lenFile,
-                            char* data, char* charbuf, int charbufSize, wchar_t* widebuf, EOLFormat& eolformat)
-{
-    char* pData = data;
-    if (bFirst && hasBOM)
-    {
-        pData += 2;
-        lenFile -= 2;
-    }
-    memcpy(widebuf, pData, lenFile);
-    // make in place WORD BYTEs swap
-    UINT64* p_qw    = (UINT64*)widebuf;
-    int     nQwords = lenFile / 8;
-    for (int nQword = 0; nQword < nQwords; nQword++)
-        p_qw[nQword] = WordSwapBytes(p_qw[nQword]);
-
-    wchar_t* p_w    = (wchar_t*)p_qw;
-    int      nWords = lenFile / 2;
-    for (int nWord = nQwords * 4; nWord < nWords; nWord++)
-        p_w[nWord] = WideCharSwap(p_w[nWord]);
-
-    int charlen = WideCharToMultiByte(CP_UTF8, 0, widebuf, lenFile / 2, charbuf, charbufSize, 0, nullptr);
-    if (eolformat == EOLFormat::UNKNOWN_FORMAT)
-        eolformat = SenseEOLFormat(charbuf, charlen);
-    edit.AddData(charbuf, charlen);
-    if (bFirst && hasBOM)
-        lenFile += 2;
-}
-
-static void LoadSomeUtf32be(DWORD lenFile, char* data)
-{
-    UINT64* p64     = (UINT64*)data;
-    int     nQwords = lenFile / 8;
-    for (int nQword = 0; nQword < nQwords; nQword++)
-        p64[nQword] = DwordSwapBytes(p64[nQword]);
-
-    UINT32* p32     = (UINT32*)p64;
-    int     nDwords = lenFile / 4;
-    for (int nDword = nQwords * 2; nDword < nDwords; nDword++)
-        p32[nDword] = DwordSwapBytes(p32[nDword]);
-}
-
-static void LoadSomeUtf32le(ILoader& edit, bool hasBOM, bool bFirst, DWORD& lenFile,
-                            char* data, char* charbuf, int charbufSize, wchar_t* widebuf, EOLFormat& eolformat)
-{
-    char* pData = data;
-    if (bFirst && hasBOM)
-    {
-        pData += 4;
-        lenFile -= 4;
-    }
-    // UTF32 have four bytes per char
-    int     nReadChars = lenFile / 4;
-    UINT32* p32        = (UINT32*)pData;
-
-    // fill buffer
-    wchar_t* pOut = (wchar_t*)widebuf;
-    for (int i = 0; i < nReadChars; ++i, ++pOut)
-    {
-        UINT32 zChar = p32[i];
-        if (zChar >= 0x110000)
-        {
-            *pOut = 0xfffd; // ? mark
-        }
-        else if (zChar >= 0x10000)
-        {
-            zChar -= 0x10000;
-            pOut[0] = ((zChar >> 10) & 0x3ff) | 0xd800; // lead surrogate
-            pOut[1] = (zChar & 0x7ff) | 0xdc00;         // trail surrogate
-            pOut++;
-        }
-        else
-        {
-            *pOut = (wchar_t)zChar;
-        }
-    }
-    int charlen = WideCharToMultiByte(CP_UTF8, 0, widebuf, nReadChars, charbuf, charbufSize, 0, nullptr);
-    if (eolformat == EOLFormat::UNKNOWN_FORMAT)
-        eolformat = SenseEOLFormat(charbuf, charlen);
-    edit.AddData(charbuf, charlen);
-    if (bFirst && hasBOM)
-        lenFile += 4;
-}
-
-static void LoadSomeOther(ILoader& edit, int encoding, DWORD lenFile,
-                          int& incompleteMultibyteChar, char* data, char* charbuf, int charbufSize, wchar_t* widebuf, EOLFormat& eolformat)
-{
-    // For other encodings, ask system if there are any invalid characters; note that it will
-    // not correctly know if the last character is cut when there are invalid characters inside the text
-    int wideLen = MultiByteToWideChar(encoding, (lenFile == -1) ? 0 : MB_ERR_INVALID_CHARS, data, lenFile, nullptr, 0);
-    if (wideLen == 0 && GetLastError() == ERROR_NO_UNICODE_TRANSLATION)
-    {
-        // Test without last byte
-        if (lenFile > 1)
-            wideLen = MultiByteToWideChar(encoding, MB_ERR_INVALID_CHARS, data, lenFile - 1, nullptr, 0);
-        if (wideLen == 0)
-        {
-            // don't have to check that the error is still ERROR_NO_UNICODE_TRANSLATION,
-            // since only the length parameter changed
-
-            // TODO: should warn user about incorrect loading due to invalid characters
-            // We still load the file, but the system will either strip or replace invalid characters
-            // (including the last character, if cut in half)
-            wideLen = MultiByteToWideChar(encoding, 0, data, lenFile, nullptr, 0);
-        }
-        else
-        {
-            // We found a valid text by removing one byte.
-            incompleteMultibyteChar = 1;
-        }
-    }
-    if (wideLen > 0)
-    {
-        MultiByteToWideChar(encoding, 0, data, lenFile - incompleteMultibyteChar, widebuf, wideLen);
-        int charlen = WideCharToMultiByte(CP_UTF8, 0, widebuf, wideLen, charbuf, charbufSize, 0, nullptr);
-        if (eolformat == EOLFormat::UNKNOWN_FORMAT)
-            eolformat = SenseEOLFormat(charbuf, charlen);
-        edit.AddData(charbuf, charlen);
-    }
+    auto threshold = CIniSettings::Instance().GetInt64(L"Defaults", L"mappedloadthreshold", MappedLoadThreshold);
+    return threshold > 0 ? static_cast<unsigned __int64>(threshold) : 0;
 }
 
 static bool AskToElevatePrivilege(HWND hWnd, const std::wstring& path, PCWSTR sElevate, PCWSTR sDontElevate)
@@ -391,7 +210,35 @@ void CDocumentManager::AddDocumentAtEnd(const CDocument& doc, DocID id)
     m_documents[id] = doc;
 }
 
-CDocument CDocumentManager::LoadFile(HWND hWnd, const std::wstring& path, int encoding, bool createIfMissing)
+// Collects the loaded data in a string instead of a Scintilla document
+class CStringLoader : public ILoader
+{
+public:
+    CStringLoader(std::string& text)
+        : m_text(text)
+    {
+    }
+    int SCI_METHOD Release() override { return 0; }
+    int SCI_METHOD AddData(const char* data, Sci_Position length) override
+    {
+        try
+        {
+            m_text.append(data, length);
+        }
+        catch (const std::bad_alloc&)
+        {
+            return SC_STATUS_BADALLOC;
+        }
+        return SC_STATUS_OK;
+    }
+    void* SCI_METHOD ConvertToDocument() override { return nullptr; }
+
+private:
+    std::string& m_text;
+};
+
+CDocument CDocumentManager::LoadFile(HWND hWnd, const std::wstring& path, int encoding, bool createIfMissing,
+                                     const LoadProgressFunc& progress, const std::atomic<bool>* cancel)
 {
     CDocument doc;
     doc.m_format = EOLFormat::UNKNOWN_FORMAT;
@@ -462,80 +309,43 @@ CDocument CDocumentManager::LoadFile(HWND hWnd, const std::wstring& path, int en
     m_scratchScintilla.Call(SCI_CLEARALL);
     m_scratchScintilla.Call(SCI_SETCODEPAGE, CP_UTF8);
 
-    ILoader* pdocLoad = reinterpret_cast<ILoader*>(m_scratchScintilla.Call(SCI_CREATELOADER, (int)bufferSizeRequested));
-    if (pdocLoad == nullptr)
+    // files too big to be loaded as a whole are shown in a window,
+    // the rest of the file is only read when needed.
+    // Files Scintilla can't allocate enough memory for are tried that way as well.
+    auto     largeThreshold = CIniSettings::Instance().GetInt64(L"Defaults", L"largefilethreshold", LargeFileThreshold);
+    bool     isLarge        = largeThreshold > 0 && fileSize >= static_cast<unsigned __int64>(largeThreshold) && LoadLargeFile(path, doc, encoding);
+    ILoader* pdocLoad       = nullptr;
+    if (!isLarge)
     {
-        ShowFileLoadError(hWnd, path,
-                          CLanguage::Instance().GetTranslatedString(ResString(g_hRes, IDS_ERR_FILETOOBIG)).c_str());
-        return doc;
-    }
-    auto& edit = *pdocLoad;
-
-    char      data[ReadBlockSize + 8] = {};
-    const int widebufSize             = ReadBlockSize * 2;
-    auto      widebuf                 = std::make_unique<wchar_t[]>(widebufSize);
-    const int charbufSize             = widebufSize * 2;
-    auto      charbuf                 = std::make_unique<char[]>(charbufSize);
-
-    DWORD lenFile                 = 0;
-    int   incompleteMultibyteChar = 0;
-    bool  bFirst                  = true;
-    bool  preferutf8              = CIniSettings::Instance().GetInt64(L"Defaults", L"encodingutf8overansi", 0) != 0;
-    bool  inconclusive            = false;
-    bool  encodingset             = encoding != -1;
-    do
-    {
-        if (!ReadFile(hFile, data + incompleteMultibyteChar, ReadBlockSize - incompleteMultibyteChar, &lenFile, nullptr))
-            lenFile = 0;
-        else
-            lenFile += incompleteMultibyteChar;
-
-        if ((!encodingset) || (inconclusive && encoding == CP_ACP))
+        pdocLoad = reinterpret_cast<ILoader*>(m_scratchScintilla.Call(SCI_CREATELOADER, (int)bufferSizeRequested));
+        if (pdocLoad == nullptr && !LoadLargeFile(path, doc, encoding))
         {
-            encoding = GetCodepageFromBuf(data, lenFile, doc.m_bHasBOM, inconclusive);
+            ShowFileLoadError(hWnd, path,
+                              CLanguage::Instance().GetTranslatedString(ResString(g_hRes, IDS_ERR_FILETOOBIG)).c_str());
+            return doc;
         }
-        encodingset = true;
-
-        doc.m_encoding = encoding;
+    }
 
-        switch (encoding)
+    if (pdocLoad)
+    {
+        LoadedFormat format;
+        DWORD        err = LoadFromHandle(hFile, fileSize, GetMappedLoadThreshold(), encoding, *pdocLoad, format, progress, cancel);
+        if (err)
         {
-            case -1:
-            case CP_UTF8:
-                LoadSomeUtf8(edit, doc.m_bHasBOM, bFirst, lenFile, data, doc.m_format);
-                break;
-            case 1200: // UTF16_LE
-                LoadSomeUtf16le(edit, doc.m_bHasBOM, bFirst, lenFile, data, charbuf.get(), charbufSize, widebuf.get(), doc.m_format);
-                break;
-            case 1201: // UTF16_BE
-                LoadSomeUtf16be(edit, doc.m_bHasBOM, bFirst, lenFile, data, charbuf.get(), charbufSize, widebuf.get(), doc.m_format);
-                break;
-            case 12001:                         // UTF32_BE
-                LoadSomeUtf32be(lenFile, data); // Doesn't load, falls through to load.
-                // intentional fall-through
-                [[fallthrough]];
-            case 12000: // UTF32_LE
-                LoadSomeUtf32le(edit, doc.m_bHasBOM, bFirst, lenFile, data, charbuf.get(), charbufSize, widebuf.get(), doc.m_format);
-                break;
-            default:
-                LoadSomeOther(edit, encoding, lenFile, incompleteMultibyteChar, data, charbuf.get(), charbufSize, widebuf.get(), doc.m_format);
-                break;
+            pdocLoad->Release();
+            if (err == ERROR_CANCELLED)
+                return doc;
+            CFormatMessageWrapper errMsg(err);
+            ShowFileLoadError(hWnd, path, errMsg);
+            return doc;
         }
+        doc.m_encoding = format.encoding;
+        doc.m_bHasBOM  = format.hasBOM;
+        doc.m_format   = ToEOLFormat(format.eolMode);
 
-        if (incompleteMultibyteChar != 0) // copy bytes to next buffer
-            memcpy(data, data + ReadBlockSize - incompleteMultibyteChar, incompleteMultibyteChar);
-
-        bFirst = false;
-    } while (lenFile == ReadBlockSize);
-
-    if (preferutf8 && inconclusive && doc.m_encoding == CP_ACP)
-        doc.m_encoding = CP_UTF8;
-
-    if (doc.m_format == EOLFormat::UNKNOWN_FORMAT)
-        doc.m_format = EOLFormat::WIN_FORMAT;
-
-    sptr_t loadeddoc = (sptr_t)pdocLoad->ConvertToDocument(); // loadeddoc has reference count 1
-    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, loadeddoc); // doc in scratch has reference count 2 (loadeddoc 1, added one)
+        sptr_t loadeddoc = (sptr_t)pdocLoad->ConvertToDocument(); // loadeddoc has reference count 1
+        m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, loadeddoc); // doc in scratch has reference count 2 (loadeddoc 1, added one)
+    }
     m_scratchScintilla.Call(SCI_SETUNDOCOLLECTION, 1);
     m_scratchScintilla.Call(SCI_EMPTYUNDOBUFFER);
     m_scratchScintilla.Call(SCI_SETSAVEPOINT);
@@ -548,258 +358,261 @@ CDocument CDocumentManager::LoadFile(HWND hWnd, const std::wstring& path, int en
     return doc;
 }
 
-static bool SaveAsUtf16(const CDocument& doc, char* buf, size_t lengthDoc, CAutoFile& hFile, std::wstring& err)
+// Replaces the content of the document in the scratch editor with the text
+// of a large file window. The document is read-only otherwise.
+static void SetLargeFileText(CScintillaWnd& scintilla, const std::string& text)
 {
-    const int writeWidebufSize = WriteBlockSize * 2;
-    auto      widebuf          = std::make_unique<wchar_t[]>(writeWidebufSize);
-    err.clear();
-    DWORD bytesWritten = 0;
-
-    auto encoding = doc.m_encoding;
-    auto hasBOM   = doc.m_bHasBOM;
-    if (doc.m_encodingSaving != -1)
-    {
-        encoding = doc.m_encodingSaving;
-        hasBOM   = doc.m_bHasBOMSaving;
-    }
+    scintilla.Call(SCI_SETREADONLY, false);
+    scintilla.Call(SCI_SETUNDOCOLLECTION, 0);
+    scintilla.Call(SCI_CLEARALL);
+    scintilla.Call(SCI_APPENDTEXT, text.size(), (sptr_t)text.data());
+    scintilla.Call(SCI_SETUNDOCOLLECTION, 1);
+    scintilla.Call(SCI_EMPTYUNDOBUFFER);
+    scintilla.Call(SCI_SETSAVEPOINT);
+    scintilla.Call(SCI_SETREADONLY, true);
+}
 
-    if (hasBOM)
+bool CDocumentManager::LoadLargeFile(const std::wstring& path, CDocument& doc, int encoding)
+{
+    // the file content is shown as is, i.e. as UTF-8
+    if (encoding != -1 && encoding != CP_UTF8)
+        return false;
+    auto largeFile = std::make_shared<CLargeFile>();
+    if (largeFile->Open(path))
+        return false;
+    std::string text;
+    if (!largeFile->ReadWindow(0, text))
+        return false;
+    if (largeFile->GetContentStart() == 0)
     {
-        BOOL result;
-        if (encoding == 1200)
-            result = WriteFile(hFile, "\xFF\xFE", 2, &bytesWritten, nullptr);
-        else
-            result = WriteFile(hFile, "\xFE\xFF", 2, &bytesWritten, nullptr);
-        if (!result || bytesWritten != 2)
+        bool hasBOM       = false;
+        bool inconclusive = false;
+        switch (CTextEncoding::DetectCodepage(text.data(), min(text.size(), size_t(ReadBlockSize)), hasBOM, inconclusive))
         {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
+            case 1200:
+            case 1201:
+            case 12000:
+            case 12001:
+                return false;
+            default:
+                break;
         }
     }
-    char* writeBuf = buf;
-    do
-    {
-        int charStart = UTF8Helper::characterStart(writeBuf, (int)min(WriteBlockSize, lengthDoc));
-        int widelen   = MultiByteToWideChar(CP_UTF8, 0, writeBuf, charStart, widebuf.get(), writeWidebufSize);
-        if (encoding == 1201)
-        {
-            UINT64* p_qw    = reinterpret_cast<UINT64*>(widebuf.get());
-            int     nQwords = widelen / 4;
-            for (int nQword = 0; nQword < nQwords; nQword++)
-                p_qw[nQword] = WordSwapBytes(p_qw[nQword]);
-            wchar_t* p_w    = (wchar_t*)p_qw;
-            int      nWords = widelen;
-            for (int nWord = nQwords * 4; nWord < nWords; nWord++)
-                p_w[nWord] = WideCharSwap(p_w[nWord]);
-        }
-        if (!WriteFile(hFile, widebuf.get(), widelen * 2, &bytesWritten, nullptr) || widelen != int(bytesWritten / 2))
-        {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
-        }
-        writeBuf += charStart;
-        lengthDoc -= charStart;
-    } while (lengthDoc > 0);
+
+    doc.m_encoding = CP_UTF8;
+    doc.m_bHasBOM  = largeFile->GetContentStart() != 0;
+    auto lf        = text.find('\n');
+    doc.m_format   = (lf == std::string::npos || (lf > 0 && text[lf - 1] == '\r')) ? EOLFormat::WIN_FORMAT : EOLFormat::UNIX_FORMAT;
+    // editing only a window of the file and saving it would lose the rest of the file
+    doc.m_bIsWriteProtected = true;
+    doc.m_largeFile         = largeFile;
+    SetLargeFileText(m_scratchScintilla, text);
     return true;
 }
 
-static bool SaveAsUtf32(const CDocument& doc, char* buf, size_t lengthDoc, CAutoFile& hFile, std::wstring& err)
+bool CDocumentManager::LoadLargeFileWindow(const CDocument& doc, unsigned __int64 offset)
 {
-    const int writeWidebufSize = WriteBlockSize * 2;
-    auto      writeWidebuf     = std::make_unique<wchar_t[]>(writeWidebufSize);
-    auto      writeWide32buf   = std::make_unique<wchar_t[]>(writeWidebufSize * 2);
-    DWORD     bytesWritten     = 0;
-    BOOL      result;
-
-    auto encoding = doc.m_encoding;
-    auto hasBOM   = doc.m_bHasBOM;
-    if (doc.m_encodingSaving != -1)
+    if (!doc.m_largeFile)
+        return false;
+    auto        oldStart = doc.m_largeFile->GetWindowStart();
+    auto        oldEnd   = doc.m_largeFile->GetWindowEnd();
+    std::string text;
+    if (!doc.m_largeFile->ReadWindow(offset, text))
+        return false;
+    // don't touch the document if the window didn't move
+    if (doc.m_largeFile->GetWindowStart() == oldStart && doc.m_largeFile->GetWindowEnd() == oldEnd)
+        return true;
+    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+    SetLargeFileText(m_scratchScintilla, text);
+    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, 0);
+    return true;
+}
+
+bool CDocumentManager::LoadFileUtf8(const std::wstring& path, std::string& text, int* encoding, bool* hasBOM,
+                                    const std::atomic<bool>* cancel)
+{
+    text.clear();
+    CAutoFile hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!hFile.IsValid())
+        return false;
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(hFile, &fileSize))
+        return false;
+    try
     {
-        encoding = doc.m_encodingSaving;
-        hasBOM   = doc.m_bHasBOMSaving;
+        text.reserve(static_cast<size_t>(fileSize.QuadPart));
     }
-
-    if (encoding == 12000)
-        result = WriteFile(hFile, "\xFF\xFE\0\0", 4, &bytesWritten, nullptr);
-    else
-        result = WriteFile(hFile, "\0\0\xFE\xFF", 4, &bytesWritten, nullptr);
-    if (!result || bytesWritten != 4)
+    catch (const std::bad_alloc&)
     {
-        CFormatMessageWrapper errMsg;
-        err = errMsg.c_str();
         return false;
     }
-    char* writeBuf = buf;
-    do
+    CStringLoader loader(text);
+    LoadedFormat  format;
+    if (LoadFromHandle(hFile, fileSize.QuadPart, GetMappedLoadThreshold(), -1, loader, format, nullptr, cancel))
     {
-        int charStart = UTF8Helper::characterStart(writeBuf, (int)min(WriteBlockSize, lengthDoc));
-        int widelen   = MultiByteToWideChar(CP_UTF8, 0, writeBuf, charStart, writeWidebuf.get(), writeWidebufSize);
+        text.clear();
+        return false;
+    }
+    if (encoding)
+        *encoding = format.encoding;
+    if (hasBOM)
+        *hasBOM = format.hasBOM;
+    return true;
+}
 
-        LPCWSTR p_In      = (LPCWSTR)writeWidebuf.get();
-        UINT32* p_Out     = (UINT32*)writeWide32buf.get();
-        int     nOutDword = 0;
-        for (int nInWord = 0; nInWord < widelen; nInWord++, nOutDword++)
+// Writes the UTF-8 document content to the file in the given encoding.
+// Returns a win32 error code, or 0 on success.
+static DWORD WriteDocument(HANDLE hFile, const char* buf, size_t lengthDoc, int encoding, bool hasBOM, const SaveProgressFunc& progress)
+{
+    auto writeData = [hFile](const char* data, size_t len) -> DWORD {
+        DWORD bytesWritten = 0;
+        if (!WriteFile(hFile, data, static_cast<DWORD>(len), &bytesWritten, nullptr) || bytesWritten != len)
         {
-            UINT32 zChar = p_In[nInWord];
-            if ((zChar & 0xfc00) == 0xd800) // lead surrogate
-            {
-                if (nInWord + 1 < widelen && (p_In[nInWord + 1] & 0xfc00) == 0xdc00) // trail surrogate follows
-                    zChar = 0x10000 + ((zChar & 0x3ff) << 10) + (p_In[++nInWord] & 0x3ff);
-                else
-                    zChar = 0xfffd; // ? mark
-            }
-            else if ((zChar & 0xfc00) == 0xdc00) // trail surrogate without lead
-                zChar = 0xfffd;                  // ? mark
-            p_Out[nOutDword] = zChar;
+            DWORD err = GetLastError();
+            return err ? err : ERROR_WRITE_FAULT;
         }
+        return 0;
+    };
+    return CDocumentWriter::Write(buf, lengthDoc, encoding, hasBOM, writeData, progress);
+}
 
-        if (encoding == 12001)
-        {
-            UINT64* p64     = reinterpret_cast<UINT64*>(writeWide32buf.get());
-            int     nQwords = widelen / 2;
-            for (int nQword = 0; nQword < nQwords; nQword++)
-                p64[nQword] = DwordSwapBytes(p64[nQword]);
-
-            UINT32* p32     = (UINT32*)p64;
-            int     nDwords = widelen;
-            for (int nDword = nQwords * 2; nDword < nDwords; nDword++)
-                p32[nDword] = DwordSwapBytes(p32[nDword]);
-        }
-        if (!WriteFile(hFile, writeWide32buf.get(), widelen * 4, &bytesWritten, nullptr) || widelen != int(bytesWritten / 4))
-        {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
-        }
-        writeBuf += charStart;
-        lengthDoc -= charStart;
-    } while (lengthDoc > 0);
-    return true;
+std::wstring CDocumentManager::CreateTempFileNextTo(const std::wstring& path)
+{
+    // GetTempFileName creates the file, so the name is ours until it's deleted
+    wchar_t tempPath[MAX_PATH] = {};
+    if (GetTempFileName(CPathUtils::GetParentDirectory(path).c_str(), L"bp", 0, tempPath) == 0)
+        return {};
+    return tempPath;
 }
 
-static bool SaveAsUtf8(const CDocument& doc, char* buf, size_t lengthDoc, CAutoFile& hFile, std::wstring& err)
+DWORD CDocumentManager::SaveFileUtf8(const std::wstring& path, std::string_view text, int encoding, bool hasBOM)
 {
-    // UTF8: save the buffer as it is
-    DWORD bytesWritten = 0;
-    auto  encoding     = doc.m_encoding;
-    auto  hasBOM       = doc.m_bHasBOM;
-    if (doc.m_encodingSaving != -1)
-    {
-        encoding = doc.m_encodingSaving;
-        hasBOM   = doc.m_bHasBOMSaving;
-    }
+    CAutoFile hFile = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!hFile.IsValid())
+        return GetLastError();
+    return WriteDocument(hFile, text.data(), text.size(), encoding, hasBOM, nullptr);
+}
 
-    if (hasBOM)
+bool CDocumentManager::SaveDoc(HWND hWnd, const std::wstring& path, const CDocument& doc, const SaveProgressFunc& progress)
+{
+    if (path.empty())
+        return false;
+    CAutoFile hFile = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!hFile.IsValid())
     {
-        if (!WriteFile(hFile, "\xEF\xBB\xBF", 3, &bytesWritten, nullptr) || bytesWritten != 3)
-        {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
-        }
+        CFormatMessageWrapper errMsg;
+        ShowFileSaveError(hWnd, path, errMsg);
+        return false;
     }
-    do
-    {
-        DWORD writeLen = (DWORD)min(WriteBlockSize, lengthDoc);
-        if (!WriteFile(hFile, buf, writeLen, &bytesWritten, nullptr))
-        {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
-        }
-        lengthDoc -= writeLen;
-        buf += writeLen;
-    } while (lengthDoc > 0);
-    return true;
-}
 
-static bool SaveAsOther(const CDocument& doc, char* buf, size_t lengthDoc, CAutoFile& hFile, std::wstring& err)
-{
-    const int widebufSize = WriteBlockSize * 2;
-    auto      widebuf     = std::make_unique<wchar_t[]>(widebufSize);
-    const int charbufSize = widebufSize * 2;
-    auto      charbuf     = std::make_unique<char[]>(charbufSize);
-    // first convert to wide char, then to the requested codepage
-    DWORD bytesWritten = 0;
-    auto  encoding     = doc.m_encoding;
-    auto  hasBOM       = doc.m_bHasBOM;
+    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+    size_t lengthDoc = m_scratchScintilla.Call(SCI_GETLENGTH);
+    // get characters directly from Scintilla buffer
+    const char* buf      = (const char*)m_scratchScintilla.Call(SCI_GETCHARACTERPOINTER);
+    auto        encoding = doc.m_encoding;
+    auto        hasBOM   = doc.m_bHasBOM;
     if (doc.m_encodingSaving != -1)
     {
         encoding = doc.m_encodingSaving;
         hasBOM   = doc.m_bHasBOMSaving;
     }
-    char* writeBuf = buf;
-    do
+    DWORD err = WriteDocument(hFile, buf, lengthDoc, encoding, hasBOM, progress);
+    if (err)
     {
-        int charStart = UTF8Helper::characterStart(writeBuf, (int)min(WriteBlockSize, lengthDoc));
-        int widelen   = MultiByteToWideChar(CP_UTF8, 0, writeBuf, charStart, widebuf.get(), widebufSize);
-        int charlen   = WideCharToMultiByte(encoding < 0 ? CP_ACP : encoding, 0, widebuf.get(), widelen, charbuf.get(), charbufSize, 0, nullptr);
-        if (!WriteFile(hFile, charbuf.get(), charlen, &bytesWritten, nullptr) || charlen != int(bytesWritten))
-        {
-            CFormatMessageWrapper errMsg;
-            err = errMsg.c_str();
-            return false;
-        }
-        writeBuf += charStart;
-        lengthDoc -= charStart;
-    } while (lengthDoc > 0);
+        CFormatMessageWrapper errMsg(err);
+        ShowFileSaveError(hWnd, path, errMsg);
+        return false;
+    }
     return true;
 }
 
-bool CDocumentManager::SaveDoc(HWND hWnd, const std::wstring& path, const CDocument& doc)
+bool CDocumentManager::SaveDocReplacing(HWND hWnd, const std::wstring& path, const CDocument& doc, const SaveProgressFunc& progress, bool& saved)
 {
-    if (path.empty())
+    saved = false;
+    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+    size_t lengthDoc = m_scratchScintilla.Call(SCI_GETLENGTH);
+    auto   threshold = CIniSettings::Instance().GetInt64(L"Defaults", L"replacesavethreshold", ReplaceSaveThreshold);
+    if (threshold <= 0 || lengthDoc < static_cast<unsigned __int64>(threshold))
         return false;
-    CAutoFile hFile = CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    {
+        // replacing the file would break hard links, and for symbolic links
+        // it would replace the link instead of the file it points to.
+        // Read-only files are left to the usual save which deals with them.
+        CAutoFile                  hOriginal = CreateFile(path.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_OPEN_REPARSE_POINT, nullptr);
+        BY_HANDLE_FILE_INFORMATION fileInfo  = {};
+        if (!hOriginal.IsValid() || !GetFileInformationByHandle(hOriginal, &fileInfo) || fileInfo.nNumberOfLinks != 1 ||
+            (fileInfo.dwFileAttributes & (FILE_ATTRIBUTE_REPARSE_POINT | FILE_ATTRIBUTE_READONLY)) != 0)
+            return false;
+    }
+    // the temporary file must be on the same volume for the replace to be atomic
+    std::wstring tempPath = CreateTempFileNextTo(path);
+    if (tempPath.empty())
+        return false;
+    CAutoFile hFile = CreateFile(tempPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, nullptr, TRUNCATE_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
     if (!hFile.IsValid())
     {
-        CFormatMessageWrapper errMsg;
-        ShowFileSaveError(hWnd, path, errMsg);
+        DeleteFile(tempPath.c_str());
         return false;
     }
 
-    m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, doc.m_document);
-    size_t lengthDoc = m_scratchScintilla.Call(SCI_GETLENGTH);
-    // get characters directly from Scintilla buffer
-    char*        buf = (char*)m_scratchScintilla.Call(SCI_GETCHARACTERPOINTER);
-    bool         ok  = false;
-    std::wstring err;
-    auto         encoding = doc.m_encoding;
-    auto         hasBOM   = doc.m_bHasBOM;
+    const char* buf      = (const char*)m_scratchScintilla.Call(SCI_GETCHARACTERPOINTER);
+    auto        encoding = doc.m_encoding;
+    auto        hasBOM   = doc.m_bHasBOM;
     if (doc.m_encodingSaving != -1)
     {
         encoding = doc.m_encodingSaving;
         hasBOM   = doc.m_bHasBOMSaving;
     }
-    switch (encoding)
+    DWORD err = WriteDocument(hFile, buf, lengthDoc, encoding, hasBOM, progress);
+    hFile.CloseHandle();
+    if (err)
     {
-        case CP_UTF8:
-            ok = SaveAsUtf8(doc, buf, lengthDoc, hFile, err);
-            break;
-        case 1200: // UTF16_LE
-        case 1201: // UTF16_BE
-            ok = SaveAsUtf16(doc, buf, lengthDoc, hFile, err);
-            break;
-        case 12000: // UTF32_LE
-        case 12001: // UTF32_BE
-            ok = SaveAsUtf32(doc, buf, lengthDoc, hFile, err);
-            break;
-        default:
-            ok = SaveAsOther(doc, buf, lengthDoc, hFile, err);
-            break;
+        // the original file is still intact
+        DeleteFile(tempPath.c_str());
+        CFormatMessageWrapper errMsg(err);
+        ShowFileSaveError(hWnd, path, errMsg);
+        return true;
+    }
+    if (!ReplaceFile(path.c_str(), tempPath.c_str(), nullptr, REPLACEFILE_IGNORE_MERGE_ERRORS | REPLACEFILE_IGNORE_ACL_ERRORS, nullptr, nullptr))
+    {
+        DeleteFile(tempPath.c_str());
+        return false;
     }
-    if (!ok)
-        ShowFileSaveError(hWnd, path, err.c_str());
+    saved = true;
     return true;
 }
 
-bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, bool& bTabMoved)
+bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, bool& bTabMoved, const SaveProgressFunc& progress)
 {
     bTabMoved = false;
     if (doc.m_path.empty())
         return false;
+    if (doc.m_largeFile)
+    {
+        ShowFileSaveError(hWnd, doc.m_path, CLanguage::Instance().GetTranslatedString(ResString(g_hRes, IDS_ERR_LARGEFILESAVE)).c_str());
+        return false;
+    }
+    auto onSaved = [&]() {
+        m_scratchScintilla.Call(SCI_SETSAVEPOINT);
+        m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, 0);
+        if (doc.m_encodingSaving != -1)
+        {
+            doc.m_encoding       = doc.m_encodingSaving;
+            doc.m_encodingSaving = -1;
+            doc.m_bHasBOM        = doc.m_bHasBOMSaving;
+            doc.m_bHasBOMSaving  = false;
+        }
+    };
+    // big files are written to a temporary file first which then replaces
+    // the original, so the original isn't lost if saving fails halfway
+    bool saved = false;
+    if (SaveDocReplacing(hWnd, doc.m_path, doc, progress, saved))
+    {
+        if (saved)
+            onSaved();
+        return saved;
+    }
+
     DWORD attributes = INVALID_FILE_ATTRIBUTES;
     DWORD err        = 0;
     // when opening files, always 'share' as much as possible to reduce problems with virus scanners
@@ -832,7 +645,7 @@ bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, bool& bTabMoved)
             {
                 std::wstring temppath = CTempFiles::Instance().GetTempFilePath(true);
 
-                if (SaveDoc(hWnd, temppath, doc))
+                if (SaveDoc(hWnd, temppath, doc, progress))
                 {
                     std::wstring cmdline        = CStringUtils::Format(L"/elevate /savepath:\"%s\" /path:\"%s\"", doc.m_path.c_str(), temppath.c_str());
                     DWORD        elevationError = RunSelfElevated(hWnd, cmdline);
@@ -865,29 +678,25 @@ bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, bool& bTabMoved)
         return false;
     }
 
-    if (SaveDoc(hWnd, doc.m_path, doc))
-    {
-        m_scratchScintilla.Call(SCI_SETSAVEPOINT);
-        m_scratchScintilla.Call(SCI_SETDOCPOINTER, 0, 0);
-        if (doc.m_encodingSaving != -1)
-        {
-            doc.m_encoding       = doc.m_encodingSaving;
-            doc.m_encodingSaving = -1;
-            doc.m_bHasBOM        = doc.m_bHasBOMSaving;
-            doc.m_bHasBOMSaving  = false;
-        }
-    }
+    saved = SaveDoc(hWnd, doc.m_path, doc, progress);
+    if (saved)
+        onSaved();
     if (attributes != INVALID_FILE_ATTRIBUTES)
     {
         // reset the file attributes after saving
         SetFileAttributes(doc.m_path.c_str(), attributes);
     }
-    return true;
+    return saved;
 }
 
-bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, const std::wstring& path)
+bool CDocumentManager::SaveFile(HWND hWnd, CDocument& doc, const std::wstring& path, const SaveProgressFunc& progress)
 {
-    return SaveDoc(hWnd, path, doc);
+    if (doc.m_largeFile)
+    {
+        ShowFileSaveError(hWnd, path, CLanguage::Instance().GetTranslatedString(ResString(g_hRes, IDS_ERR_LARGEFILESAVE)).c_str());
+        return false;
+    }
+    return SaveDoc(hWnd, path, doc, progress);
 }
 
 bool CDocumentManager::UpdateFileTime(CDocument& doc, bool bIncludeReadonly)
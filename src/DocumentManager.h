@@ -18,6 +18,12 @@
 #include "ScintillaWnd.h"
 
 #include "Document.h"
+#include "DocID.h"
+#include "DocumentLoader.h"
+
+#include <atomic>
+#include <functional>
+#include <string_view>
 
 enum class DocModifiedState
 {
@@ -27,47 +33,8 @@ enum class DocModifiedState
     DM_Unknown
 };
 
-class DocID
-{
-public:
-    explicit DocID(int i) : id(i) {}
-    DocID() : id(-1) {}
-    bool IsValid() const { return id >= 0; }
-    int GetValue() const { return id; }
-
-    bool operator == (const DocID& other) const
-    {
-        return (this->id == other.id);
-    }
-    bool operator != (const DocID& other) const
-    {
-        return (this->id != other.id);
-    }
-    bool operator <(const DocID& rhs) const
-    {
-        return id < rhs.id;
-    }
-
-private:
-    int id;
-    friend struct std::hash<DocID>;
-};
-
-namespace std
-{
-    template<>
-    struct hash<DocID>
-    {
-        std::size_t operator()(const DocID& cmp) const
-        {
-            using std::size_t;
-            using std::hash;
-
-            return hash<int>()(cmp.id); // int hash has also been implemented
-        }
-    };
-}
-
+/// called while a document is saved with the number of bytes written so far
+using SaveProgressFunc = std::function<void(unsigned __int64 pos, unsigned __int64 end)>;
 
 class CDocumentManager
 {
@@ -83,14 +50,37 @@ public:
     const CDocument&            GetDocumentFromID(DocID id) const;
     CDocument&                  GetModDocumentFromID(DocID id);
 
-    CDocument                   LoadFile(HWND hWnd, const std::wstring& path, int encoding, bool createIfMissing);
-    bool                        SaveFile(HWND hWnd, CDocument& doc, bool & bTabMoved);
-    bool                        SaveFile(HWND hWnd, CDocument& doc, const std::wstring& path);
+    /// loads a file into a new document. If \c cancel is given, loading stops
+    /// as soon as it is set: the returned document is then empty, and no
+    /// error is shown.
+    CDocument                   LoadFile(HWND hWnd, const std::wstring& path, int encoding, bool createIfMissing,
+                                         const LoadProgressFunc& progress = nullptr, const std::atomic<bool>* cancel = nullptr);
+    /// loads a file and converts it to UTF-8 without creating a Scintilla document.
+    /// Doesn't show any error messages, only returns false on errors or if
+    /// \c cancel was set while loading.
+    /// If given, \c encoding and \c hasBOM are set to what the file uses.
+    static bool                 LoadFileUtf8(const std::wstring& path, std::string& text, int* encoding = nullptr, bool* hasBOM = nullptr,
+                                             const std::atomic<bool>* cancel = nullptr);
+    /// writes the UTF-8 \c text to a file in the given encoding.
+    /// Doesn't show any error messages, returns a win32 error code or 0 on success.
+    static DWORD                SaveFileUtf8(const std::wstring& path, std::string_view text, int encoding, bool hasBOM);
+    /// creates an empty file with a unique name in the folder of \c path, for
+    /// writing a file that then replaces \c path. Returns the path of the new
+    /// file, or an empty string if it couldn't be created.
+    static std::wstring         CreateTempFileNextTo(const std::wstring& path);
+    bool                        SaveFile(HWND hWnd, CDocument& doc, bool & bTabMoved, const SaveProgressFunc& progress = nullptr);
+    bool                        SaveFile(HWND hWnd, CDocument& doc, const std::wstring& path, const SaveProgressFunc& progress = nullptr);
+    /// loads the part of a large file around \c offset into the document
+    bool                        LoadLargeFileWindow(const CDocument& doc, unsigned __int64 offset);
     bool                        UpdateFileTime(CDocument& doc, bool bIncludeReadonly);
     DocModifiedState            HasFileChanged(DocID id) const;
 
 private:
-    bool                        SaveDoc(HWND hWnd, const std::wstring& path, const CDocument& doc);
+    bool                        LoadLargeFile(const std::wstring& path, CDocument& doc, int encoding);
+    bool                        SaveDoc(HWND hWnd, const std::wstring& path, const CDocument& doc, const SaveProgressFunc& progress);
+    /// saves big files to a temporary file which then replaces the original.
+    /// Returns false if that's not possible and the file has to be saved directly.
+    bool                        SaveDocReplacing(HWND hWnd, const std::wstring& path, const CDocument& doc, const SaveProgressFunc& progress, bool& saved);
 
 private:
     std::map<DocID,CDocument>   m_documents;
@@ -0,0 +1,324 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "DocumentStatistics.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#    define DOCUMENTSTATISTICS_SIMD
+#    include <intrin.h>
+#else
+#    include <array>
+#endif
+
+namespace
+{
+// the size the blocks are split at, the next line end finishes a block
+constexpr size_t BlockSize = 64 * 1024;
+
+// the classes of 64 bytes, one bit per byte
+struct ByteMasks
+{
+    uint64_t space     = 0; // ' ', '\t', '\r' and '\n'
+    uint64_t lf        = 0;
+    uint64_t cr        = 0;
+    uint64_t separator = 0; // punctuation that splits words
+    uint64_t trail     = 0; // UTF-8 trail bytes
+};
+
+#ifdef DOCUMENTSTATISTICS_SIMD
+inline uint64_t MoveMask(__m128i v, int shift)
+{
+    return static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(v))) << shift;
+}
+
+inline __m128i Equals(__m128i v, char c)
+{
+    return _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
+}
+
+// true where low < v < high, only for ASCII bounds
+inline __m128i Between(__m128i v, char low, char high)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(low)), _mm_cmplt_epi8(v, _mm_set1_epi8(high)));
+}
+
+void Classify(const char* data, ByteMasks& masks)
+{
+    for (int i = 0; i < 64; i += 16)
+    {
+        const __m128i v     = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i lf    = Equals(v, '\n');
+        const __m128i cr    = Equals(v, '\r');
+        const __m128i space = _mm_or_si128(_mm_or_si128(Equals(v, ' '), Equals(v, '\t')), _mm_or_si128(lf, cr));
+        // !"$%&'()*+,-./ :; = ? [\]^ {|}
+        __m128i       sep   = _mm_andnot_si128(Equals(v, '#'), Between(v, ' ', '0'));
+        sep                 = _mm_or_si128(sep, _mm_or_si128(Between(v, '9', '<'), _mm_or_si128(Equals(v, '='), Equals(v, '?'))));
+        sep                 = _mm_or_si128(sep, _mm_or_si128(Between(v, 'Z', '_'), Between(v, 'z', '~')));
+        // 0x80 - 0xBF are -128 to -65 as signed bytes
+        const __m128i trail = _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+        masks.space |= MoveMask(space, i);
+        masks.lf |= MoveMask(lf, i);
+        masks.cr |= MoveMask(cr, i);
+        masks.separator |= MoveMask(sep, i);
+        masks.trail |= MoveMask(trail, i);
+    }
+}
+#else
+enum : unsigned char
+{
+    ClassSpace     = 1,
+    ClassLf        = 2,
+    ClassCr        = 4,
+    ClassSeparator = 8,
+    ClassTrail     = 16,
+};
+
+constexpr auto ByteClasses = []() {
+    std::array<unsigned char, 256> classes{};
+    classes[' ']  = ClassSpace;
+    classes['\t'] = ClassSpace;
+    classes['\n'] = ClassSpace | ClassLf;
+    classes['\r'] = ClassSpace | ClassCr;
+    for (unsigned char c : std::string_view(";.:,?!^()\"'{}[]&%$/*-+=|\\"))
+        classes[c] = ClassSeparator;
+    for (int c = 0x80; c < 0xC0; ++c)
+        classes[c] = ClassTrail;
+    return classes;
+}();
+
+void Classify(const char* data, ByteMasks& masks)
+{
+    for (int i = 0; i < 64; ++i)
+    {
+        const auto     cls = ByteClasses[static_cast<unsigned char>(data[i])];
+        const uint64_t bit = 1ULL << i;
+        masks.space |= (cls & ClassSpace) ? bit : 0;
+        masks.lf |= (cls & ClassLf) ? bit : 0;
+        masks.cr |= (cls & ClassCr) ? bit : 0;
+        masks.separator |= (cls & ClassSeparator) ? bit : 0;
+        masks.trail |= (cls & ClassTrail) ? bit : 0;
+    }
+}
+#endif
+
+// same as Scintilla, "\r\n", "\n" and a single "\r" all end a line
+bool IsLineStart(std::string_view text, size_t pos)
+{
+    return text[pos - 1] == '\n' || (text[pos - 1] == '\r' && text[pos] != '\n');
+}
+} // namespace
+
+CDocumentStatistics::CDocumentStatistics()
+{
+    Reset(0);
+}
+
+void CDocumentStatistics::Reset(size_t length)
+{
+    m_blocks.assign(1, Block());
+    m_blocks[0].length = length;
+    m_length           = length;
+    m_dirty            = true;
+}
+
+void CDocumentStatistics::Inserted(size_t pos, size_t length)
+{
+    MarkDirty(pos, 0);
+    // text inserted at the end of a block goes to the next one, the block
+    // before may end with a line end
+    size_t start = 0;
+    for (auto& block : m_blocks)
+    {
+        if (pos < start + block.length || &block == &m_blocks.back())
+        {
+            block.length += length;
+            break;
+        }
+        start += block.length;
+    }
+    m_length += length;
+}
+
+void CDocumentStatistics::Deleted(size_t pos, size_t length)
+{
+    MarkDirty(pos, length);
+    size_t start = 0;
+    for (auto& block : m_blocks)
+    {
+        size_t end = start + block.length;
+        if (start >= pos + length)
+            break;
+        if (end > pos)
+            block.length -= std::min<size_t>(end, pos + length) - std::max<size_t>(start, pos);
+        start = end;
+    }
+    m_length -= std::min<size_t>(length, m_length);
+}
+
+void CDocumentStatistics::MarkDirty(size_t pos, size_t length)
+{
+    // the blocks right before and after the change are marked too: the text
+    // after the change may continue a "\r" at the end of the block before,
+    // and the line at the start of the block after may not start there anymore
+    size_t start = 0;
+    for (auto& block : m_blocks)
+    {
+        if (start > pos + length)
+            break;
+        size_t end = start + block.length;
+        if (end >= pos)
+            block.dirty = true;
+        start = end;
+    }
+    m_dirty = true;
+}
+
+CDocumentStatistics::Counts CDocumentStatistics::Get(const TextFunc& getText)
+{
+    if (!m_dirty)
+        return m_counts;
+
+    std::vector<Block> blocks;
+    blocks.reserve(m_blocks.size() + 1);
+    size_t start = 0;
+    for (size_t i = 0; i < m_blocks.size();)
+    {
+        if (!m_blocks[i].dirty)
+        {
+            start += m_blocks[i].length;
+            blocks.push_back(m_blocks[i++]);
+            continue;
+        }
+        // neighbouring dirty blocks are scanned together, their lines may
+        // have moved from one to the other
+        size_t length = 0;
+        for (; i < m_blocks.size() && m_blocks[i].dirty; ++i)
+            length += m_blocks[i].length;
+        if (length)
+            ScanRange(getText(start, length), blocks);
+        start += length;
+    }
+    if (blocks.empty())
+    {
+        blocks.emplace_back();
+        blocks.back().dirty = false;
+    }
+    m_blocks.swap(blocks);
+
+    Counts counts;
+    bool   lastEmpty = true;
+    for (const auto& block : m_blocks)
+    {
+        counts.characters += block.characters;
+        counts.words += block.words;
+        counts.lines += block.lines;
+        counts.emptyLines += block.emptyLines;
+        if (block.lines)
+        {
+            counts.paragraphs += block.paragraphs + (lastEmpty && !block.firstEmpty ? 1 : 0);
+            lastEmpty = block.lastEmpty;
+        }
+    }
+    // the empty line after the last line end
+    if (m_blocks.back().endsWithEol)
+    {
+        ++counts.lines;
+        ++counts.emptyLines;
+    }
+    m_counts = counts;
+    m_dirty  = false;
+    return m_counts;
+}
+
+void CDocumentStatistics::ScanRange(std::string_view text, std::vector<Block>& blocks)
+{
+    for (size_t start = 0; start < text.size();)
+    {
+        // blocks end with a line end, so no line is split between two blocks
+        size_t end = std::min<size_t>(text.size(), start + BlockSize);
+        while (end < text.size() && !IsLineStart(text, end))
+            ++end;
+        Block block;
+        block.length = end - start;
+        block.dirty  = false;
+        ScanBlock(text.substr(start, block.length), block);
+        blocks.push_back(block);
+        start = end;
+    }
+}
+
+void CDocumentStatistics::ScanBlock(std::string_view text, Block& block)
+{
+    auto endLine = [&block](bool empty) {
+        if (block.lines == 0)
+            block.firstEmpty = empty;
+        else if (block.lastEmpty && !empty)
+            ++block.paragraphs;
+        block.lastEmpty = empty;
+        block.emptyLines += empty ? 1 : 0;
+        ++block.lines;
+    };
+
+    const char*  data        = text.data();
+    const size_t size        = text.size();
+    uint64_t     lastWord    = 0;
+    bool         lineContent = false;
+    for (size_t pos = 0; pos < size; pos += 64)
+    {
+        const size_t count = std::min<size_t>(64, size - pos);
+        ByteMasks    masks;
+        if (count == 64)
+            Classify(data + pos, masks);
+        else
+        {
+            char buffer[64] = {};
+            memcpy(buffer, data + pos, count);
+            Classify(buffer, masks);
+        }
+        const uint64_t valid   = count == 64 ? ~0ULL : (1ULL << count) - 1;
+        const uint64_t word    = ~(masks.space | masks.separator) & valid;
+        uint64_t       content = ~masks.space & valid;
+        block.characters += std::popcount(~masks.trail & valid);
+        // a word starts where a word byte follows a non-word byte
+        block.words += std::popcount(word & ~((word << 1) | lastWord));
+        lastWord = word >> 63;
+
+        // a '\r' only ends a line if no '\n' follows
+        uint64_t nextLf = masks.lf >> 1;
+        if (pos + 64 < size && data[pos + 64] == '\n')
+            nextLf |= 1ULL << 63;
+        uint64_t lineEnds = masks.lf | (masks.cr & ~nextLf);
+        while (lineEnds)
+        {
+            const uint64_t before = (lineEnds & (~lineEnds + 1)) - 1;
+            endLine(!lineContent && (content & before) == 0);
+            lineContent = false;
+            content &= ~before;
+            lineEnds &= lineEnds - 1;
+        }
+        lineContent = lineContent || content != 0;
+    }
+    block.endsWithEol = size == 0 || data[size - 1] == '\n' || data[size - 1] == '\r';
+    if (!block.endsWithEol)
+        endLine(!lineContent);
+}
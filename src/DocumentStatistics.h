@@ -0,0 +1,84 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <functional>
+#include <string_view>
+#include <vector>
+
+/// Counts the characters, words, lines and paragraphs of a document and keeps
+/// the counts up to date while the document is edited.
+///
+/// The document is split into blocks of whole lines, about 64 kB each, and
+/// the counts of every block are kept. An edit only marks the blocks it
+/// touches, so after an edit Get() only scans these blocks again. The bytes
+/// are classified 64 at a time into a bit mask per class, with SSE2 where
+/// available, and the counts are taken from the masks.
+class CDocumentStatistics
+{
+public:
+    struct Counts
+    {
+        size_t characters = 0;
+        size_t words      = 0;
+        size_t lines      = 0;
+        size_t emptyLines = 0;
+        size_t paragraphs = 0;
+    };
+    /// returns \c length bytes of the document, starting at \c pos
+    using TextFunc = std::function<std::string_view(size_t pos, size_t length)>;
+
+    CDocumentStatistics();
+
+    /// drops all counts, the next Get() scans the whole document
+    void   Reset(size_t length);
+    /// to be called after \c length bytes got inserted at \c pos
+    void   Inserted(size_t pos, size_t length);
+    /// to be called after \c length bytes got deleted at \c pos
+    void   Deleted(size_t pos, size_t length);
+    size_t GetLength() const { return m_length; }
+    /// returns the counts of the document, scanning the blocks that changed
+    /// since the last call
+    Counts Get(const TextFunc& getText);
+
+private:
+    struct Block
+    {
+        size_t length      = 0;
+        size_t characters  = 0;
+        size_t words       = 0;
+        // the lines ending in the block, plus an unterminated last line
+        size_t lines       = 0;
+        size_t emptyLines  = 0;
+        // the paragraphs starting after the first line of the block
+        size_t paragraphs  = 0;
+        bool   firstEmpty  = true;
+        bool   lastEmpty   = true;
+        bool   endsWithEol = true;
+        bool   dirty       = true;
+    };
+
+    /// marks the blocks touching [pos, pos + length] as dirty
+    void        MarkDirty(size_t pos, size_t length);
+    /// splits \c text into blocks of whole lines and counts them
+    static void ScanRange(std::string_view text, std::vector<Block>& blocks);
+    static void ScanBlock(std::string_view text, Block& block);
+
+    std::vector<Block> m_blocks;
+    size_t             m_length = 0;
+    bool               m_dirty  = true;
+    Counts             m_counts;
+};
@@ -0,0 +1,221 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "stdafx.h"
+#include "DocumentWriter.h"
+#include "TextEncoding.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+// documents are converted and written in blocks of this size
+constexpr size_t SaveBlockSize = 4 * 1024 * 1024; // 4 MB
+// number of blocks being converted and written at the same time
+constexpr size_t SavePipelineDepth = 2;
+
+struct SaveBlock
+{
+    std::unique_ptr<char[]> buffer;
+    const char*             data   = nullptr;
+    size_t                  len    = 0;
+    size_t                  srcEnd = 0; // position in the text after this block
+};
+
+// Converts UTF-8 to the encoding a document is saved in.
+// Returns the number of bytes written to out.
+size_t ConvertForSaving(int encoding, const char* src, int len, char* out, int outSize, wchar_t* widebuf, int widebufSize)
+{
+    switch (encoding)
+    {
+        case 1200: // UTF16_LE
+        case 1201: // UTF16_BE
+            return CTextEncoding::Utf8ToUtf16(src, len, encoding == 1201, out);
+        case 12000: // UTF32_LE
+        case 12001: // UTF32_BE
+            return CTextEncoding::Utf8ToUtf32(src, len, encoding == 12001, out);
+        default:
+        {
+            // first convert to wide char, then to the requested codepage
+            int widelen = MultiByteToWideChar(CP_UTF8, 0, src, len, widebuf, widebufSize);
+            return WideCharToMultiByte(encoding < 0 ? CP_ACP : encoding, 0, widebuf, widelen, out, outSize, 0, nullptr);
+        }
+    }
+}
+} // namespace
+
+DWORD CDocumentWriter::Write(const char* buf, size_t lengthDoc, int encoding, bool hasBOM, const WriteFunc& write, const ProgressFunc& progress)
+{
+    DWORD err = 0;
+    switch (encoding)
+    {
+        case CP_UTF8:
+            if (hasBOM)
+                err = write("\xEF\xBB\xBF", 3);
+            break;
+        case 1200: // UTF16_LE
+        case 1201: // UTF16_BE
+            if (hasBOM)
+                err = write(encoding == 1200 ? "\xFF\xFE" : "\xFE\xFF", 2);
+            break;
+        case 12000: // UTF32_LE
+        case 12001: // UTF32_BE
+            // UTF-32 is always saved with a BOM
+            err = write(encoding == 12000 ? "\xFF\xFE\0\0" : "\0\0\xFE\xFF", 4);
+            break;
+        default:
+            break;
+    }
+    if (err)
+        return err;
+
+    // every UTF-8 byte results in at most two bytes of UTF-16
+    // and at most four bytes of UTF-32 or other encodings
+    const int  outSize     = static_cast<int>(SaveBlockSize) * ((encoding == 1200 || encoding == 1201) ? 2 : 4);
+    const int  widebufSize = static_cast<int>(SaveBlockSize);
+    const bool convert     = encoding != CP_UTF8;
+    size_t     srcPos      = 0;
+    // fills the block with the next part of the document.
+    // UTF-8 is written directly from the Scintilla buffer.
+    auto nextBlock = [&](SaveBlock& block, std::unique_ptr<wchar_t[]>& widebuf) -> bool {
+        if (srcPos >= lengthDoc)
+            return false;
+        int len = static_cast<int>(std::min<size_t>(SaveBlockSize, lengthDoc - srcPos));
+        if (!convert)
+            block.data = buf + srcPos;
+        else
+        {
+            // don't split characters between blocks
+            if (srcPos + len < lengthDoc)
+                len = static_cast<int>(CTextEncoding::Utf8CompleteLength(buf + srcPos, len));
+            if (!block.buffer)
+                block.buffer = std::unique_ptr<char[]>(new char[outSize]);
+            if (!widebuf && encoding != 1200 && encoding != 1201 && encoding != 12000 && encoding != 12001)
+                widebuf = std::unique_ptr<wchar_t[]>(new wchar_t[widebufSize]);
+            block.len  = ConvertForSaving(encoding, buf + srcPos, len, block.buffer.get(), outSize, widebuf.get(), widebufSize);
+            block.data = block.buffer.get();
+        }
+        if (!convert)
+            block.len = len;
+        srcPos += len;
+        block.srcEnd = srcPos;
+        return true;
+    };
+
+    if (lengthDoc <= SaveBlockSize)
+    {
+        // not worth starting threads for
+        SaveBlock                  block;
+        std::unique_ptr<wchar_t[]> widebuf;
+        while (nextBlock(block, widebuf))
+        {
+            err = write(block.data, block.len);
+            if (err)
+                return err;
+        }
+        return 0;
+    }
+
+    std::mutex              mutex;
+    std::condition_variable cond;
+    std::deque<SaveBlock>   freeBlocks(SavePipelineDepth);
+    std::deque<SaveBlock>   filledBlocks;
+    bool                    convertDone = false;
+    bool                    writeDone   = false;
+    DWORD                   writeError  = 0;
+    size_t                  written     = 0;
+
+    std::thread converter([&]() {
+        std::unique_ptr<wchar_t[]> widebuf;
+        for (;;)
+        {
+            SaveBlock block;
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                cond.wait(lk, [&]() { return !freeBlocks.empty() || writeError; });
+                if (writeError)
+                    break;
+                block = std::move(freeBlocks.front());
+                freeBlocks.pop_front();
+            }
+            bool more = nextBlock(block, widebuf);
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                if (more)
+                    filledBlocks.push_back(std::move(block));
+                else
+                    convertDone = true;
+            }
+            cond.notify_all();
+            if (!more)
+                break;
+        }
+    });
+    std::thread writer([&]() {
+        for (;;)
+        {
+            SaveBlock block;
+            {
+                std::unique_lock<std::mutex> lk(mutex);
+                cond.wait(lk, [&]() { return !filledBlocks.empty() || convertDone; });
+                if (filledBlocks.empty())
+                    break;
+                block = std::move(filledBlocks.front());
+                filledBlocks.pop_front();
+            }
+            DWORD blockError = write(block.data, block.len);
+            {
+                std::lock_guard<std::mutex> lk(mutex);
+                if (blockError)
+                    writeError = blockError;
+                else
+                {
+                    written = block.srcEnd;
+                    freeBlocks.push_back(std::move(block));
+                }
+            }
+            cond.notify_all();
+            if (blockError)
+                break;
+        }
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            writeDone = true;
+        }
+        cond.notify_all();
+    });
+
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+        while (!cond.wait_for(lk, std::chrono::milliseconds(100), [&]() { return writeDone; }))
+        {
+            size_t pos = written;
+            lk.unlock();
+            if (progress)
+                progress(pos, lengthDoc);
+            lk.lock();
+        }
+    }
+    converter.join();
+    writer.join();
+    return writeError;
+}
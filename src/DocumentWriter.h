@@ -0,0 +1,39 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <cstddef>
+#include <functional>
+
+/// Writes the UTF-8 text of a document in the encoding it is saved in.
+///
+/// Big documents are converted on one thread and written on another, with
+/// two blocks in flight, so the disk is kept busy while the next block is
+/// converted. The calling thread only reports the progress, at least every
+/// 100 ms until the text is written.
+class CDocumentWriter
+{
+public:
+    /// writes the data, returns a win32 error code or 0 on success
+    using WriteFunc = std::function<DWORD(const char* data, size_t len)>;
+    /// called with the number of bytes of the text written so far
+    using ProgressFunc = std::function<void(unsigned __int64 pos, unsigned __int64 end)>;
+
+    /// writes \c text of \c len bytes in \c encoding, which is a codepage,
+    /// 1200/1201 for UTF-16LE/BE or 12000/12001 for UTF-32LE/BE.
+    /// Returns the first error \c write returned, or 0 on success.
+    static DWORD Write(const char* text, size_t len, int encoding, bool hasBOM, const WriteFunc& write, const ProgressFunc& progress = nullptr);
+};
@@ -0,0 +1,388 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "FileSorter.h"
+#include "SmartHandle.h"
+#include "TempFile.h"
+#include "OnOutOfScope.h"
+
+#include <queue>
+#include <unordered_set>
+
+namespace
+{
+// the file is sorted in runs of about this size. The sort keys and the
+// line views take about three times as much memory again.
+constexpr size_t RunSize        = 64 * 1024 * 1024;
+// the runs are read in blocks of this size while they're merged
+constexpr size_t MergeBlockSize = 2 * 1024 * 1024;
+// at most that many runs are merged at once, more take several passes
+constexpr size_t MaxMergeWidth  = 64;
+// the output is written in blocks of this size
+constexpr size_t WriteBlockSize = 4 * 1024 * 1024;
+
+// returns the position after the last line break in \c text, or npos.
+// A '\r' at the very end doesn't count, a '\n' may still follow it.
+size_t LastLineEnd(std::string_view text)
+{
+    auto pos = text.find_last_of("\r\n");
+    if (pos != std::string_view::npos && text[pos] == '\r' && pos + 1 == text.size())
+        pos = pos ? text.find_last_of("\r\n", pos - 1) : std::string_view::npos;
+    return pos == std::string_view::npos ? pos : pos + 1;
+}
+
+// reads a file in blocks that end at a line break
+class CLineReader
+{
+public:
+    DWORD Open(const std::wstring& path)
+    {
+        m_hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (!m_hFile.IsValid())
+            return GetLastError();
+        LARGE_INTEGER size = {};
+        if (!GetFileSizeEx(m_hFile, &size))
+            return GetLastError();
+        m_size = size.QuadPart;
+        return 0;
+    }
+
+    unsigned __int64 GetSize() const { return m_size; }
+    bool             AtEnd() const { return m_rest.empty() && m_pos >= m_size; }
+
+    // fills \c buffer with the next bytes of the file, as many as fit
+    DWORD ReadBytes(std::string& buffer)
+    {
+        DWORD read = 0;
+        if (!ReadFile(m_hFile, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr))
+            return GetLastError();
+        buffer.resize(read);
+        m_pos += read;
+        return 0;
+    }
+
+    // reads at least \c size bytes up to a line break into \c text, or the
+    // rest of the file. \c text is empty once the whole file is read.
+    DWORD Read(size_t size, std::string& text)
+    {
+        text.swap(m_rest);
+        m_rest.clear();
+        for (;;)
+        {
+            if (m_pos >= m_size)
+                return 0;
+            if (text.size() >= size)
+            {
+                auto lineEnd = LastLineEnd(text);
+                if (lineEnd != std::string_view::npos)
+                {
+                    m_rest.assign(text, lineEnd);
+                    text.resize(lineEnd);
+                    return 0;
+                }
+                // the line doesn't fit, read more of it
+                size = text.size() * 2;
+            }
+            size_t start  = text.size();
+            DWORD  toRead = static_cast<DWORD>(std::min<unsigned __int64>(size - start, m_size - m_pos));
+            DWORD  read   = 0;
+            text.resize(start + toRead);
+            if (!ReadFile(m_hFile, text.data() + start, toRead, &read, nullptr))
+            {
+                DWORD err = GetLastError();
+                text.clear();
+                return err;
+            }
+            text.resize(start + read);
+            m_pos += read;
+            // the file got shorter meanwhile
+            if (read == 0)
+                m_size = m_pos;
+        }
+    }
+
+private:
+    CAutoFile        m_hFile;
+    unsigned __int64 m_size = 0;
+    unsigned __int64 m_pos  = 0;
+    // the start of a line read with the previous block
+    std::string      m_rest;
+};
+
+// writes a file in big blocks
+class CFileWriter
+{
+public:
+    DWORD Create(const std::wstring& path)
+    {
+        m_hFile = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        return m_hFile.IsValid() ? 0 : GetLastError();
+    }
+
+    DWORD Write(std::string_view data)
+    {
+        if (m_buffer.size() + data.size() < WriteBlockSize)
+        {
+            m_buffer += data;
+            return 0;
+        }
+        DWORD err = Flush();
+        if (err)
+            return err;
+        // big blocks aren't copied to the buffer first
+        if (data.size() >= WriteBlockSize)
+            return WriteAll(data);
+        m_buffer = data;
+        return 0;
+    }
+
+    DWORD Close()
+    {
+        DWORD err = Flush();
+        m_hFile.CloseHandle();
+        return err;
+    }
+
+private:
+    DWORD Flush()
+    {
+        DWORD err = WriteAll(m_buffer);
+        m_buffer.clear();
+        return err;
+    }
+
+    DWORD WriteAll(std::string_view data)
+    {
+        while (!data.empty())
+        {
+            DWORD written = 0;
+            if (!WriteFile(m_hFile, data.data(), static_cast<DWORD>(std::min<size_t>(data.size(), WriteBlockSize)), &written, nullptr))
+                return GetLastError();
+            data.remove_prefix(written);
+        }
+        return 0;
+    }
+
+    CAutoFile   m_hFile;
+    std::string m_buffer;
+};
+
+// a run while it is merged, with the lines of the current block
+struct MergeInput
+{
+    CLineReader                   reader;
+    std::string                   text;
+    std::vector<std::string_view> lines;
+    std::vector<std::string>      keyStorage;
+    std::vector<std::string_view> keys;
+    size_t                        pos = 0;
+};
+} // namespace
+
+CFileSorter::CFileSorter(DWORD cmpFlags, bool descending, bool removeDuplicates)
+    : m_sorter(cmpFlags)
+    , m_descending(descending)
+    , m_removeDuplicates(removeDuplicates)
+{
+}
+
+DWORD CFileSorter::Sort(const std::wstring& source, unsigned __int64 contentStart, const std::wstring& target, std::string_view eol,
+                        const ProgressFunc& progress, const std::atomic<bool>* cancel)
+{
+    CLineReader reader;
+    std::string prefix(static_cast<size_t>(contentStart), '\0');
+    DWORD       err = reader.Open(source);
+    if (!err)
+        err = reader.ReadBytes(prefix);
+    if (err)
+        return err;
+
+    // every run takes one pass over the file, and so does every merge pass.
+    // Until the number of runs is known, one merge pass is assumed.
+    const unsigned __int64    size  = reader.GetSize() - prefix.size();
+    unsigned __int64          total = size * 2;
+    unsigned __int64          done  = 0;
+    std::vector<std::wstring> runs;
+    std::vector<std::wstring> tempFiles;
+    OnOutOfScope(for (const auto& tempFile : tempFiles) DeleteFile(tempFile.c_str()););
+    bool        targetDone = false;
+    bool        finalEol   = false;
+    std::string text;
+    while (!err && !targetDone)
+    {
+        if (cancel && *cancel)
+        {
+            err = ERROR_CANCELLED;
+            break;
+        }
+        err = reader.Read(RunSize, text);
+        if (err || text.empty())
+            break;
+        done += text.size();
+        finalEol = text.back() == '\n' || text.back() == '\r';
+
+        auto lines = CLineSorter::SplitLines(text);
+        auto order = m_sorter.Sort(lines, m_descending, m_removeDuplicates);
+        // a file that fits into one run is sorted right into the target
+        targetDone = runs.empty() && reader.AtEnd();
+        std::wstring path;
+        if (targetDone)
+            path = target;
+        else
+        {
+            path = CTempFiles::Instance().GetTempFilePath(true);
+            runs.push_back(path);
+            tempFiles.push_back(path);
+        }
+        // the runs end every line with a '\n', the target is written like
+        // the merge does it
+        std::string_view runEol = targetDone ? eol : "\n";
+        CFileWriter      writer;
+        err = writer.Create(path);
+        if (!err && targetDone)
+            err = writer.Write(prefix);
+        if (!err)
+            err = writer.Write(CLineSorter::JoinLines(lines, order, runEol));
+        if (!err && (!targetDone || finalEol))
+            err = writer.Write(runEol);
+        if (!err)
+            err = writer.Close();
+        if (progress)
+            progress(done, total);
+    }
+
+    // a file without lines gets just the BOM, from a merge of no runs
+    if (!err && !targetDone)
+    {
+        size_t passes = 1;
+        for (size_t width = MaxMergeWidth; width < runs.size(); width *= MaxMergeWidth)
+            ++passes;
+        total = size * (1 + passes);
+        // merge groups of runs into bigger runs until they can be merged
+        // into the target at once. Merging neighboring runs keeps the order
+        // of lines with equal keys.
+        while (!err && runs.size() > MaxMergeWidth)
+        {
+            std::vector<std::wstring> merged;
+            for (size_t first = 0; first < runs.size() && !err; first += MaxMergeWidth)
+            {
+                std::vector<std::wstring> group(runs.begin() + first, runs.begin() + std::min<size_t>(runs.size(), first + MaxMergeWidth));
+                merged.push_back(CTempFiles::Instance().GetTempFilePath(true));
+                tempFiles.push_back(merged.back());
+                err = Merge(group, merged.back(), std::string_view(), "\n", true, done, total, progress, cancel);
+                // the disk space is needed for the next pass
+                for (const auto& run : group)
+                    DeleteFile(run.c_str());
+            }
+            runs.swap(merged);
+        }
+        if (!err)
+            err = Merge(runs, target, prefix, eol, finalEol, done, total, progress, cancel);
+    }
+    if (err)
+        DeleteFile(target.c_str());
+    return err;
+}
+
+DWORD CFileSorter::Merge(const std::vector<std::wstring>& runs, const std::wstring& target, std::string_view prefix, std::string_view eol, bool finalEol,
+                         unsigned __int64& done, unsigned __int64 total, const ProgressFunc& progress, const std::atomic<bool>* cancel)
+{
+    std::vector<MergeInput> inputs(runs.size());
+    auto                    readBlock = [&](MergeInput& input) -> DWORD {
+        input.pos = 0;
+        input.lines.clear();
+        if (cancel && *cancel)
+            return ERROR_CANCELLED;
+        DWORD err = input.reader.Read(MergeBlockSize, input.text);
+        if (err || input.text.empty())
+            return err;
+        done += input.text.size();
+        input.lines = CLineSorter::SplitLines(input.text);
+        input.keys  = m_sorter.GetSortKeys(input.lines, input.keyStorage);
+        if (progress)
+            progress(done, total);
+        return 0;
+    };
+    // the heap has the run with the next line on top
+    auto after = [&](size_t lhs, size_t rhs) {
+        auto lhsKey = inputs[lhs].keys[inputs[lhs].pos];
+        auto rhsKey = inputs[rhs].keys[inputs[rhs].pos];
+        if (lhsKey != rhsKey)
+            return m_descending ? lhsKey < rhsKey : rhsKey < lhsKey;
+        // lines with equal keys keep their order: the earlier runs have
+        // the earlier lines of the file
+        return lhs > rhs;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(after)> heap(after);
+
+    DWORD err = 0;
+    for (size_t i = 0; i < runs.size() && !err; ++i)
+    {
+        err = inputs[i].reader.Open(runs[i]);
+        if (!err)
+            err = readBlock(inputs[i]);
+        if (!err && !inputs[i].lines.empty())
+            heap.push(i);
+    }
+    CFileWriter writer;
+    if (!err)
+        err = writer.Create(target);
+    if (!err)
+        err = writer.Write(prefix);
+
+    // identical lines have the same key, but lines with the same key
+    // aren't necessarily identical, e.g. when ignoring the case
+    std::string                     groupKey;
+    std::unordered_set<std::string> seen;
+    bool                            anyLine = false;
+    while (!err && !heap.empty())
+    {
+        auto  index = heap.top();
+        auto& input = inputs[index];
+        heap.pop();
+        auto line = input.lines[input.pos];
+        bool keep = true;
+        if (m_removeDuplicates)
+        {
+            auto key = input.keys[input.pos];
+            if (seen.empty() || key != groupKey)
+            {
+                groupKey.assign(key);
+                seen.clear();
+            }
+            keep = seen.emplace(line).second;
+        }
+        if (keep)
+        {
+            if (anyLine)
+                err = writer.Write(eol);
+            if (!err)
+                err = writer.Write(line);
+            anyLine = true;
+        }
+        if (!err && ++input.pos == input.lines.size())
+            err = readBlock(input);
+        if (!err && input.pos < input.lines.size())
+            heap.push(index);
+    }
+    if (!err && anyLine && finalEol)
+        err = writer.Write(eol);
+    if (!err)
+        err = writer.Close();
+    return err;
+}
@@ -0,0 +1,59 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "LineSorter.h"
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Sorts the lines of a file that is too big to be sorted in memory.
+///
+/// The file is read in runs of whole lines, every run is sorted on all cores
+/// with CLineSorter and written to a temp file. The runs are then merged,
+/// up to 64 of them at once, so the memory needed doesn't depend on the size
+/// of the file. The lines end up in the same order the sort of a selection
+/// gives: lines with equal keys keep their order, and removing duplicates
+/// keeps the first of several identical lines.
+class CFileSorter
+{
+public:
+    /// called with the current position while sorting
+    using ProgressFunc = std::function<void(unsigned __int64 pos, unsigned __int64 end)>;
+
+    CFileSorter(DWORD cmpFlags, bool descending, bool removeDuplicates);
+
+    /// sorts the lines of \c source into \c target, with \c eol between the
+    /// lines. The first \c contentStart bytes of the source, i.e. its BOM,
+    /// are copied as they are. Returns a win32 error code, 0 on success or
+    /// ERROR_CANCELLED if \c cancel got set. \c target is deleted on errors.
+    DWORD Sort(const std::wstring& source, unsigned __int64 contentStart, const std::wstring& target, std::string_view eol,
+               const ProgressFunc& progress, const std::atomic<bool>* cancel);
+
+private:
+    /// merges the sorted \c runs into \c target, starting with \c prefix.
+    /// The lines are separated by \c eol, with another one after the last
+    /// line if \c finalEol is set. \c done is advanced by the bytes read.
+    DWORD Merge(const std::vector<std::wstring>& runs, const std::wstring& target, std::string_view prefix, std::string_view eol, bool finalEol,
+                unsigned __int64& done, unsigned __int64 total, const ProgressFunc& progress, const std::atomic<bool>* cancel);
+
+    CLineSorter m_sorter;
+    bool        m_descending;
+    bool        m_removeDuplicates;
+};
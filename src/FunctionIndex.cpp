@@ -0,0 +1,337 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "FunctionIndex.h"
+#include "BowPad.h"
+#include "LexStyles.h"
+#include "StringUtils.h"
+#include "OnOutOfScope.h"
+#include "BufferSearch.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace
+{
+// Turns "Hello/* there */world" into "Helloworld"
+void StripComments(std::string& f)
+{
+    constexpr char   comment_begin[]   = {"/*"};
+    constexpr char   comment_end[]     = {"*/"};
+    constexpr size_t comment_begin_len = std::size(comment_begin) - 1;
+    constexpr size_t comment_end_len   = std::size(comment_end) - 1;
+    size_t           comment_begin_pos = 0;
+    for (;;)
+    {
+        comment_begin_pos = f.find(comment_begin, comment_begin_pos);
+        if (comment_begin_pos == std::string::npos)
+            break;
+        auto comment_end_pos = f.find(comment_end,
+                                      comment_begin_pos + comment_begin_len);
+        if (comment_end_pos == std::string::npos)
+            break;
+        auto e     = f.erase(f.begin() + comment_begin_pos,
+                         f.begin() + comment_end_pos + comment_end_len);
+        auto trash = std::remove(e, f.end(), '\0');
+        f.erase(trash, f.end());
+    }
+}
+
+void Normalize(std::string& f)
+{
+    // Remove certain chars and replace adjacent whitespace inside the string.
+    // Remember to patch up the size to reflect what we remove.
+    auto e = std::remove_if(f.begin(), f.end(), [](auto c) {
+        return c == '\r' || c == '{';
+    });
+    f.erase(e, f.end());
+    std::replace_if(
+        f.begin(), f.end(), [](auto c) {
+            return c == '\n' || c == '\t';
+        },
+        ' ');
+    auto new_end = std::unique(f.begin(), f.end(), [](auto lhs, auto rhs) -> bool {
+        return (lhs == ' ' && rhs == ' ');
+    });
+    f.erase(new_end, f.end());
+}
+} // namespace
+
+CFunctionIndex& CFunctionIndex::Instance()
+{
+    static CFunctionIndex instance;
+    return instance;
+}
+
+CFunctionIndex::CFunctionIndex()
+{
+}
+
+CFunctionIndex::~CFunctionIndex()
+{
+}
+
+const std::vector<CFunctionIndex::Function>* CFunctionIndex::GetFunctions(DocID id, const CDocument& doc, const std::function<void()>& onFound)
+{
+    const auto& regex = CLexStyles::Instance().GetFunctionRegexForLang(doc.GetLanguage());
+    if (regex.empty() || !doc.m_document)
+    {
+        Remove(id);
+        return nullptr;
+    }
+    if (!m_edit)
+    {
+        m_edit = std::make_unique<CScintillaWnd>(g_hRes);
+        m_edit->InitScratch(g_hRes);
+    }
+    m_edit->Call(SCI_SETDOCPOINTER, 0, 0);
+    m_edit->Call(SCI_SETSTATUS, SC_STATUS_OK);
+    m_edit->Call(SCI_CLEARALL);
+    m_edit->Call(SCI_SETDOCPOINTER, 0, doc.m_document);
+    OnOutOfScope(
+        m_edit->Call(SCI_SETDOCPOINTER, 0, 0););
+
+    auto&  index  = m_indexes[id];
+    sptr_t length = m_edit->Call(SCI_GETLENGTH);
+    if (index.document != doc.m_document || index.regex != regex || index.length != length)
+    {
+        // a different document, a different language or a change the
+        // index was not told about
+        if (index.regex != regex || !index.search)
+        {
+            index.regex  = regex;
+            index.search = std::make_shared<const CBufferSearch>(regex, SCFIND_REGEXP | SCFIND_CXX11REGEX);
+        }
+        index.document = doc.m_document;
+        index.length   = length;
+        StartScan(index, onFound);
+        return nullptr;
+    }
+    if (index.scan)
+    {
+        if (!index.scan->done)
+            return nullptr;
+        // the lines of the functions are still right unless the document
+        // was edited while they were searched
+        index.functions = std::move(index.scan->functions);
+        index.scan.reset();
+        for (const auto& edit : index.scanEdits)
+            ApplyEdit(index, edit);
+        index.scanEdits.clear();
+    }
+    if (index.dirtyStart >= 0)
+    {
+        std::string_view text(reinterpret_cast<const char*>(m_edit->Call(SCI_GETCHARACTERPOINTER)), length);
+        auto             first = FindEdited(index, text);
+        if (first < 0)
+        {
+            StartScan(index, onFound);
+            return nullptr;
+        }
+        UpdateLines(index, first);
+    }
+    return &index.functions;
+}
+
+void CFunctionIndex::OnModified(DocID id, sptr_t position, sptr_t length, bool inserted)
+{
+    auto found = m_indexes.find(id);
+    if (found == m_indexes.end())
+        return;
+    auto& index = found->second;
+    index.length += inserted ? length : -length;
+    if (index.scan)
+        index.scanEdits.push_back({position, length, inserted});
+    else
+        ApplyEdit(index, {position, length, inserted});
+}
+
+bool CFunctionIndex::IsSearching(DocID id) const
+{
+    auto found = m_indexes.find(id);
+    return found != m_indexes.end() && found->second.scan != nullptr;
+}
+
+void CFunctionIndex::Invalidate(DocID id)
+{
+    auto found = m_indexes.find(id);
+    if (found != m_indexes.end())
+        found->second.document = 0;
+}
+
+void CFunctionIndex::Remove(DocID id)
+{
+    auto found = m_indexes.find(id);
+    if (found == m_indexes.end())
+        return;
+    if (found->second.scan)
+        found->second.scan->cancel = true;
+    m_indexes.erase(found);
+}
+
+void CFunctionIndex::StartScan(DocumentIndex& index, const std::function<void()>& onFound)
+{
+    if (index.scan)
+        index.scan->cancel = true;
+    index.functions.clear();
+    index.dirtyStart = -1;
+    index.dirtyEnd   = -1;
+    index.scanEdits.clear();
+    index.scan = std::make_shared<Scan>();
+
+    // the document can only be used from the main thread, the worker
+    // searches a copy of it
+    std::string text(reinterpret_cast<const char*>(m_edit->Call(SCI_GETCHARACTERPOINTER)), index.length);
+    std::thread([scan = index.scan, search = index.search, text = std::move(text), onFound]() {
+        ProfileTimer timer(L"finding all functions");
+        CTextLines   lines(text);
+        Function     function;
+        for (sptr_t pos = 0; !scan->cancel && FindNext(*search, text, pos, lines.GetLength(), function); pos = function.end + 1)
+        {
+            function.line = lines.LineFromPosition(function.signatureStart);
+            scan->functions.push_back(std::move(function));
+        }
+        scan->done = true;
+        if (!scan->cancel && onFound)
+            onFound();
+    }).detach();
+}
+
+void CFunctionIndex::ApplyEdit(DocumentIndex& index, const Edit& edit)
+{
+    auto move = [&](sptr_t& pos) {
+        if (edit.inserted)
+        {
+            if (pos >= edit.position)
+                pos += edit.length;
+        }
+        else if (pos >= edit.position + edit.length)
+            pos -= edit.length;
+        else if (pos > edit.position)
+            pos = edit.position;
+    };
+    for (auto& function : index.functions)
+    {
+        move(function.start);
+        move(function.end);
+        move(function.signatureStart);
+    }
+    if (index.dirtyStart >= 0)
+    {
+        move(index.dirtyStart);
+        move(index.dirtyEnd);
+    }
+    sptr_t editEnd   = edit.inserted ? edit.position + edit.length : edit.position;
+    index.dirtyStart = index.dirtyStart < 0 ? edit.position : std::min<sptr_t>(index.dirtyStart, edit.position);
+    index.dirtyEnd   = std::max<sptr_t>(index.dirtyEnd, editEnd);
+}
+
+ptrdiff_t CFunctionIndex::FindEdited(DocumentIndex& index, std::string_view text)
+{
+    ProfileTimer timer(L"finding edited functions");
+    // The edits can only change the functions on the edited lines, and
+    // the search for all functions would have searched those lines
+    // starting at the end of the function before them. From there, the
+    // search finds the same functions as before once it finds one after
+    // the edited lines that is already known.
+    // A match that ended at the line before the edit could now go on, so
+    // that line is searched again too.
+    sptr_t editLine  = m_edit->Call(SCI_LINEFROMPOSITION, index.dirtyStart);
+    sptr_t editStart = m_edit->Call(SCI_POSITIONFROMLINE, std::max<sptr_t>(0, editLine - 1));
+    sptr_t editEnd   = m_edit->Call(SCI_GETLINEENDPOSITION, m_edit->Call(SCI_LINEFROMPOSITION, index.dirtyEnd));
+    index.dirtyStart = -1;
+    index.dirtyEnd   = -1;
+
+    auto& functions = index.functions;
+    // the functions don't overlap, so their ends are sorted too
+    auto first = std::partition_point(functions.begin(), functions.end(), [&](const Function& f) { return f.end < editStart; });
+    // The function before the edit is searched again as well: the search
+    // for all functions only gets to the same place after it if it's
+    // still found the same way. If it isn't, the functions before it
+    // could have changed too.
+    bool   seam = first != functions.begin();
+    sptr_t pos  = 0;
+    if (seam)
+    {
+        --first;
+        pos = first->start;
+    }
+    auto next = std::partition_point(first, functions.end(), [&](const Function& f) { return f.start <= editEnd; });
+
+    std::vector<Function> found;
+    Function              function;
+    bool                  known = false;
+    while (FindNext(*index.search, text, pos, index.length, function))
+    {
+        if (seam && found.empty() && (function.start != first->start || function.end != first->end))
+            return -1;
+        // the known functions the search went past don't exist anymore
+        while (next != functions.end() && next->start < function.start)
+            ++next;
+        if (next != functions.end() && function.start > editEnd && next->start == function.start && next->end == function.end)
+        {
+            known = true;
+            break;
+        }
+        pos = function.end + 1;
+        found.push_back(std::move(function));
+    }
+    if (seam && found.empty())
+        return -1;
+    if (!known)
+        next = functions.end();
+    auto firstIndex = first - functions.begin();
+    functions.erase(first, next);
+    functions.insert(functions.begin() + firstIndex, std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+    return firstIndex;
+}
+
+bool CFunctionIndex::FindNext(const CBufferSearch& search, std::string_view text, sptr_t start, sptr_t end, Function& function)
+{
+    if (end - start <= 0)
+        return false;
+    sptr_t matchEnd   = 0;
+    sptr_t matchStart = search.FindText(text, start, end, matchEnd);
+    if (matchStart < 0)
+        return false;
+    // Skip newlines, whitespaces and possible leftover closing braces from
+    // the start of the matched function text.
+    sptr_t cpmin = matchStart;
+    while (cpmin < matchEnd)
+    {
+        char c = text[cpmin];
+        if (c != '\r' && c != '\n' && c != ';' && c != '}' && c != ' ' && c != '\t')
+            break;
+        ++cpmin;
+    }
+    function.start          = matchStart;
+    function.end            = matchEnd;
+    function.signatureStart = cpmin;
+    function.signature.assign(text.substr(cpmin, matchEnd - cpmin));
+    StripComments(function.signature);
+    Normalize(function.signature);
+    CStringUtils::trim(function.signature);
+    return true;
+}
+
+void CFunctionIndex::UpdateLines(DocumentIndex& index, size_t first)
+{
+    // the lines of the functions before the first changed one didn't change
+    for (size_t i = first; i < index.functions.size(); ++i)
+        index.functions[i].line = m_edit->Call(SCI_LINEFROMPOSITION, index.functions[i].signatureStart);
+}
@@ -0,0 +1,128 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "DocumentManager.h"
+#include "ScintillaWnd.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+class CBufferSearch;
+
+/// The functions found in the open documents with the function regex of
+/// their language.
+///
+/// The first search for the functions of a document runs on a worker
+/// thread over a copy of the document, the edits made while it runs are
+/// recorded and applied to its result when it's taken over. After that the
+/// index only records which parts of the document were edited. When the
+/// functions are needed again, the search starts again at the start of the
+/// last function before the first edit and stops as soon as it finds a
+/// function after the last edit that is already in the index. Usually
+/// that's only the text between the function before and the one after the
+/// edit. If the function before the edit isn't found the same way again,
+/// the whole document is searched again.
+///
+/// Edits of the document shown in the editor are reported with
+/// OnModified(). Documents that are changed in other ways have to be
+/// invalidated, unless their length changes. Must only be used from the
+/// main thread.
+class CFunctionIndex
+{
+public:
+    struct Function
+    {
+        sptr_t      start          = 0; ///< where the match of the function regex starts
+        sptr_t      end            = 0; ///< where it ends
+        sptr_t      signatureStart = 0; ///< start without the leading whitespace
+        sptr_t      line           = 0; ///< the line the signature starts on
+        /// the signature without comments and with whitespace collapsed
+        std::string signature;
+    };
+
+    static CFunctionIndex& Instance();
+
+    /// returns the functions of the document in document order, after
+    /// updating them if the document changed since the last call. Returns
+    /// nullptr if the language of the document has no function regex, or
+    /// while all functions of the document are searched on the worker
+    /// thread. \c onFound is called from the worker thread once it's done,
+    /// the next call then returns the functions.
+    const std::vector<Function>* GetFunctions(DocID id, const CDocument& doc, const std::function<void()>& onFound = nullptr);
+
+    /// records an edit of the document: \c length bytes were inserted or
+    /// deleted at \c position.
+    void OnModified(DocID id, sptr_t position, sptr_t length, bool inserted);
+    /// true while all functions of the document are searched on the
+    /// worker thread
+    bool IsSearching(DocID id) const;
+    /// forces the functions of the document to be searched again
+    void Invalidate(DocID id);
+    void Remove(DocID id);
+
+private:
+    CFunctionIndex();
+    ~CFunctionIndex();
+
+    /// the search for all functions of a document on the worker thread
+    struct Scan
+    {
+        std::atomic<bool>     cancel = false;
+        std::atomic<bool>     done   = false;
+        /// only valid once done is set
+        std::vector<Function> functions;
+    };
+
+    struct Edit
+    {
+        sptr_t position = 0;
+        sptr_t length   = 0;
+        bool   inserted = false;
+    };
+
+    struct DocumentIndex
+    {
+        Document                             document = 0;
+        std::string                          regex;
+        std::shared_ptr<const CBufferSearch> search;
+        sptr_t                               length = 0;
+        std::vector<Function>                functions;
+        // the edited range that was not searched again yet, -1 if none
+        sptr_t                               dirtyStart = -1;
+        sptr_t                               dirtyEnd   = -1;
+        // the running search for all functions and the edits made since
+        // the copy of the document it searches was made
+        std::shared_ptr<Scan>                scan;
+        std::vector<Edit>                    scanEdits;
+    };
+
+    void        StartScan(DocumentIndex& index, const std::function<void()>& onFound);
+    static void ApplyEdit(DocumentIndex& index, const Edit& edit);
+    /// returns the index of the first function that changed, or -1 if
+    /// all functions have to be searched again
+    ptrdiff_t   FindEdited(DocumentIndex& index, std::string_view text);
+    static bool FindNext(const CBufferSearch& search, std::string_view text, sptr_t start, sptr_t end, Function& function);
+    void        UpdateLines(DocumentIndex& index, size_t first);
+
+    std::unique_ptr<CScintillaWnd>           m_edit;
+    std::unordered_map<DocID, DocumentIndex> m_indexes;
+};
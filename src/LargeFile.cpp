@@ -0,0 +1,286 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "LargeFile.h"
+#include "BufferSearch.h"
+#include "TextEncoding.h"
+
+#include <algorithm>
+
+namespace
+{
+// only every n-th line start is stored in the index
+constexpr unsigned __int64 LineIndexStep = 1024;
+// size of the blocks the file is scanned in
+constexpr size_t ScanBlockSize = 1024 * 1024;
+// size of the blocks searched at once
+constexpr size_t SearchChunkSize = 16 * 1024 * 1024;
+// the text searched along with each block for the context of line starts and
+// word boundaries at its start
+constexpr size_t SearchContextSize = 1024;
+
+// returns the number of line breaks in the data
+size_t CountLineBreaks(const char* data, size_t len)
+{
+    return std::count(data, data + len, '\n');
+}
+
+// moves back to the start of an UTF-8 character
+size_t CharacterStart(const char* data, size_t pos)
+{
+    while (pos > 0 && (static_cast<unsigned char>(data[pos]) & 0xC0) == 0x80)
+        --pos;
+    return pos;
+}
+} // namespace
+
+CLargeFile::CLargeFile()
+    : m_lineCount(1)
+    , m_indexComplete(false)
+    , m_stop(false)
+{
+}
+
+CLargeFile::~CLargeFile()
+{
+    m_stop = true;
+    if (m_indexThread.joinable())
+        m_indexThread.join();
+}
+
+DWORD CLargeFile::Open(const std::wstring& path)
+{
+    m_hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!m_hFile.IsValid())
+        return GetLastError();
+    LARGE_INTEGER fileSize = {};
+    if (!GetFileSizeEx(m_hFile, &fileSize))
+        return GetLastError();
+    m_fileSize = fileSize.QuadPart;
+    if (!m_file.Open(m_hFile, m_fileSize))
+    {
+        DWORD err = GetLastError();
+        return err ? err : ERROR_FILE_INVALID;
+    }
+    m_buffer.resize(ScanBlockSize);
+
+    // skip an UTF-8 BOM
+    char bom[3] = {};
+    if (m_fileSize >= 3 && m_file.Copy(bom, 0, 3) && memcmp(bom, "\xEF\xBB\xBF", 3) == 0)
+        m_contentStart = 3;
+    m_lineIndex.push_back(m_contentStart);
+    m_windowStart = m_contentStart;
+    m_windowEnd   = m_contentStart;
+
+    m_indexThread = std::thread(&CLargeFile::IndexThread, this);
+    return 0;
+}
+
+void CLargeFile::IndexThread()
+{
+    // the index thread uses its own view, the one of the UI thread
+    // moves around the file independently
+    CMappedFile file;
+    if (!file.Open(m_hFile, m_fileSize))
+        return;
+    std::vector<char>             buffer(ScanBlockSize);
+    std::vector<unsigned __int64> lineStarts;
+    unsigned __int64              offset = m_contentStart;
+    unsigned __int64              lines  = 0;
+    while (offset < m_fileSize && !m_stop)
+    {
+        size_t len = static_cast<size_t>(std::min<unsigned __int64>(buffer.size(), m_fileSize - offset));
+        if (!file.Copy(buffer.data(), offset, len))
+            return;
+        const char* start = buffer.data();
+        const char* end   = start + len;
+        for (const char* p = start; (p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr;)
+        {
+            ++p;
+            ++lines;
+            if ((lines % LineIndexStep) == 0)
+                lineStarts.push_back(offset + (p - start));
+        }
+        if (!lineStarts.empty())
+        {
+            std::lock_guard<std::mutex> lk(m_indexMutex);
+            m_lineIndex.insert(m_lineIndex.end(), lineStarts.begin(), lineStarts.end());
+            lineStarts.clear();
+        }
+        offset += len;
+        m_lineCount = lines + 1;
+    }
+    m_indexComplete = offset >= m_fileSize;
+}
+
+unsigned __int64 CLargeFile::SkipLines(unsigned __int64 offset, unsigned __int64 lines)
+{
+    std::lock_guard<std::mutex> lk(m_fileMutex);
+    while (lines > 0 && offset < m_fileSize)
+    {
+        size_t len = static_cast<size_t>(std::min<unsigned __int64>(m_buffer.size(), m_fileSize - offset));
+        if (!m_file.Copy(m_buffer.data(), offset, len))
+            return m_fileSize;
+        const char* start = m_buffer.data();
+        const char* end   = start + len;
+        const char* p     = start;
+        while (lines > 0 && (p = static_cast<const char*>(memchr(p, '\n', end - p))) != nullptr)
+        {
+            ++p;
+            --lines;
+        }
+        if (lines == 0)
+            return offset + (p - start);
+        offset += len;
+    }
+    return lines == 0 ? offset : m_fileSize;
+}
+
+unsigned __int64 CLargeFile::OffsetFromLine(unsigned __int64 line)
+{
+    unsigned __int64 base  = 0;
+    unsigned __int64 index = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_indexMutex);
+        index = std::min<unsigned __int64>(line / LineIndexStep, m_lineIndex.size() - 1);
+        base  = m_lineIndex[static_cast<size_t>(index)];
+    }
+    return SkipLines(base, line - index * LineIndexStep);
+}
+
+unsigned __int64 CLargeFile::LineFromOffset(unsigned __int64 offset)
+{
+    unsigned __int64 base = 0;
+    unsigned __int64 line = 0;
+    {
+        std::lock_guard<std::mutex> lk(m_indexMutex);
+        auto it = std::upper_bound(m_lineIndex.begin(), m_lineIndex.end(), offset);
+        if (it == m_lineIndex.begin())
+            return 0;
+        --it;
+        base = *it;
+        line = (it - m_lineIndex.begin()) * LineIndexStep;
+    }
+    std::lock_guard<std::mutex> lk(m_fileMutex);
+    offset = std::min<unsigned __int64>(offset, m_fileSize);
+    while (base < offset)
+    {
+        size_t len = static_cast<size_t>(std::min<unsigned __int64>(m_buffer.size(), offset - base));
+        if (!m_file.Copy(m_buffer.data(), base, len))
+            break;
+        line += CountLineBreaks(m_buffer.data(), len);
+        base += len;
+    }
+    return line;
+}
+
+bool CLargeFile::ReadWindow(unsigned __int64 offset, std::string& text)
+{
+    offset = std::clamp(offset, m_contentStart, m_fileSize);
+    // start the window at a line start half a window before the offset,
+    // unless that line is so long that the offset would not be in the window
+    unsigned __int64 desired   = std::max<unsigned __int64>(offset, m_contentStart + WindowSize / 2) - WindowSize / 2;
+    unsigned __int64 firstLine = LineFromOffset(desired);
+    unsigned __int64 start     = OffsetFromLine(firstLine);
+    bool             midLine   = start + WindowSize / 2 < desired;
+    if (midLine)
+        start = desired;
+
+    size_t len = static_cast<size_t>(std::min<unsigned __int64>(WindowSize, m_fileSize - start));
+    text.resize(len);
+    {
+        std::lock_guard<std::mutex> lk(m_fileMutex);
+        if (len && !m_file.Copy(&text[0], start, len))
+            return false;
+    }
+    if (midLine)
+    {
+        // don't start in the middle of a character either
+        size_t skip = 0;
+        while (skip < text.size() && (static_cast<unsigned char>(text[skip]) & 0xC0) == 0x80)
+            ++skip;
+        text.erase(0, skip);
+        start += skip;
+        len -= skip;
+    }
+    if (start + len < m_fileSize)
+    {
+        // end the window after a line break, or at least not in the middle of a character
+        auto lastLF = text.find_last_of('\n');
+        if (lastLF != std::string::npos && lastLF >= text.size() / 2)
+            len = lastLF + 1;
+        else
+            len = CTextEncoding::Utf8CompleteLength(text.data(), len);
+        text.resize(len);
+    }
+    m_windowFirstLine = firstLine;
+    m_windowStart     = start;
+    m_windowEnd       = start + len;
+    return true;
+}
+
+__int64 CLargeFile::Find(const CBufferSearch& searcher, unsigned __int64 startOffset, unsigned __int64 endOffset, unsigned __int64& matchEnd, const ProgressFunc& progress)
+{
+    startOffset = std::max<unsigned __int64>(startOffset, m_contentStart);
+    endOffset   = std::min<unsigned __int64>(endOffset, m_fileSize);
+    std::string chunk;
+    for (unsigned __int64 pos = startOffset; pos < endOffset;)
+    {
+        // matches starting before searchEnd are searched in this chunk. The chunk
+        // goes on by the longest match after it, so matches across the end are
+        // found as a whole: the next chunk starts at searchEnd again
+        unsigned __int64 chunkStart = pos - std::min<unsigned __int64>(SearchContextSize, pos - m_contentStart);
+        unsigned __int64 searchEnd  = std::min<unsigned __int64>(endOffset, pos + SearchChunkSize);
+        unsigned __int64 chunkEnd   = std::min<unsigned __int64>(m_fileSize, searchEnd + MaxMatchLength);
+        size_t           len        = static_cast<size_t>(chunkEnd - chunkStart);
+        chunk.resize(len);
+        {
+            std::lock_guard<std::mutex> lk(m_fileMutex);
+            if (!m_file.Copy(&chunk[0], chunkStart, len))
+                return -1;
+        }
+        // neither start nor end the chunk or the searched part in the middle of a character
+        size_t skip = 0;
+        while (chunkStart + skip < pos && (static_cast<unsigned char>(chunk[skip]) & 0xC0) == 0x80)
+            ++skip;
+        if (chunkEnd < m_fileSize)
+            len = CTextEncoding::Utf8CompleteLength(chunk.data(), len);
+        if (searchEnd < endOffset)
+        {
+            auto charStart = chunkStart + CharacterStart(chunk.data(), static_cast<size_t>(searchEnd - chunkStart));
+            // data that's not UTF-8 at all can't be cut at a character
+            if (charStart > pos)
+                searchEnd = charStart;
+        }
+
+        std::string_view text(chunk.data() + skip, len - skip);
+        sptr_t           end   = 0;
+        sptr_t           found = searcher.FindText(text, static_cast<sptr_t>(pos - chunkStart - skip), static_cast<sptr_t>(text.size()), end);
+        if (found == -2)
+            return -1;
+        if (found >= 0 && chunkStart + skip + found < searchEnd)
+        {
+            matchEnd = chunkStart + skip + end;
+            return static_cast<__int64>(chunkStart + skip + found);
+        }
+        pos = searchEnd;
+        if (progress)
+            progress(pos - startOffset, endOffset - startOffset);
+    }
+    return -1;
+}
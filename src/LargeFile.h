@@ -0,0 +1,113 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "MappedFile.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+
+class CBufferSearch;
+
+/// A file too big to be loaded into Scintilla as a whole.
+///
+/// The lines are indexed on a background thread right after opening, only
+/// every LineIndexStep-th line start is stored to keep the index small even
+/// for files with billions of lines. Lines which are not yet indexed are
+/// found by scanning the file, so everything works before the index is
+/// complete, just slower.
+///
+/// Only a window of lines is loaded into the editor. The window is tracked
+/// here as well, so line numbers and positions in the editor can be mapped
+/// to the file. Lines are separated by '\n', the content is treated as UTF-8.
+class CLargeFile
+{
+public:
+    /// called with the current position while searching
+    using ProgressFunc = std::function<void(unsigned __int64 pos, unsigned __int64 end)>;
+
+    /// size of the window loaded into the editor
+    static constexpr unsigned __int64 WindowSize = 8 * 1024 * 1024;
+    /// the window is moved once the view gets closer than this to its ends
+    static constexpr unsigned __int64 WindowMargin = 1024 * 1024;
+    /// the longest match Find() is sure to find
+    static constexpr unsigned __int64 MaxMatchLength = 1024 * 1024;
+
+    CLargeFile();
+    ~CLargeFile();
+    CLargeFile(const CLargeFile&) = delete;
+    CLargeFile& operator=(const CLargeFile&) = delete;
+
+    /// opens the file and starts indexing the lines.
+    /// Returns a win32 error code, or 0 on success.
+    DWORD            Open(const std::wstring& path);
+
+    unsigned __int64 GetSize() const { return m_fileSize; }
+    /// offset of the first line, i.e. the size of the BOM
+    unsigned __int64 GetContentStart() const { return m_contentStart; }
+    /// number of lines indexed so far, or all lines once indexing is complete
+    unsigned __int64 GetLineCount() const { return m_lineCount; }
+    bool             IsIndexComplete() const { return m_indexComplete; }
+
+    /// returns the offset where \c line starts, or the file size if the
+    /// file has fewer lines
+    unsigned __int64 OffsetFromLine(unsigned __int64 line);
+    /// returns the line that contains \c offset
+    unsigned __int64 LineFromOffset(unsigned __int64 offset);
+
+    /// reads about WindowSize bytes of whole lines around \c offset and
+    /// makes them the current window.
+    bool             ReadWindow(unsigned __int64 offset, std::string& text);
+    unsigned __int64 GetWindowFirstLine() const { return m_windowFirstLine; }
+    unsigned __int64 GetWindowStart() const { return m_windowStart; }
+    unsigned __int64 GetWindowEnd() const { return m_windowEnd; }
+
+    /// searches forward for a match that starts between \c startOffset and
+    /// \c endOffset in the file. The match itself can go on past \c endOffset,
+    /// and the text before \c startOffset counts for line starts and word
+    /// boundaries. Returns the offset of the match and sets \c matchEnd, or
+    /// returns -1 if nothing was found. Matches longer than MaxMatchLength
+    /// may be cut short or not be found.
+    __int64          Find(const CBufferSearch& searcher, unsigned __int64 startOffset, unsigned __int64 endOffset, unsigned __int64& matchEnd, const ProgressFunc& progress);
+
+private:
+    void             IndexThread();
+    /// skips \c lines lines starting at \c offset, returns the offset after
+    /// the last skipped line break or the file size.
+    unsigned __int64 SkipLines(unsigned __int64 offset, unsigned __int64 lines);
+
+    CAutoFile                     m_hFile;
+    CMappedFile                   m_file; ///< used from the UI thread, guarded by m_fileMutex
+    std::mutex                    m_fileMutex;
+    std::vector<char>             m_buffer;
+    unsigned __int64              m_fileSize     = 0;
+    unsigned __int64              m_contentStart = 0;
+
+    std::thread                   m_indexThread;
+    std::mutex                    m_indexMutex;
+    std::vector<unsigned __int64> m_lineIndex; ///< start of every LineIndexStep-th line
+    std::atomic<unsigned __int64> m_lineCount;
+    std::atomic_bool              m_indexComplete;
+    std::atomic_bool              m_stop;
+
+    unsigned __int64              m_windowFirstLine = 0;
+    unsigned __int64              m_windowStart     = 0;
+    unsigned __int64              m_windowEnd       = 0;
+};
@@ -0,0 +1,252 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "LineSorter.h"
+
+#include <unordered_set>
+
+#ifndef _WIN32
+#    include "CaseConvert.h"
+#    include "UniConversion.h"
+
+namespace
+{
+// a code point as three bytes that never start with 0, so that the 0 between
+// the levels of a key sorts before any character
+void AppendWeight(std::string& keys, unsigned int cp)
+{
+    keys += static_cast<char>((cp >> 16) + 1);
+    keys += static_cast<char>((cp >> 8) & 0xFF);
+    keys += static_cast<char>(cp & 0xFF);
+}
+
+// returns the code point at \c pos and its length in bytes, invalid bytes
+// are mapped to the lone surrogates no valid utf8 decodes to
+unsigned int DecodeAt(std::string_view text, size_t pos, size_t& width)
+{
+    auto us         = reinterpret_cast<const unsigned char*>(text.data()) + pos;
+    int  classified = Scintilla::UTF8Classify(us, text.size() - pos);
+    if (classified & Scintilla::UTF8MaskInvalid)
+    {
+        width = 1;
+        return 0xDC00 + us[0];
+    }
+    width = classified & Scintilla::UTF8MaskWidth;
+    return Scintilla::UnicodeFromUTF8(us);
+}
+} // namespace
+#endif
+
+CLineSorter::CLineSorter(DWORD cmpFlags)
+    : m_mapFlags(LCMAP_SORTKEY | cmpFlags)
+{
+#ifndef _WIN32
+    // sets up the case folding tables, they're only read while sorting
+    Scintilla::ConverterFor(Scintilla::CaseConversionFold);
+#endif
+}
+
+std::vector<size_t> CLineSorter::Sort(const std::vector<std::string_view>& lines, bool descending, bool removeDuplicates)
+{
+    std::vector<std::string> blockKeys;
+    auto                     keys = GetSortKeys(lines, blockKeys);
+    std::vector<SortItem>    items(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        items[i].index = i;
+        for (size_t b = 0; b < sizeof(items[i].prefix); ++b)
+            items[i].prefix = (items[i].prefix << 8) | (b < keys[i].size() ? static_cast<unsigned char>(keys[i][b]) : 0);
+    }
+
+    // string_view compares chars as unsigned, same as the keys are meant to be compared
+    auto less = [&](const SortItem& lhs, const SortItem& rhs) {
+        if (lhs.prefix != rhs.prefix)
+            return lhs.prefix < rhs.prefix;
+        return keys[lhs.index] < keys[rhs.index];
+    };
+    if (descending)
+        ParallelSort(m_pool, items, [&](const SortItem& lhs, const SortItem& rhs) { return less(rhs, lhs); });
+    else
+        ParallelSort(m_pool, items, less);
+
+    std::vector<size_t> order(items.size());
+    for (size_t i = 0; i < items.size(); ++i)
+        order[i] = items[i].index;
+
+    if (removeDuplicates)
+    {
+        // identical lines have the same key, but lines with the same key
+        // aren't necessarily identical, e.g. when ignoring the case
+        std::unordered_set<std::string_view> seen;
+        size_t                               kept     = 0;
+        size_t                               runStart = 0;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            if (i == 0 || keys[order[i]] != keys[order[runStart]])
+            {
+                runStart = i;
+                seen.clear();
+            }
+            if (seen.insert(lines[order[i]]).second)
+                order[kept++] = order[i];
+        }
+        order.resize(kept);
+    }
+    return order;
+}
+
+std::vector<std::string_view> CLineSorter::GetSortKeys(const std::vector<std::string_view>& lines, std::vector<std::string>& storage)
+{
+    // the keys of a block of lines are appended to one string per block,
+    // the views into them are only taken once all blocks are done since
+    // the strings grow meanwhile
+    const size_t blockCount = std::max<size_t>(1, (lines.size() + MinChunkSize - 1) / MinChunkSize);
+    storage.assign(blockCount, std::string());
+    std::vector<size_t> keyEnds(lines.size());
+    for (size_t block = 0; block < blockCount; ++block)
+    {
+        m_pool.Submit([&, block](NoWorkerContext&) {
+            std::wstring wide;
+            auto&        keys = storage[block];
+            for (size_t i = block * MinChunkSize; i < std::min<size_t>(lines.size(), (block + 1) * MinChunkSize); ++i)
+            {
+                AppendSortKey(lines[i], wide, keys);
+                keyEnds[i] = keys.size();
+            }
+        });
+    }
+    m_pool.Wait();
+    std::vector<std::string_view> keys(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        size_t start = (i % MinChunkSize) ? keyEnds[i - 1] : 0;
+        keys[i]      = std::string_view(storage[i / MinChunkSize]).substr(start, keyEnds[i] - start);
+    }
+    return keys;
+}
+
+#ifdef _WIN32
+void CLineSorter::AppendSortKey(std::string_view line, std::wstring& wide, std::string& keys) const
+{
+    // an empty line has an empty key and comes first
+    if (line.empty())
+        return;
+    wide.resize(line.size());
+    int wideLen = MultiByteToWideChar(CP_UTF8, 0, line.data(), static_cast<int>(line.size()), wide.data(), static_cast<int>(wide.size()));
+    if (wideLen <= 0)
+        return;
+    // the keys are rarely longer than that, otherwise the size is asked for
+    int keySize = wideLen * 6 + 16;
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        size_t start = keys.size();
+        keys.resize(start + keySize);
+        int written = LCMapStringEx(nullptr, m_mapFlags, wide.data(), wideLen, reinterpret_cast<LPWSTR>(keys.data() + start), keySize, nullptr, nullptr, 0);
+        keys.resize(start + std::max(written, 0));
+        if (written > 0 || GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+            return;
+        keySize = LCMapStringEx(nullptr, m_mapFlags, wide.data(), wideLen, nullptr, 0, nullptr, nullptr, 0);
+    }
+}
+#else
+void CLineSorter::AppendSortKey(std::string_view line, std::wstring& /*wide*/, std::string& keys) const
+{
+    // an empty line has an empty key and comes first
+    if (line.empty())
+        return;
+    // the first level are the case folded code points, digit runs are
+    // weighted by their number of significant digits first
+    const bool digitsAsNumbers = (m_mapFlags & SORT_DIGITSASNUMBERS) != 0;
+    size_t     width           = 1;
+    for (size_t pos = 0; pos < line.size(); pos += width)
+    {
+        if (digitsAsNumbers && line[pos] >= '0' && line[pos] <= '9')
+        {
+            size_t end = pos;
+            while (end < line.size() && line[end] >= '0' && line[end] <= '9')
+                ++end;
+            while (pos + 1 < end && line[pos] == '0')
+                ++pos;
+            auto digits = static_cast<unsigned int>(end - pos);
+            AppendWeight(keys, '0');
+            for (int shift = 24; shift >= 0; shift -= 8)
+                keys += static_cast<char>((digits >> shift) & 0xFF);
+            keys.append(line.data() + pos, digits);
+            pos   = end;
+            width = 0;
+            continue;
+        }
+        unsigned int cp     = DecodeAt(line, pos, width);
+        const char*  folded = cp < 0xDC00 || cp > 0xDFFF ? Scintilla::CaseConvert(cp, Scintilla::CaseConversionFold) : nullptr;
+        if (!folded)
+        {
+            AppendWeight(keys, cp);
+            continue;
+        }
+        std::string_view foldedText(folded);
+        size_t           foldedWidth = 1;
+        for (size_t f = 0; f < foldedText.size(); f += foldedWidth)
+            AppendWeight(keys, DecodeAt(foldedText, f, foldedWidth));
+    }
+    if (m_mapFlags & (NORM_IGNORECASE | LINGUISTIC_IGNORECASE))
+        return;
+    // the second level tells the cases apart, lower case first like
+    // CompareStringEx does
+    keys += '\0';
+    for (size_t pos = 0; pos < line.size(); pos += width)
+    {
+        unsigned int cp = DecodeAt(line, pos, width);
+        keys += static_cast<char>((cp < 0xDC00 || cp > 0xDFFF) && Scintilla::CaseConvert(cp, Scintilla::CaseConversionFold) ? 2 : 1);
+    }
+}
+#endif
+
+std::vector<std::string_view> CLineSorter::SplitLines(std::string_view text)
+{
+    std::vector<std::string_view> lines;
+    size_t                        lineStart = 0;
+    for (size_t pos = 0; pos < text.size(); ++pos)
+    {
+        if (text[pos] != '\r' && text[pos] != '\n')
+            continue;
+        lines.push_back(text.substr(lineStart, pos - lineStart));
+        if (text[pos] == '\r' && pos + 1 < text.size() && text[pos + 1] == '\n')
+            ++pos;
+        lineStart = pos + 1;
+    }
+    // like stringtok(), a line break at the end doesn't start another line
+    if (lineStart < text.size() || text.empty())
+        lines.push_back(text.substr(lineStart));
+    return lines;
+}
+
+std::string CLineSorter::JoinLines(const std::vector<std::string_view>& lines, const std::vector<size_t>& order, std::string_view eol)
+{
+    size_t size = order.empty() ? 0 : (order.size() - 1) * eol.size();
+    for (auto index : order)
+        size += lines[index].size();
+    std::string text;
+    text.reserve(size);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (i)
+            text += eol;
+        text += lines[order[i]];
+    }
+    return text;
+}
@@ -0,0 +1,114 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Sorts lines of utf8 text in the order CompareStringEx puts them, fast
+/// enough for selections with millions of lines.
+///
+/// Instead of comparing the lines with CompareStringEx O(n log n) times,
+/// LCMapStringEx computes a sort key for every line once. Comparing the
+/// keys byte by byte gives the same order as CompareStringEx with the same
+/// flags does. The keys are computed and the lines sorted on all cores.
+///
+/// Without the Windows collation, e.g. for the tests and benchmarks on other
+/// systems, the keys order the case folded code points, with digit runs as
+/// numbers for SORT_DIGITSASNUMBERS and lower case first unless the case is
+/// ignored.
+class CLineSorter
+{
+public:
+    /// \c cmpFlags are the CompareStringEx flags to sort with, e.g.
+    /// LINGUISTIC_IGNORECASE and SORT_DIGITSASNUMBERS
+    explicit CLineSorter(DWORD cmpFlags);
+
+    /// returns the indexes of \c lines in sorted order. Equal lines keep
+    /// their order. With \c removeDuplicates, only the first of several
+    /// identical lines is kept.
+    std::vector<size_t> Sort(const std::vector<std::string_view>& lines, bool descending, bool removeDuplicates);
+    /// returns the sort keys of \c lines, computed on all cores. The keys
+    /// point into \c storage. Keys compare like string_views do.
+    std::vector<std::string_view> GetSortKeys(const std::vector<std::string_view>& lines, std::vector<std::string>& storage);
+
+    /// returns the lines split at "\r\n", "\r" and "\n", a line break at
+    /// the end of the text is ignored
+    static std::vector<std::string_view> SplitLines(std::string_view text);
+    /// returns the lines in \c order joined with \c eol, built in one allocation
+    static std::string JoinLines(const std::vector<std::string_view>& lines, const std::vector<size_t>& order, std::string_view eol);
+
+    /// sorts \c items with \c less, stable: the parts of it are sorted in
+    /// parallel, then merged in parallel in rounds
+    template <typename T, typename Less>
+    static void ParallelSort(CWorkStealingPool<>& pool, std::vector<T>& items, Less less)
+    {
+        size_t chunks = std::min<size_t>(pool.GetThreadCount(), items.size() / MinChunkSize);
+        if (chunks <= 1)
+        {
+            std::stable_sort(items.begin(), items.end(), less);
+            return;
+        }
+        std::vector<size_t> bounds;
+        for (size_t i = 0; i <= chunks; ++i)
+            bounds.push_back(items.size() * i / chunks);
+        for (size_t i = 0; i < chunks; ++i)
+        {
+            pool.Submit([&, i](NoWorkerContext&) {
+                std::stable_sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less);
+            });
+        }
+        pool.Wait();
+        std::vector<T> merged(items.size());
+        for (size_t width = 1; width < chunks; width *= 2)
+        {
+            for (size_t i = 0; i + width < chunks; i += 2 * width)
+            {
+                auto first = items.begin() + bounds[i];
+                auto mid   = items.begin() + bounds[i + width];
+                auto last  = items.begin() + bounds[std::min<size_t>(i + 2 * width, chunks)];
+                pool.Submit([&, first, mid, last](NoWorkerContext&) {
+                    auto out = merged.begin() + (first - items.begin());
+                    std::merge(first, mid, mid, last, out, less);
+                    std::copy(out, out + (last - first), first);
+                });
+            }
+            pool.Wait();
+        }
+    }
+
+private:
+    // sorting fewer lines than this per thread isn't worth it
+    static constexpr size_t MinChunkSize = 16 * 1024;
+
+    struct SortItem
+    {
+        // the first bytes of the key, most significant first: most
+        // comparisons are decided without looking at the keys themselves
+        unsigned __int64 prefix = 0;
+        size_t           index  = 0;
+    };
+
+    /// appends the sort key of \c line to \c keys
+    void AppendSortKey(std::string_view line, std::wstring& wide, std::string& keys) const;
+
+    DWORD               m_mapFlags;
+    CWorkStealingPool<> m_pool;
+};
@@ -24,6 +24,7 @@
 #include "UnicodeUtils.h"
 #include "TempFile.h"
 #include "CommandHandler.h"
+#include "CmdSort.h"
 #include "MRU.h"
 #include "KeyboardShortcutHandler.h"
 #include "AppUtils.h"
@@ -44,6 +45,8 @@
 #include "DarkModeHelper.h"
 #include "DPIAware.h"
 #include "Monitor.h"
+#include "LargeFile.h"
+#include "BufferSearch.h"
 #include "../ext/tinyexpr/tinyexpr.h"
 
 #include <memory>
@@ -224,7 +227,9 @@ CMainWindow::CMainWindow(HINSTANCE hInst, const WNDCLASSEX* wcx /* = nullptr*/)
     , m_lastfoldercolorindex(0)
     , m_oldPt{0, 0}
     , m_inMenuLoop(false)
+    , m_largeFileWindowPending(false)
     , m_blockCount(0)
+    , m_progressCount(0)
     , m_custToolTip(hResource)
     , m_normalThemeBack(0)
     , m_normalThemeHigh(0)
@@ -702,6 +707,26 @@ LRESULT CALLBACK CMainWindow::WinMsgHandler(HWND hwnd, UINT uMsg, WPARAM wParam,
         case WM_AFTERINIT:
             HandleAfterInit();
             break;
+        case WM_SORTFILEPROGRESS:
+        {
+            // the sort of a large file reports from its worker thread
+            auto pCmd = static_cast<CCmdSort*>(CCommandHandler::Instance().GetCommand(cmdSort));
+            if (pCmd)
+                pCmd->OnSortFileProgress();
+        }
+        break;
+        case WM_LARGEFILEWINDOW:
+        {
+            m_largeFileWindowPending = false;
+            // keep the first visible line where it is
+            auto docID = m_TabBar.GetCurrentTabId();
+            if (m_DocManager.HasDocumentID(docID) && m_DocManager.GetDocumentFromID(docID).m_largeFile)
+            {
+                auto firstLine = m_editor.Call(SCI_DOCLINEFROMVISIBLE, m_editor.Call(SCI_GETFIRSTVISIBLELINE));
+                LoadLargeFileWindow(m_DocManager.GetDocumentFromID(docID).m_largeFile->GetWindowStart() + m_editor.Call(SCI_POSITIONFROMLINE, firstLine));
+            }
+        }
+        break;
         case WM_NOTIFY:
         {
             LPNMHDR pnmhdr = reinterpret_cast<LPNMHDR>(lParam);
@@ -816,6 +841,9 @@ LRESULT CALLBACK CMainWindow::WinMsgHandler(HWND hwnd, UINT uMsg, WPARAM wParam,
             *result      = m_inMenuLoop ? FALSE : TRUE;
         }
         break;
+        case WM_SELTEXTMARKERSCHANGED:
+            UpdateStatusBar(false);
+            break;
         case WM_MOUSEWHEEL:
         {
             POINT pt = {GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam)};
@@ -1032,6 +1060,24 @@ LRESULT CMainWindow::HandleEditorEvents(const NMHDR& nmhdr, WPARAM wParam, LPARA
     CCommandHandler::Instance().ScintillaNotify(pScn);
     switch (scn.nmhdr.code)
     {
+        case SCN_MODIFIED:
+            // the counts of the document only need the edited parts counted again
+            if (scn.modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))
+            {
+                auto docID = m_TabBar.GetCurrentTabId();
+                if (m_DocManager.HasDocumentID(docID))
+                {
+                    const auto& doc = m_DocManager.GetDocumentFromID(docID);
+                    if (doc.m_statistics && doc.m_document == static_cast<Document>(m_editor.Call(SCI_GETDOCPOINTER)))
+                    {
+                        if (scn.modificationType & SC_MOD_INSERTTEXT)
+                            doc.m_statistics->Inserted(scn.position, scn.length);
+                        else
+                            doc.m_statistics->Deleted(scn.position, scn.length);
+                    }
+                }
+            }
+            break;
         case SCN_SAVEPOINTREACHED:
         case SCN_SAVEPOINTLEFT:
             HandleSavePoint(scn);
@@ -1689,8 +1735,12 @@ bool CMainWindow::SaveDoc(DocID docID, bool bSaveAs)
         if (doc.m_bEnsureNewlineAtEnd)
             EnsureNewLineAtEnd(doc);
 
-        bool bTabMoved = false;
-        if (!m_DocManager.SaveFile(*this, doc, bTabMoved))
+        // big files take a while to save. The window stays blocked meanwhile
+        // since the text is written straight from the Scintilla buffer, it
+        // only shows the progress once that is reported.
+        CProgressReporter progress(*this);
+        bool              bTabMoved = false;
+        if (!m_DocManager.SaveFile(*this, doc, bTabMoved, std::ref(progress)))
         {
             if (bTabMoved)
                 CloseTab(m_TabBar.GetCurrentTabIndex(), true);
@@ -1743,7 +1793,9 @@ bool CMainWindow::SaveDoc(DocID docID, const std::wstring& path)
 
     auto& doc = m_DocManager.GetModDocumentFromID(docID);
 
-    if (!m_DocManager.SaveFile(*this, doc, path))
+    // big files take a while to save, the window stays blocked meanwhile
+    CProgressReporter progress(*this);
+    if (!m_DocManager.SaveFile(*this, doc, path, std::ref(progress)))
     {
         return false;
     }
@@ -1847,9 +1899,105 @@ void CMainWindow::EnsureAtLeastOneTab()
 
 void CMainWindow::GoToLine(size_t line)
 {
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (m_DocManager.HasDocumentID(docID) && m_DocManager.GetDocumentFromID(docID).m_largeFile)
+    {
+        GotoLargeFileLine(line);
+        return;
+    }
     m_editor.GotoLine((long)line);
 }
 
+void CMainWindow::GotoLargeFileLine(unsigned __int64 line)
+{
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (!m_DocManager.HasDocumentID(docID))
+        return;
+    const auto& doc = m_DocManager.GetDocumentFromID(docID);
+    if (!doc.m_largeFile)
+        return;
+    auto pos = LoadLargeFileWindow(doc.m_largeFile->OffsetFromLine(line));
+    if (pos >= 0)
+        m_editor.GotoLine(m_editor.Call(SCI_LINEFROMPOSITION, pos));
+}
+
+bool CMainWindow::FindInLargeFile(const std::string& searchFor, int searchFlags, bool& wrapped)
+{
+    wrapped    = false;
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (!m_DocManager.HasDocumentID(docID))
+        return false;
+    const auto& doc = m_DocManager.GetDocumentFromID(docID);
+    if (!doc.m_largeFile)
+        return false;
+    CBufferSearch searcher(searchFor, searchFlags);
+    if (!searcher.IsValid())
+        return false;
+
+    // search the file after the window first, then wrap around to its start.
+    // The editor only found no match that ends in the window, so the search
+    // starts in the window for the matches that go on past its end.
+    auto&            largeFile = *doc.m_largeFile;
+    unsigned __int64 matchEnd  = 0;
+    __int64          found     = -1;
+    unsigned __int64 cursor    = largeFile.GetWindowStart() + m_editor.Call(SCI_GETCURRENTPOS);
+    unsigned __int64 start     = std::max<unsigned __int64>(largeFile.GetWindowEnd(), CLargeFile::MaxMatchLength) - CLargeFile::MaxMatchLength;
+    {
+        CProgressReporter progress(*this);
+        found = largeFile.Find(searcher, std::max<unsigned __int64>(start, cursor), largeFile.GetSize(), matchEnd, std::ref(progress));
+        if (found < 0)
+        {
+            found   = largeFile.Find(searcher, largeFile.GetContentStart(), largeFile.GetWindowStart(), matchEnd, std::ref(progress));
+            wrapped = found >= 0;
+        }
+    }
+    if (found < 0)
+        return false;
+    auto pos = LoadLargeFileWindow(found);
+    if (pos < 0)
+        return false;
+    m_editor.Center(pos, pos + static_cast<sptr_t>(matchEnd - found));
+    return true;
+}
+
+// Loads the window of the active large file around the offset, unless the offset
+// is already well inside the current window. Returns the position of the offset
+// in the editor, or -1 on errors.
+sptr_t CMainWindow::LoadLargeFileWindow(unsigned __int64 offset)
+{
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (!m_DocManager.HasDocumentID(docID))
+        return -1;
+    const auto& doc = m_DocManager.GetDocumentFromID(docID);
+    if (!doc.m_largeFile)
+        return -1;
+    auto&            largeFile = *doc.m_largeFile;
+    unsigned __int64 minOffset = largeFile.GetWindowStart();
+    unsigned __int64 maxOffset = largeFile.GetWindowEnd();
+    if (minOffset > largeFile.GetContentStart())
+        minOffset += CLargeFile::WindowMargin;
+    if (maxOffset < largeFile.GetSize())
+        maxOffset = max(maxOffset, minOffset + CLargeFile::WindowMargin) - CLargeFile::WindowMargin;
+    if (offset < minOffset || offset > maxOffset)
+    {
+        // replacing the text resets the view: restore the first visible line
+        // and the caret if they're still in the window
+        auto firstLine   = m_editor.Call(SCI_DOCLINEFROMVISIBLE, m_editor.Call(SCI_GETFIRSTVISIBLELINE));
+        auto firstOffset = largeFile.GetWindowStart() + m_editor.Call(SCI_POSITIONFROMLINE, firstLine);
+        auto caretOffset = largeFile.GetWindowStart() + m_editor.Call(SCI_GETCURRENTPOS);
+        if (!m_DocManager.LoadLargeFileWindow(doc, offset))
+            return -1;
+        auto start = largeFile.GetWindowStart();
+        auto end   = largeFile.GetWindowEnd();
+        if (caretOffset >= start && caretOffset <= end)
+            m_editor.Call(SCI_SETEMPTYSELECTION, static_cast<sptr_t>(caretOffset - start));
+        if (firstOffset >= start && firstOffset <= end)
+            m_editor.Call(SCI_SETFIRSTVISIBLELINE, m_editor.Call(SCI_VISIBLEFROMDOCLINE, m_editor.Call(SCI_LINEFROMPOSITION, static_cast<sptr_t>(firstOffset - start))));
+    }
+    offset = min(max(offset, largeFile.GetWindowStart()), largeFile.GetWindowEnd());
+    return static_cast<sptr_t>(offset - largeFile.GetWindowStart());
+}
+
 int CMainWindow::GetZoomPC() const
 {
     int fontsize   = (int)m_editor.ConstCall(SCI_STYLEGETSIZE, STYLE_DEFAULT);
@@ -1870,6 +2018,7 @@ void CMainWindow::SetZoomPC(int zoomPC)
 void CMainWindow::UpdateStatusBar(bool bEverything)
 {
     static ResString rsStatusTTDocSize(g_hRes, IDS_STATUSTTDOCSIZE);         // Length in bytes: %ld\r\nLines: %ld
+    static ResString rsStatusTTDocStats(g_hRes, IDS_STATUSTTDOCSTATS);       // Characters: %Iu\r\nWords: %Iu\r\nParagraphs: %Iu
     static ResString rsStatusTTCurPos(g_hRes, IDS_STATUSTTCURPOS);           // Line : %ld\r\nColumn : %ld\r\nSelection : %Iu | %Iu\r\nMatches: %ld
     static ResString rsStatusTTEOF(g_hRes, IDS_STATUSTTEOF);                 // Line endings: %s
     static ResString rsStatusTTTyping(g_hRes, IDS_STATUSTTTYPING);           // Typing mode: %s
@@ -1900,6 +2049,25 @@ void CMainWindow::UpdateStatusBar(bool bEverything)
     auto lengthInBytes      = m_editor.Call(SCI_GETLENGTH);
     auto bidi               = m_editor.Call(SCI_GETBIDIRECTIONAL);
 
+    auto docID       = m_TabBar.GetCurrentTabId();
+    bool isLargeFile = m_DocManager.HasDocumentID(docID) && m_DocManager.GetDocumentFromID(docID).m_largeFile;
+    if (isLargeFile)
+    {
+        // only a part of large files is loaded: show the numbers for the whole file
+        const auto& largeFile = *m_DocManager.GetDocumentFromID(docID).m_largeFile;
+        line += (long)largeFile.GetWindowFirstLine();
+        lineCount     = (long)largeFile.GetLineCount();
+        lengthInBytes = (sptr_t)largeFile.GetSize();
+    }
+    auto sDocSize = CStringUtils::Format(rsStatusTTDocSize, lengthInBytes, lineCount);
+    // the counts are kept up to date while editing, so getting them here is
+    // cheap. Large files are only loaded in parts and are not counted.
+    if (!isLargeFile)
+    {
+        auto counts = GetDocumentStatistics();
+        sDocSize += L"\r\n" + CStringUtils::Format(rsStatusTTDocStats, counts.characters, counts.words, counts.paragraphs);
+    }
+
     auto numberColor = 0x600000;
     if (CTheme::Instance().IsHighContrastModeDark())
         numberColor = CTheme::Instance().GetThemeColor(GetSysColor(COLOR_WINDOWTEXT));
@@ -1909,7 +2077,7 @@ void CMainWindow::UpdateStatusBar(bool bEverything)
     m_StatusBar.SetPart(STATUSBAR_CUR_POS,
                         CStringUtils::Format(rsStatusCurposLong, numberColor, line, numberColor, lineCount, numberColor, column),
                         CStringUtils::Format(rsStatusCurpos, numberColor, line, numberColor, lineCount, numberColor, column),
-                        CStringUtils::Format(rsStatusTTDocSize, lengthInBytes, lineCount),
+                        sDocSize,
                         200,
                         130,
                         0,
@@ -2957,9 +3125,34 @@ void CMainWindow::HandleUpdateUI(const SCNotification& scn)
     m_editor.MatchBraces(BraceMatch::Braces);
     m_editor.MatchTags();
     AddHotSpots();
+    CheckLargeFileWindow();
     UpdateStatusBar(false);
 }
 
+// Moves the window of a large file once the view gets close to one of its ends.
+// The text can't be replaced while Scintilla paints, so that's done later.
+void CMainWindow::CheckLargeFileWindow()
+{
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (m_largeFileWindowPending || !m_DocManager.HasDocumentID(docID))
+        return;
+    const auto& doc = m_DocManager.GetDocumentFromID(docID);
+    if (!doc.m_largeFile)
+        return;
+    // the same limits as in LoadLargeFileWindow(), the screen is small compared to the margin
+    auto        firstLine = m_editor.Call(SCI_DOCLINEFROMVISIBLE, m_editor.Call(SCI_GETFIRSTVISIBLELINE));
+    auto        startPos  = m_editor.Call(SCI_POSITIONFROMLINE, firstLine);
+    auto        margin    = static_cast<sptr_t>(CLargeFile::WindowMargin);
+    const auto& largeFile = *doc.m_largeFile;
+    bool        nearStart = startPos < margin && largeFile.GetWindowStart() > largeFile.GetContentStart();
+    bool        nearEnd   = m_editor.Call(SCI_GETLENGTH) - startPos < margin && largeFile.GetWindowEnd() < largeFile.GetSize();
+    if (nearStart || nearEnd)
+    {
+        m_largeFileWindowPending = true;
+        PostMessage(*this, WM_LARGEFILEWINDOW, 0, 0);
+    }
+}
+
 void CMainWindow::HandleAutoIndent(const SCNotification& scn)
 {
     int    eolMode      = int(m_editor.Call(SCI_GETEOLMODE));
@@ -3184,7 +3377,14 @@ int CMainWindow::OpenFile(const std::wstring& file, unsigned int openFlags)
                 return false;
         }
 
-        CDocument doc = m_DocManager.LoadFile(*this, filepath, encoding, createIfMissing);
+        // big files take a while to load: show the progress once it's reported,
+        // pressing escape abandons the load
+        std::atomic<bool> cancelLoad = false;
+        CDocument         doc;
+        {
+            CProgressReporter progress(*this, &cancelLoad);
+            doc = m_DocManager.LoadFile(*this, filepath, encoding, createIfMissing, std::ref(progress), &cancelLoad);
+        }
         if (doc.m_document)
         {
             DocID activetabid;
@@ -3301,6 +3501,12 @@ int CMainWindow::OpenFile(const std::wstring& file, unsigned int openFlags)
         else
         {
             CMRU::Instance().RemovePath(filepath, false);
+            if (cancelLoad)
+            {
+                ResString rTitle(g_hRes, IDS_APP_TITLE);
+                ResString rCancelled(g_hRes, IDS_OPENCANCELLED);
+                ::MessageBox(*this, CStringUtils::Format(rCancelled, filepath.c_str()).c_str(), (LPCWSTR)rTitle, MB_ICONINFORMATION);
+            }
         }
     }
     m_insertionIndex = -1;
@@ -3830,7 +4036,7 @@ bool CMainWindow::ReloadTab(int tab, int encoding, bool dueToOutsideChanges)
     }
 
     docreload.m_position          = doc.m_position;
-    docreload.m_bIsWriteProtected = doc.m_bIsWriteProtected;
+    docreload.m_bIsWriteProtected = doc.m_bIsWriteProtected || docreload.m_largeFile;
     docreload.m_saveCallback      = doc.m_saveCallback;
     auto lang                     = doc.GetLanguage();
     doc                           = docreload;
@@ -4103,6 +4309,9 @@ void CMainWindow::ReBlockUI(int blockCount)
 void CMainWindow::ShowProgressCtrl(UINT delay)
 {
     APPVERIFY(m_blockCount > 0);
+    // nested operations keep the bar of the outer one
+    if (m_progressCount++ > 0)
+        return;
 
     m_progressBar.SetDarkMode(CTheme::Instance().IsDarkTheme(), CTheme::Instance().GetThemeColor(::GetSysColor(COLOR_WINDOW)));
     RECT rect;
@@ -4115,9 +4324,26 @@ void CMainWindow::ShowProgressCtrl(UINT delay)
 
 void CMainWindow::HideProgressCtrl()
 {
+    --m_progressCount;
+    APPVERIFY(m_progressCount >= 0);
+    if (m_progressCount > 0)
+        return;
     ShowWindow(m_progressBar, SW_HIDE);
 }
 
+CDocumentStatistics::Counts CMainWindow::GetDocumentStatistics()
+{
+    auto docID = m_TabBar.GetCurrentTabId();
+    if (!m_DocManager.HasDocumentID(docID))
+        return {};
+    // the counts are kept with the document, so switching tabs doesn't
+    // count the whole document again
+    auto& doc = m_DocManager.GetModDocumentFromID(docID);
+    if (!doc.m_statistics)
+        doc.m_statistics = std::make_shared<CDocumentStatistics>();
+    return m_editor.GetDocumentStatistics(*doc.m_statistics);
+}
+
 void CMainWindow::SetProgress(DWORD32 pos, DWORD32 end)
 {
     m_progressBar.SetRange(0, end);
@@ -4125,6 +4351,60 @@ void CMainWindow::SetProgress(DWORD32 pos, DWORD32 end)
     UpdateWindow(m_progressBar);
 }
 
+CProgressReporter::CProgressReporter(CMainWindow& mainWindow, std::atomic<bool>* cancel)
+    : m_mainWindow(mainWindow)
+    , m_cancel(cancel)
+    , m_shown(false)
+    , m_nested(false)
+    , m_lastProgress(0)
+{
+}
+
+CProgressReporter::~CProgressReporter()
+{
+    if (m_shown)
+    {
+        m_mainWindow.HideProgressCtrl();
+        m_mainWindow.BlockAllUIUpdates(false);
+    }
+}
+
+void CProgressReporter::operator()(unsigned __int64 pos, unsigned __int64 end)
+{
+    if (!m_shown)
+    {
+        m_nested = m_mainWindow.m_progressCount > 0;
+        m_mainWindow.BlockAllUIUpdates(true);
+        m_mainWindow.ShowProgressCtrl((UINT)CIniSettings::Instance().GetInt64(L"View", L"progressdelay", 1000));
+        m_shown = true;
+    }
+    // some operations report every block: only redraw when the bar moves.
+    // Inside an operation that already shows its progress, e.g. opening
+    // several files, the bar keeps showing the outer progress.
+    auto current = DWORD32(pos * 1000 / std::max<unsigned __int64>(end, 1));
+    if (!m_nested && current != m_lastProgress)
+    {
+        m_mainWindow.SetProgress(current, 1000);
+        m_lastProgress = current;
+    }
+
+    // repaint, so the window shows the progress and isn't reported as not
+    // responding, but process nothing else: it is still blocked
+    MSG msg;
+    while (PeekMessage(&msg, nullptr, WM_KEYFIRST, WM_KEYLAST, PM_REMOVE))
+    {
+        if (m_cancel && msg.message == WM_KEYDOWN && msg.wParam == VK_ESCAPE)
+            *m_cancel = true;
+    }
+    while (PeekMessage(&msg, nullptr, WM_MOUSEFIRST, WM_MOUSELAST, PM_REMOVE))
+    {
+        if (m_cancel && msg.message == WM_LBUTTONUP && msg.hwnd == m_mainWindow.m_progressBar)
+            *m_cancel = true;
+    }
+    while (PeekMessage(&msg, nullptr, WM_PAINT, WM_PAINT, PM_REMOVE))
+        DispatchMessage(&msg);
+}
+
 void CMainWindow::SetFileTreeWidth(int width)
 {
     m_treeWidth = width;
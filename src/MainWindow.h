@@ -30,6 +30,7 @@
 #include <UIRibbon.h>
 #include <UIRibbonPropertyHelpers.h>
 #include <list>
+#include <atomic>
 
 const int COMMAND_TIMER_ID_START = 1000;
 
@@ -64,6 +65,7 @@ class CMainWindow : public CWindow
     , public IUICommandHandler
 {
     friend class ICommand;
+    friend class CProgressReporter;
 
 public:
     CMainWindow(HINSTANCE hInst, const WNDCLASSEX* wcx = nullptr);
@@ -83,6 +85,8 @@ public:
     bool         SaveDoc(DocID docID, const std::wstring& path);
     void         EnsureAtLeastOneTab();
     void         GoToLine(size_t line);
+    void         GotoLargeFileLine(unsigned __int64 line);
+    bool         FindInLargeFile(const std::string& searchFor, int searchFlags, bool& wrapped);
     bool         CloseTab(int tab, bool force = false, bool quitting = false);
     bool         CloseAllTabs(bool quitting = false);
     void         SetFileToOpen(const std::wstring& path, size_t line = (size_t)-1) { m_pathsToOpen[path] = line; }
@@ -125,6 +129,8 @@ private:
     HWND         FindAppMainWindow(HWND hStartWnd, bool* isThisInstance = nullptr) const;
     void         ResizeChildWindows();
     void         UpdateStatusBar(bool bEverything);
+    /// the counts of the active document
+    CDocumentStatistics::Counts GetDocumentStatistics();
     void         AddHotSpots();
 
     bool                          AskToCreateNonExistingFile(const std::wstring& path) const;
@@ -168,6 +174,8 @@ private:
     void     HandleWriteProtectedEdit();
     void     HandleSavePoint(const SCNotification& scn);
     void     HandleUpdateUI(const SCNotification& scn);
+    void     CheckLargeFileWindow();
+    sptr_t   LoadLargeFileWindow(unsigned __int64 offset);
     void     HandleAutoIndent(const SCNotification& scn);
     HRESULT  LoadRibbonSettings(IUnknown* pView);
     HRESULT  SaveRibbonSettings();
@@ -226,11 +234,13 @@ private:
     int                                             m_insertionIndex;
     bool                                            m_windowRestored;
     bool                                            m_inMenuLoop;
+    bool                                            m_largeFileWindowPending;
     std::unique_ptr<_IMAGELIST, HIMAGELIST_Deleter> m_TabBarImageList;
     CScintillaWnd                                   m_scratchEditor;
     std::map<std::wstring, int>                     m_foldercolorindexes;
     int                                             m_lastfoldercolorindex;
     int                                             m_blockCount;
+    int                                             m_progressCount;
     UI_HSBCOLOR                                     m_normalThemeText;
     UI_HSBCOLOR                                     m_normalThemeBack;
     UI_HSBCOLOR                                     m_normalThemeHigh;
@@ -252,3 +262,30 @@ private:
     IUIRibbon* m_pRibbon;
     UINT       m_RibbonHeight;
 };
+
+/// Reports the progress of a long operation that runs on the UI thread.
+/// The progress bar is shown with the first report and hidden again when the
+/// reporter goes out of scope. The window stays blocked until the operation
+/// is done: between the reports it is only repainted, all input is dropped
+/// so nothing can change while the operation runs.
+/// If another operation already shows the progress bar, it keeps showing
+/// the outer progress.
+/// If \c cancel is given, escape or a click on the progress bar sets it.
+/// Pass it to the operation with std::ref().
+class CProgressReporter
+{
+public:
+    CProgressReporter(CMainWindow& mainWindow, std::atomic<bool>* cancel = nullptr);
+    ~CProgressReporter();
+    CProgressReporter(const CProgressReporter&) = delete;
+    CProgressReporter& operator=(const CProgressReporter&) = delete;
+
+    void operator()(unsigned __int64 pos, unsigned __int64 end);
+
+private:
+    CMainWindow&       m_mainWindow;
+    std::atomic<bool>* m_cancel;
+    bool               m_shown;
+    bool               m_nested;
+    DWORD32            m_lastProgress;
+};
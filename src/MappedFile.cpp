@@ -0,0 +1,187 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "MappedFile.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#    include <sys/mman.h>
+#    include <unistd.h>
+#endif
+
+namespace
+{
+// size of the mapped window: on 64-bit we have plenty of address space,
+// on 32-bit keep it small enough to not fail with fragmented address space
+constexpr size_t MappedViewSize = sizeof(void*) > 4 ? 1024 * 1024 * 1024 : 64 * 1024 * 1024;
+
+struct CopyContext
+{
+    char*       dest;
+    const char* src;
+    size_t      len;
+};
+
+void CopyFunc(void* ctx)
+{
+    auto* c = static_cast<CopyContext*>(ctx);
+    memcpy(c->dest, c->src, c->len);
+}
+} // namespace
+
+#ifdef _WIN32
+bool GuardedMappedAccess(void (*func)(void* ctx), void* ctx)
+{
+    // note: no objects with destructors may live in this function,
+    // and func must not rely on stack unwinding either.
+    __try
+    {
+        func(ctx);
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+    {
+        return false;
+    }
+    return true;
+}
+
+CMappedFile::CMappedFile()
+{
+    SYSTEM_INFO si = {};
+    GetSystemInfo(&si);
+    m_granularity = si.dwAllocationGranularity;
+}
+#else
+bool GuardedMappedAccess(void (*func)(void* ctx), void* ctx)
+{
+    func(ctx);
+    return true;
+}
+
+CMappedFile::CMappedFile()
+{
+    m_granularity = static_cast<DWORD>(sysconf(_SC_PAGESIZE));
+}
+#endif
+
+CMappedFile::~CMappedFile()
+{
+    Close();
+}
+
+bool CMappedFile::Open(HANDLE hFile, unsigned __int64 fileSize)
+{
+    Close();
+    // empty files can't be mapped
+    if (fileSize == 0)
+        return false;
+#ifdef _WIN32
+    m_hMapping = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+#else
+    // keep a descriptor of our own, like the mapping handle does
+    m_fd = dup(FileDescriptor(hFile));
+#endif
+    if (!IsOpen())
+        return false;
+    m_fileSize = fileSize;
+    return true;
+}
+
+void CMappedFile::Close()
+{
+    UnmapView();
+    m_fileSize = 0;
+#ifdef _WIN32
+    m_hMapping.CloseHandle();
+#else
+    if (m_fd >= 0)
+        close(m_fd);
+    m_fd = -1;
+#endif
+}
+
+bool CMappedFile::IsOpen() const
+{
+#ifdef _WIN32
+    return m_hMapping.IsValid();
+#else
+    return m_fd >= 0;
+#endif
+}
+
+void CMappedFile::UnmapView()
+{
+    if (m_view)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_view);
+#else
+        munmap(const_cast<char*>(m_view), m_viewSize);
+#endif
+    }
+    m_view      = nullptr;
+    m_viewStart = 0;
+    m_viewSize  = 0;
+}
+
+const char* CMappedFile::GetData(unsigned __int64 offset, size_t& len)
+{
+    if (!IsOpen() || offset >= m_fileSize)
+    {
+        len = 0;
+        return nullptr;
+    }
+    len = static_cast<size_t>(std::min<unsigned __int64>(len, m_fileSize - offset));
+    if (m_view && offset >= m_viewStart && offset + len <= m_viewStart + m_viewSize)
+        return m_view + (offset - m_viewStart);
+
+    UnmapView();
+
+    // views must start at a multiple of the allocation granularity
+    unsigned __int64 start    = offset - (offset % m_granularity);
+    unsigned __int64 viewSize = std::max<unsigned __int64>(MappedViewSize, offset - start + len);
+    viewSize                  = std::min<unsigned __int64>(viewSize, m_fileSize - start);
+
+#ifdef _WIN32
+    m_view = static_cast<const char*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, static_cast<DWORD>(start >> 32), static_cast<DWORD>(start & 0xFFFFFFFF), static_cast<SIZE_T>(viewSize)));
+#else
+    void* view = mmap(nullptr, static_cast<size_t>(viewSize), PROT_READ, MAP_SHARED, m_fd, static_cast<off_t>(start));
+    m_view     = view == MAP_FAILED ? nullptr : static_cast<const char*>(view);
+    if (m_view)
+        madvise(view, static_cast<size_t>(viewSize), MADV_SEQUENTIAL);
+#endif
+    if (m_view == nullptr)
+    {
+        len = 0;
+        return nullptr;
+    }
+    m_viewStart = start;
+    m_viewSize  = static_cast<size_t>(viewSize);
+    return m_view + (offset - m_viewStart);
+}
+
+bool CMappedFile::Copy(char* dest, unsigned __int64 offset, size_t len)
+{
+    size_t      available = len;
+    const char* src       = GetData(offset, available);
+    if (src == nullptr || available != len)
+        return false;
+    CopyContext ctx = {dest, src, len};
+    return GuardedMappedAccess(CopyFunc, &ctx);
+}
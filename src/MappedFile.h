@@ -0,0 +1,66 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#ifdef _WIN32
+#    include "SmartHandle.h"
+#endif
+
+/// Read-only view on a file mapping.
+/// Only a window of the file is mapped at any time, so files larger than
+/// the available address space can be accessed as well. Pointers returned
+/// by GetData() are only valid until the next call to GetData() or Copy().
+/// Without Windows the file is mapped with mmap(), see compat/posix.
+class CMappedFile
+{
+public:
+    CMappedFile();
+    ~CMappedFile();
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    bool             Open(HANDLE hFile, unsigned __int64 fileSize);
+    void             Close();
+    bool             IsOpen() const;
+    unsigned __int64 GetSize() const { return m_fileSize; }
+
+    /// returns a pointer to the data at \c offset. \c len is clamped to
+    /// the end of the file. Returns nullptr if the view can't be mapped.
+    const char*      GetData(unsigned __int64 offset, size_t& len);
+    /// copies \c len bytes at \c offset to \c dest. Returns false if the
+    /// data can't be mapped or read, e.g. if the file got truncated or a
+    /// network share became unavailable.
+    bool             Copy(char* dest, unsigned __int64 offset, size_t len);
+
+private:
+#ifdef _WIN32
+    CAutoGeneralHandle m_hMapping;
+#else
+    int                m_fd        = -1;
+#endif
+    const char*        m_view      = nullptr;
+    unsigned __int64   m_viewStart = 0;
+    size_t             m_viewSize  = 0;
+    unsigned __int64   m_fileSize  = 0;
+    DWORD              m_granularity;
+
+    void UnmapView();
+};
+
+/// Runs \c func with a guard against EXCEPTION_IN_PAGE_ERROR, which is
+/// raised when reading from a mapped view fails. Returns false in that case.
+/// Without Windows a failed read raises SIGBUS instead, which isn't caught.
+bool GuardedMappedAccess(void (*func)(void* ctx), void* ctx);
@@ -0,0 +1,172 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "OccurrenceScanner.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#    define OCCURRENCESCANNER_SIMD
+#    include <intrin.h>
+#endif
+
+namespace
+{
+// the text is searched in blocks of this size, so a stopped scan ends quickly
+constexpr size_t BlockSize      = 1024 * 1024;
+// the lines found so far are handed on at most this often
+constexpr auto   NotifyInterval = std::chrono::milliseconds(100);
+
+// the number of line ends in [start, end) of the text. Same as Scintilla,
+// "\r\n", "\n" and a single "\r" all end a line.
+size_t CountLineEnds(std::string_view text, size_t start, size_t end)
+{
+    const char* first = text.data() + start;
+    const char* last  = text.data() + end;
+    size_t      count = std::count(first, last, '\n');
+    for (const char* p = first; (p = static_cast<const char*>(memchr(p, '\r', last - p))) != nullptr; ++p)
+    {
+        if (p + 1 == text.data() + text.size() || p[1] != '\n')
+            ++count;
+    }
+    return count;
+}
+} // namespace
+
+COccurrenceScanner::~COccurrenceScanner()
+{
+    Cancel();
+}
+
+void COccurrenceScanner::Start(HWND notifyWnd, std::string text, std::string needle)
+{
+    Cancel();
+    m_text   = std::move(text);
+    m_needle = std::move(needle);
+    m_stop   = false;
+    m_thread = std::thread(&COccurrenceScanner::ScanThread, this, notifyWnd);
+}
+
+void COccurrenceScanner::Cancel()
+{
+    m_stop = true;
+    if (m_thread.joinable())
+        m_thread.join();
+    std::string().swap(m_text);
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_lines.clear();
+    m_count = 0;
+}
+
+size_t COccurrenceScanner::TakeLines(std::vector<size_t>& lines)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    lines.swap(m_lines);
+    m_lines.clear();
+    auto count = m_count;
+    m_count    = 0;
+    return count;
+}
+
+size_t COccurrenceScanner::Find(std::string_view text, std::string_view needle, size_t start)
+{
+    if (needle.empty() || start > text.size() || text.size() - start < needle.size())
+        return std::string_view::npos;
+    if (needle.size() == 1)
+    {
+        auto found = static_cast<const char*>(memchr(text.data() + start, needle[0], text.size() - start));
+        return found ? found - text.data() : std::string_view::npos;
+    }
+    size_t pos = start;
+#ifdef OCCURRENCESCANNER_SIMD
+    // compare the first and the last byte of the needle at 16 positions at
+    // once, only where both match the whole needle is compared
+    const char*   data      = text.data();
+    const size_t  lastStart = text.size() - needle.size();
+    const __m128i first     = _mm_set1_epi8(needle.front());
+    const __m128i last      = _mm_set1_epi8(needle.back());
+    for (; pos + 16 <= lastStart + 1; pos += 16)
+    {
+        const __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos));
+        const __m128i blockLast  = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + pos + needle.size() - 1));
+        unsigned      mask       = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(blockFirst, first), _mm_cmpeq_epi8(blockLast, last)));
+        while (mask)
+        {
+            auto offset = static_cast<size_t>(std::countr_zero(mask));
+            if (memcmp(data + pos + offset + 1, needle.data() + 1, needle.size() - 2) == 0)
+                return pos + offset;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return text.find(needle, pos);
+}
+
+void COccurrenceScanner::ScanThread(HWND notifyWnd)
+{
+    std::string_view    text(m_text);
+    std::vector<size_t> lines;
+    size_t              count      = 0;
+    size_t              line       = 0;
+    size_t              linePos    = 0;
+    size_t              pos        = 0;
+    auto                lastNotify = std::chrono::steady_clock::now();
+    auto                handOn     = [&]() {
+        {
+            std::lock_guard<std::mutex> lk(m_mutex);
+            m_lines.insert(m_lines.end(), lines.begin(), lines.end());
+            m_count += count;
+        }
+        lines.clear();
+        count      = 0;
+        lastNotify = std::chrono::steady_clock::now();
+        PostMessage(notifyWnd, WM_OCCURRENCESFOUND, 0, 0);
+    };
+    while (!m_stop)
+    {
+        // only matches that start in the current block are found, but they
+        // may end in the next one
+        size_t blockEnd = std::min<size_t>(text.size(), pos + BlockSize);
+        auto   found    = Find(text.substr(0, std::min<size_t>(text.size(), blockEnd + m_needle.size() - 1)), m_needle, pos);
+        if (found == std::string_view::npos)
+        {
+            if (blockEnd >= text.size())
+                break;
+            pos = blockEnd;
+        }
+        else
+        {
+            line += CountLineEnds(text, linePos, found);
+            linePos = found;
+            if (lines.empty() || lines.back() != line)
+                lines.push_back(line);
+            ++count;
+            // the occurrences don't overlap
+            pos = found + m_needle.size();
+        }
+        if (!lines.empty() && std::chrono::steady_clock::now() - lastNotify >= NotifyInterval)
+            handOn();
+    }
+    if (!m_stop)
+        handOn();
+    // the copy isn't needed anymore
+    std::string().swap(m_text);
+}
@@ -0,0 +1,64 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/// Finds all occurrences of a string in a document on a background thread.
+///
+/// The scan runs over a copy of the document text, so the document can be
+/// edited while it runs. The lines with occurrences are collected in batches
+/// and WM_OCCURRENCESFOUND is posted to the window passed to Start() for
+/// every batch, the UI thread then fetches them with TakeLines().
+/// Starting a new scan or calling Cancel() drops everything the previous
+/// scan found and not yet handed on.
+class COccurrenceScanner
+{
+public:
+    COccurrenceScanner() = default;
+    ~COccurrenceScanner();
+
+    COccurrenceScanner(const COccurrenceScanner&) = delete;
+    COccurrenceScanner& operator=(const COccurrenceScanner&) = delete;
+
+    void   Start(HWND notifyWnd, std::string text, std::string needle);
+    /// stops the scan and waits for the thread to end
+    void   Cancel();
+    /// moves the lines found since the last call to \c lines, every line
+    /// only once per batch. Returns the number of occurrences in them.
+    size_t TakeLines(std::vector<size_t>& lines);
+
+    /// returns the position of the first occurrence of \c needle at or
+    /// after \c start, or std::string_view::npos. Case sensitive.
+    static size_t Find(std::string_view text, std::string_view needle, size_t start);
+
+private:
+    void ScanThread(HWND notifyWnd);
+
+    std::thread         m_thread;
+    std::atomic<bool>   m_stop = false;
+    std::string         m_text;
+    std::string         m_needle;
+    // the results not yet taken by the UI thread
+    std::mutex          m_mutex;
+    std::vector<size_t> m_lines;
+    size_t              m_count = 0;
+};
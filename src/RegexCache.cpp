@@ -0,0 +1,137 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "RegexCache.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace
+{
+constexpr __int64 DefaultMaxEntries = 64;
+
+// the kinds of regexes, the first character of the keys
+enum class Kind : char
+{
+    Regex  = 'r',
+    WRegex = 'w',
+    Engine = 'e',
+};
+
+std::string MakeKey(Kind kind, unsigned int flags, std::string_view pattern)
+{
+    std::string key;
+    key.reserve(pattern.size() + 12);
+    key += static_cast<char>(kind);
+    key += std::to_string(flags);
+    key += '\0';
+    key += pattern;
+    return key;
+}
+} // namespace
+
+CRegexCache& CRegexCache::Instance()
+{
+    static CRegexCache instance;
+    return instance;
+}
+
+template <typename Compile>
+CRegexCache::Compiled CRegexCache::Get(std::string key, Compile compile)
+{
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        auto                        found = m_index.find(key);
+        if (found != m_index.end())
+        {
+            m_entries.splice(m_entries.begin(), m_entries, found->second);
+            ++m_stats.hits;
+            return found->second->compiled;
+        }
+    }
+    // compile without holding the lock, other threads may need other
+    // regexes meanwhile. If two threads compile the same regex, the
+    // first one to finish gets cached.
+    auto     start    = std::chrono::steady_clock::now();
+    Compiled compiled = compile();
+    auto     micros   = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    ++m_stats.misses;
+    m_stats.compileMicros += micros;
+    if (m_maxEntries == 0)
+        m_maxEntries = static_cast<size_t>(std::max<__int64>(1, CIniSettings::Instance().GetInt64(L"searchreplace", L"regexcachesize", DefaultMaxEntries)));
+    if (m_index.find(key) == m_index.end())
+    {
+        m_entries.push_front(Entry{std::move(key), compiled});
+        m_index[m_entries.front().key] = m_entries.begin();
+        while (m_entries.size() > m_maxEntries)
+        {
+            m_index.erase(m_entries.back().key);
+            m_entries.pop_back();
+        }
+    }
+    m_stats.entries = m_entries.size();
+    CTraceToOutputDebugString::Instance()(L"BowPad : regex compiled in %I64d us, regex cache: %I64u hits, %I64u misses, %I64u us compiling\n",
+                                          static_cast<__int64>(micros), m_stats.hits, m_stats.misses, m_stats.compileMicros);
+    return compiled;
+}
+
+std::shared_ptr<const std::regex> CRegexCache::GetRegex(const std::string& pattern, std::regex_constants::syntax_option_type flags)
+{
+    auto compiled = Get(MakeKey(Kind::Regex, flags, pattern), [&]() {
+        return Compiled{std::make_shared<const std::regex>(pattern, flags)};
+    });
+    return std::static_pointer_cast<const std::regex>(compiled.regex);
+}
+
+std::shared_ptr<const std::wregex> CRegexCache::GetWRegex(const std::wstring& pattern, std::regex_constants::syntax_option_type flags)
+{
+    std::string_view bytes(reinterpret_cast<const char*>(pattern.data()), pattern.size() * sizeof(wchar_t));
+    auto             compiled = Get(MakeKey(Kind::WRegex, flags, bytes), [&]() {
+        return Compiled{std::make_shared<const std::wregex>(pattern, flags)};
+    });
+    return std::static_pointer_cast<const std::wregex>(compiled.regex);
+}
+
+std::shared_ptr<const CRegexEngine> CRegexCache::GetEngine(std::string_view pattern, bool caseSensitive, CRegexEngine::CompileResult& result)
+{
+    auto compiled = Get(MakeKey(Kind::Engine, caseSensitive ? 1 : 0, pattern), [&]() {
+        auto engine = std::make_shared<CRegexEngine>();
+        auto res    = engine->Compile(pattern, caseSensitive);
+        if (res != CRegexEngine::CompileResult::Ok)
+            engine.reset();
+        return Compiled{std::move(engine), res};
+    });
+    result = compiled.result;
+    return std::static_pointer_cast<const CRegexEngine>(compiled.regex);
+}
+
+CRegexCache::Statistics CRegexCache::GetStatistics() const
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_stats;
+}
+
+void CRegexCache::Clear()
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_index.clear();
+    m_entries.clear();
+    m_stats.entries = 0;
+}
@@ -0,0 +1,90 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "RegexEngine.h"
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// Keeps the most recently used compiled regexes for the whole process.
+///
+/// The searches, the function list, the regex capture and everything else
+/// that runs regexes get them from here, so a regex that is used again is
+/// not compiled again. The entries are keyed by the pattern, the flags and
+/// the kind of regex, and the least recently used ones are dropped once
+/// there are more than the [searchreplace] \c regexcachesize of the ini.
+///
+/// The compiled regexes are shared and must not be modified, running them
+/// from several threads at once is fine. All methods can be called from
+/// multiple threads.
+class CRegexCache
+{
+public:
+    struct Statistics
+    {
+        unsigned __int64 hits          = 0;
+        unsigned __int64 misses        = 0;
+        /// total time spent compiling regexes, in microseconds
+        unsigned __int64 compileMicros = 0;
+        size_t           entries       = 0;
+    };
+
+    static CRegexCache& Instance();
+
+    /// returns the compiled regex, throws std::regex_error if the pattern is invalid
+    std::shared_ptr<const std::regex>  GetRegex(const std::string& pattern, std::regex_constants::syntax_option_type flags);
+    std::shared_ptr<const std::wregex> GetWRegex(const std::wstring& pattern, std::regex_constants::syntax_option_type flags);
+    /// returns the regex compiled by the utf8 regex engine and sets \c result.
+    /// Returns nullptr if the engine can't compile the pattern, that is
+    /// remembered as well.
+    std::shared_ptr<const CRegexEngine> GetEngine(std::string_view pattern, bool caseSensitive, CRegexEngine::CompileResult& result);
+
+    Statistics GetStatistics() const;
+    void       Clear();
+
+private:
+    CRegexCache() = default;
+
+    struct Compiled
+    {
+        std::shared_ptr<const void> regex;
+        CRegexEngine::CompileResult result = CRegexEngine::CompileResult::Ok;
+    };
+    struct Entry
+    {
+        std::string key;
+        Compiled    compiled;
+    };
+
+    /// returns the regex for \c key, compiling it with \c compile if it is
+    /// not cached yet. \c compile may throw, failures are not cached then.
+    template <typename Compile>
+    Compiled Get(std::string key, Compile compile);
+
+    mutable std::mutex                                               m_mutex;
+    // the most recently used entry comes first
+    std::list<Entry>                                                 m_entries;
+    // keyed by views of the keys in m_entries
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index;
+    size_t                                                           m_maxEntries = 0;
+    Statistics                                                       m_stats;
+};
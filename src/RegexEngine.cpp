@@ -0,0 +1,2116 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "RegexEngine.h"
+#include "../ext/scintilla/src/CaseConvert.h"
+#include "../ext/scintilla/lexlib/CharacterCategory.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <unordered_map>
+
+namespace
+{
+constexpr int      Unlimited       = -1;
+// limits for the regexes the engine compiles, bigger ones are left to std::regex
+constexpr size_t   MaxProgramSize  = 100000;
+constexpr int      MaxRepeatCount  = 1000;
+constexpr int      MaxNestingDepth = 250;
+// the thread states of the Pike VM, see Matcher::Mark()
+constexpr int      MaxScopeDepth   = 16;
+constexpr size_t   MaxThreadStates = 1 << 20;
+// the DFA states kept per thread, about 600 bytes each
+constexpr size_t   MaxDfaStates    = 5000;
+// invalid utf8 bytes are decoded to InvalidByteBase + the byte value,
+// so they don't match any real character
+constexpr char32_t InvalidByteBase = 0x110000;
+constexpr size_t   npos            = std::string_view::npos;
+
+std::atomic<unsigned int> g_nextEngineId = 0;
+
+enum BuiltinClass : unsigned int
+{
+    ClassDigit    = 1 << 0,
+    ClassNotDigit = 1 << 1,
+    ClassWord     = 1 << 2,
+    ClassNotWord  = 1 << 3,
+    ClassSpace    = 1 << 4,
+    ClassNotSpace = 1 << 5,
+};
+
+// decodes the character at pos, returns its length in bytes
+size_t DecodeUtf8(std::string_view text, size_t pos, size_t end, char32_t& ch)
+{
+    auto b0 = static_cast<unsigned char>(text[pos]);
+    if (b0 < 0x80)
+    {
+        ch = b0;
+        return 1;
+    }
+    size_t   len      = 0;
+    char32_t minValue = 0;
+    if ((b0 & 0xE0) == 0xC0)
+    {
+        len      = 2;
+        ch       = b0 & 0x1F;
+        minValue = 0x80;
+    }
+    else if ((b0 & 0xF0) == 0xE0)
+    {
+        len      = 3;
+        ch       = b0 & 0x0F;
+        minValue = 0x800;
+    }
+    else if ((b0 & 0xF8) == 0xF0)
+    {
+        len      = 4;
+        ch       = b0 & 0x07;
+        minValue = 0x10000;
+    }
+    if (len == 0 || pos + len > end)
+    {
+        ch = InvalidByteBase + b0;
+        return 1;
+    }
+    for (size_t i = 1; i < len; ++i)
+    {
+        auto b = static_cast<unsigned char>(text[pos + i]);
+        if ((b & 0xC0) != 0x80)
+        {
+            ch = InvalidByteBase + b0;
+            return 1;
+        }
+        ch = (ch << 6) | (b & 0x3F);
+    }
+    if (ch < minValue || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+    {
+        ch = InvalidByteBase + b0;
+        return 1;
+    }
+    return len;
+}
+
+char32_t PreviousChar(std::string_view text, size_t pos)
+{
+    size_t start = pos - 1;
+    while (start > 0 && pos - start < 4 && (static_cast<unsigned char>(text[start]) & 0xC0) == 0x80)
+        --start;
+    char32_t ch = 0;
+    if (DecodeUtf8(text, start, pos, ch) != pos - start)
+        ch = InvalidByteBase + static_cast<unsigned char>(text[pos - 1]);
+    return ch;
+}
+
+// returns the end of the character \c pos is inside of, or \c pos
+size_t CharBoundary(std::string_view text, size_t pos)
+{
+    size_t start = pos;
+    while (start > 0 && start < text.size() && pos - start < 3 && (static_cast<unsigned char>(text[start]) & 0xC0) == 0x80)
+        --start;
+    if (start == pos)
+        return pos;
+    char32_t ch = 0;
+    return std::max<size_t>(pos, start + DecodeUtf8(text, start, text.size(), ch));
+}
+
+char32_t ConvertCase(char32_t ch, Scintilla::CaseConversion conversion)
+{
+    if (ch >= InvalidByteBase)
+        return ch;
+    const char* converted = Scintilla::CaseConvert(static_cast<int>(ch), conversion);
+    if (converted == nullptr || *converted == 0)
+        return ch;
+    std::string_view conv(converted);
+    char32_t         result = 0;
+    // conversions to several characters can't be matched character by character
+    if (DecodeUtf8(conv, 0, conv.size(), result) != conv.size())
+        return ch;
+    return result;
+}
+
+char32_t Fold(char32_t ch)
+{
+    if (ch < 0x80)
+        return (ch >= 'A' && ch <= 'Z') ? ch + 'a' - 'A' : ch;
+    return ConvertCase(ch, Scintilla::CaseConversionFold);
+}
+
+char32_t ToUpper(char32_t ch)
+{
+    if (ch < 0x80)
+        return (ch >= 'a' && ch <= 'z') ? ch - 'a' + 'A' : ch;
+    return ConvertCase(ch, Scintilla::CaseConversionUpper);
+}
+
+char32_t ToLower(char32_t ch)
+{
+    if (ch < 0x80)
+        return (ch >= 'A' && ch <= 'Z') ? ch + 'a' - 'A' : ch;
+    return ConvertCase(ch, Scintilla::CaseConversionLower);
+}
+
+bool IsDigit(char32_t ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+bool IsWordChar(char32_t ch)
+{
+    if (ch < 0x80)
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || IsDigit(ch) || ch == '_';
+    if (ch >= InvalidByteBase)
+        return false;
+    auto cat = Scintilla::CategoriseCharacter(static_cast<int>(ch));
+    return cat <= Scintilla::ccLo || cat == Scintilla::ccNd;
+}
+
+bool IsSpace(char32_t ch)
+{
+    if (ch < 0x80)
+        return ch == ' ' || (ch >= '\t' && ch <= '\r');
+    if (ch == 0xA0 || ch == 0xFEFF || ch == 0x2028 || ch == 0x2029)
+        return true;
+    return ch < InvalidByteBase && Scintilla::CategoriseCharacter(static_cast<int>(ch)) == Scintilla::ccZs;
+}
+
+// the line terminators of ECMAScript, ^ and $ match after and before each of
+// them, so both also match between the \r and the \n of a \r\n
+bool IsLineTerminator(char32_t ch)
+{
+    return ch == '\n' || ch == '\r' || ch == 0x2028 || ch == 0x2029;
+}
+
+bool IsLineStart(std::string_view text, size_t pos)
+{
+    return pos == 0 || IsLineTerminator(PreviousChar(text, pos));
+}
+
+bool IsLineEnd(std::string_view text, size_t pos)
+{
+    if (pos >= text.size())
+        return true;
+    char32_t ch = 0;
+    DecodeUtf8(text, pos, text.size(), ch);
+    return IsLineTerminator(ch);
+}
+
+bool IsWordBoundary(std::string_view text, size_t pos)
+{
+    bool wordBefore = pos > 0 && IsWordChar(PreviousChar(text, pos));
+    bool wordAfter  = false;
+    if (pos < text.size())
+    {
+        char32_t ch = 0;
+        DecodeUtf8(text, pos, text.size(), ch);
+        wordAfter = IsWordChar(ch);
+    }
+    return wordBefore != wordAfter;
+}
+
+unsigned char LeadByte(char32_t ch)
+{
+    if (ch < 0x80)
+        return static_cast<unsigned char>(ch);
+    if (ch < 0x800)
+        return static_cast<unsigned char>(0xC0 | (ch >> 6));
+    if (ch < 0x10000)
+        return static_cast<unsigned char>(0xE0 | (ch >> 12));
+    return static_cast<unsigned char>(0xF0 | (ch >> 18));
+}
+} // namespace
+
+// Parses the regex into a syntax tree and generates the program from it.
+class CRegexEngine::Compiler
+{
+public:
+    Compiler(CRegexEngine& engine)
+        : m_engine(engine)
+        , m_program(&engine.m_program)
+    {
+    }
+
+    CompileResult Compile(std::string_view pattern);
+
+private:
+    enum class NodeKind
+    {
+        Empty,
+        Char,
+        Any,
+        Class,
+        Concat,
+        Alternation,
+        Repeat,
+        Group,
+        Assertion,
+        LookAhead,
+    };
+
+    struct Node
+    {
+        NodeKind         kind;
+        char32_t         ch     = 0;
+        int              index     = 0; ///< class index or group number
+        int              min       = 0;
+        int              max       = 0;
+        bool             greedy    = true;
+        Op               op        = Op::Match; ///< op of assertions and lookaheads
+        int              lastGroup = 0;         ///< repeats: the groups index..lastGroup are repeated
+        std::vector<int> children;
+    };
+
+    int      Fail(CompileResult result);
+    int      AddNode(NodeKind kind);
+    bool     AtEnd() const { return m_pos >= m_pattern.size(); }
+    char32_t Peek(size_t offset = 0) const { return m_pos + offset < m_pattern.size() ? m_pattern[m_pos + offset] : 0; }
+
+    int      ParseDisjunction(int depth);
+    int      ParseAlternative(int depth);
+    int      ParseTerm(int depth);
+    int      ParseAtom(int depth);
+    int      ParseEscape();
+    int      ParseClass();
+    int      ParseClassAtom(CharClass& cls, char32_t& ch);
+    int      ParseCharEscape(char32_t escaped, char32_t& ch);
+    bool     ParseQuantifier(int& min, int& max, bool& greedy);
+    bool     ParseHex(size_t digits, char32_t& value);
+    int      NoQuantifier(int node);
+
+    bool     CanMatchEmpty(int node) const;
+    void     Emit(int node);
+    void     EmitIteration(const Node& node, bool optional);
+    int      EmitInstruction(Op op, int x = 0, int y = 0, char32_t ch = 0);
+    void     SetSplit(int split, int body, int exit, bool greedy);
+
+    CRegexEngine&                    m_engine;
+    std::vector<Instruction>*        m_program; ///< the program instructions are emitted to
+    bool                             m_reverse = false;
+    std::u32string                   m_pattern;
+    size_t                           m_pos        = 0;
+    int                              m_groupCount    = 0;
+    int                              m_progressSlots = 0;
+    int                              m_scope         = -1; ///< the progress scope emitted instructions are in
+    int                              m_scopeDepth    = 0;
+    std::vector<Node>                m_nodes;
+    std::vector<std::pair<int, int>> m_pendingLookAheads; ///< instruction and node
+    CompileResult                    m_result = CompileResult::Ok;
+};
+
+CRegexEngine::CompileResult CRegexEngine::Compiler::Compile(std::string_view pattern)
+{
+    for (size_t pos = 0; pos < pattern.size();)
+    {
+        char32_t ch = 0;
+        pos += DecodeUtf8(pattern, pos, pattern.size(), ch);
+        if (ch >= InvalidByteBase)
+            return CompileResult::Invalid;
+        m_pattern.push_back(ch);
+    }
+
+    int root = ParseDisjunction(0);
+    if (root < 0)
+        return m_result;
+    if (!AtEnd())
+        return CompileResult::Invalid; // unbalanced ')'
+
+    EmitInstruction(Op::Save, 0);
+    Emit(root);
+    EmitInstruction(Op::Save, 1);
+    EmitInstruction(Op::Match);
+    // the lookaheads are separate programs after the main one
+    for (size_t i = 0; i < m_pendingLookAheads.size() && m_result == CompileResult::Ok; ++i)
+    {
+        auto [instruction, node]          = m_pendingLookAheads[i];
+        m_engine.m_program[instruction].x = static_cast<int>(m_engine.m_program.size());
+        Emit(node);
+        EmitInstruction(Op::Match);
+    }
+    m_engine.m_groupSlotCount = (m_groupCount + 1) * 2;
+    m_engine.m_slotCount      = m_engine.m_groupSlotCount + m_progressSlots;
+    if (m_result != CompileResult::Ok)
+        return m_result;
+    if (m_engine.m_program.size() * m_engine.m_statesPerPc > MaxThreadStates)
+        return CompileResult::Unsupported;
+
+    // the DFA can't run lookaheads and the progress checks of repeats, it
+    // needs the program for the reversed regex to find where matches start
+    bool dfaPossible = std::none_of(m_engine.m_program.begin(), m_engine.m_program.end(), [](const Instruction& inst) {
+        return inst.op == Op::LookAhead || inst.op == Op::NegativeLookAhead || inst.op == Op::CheckProgress;
+    });
+    if (dfaPossible)
+    {
+        m_program = &m_engine.m_reverseProgram;
+        m_reverse = true;
+        Emit(root);
+        EmitInstruction(Op::Match);
+        if (m_result != CompileResult::Ok)
+        {
+            // too big, the Pike VM has to do without the DFA
+            m_engine.m_reverseProgram.clear();
+            m_result = CompileResult::Ok;
+        }
+    }
+    return m_result;
+}
+
+int CRegexEngine::Compiler::Fail(CompileResult result)
+{
+    if (m_result == CompileResult::Ok)
+        m_result = result;
+    return -1;
+}
+
+int CRegexEngine::Compiler::AddNode(NodeKind kind)
+{
+    m_nodes.push_back(Node());
+    m_nodes.back().kind = kind;
+    return static_cast<int>(m_nodes.size() - 1);
+}
+
+int CRegexEngine::Compiler::ParseDisjunction(int depth)
+{
+    if (depth > MaxNestingDepth)
+        return Fail(CompileResult::Unsupported);
+    int first = ParseAlternative(depth);
+    if (first < 0 || Peek() != '|')
+        return first;
+    int alternation = AddNode(NodeKind::Alternation);
+    m_nodes[alternation].children.push_back(first);
+    while (!AtEnd() && Peek() == '|')
+    {
+        ++m_pos;
+        int alternative = ParseAlternative(depth);
+        if (alternative < 0)
+            return -1;
+        m_nodes[alternation].children.push_back(alternative);
+    }
+    return alternation;
+}
+
+int CRegexEngine::Compiler::ParseAlternative(int depth)
+{
+    int sequence = AddNode(NodeKind::Concat);
+    while (!AtEnd() && Peek() != '|' && Peek() != ')')
+    {
+        int term = ParseTerm(depth);
+        if (term < 0)
+            return -1;
+        m_nodes[sequence].children.push_back(term);
+    }
+    return sequence;
+}
+
+int CRegexEngine::Compiler::NoQuantifier(int node)
+{
+    // quantified assertions are not standard ECMAScript, leave them to std::regex
+    auto c = Peek();
+    if (c == '*' || c == '+' || c == '?' || c == '{')
+        return Fail(CompileResult::Unsupported);
+    return node;
+}
+
+int CRegexEngine::Compiler::ParseTerm(int depth)
+{
+    auto c = Peek();
+    if (c == '^' || c == '$')
+    {
+        ++m_pos;
+        int node         = AddNode(NodeKind::Assertion);
+        m_nodes[node].op = c == '^' ? Op::LineStart : Op::LineEnd;
+        return NoQuantifier(node);
+    }
+    if (c == '\\' && (Peek(1) == 'b' || Peek(1) == 'B'))
+    {
+        int node         = AddNode(NodeKind::Assertion);
+        m_nodes[node].op = Peek(1) == 'b' ? Op::WordBoundary : Op::NotWordBoundary;
+        m_pos += 2;
+        return NoQuantifier(node);
+    }
+    if (c == '(' && Peek(1) == '?' && (Peek(2) == '=' || Peek(2) == '!'))
+    {
+        int node         = AddNode(NodeKind::LookAhead);
+        m_nodes[node].op = Peek(2) == '=' ? Op::LookAhead : Op::NegativeLookAhead;
+        m_pos += 3;
+        int groupCount = m_groupCount;
+        int child      = ParseDisjunction(depth + 1);
+        if (child < 0)
+            return -1;
+        // groups in lookaheads would have to be set by the lookahead match
+        if (m_groupCount != groupCount)
+            return Fail(CompileResult::Unsupported);
+        if (Peek() != ')')
+            return Fail(CompileResult::Invalid);
+        ++m_pos;
+        m_nodes[node].children.push_back(child);
+        // ECMAScript allows quantified lookaheads (Annex B). A repetition that
+        // matches nothing ends the loop, so only the required ones count:
+        // none makes the lookahead match the empty string, any other number
+        // is the same as checking it once
+        int  min    = 0;
+        int  max    = 0;
+        bool greedy = true;
+        if (!ParseQuantifier(min, max, greedy))
+            return m_result == CompileResult::Ok ? node : -1;
+        if (max != Unlimited && min > max)
+            return Fail(CompileResult::Invalid);
+        return min == 0 ? AddNode(NodeKind::Concat) : node;
+    }
+
+    int groupCount = m_groupCount;
+    int atom       = ParseAtom(depth);
+    if (atom < 0)
+        return -1;
+    int  min    = 0;
+    int  max    = 0;
+    bool greedy = true;
+    if (!ParseQuantifier(min, max, greedy))
+        return m_result == CompileResult::Ok ? atom : -1;
+    if (max != Unlimited && min > max)
+        return Fail(CompileResult::Invalid);
+    if (min > MaxRepeatCount || max > MaxRepeatCount)
+        return Fail(CompileResult::Unsupported);
+    int node             = AddNode(NodeKind::Repeat);
+    m_nodes[node].min    = min;
+    m_nodes[node].max    = max;
+    m_nodes[node].greedy = greedy;
+    if (m_groupCount > groupCount)
+    {
+        m_nodes[node].index     = groupCount + 1;
+        m_nodes[node].lastGroup = m_groupCount;
+    }
+    m_nodes[node].children.push_back(atom);
+    return node;
+}
+
+bool CRegexEngine::Compiler::ParseQuantifier(int& min, int& max, bool& greedy)
+{
+    auto c = Peek();
+    if (c == '*')
+    {
+        min = 0;
+        max = Unlimited;
+    }
+    else if (c == '+')
+    {
+        min = 1;
+        max = Unlimited;
+    }
+    else if (c == '?')
+    {
+        min = 0;
+        max = 1;
+    }
+    else if (c == '{')
+    {
+        auto parseNumber = [this](int& value) {
+            size_t start = m_pos;
+            value        = 0;
+            while (IsDigit(Peek()))
+            {
+                value = std::min<int>(value * 10 + static_cast<int>(Peek() - '0'), MaxRepeatCount + 1);
+                ++m_pos;
+            }
+            return m_pos > start;
+        };
+        ++m_pos;
+        if (!parseNumber(min))
+        {
+            Fail(CompileResult::Invalid);
+            return false;
+        }
+        max = min;
+        if (Peek() == ',')
+        {
+            ++m_pos;
+            if (!parseNumber(max))
+                max = Unlimited;
+        }
+        if (Peek() != '}')
+        {
+            Fail(CompileResult::Invalid);
+            return false;
+        }
+    }
+    else
+        return false;
+    ++m_pos;
+    greedy = true;
+    if (Peek() == '?')
+    {
+        greedy = false;
+        ++m_pos;
+    }
+    return true;
+}
+
+int CRegexEngine::Compiler::ParseAtom(int depth)
+{
+    auto c = Peek();
+    switch (c)
+    {
+        case '.':
+            ++m_pos;
+            return AddNode(NodeKind::Any);
+        case '(':
+        {
+            int group = -1;
+            if (Peek(1) == '?')
+            {
+                // named groups, lookbehinds and whatever std::regex supports
+                if (Peek(2) != ':')
+                    return Fail(CompileResult::Unsupported);
+                m_pos += 3;
+            }
+            else
+            {
+                group = ++m_groupCount;
+                ++m_pos;
+            }
+            int child = ParseDisjunction(depth + 1);
+            if (child < 0)
+                return -1;
+            if (Peek() != ')')
+                return Fail(CompileResult::Invalid);
+            ++m_pos;
+            if (group < 0)
+                return child;
+            int node            = AddNode(NodeKind::Group);
+            m_nodes[node].index = group;
+            m_nodes[node].children.push_back(child);
+            return node;
+        }
+        case '[':
+            return ParseClass();
+        case '\\':
+            return ParseEscape();
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            // nothing to repeat
+            return Fail(CompileResult::Invalid);
+        default:
+        {
+            ++m_pos;
+            int node         = AddNode(NodeKind::Char);
+            m_nodes[node].ch = c;
+            return node;
+        }
+    }
+}
+
+bool CRegexEngine::Compiler::ParseHex(size_t digits, char32_t& value)
+{
+    value = 0;
+    for (size_t i = 0; i < digits; ++i)
+    {
+        auto c = Peek();
+        if (IsDigit(c))
+            value = value * 16 + (c - '0');
+        else if (c >= 'a' && c <= 'f')
+            value = value * 16 + (c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')
+            value = value * 16 + (c - 'A' + 10);
+        else
+            return false;
+        ++m_pos;
+    }
+    return true;
+}
+
+// parses the escapes that are the same in and outside of classes, the
+// backslash and the escaped char are already consumed.
+// Returns 1 if \c ch was set, -1 on errors.
+int CRegexEngine::Compiler::ParseCharEscape(char32_t escaped, char32_t& ch)
+{
+    switch (escaped)
+    {
+        case 'n':
+            ch = '\n';
+            return 1;
+        case 'r':
+            ch = '\r';
+            return 1;
+        case 't':
+            ch = '\t';
+            return 1;
+        case 'f':
+            ch = '\f';
+            return 1;
+        case 'v':
+            ch = '\v';
+            return 1;
+        case '0':
+            // octal escapes are not ECMAScript
+            if (IsDigit(Peek()))
+                return Fail(CompileResult::Unsupported);
+            ch = 0;
+            return 1;
+        case 'x':
+            if (!ParseHex(2, ch))
+                return Fail(CompileResult::Invalid);
+            return 1;
+        case 'u':
+            if (!ParseHex(4, ch))
+                return Fail(CompileResult::Invalid);
+            return 1;
+        case 'c':
+        {
+            auto letter = Peek();
+            if (!((letter >= 'a' && letter <= 'z') || (letter >= 'A' && letter <= 'Z')))
+                return Fail(CompileResult::Unsupported);
+            ++m_pos;
+            ch = letter % 32;
+            return 1;
+        }
+        default:
+            break;
+    }
+    // back references and unknown escapes
+    if (escaped < 0x80 && (IsDigit(escaped) || (escaped >= 'a' && escaped <= 'z') || (escaped >= 'A' && escaped <= 'Z')))
+        return Fail(CompileResult::Unsupported);
+    ch = escaped;
+    return 1;
+}
+
+int CRegexEngine::Compiler::ParseEscape()
+{
+    ++m_pos;
+    if (AtEnd())
+        return Fail(CompileResult::Invalid);
+    auto         escaped  = Peek();
+    unsigned int builtins = 0;
+    switch (escaped)
+    {
+        case 'd': builtins = ClassDigit; break;
+        case 'D': builtins = ClassNotDigit; break;
+        case 'w': builtins = ClassWord; break;
+        case 'W': builtins = ClassNotWord; break;
+        case 's': builtins = ClassSpace; break;
+        case 'S': builtins = ClassNotSpace; break;
+        default: break;
+    }
+    ++m_pos;
+    if (builtins)
+    {
+        CharClass cls;
+        cls.builtins        = builtins;
+        int node            = AddNode(NodeKind::Class);
+        m_nodes[node].index = static_cast<int>(m_engine.m_classes.size());
+        m_engine.m_classes.push_back(std::move(cls));
+        return node;
+    }
+    char32_t ch = 0;
+    if (ParseCharEscape(escaped, ch) < 0)
+        return -1;
+    int node         = AddNode(NodeKind::Char);
+    m_nodes[node].ch = ch;
+    return node;
+}
+
+// returns 1 for a character, 0 for a builtin class and -1 on errors
+int CRegexEngine::Compiler::ParseClassAtom(CharClass& cls, char32_t& ch)
+{
+    auto c = Peek();
+    ++m_pos;
+    if (c == '[' && (Peek() == ':' || Peek() == '.' || Peek() == '='))
+        return Fail(CompileResult::Unsupported); // posix classes
+    if (c != '\\')
+    {
+        ch = c;
+        return 1;
+    }
+    if (AtEnd())
+        return Fail(CompileResult::Invalid);
+    auto escaped = Peek();
+    ++m_pos;
+    switch (escaped)
+    {
+        case 'd': cls.builtins |= ClassDigit; return 0;
+        case 'D': cls.builtins |= ClassNotDigit; return 0;
+        case 'w': cls.builtins |= ClassWord; return 0;
+        case 'W': cls.builtins |= ClassNotWord; return 0;
+        case 's': cls.builtins |= ClassSpace; return 0;
+        case 'S': cls.builtins |= ClassNotSpace; return 0;
+        case 'b': ch = '\b'; return 1;
+        default: break;
+    }
+    return ParseCharEscape(escaped, ch);
+}
+
+int CRegexEngine::Compiler::ParseClass()
+{
+    ++m_pos;
+    CharClass cls;
+    if (Peek() == '^')
+    {
+        cls.negated = true;
+        ++m_pos;
+    }
+    for (;;)
+    {
+        if (AtEnd())
+            return Fail(CompileResult::Invalid);
+        if (Peek() == ']')
+        {
+            ++m_pos;
+            break;
+        }
+        char32_t low  = 0;
+        int      type = ParseClassAtom(cls, low);
+        if (type < 0)
+            return -1;
+        if (Peek() == '-' && Peek(1) != ']' && m_pos + 1 < m_pattern.size())
+        {
+            ++m_pos;
+            char32_t high     = 0;
+            int      highType = ParseClassAtom(cls, high);
+            if (highType < 0)
+                return -1;
+            if (type == 0 || highType == 0 || low > high)
+                return Fail(CompileResult::Invalid);
+            cls.ranges.emplace_back(low, high);
+        }
+        else if (type == 1)
+            cls.ranges.emplace_back(low, low);
+    }
+    int node            = AddNode(NodeKind::Class);
+    m_nodes[node].index = static_cast<int>(m_engine.m_classes.size());
+    m_engine.m_classes.push_back(std::move(cls));
+    return node;
+}
+
+int CRegexEngine::Compiler::EmitInstruction(Op op, int x, int y, char32_t ch)
+{
+    auto& program = *m_program;
+    if (program.size() >= MaxProgramSize)
+        Fail(CompileResult::Unsupported);
+    Instruction inst;
+    inst.op = op;
+    inst.x  = x;
+    inst.y  = y;
+    inst.ch = ch;
+    program.push_back(inst);
+    if (!m_reverse)
+        m_engine.m_scopes.push_back(m_scope);
+    return static_cast<int>(program.size() - 1);
+}
+
+void CRegexEngine::Compiler::SetSplit(int split, int body, int exit, bool greedy)
+{
+    // the first target of a split has the higher priority
+    auto& inst = (*m_program)[split];
+    inst.x     = greedy ? body : exit;
+    inst.y     = greedy ? exit : body;
+}
+
+bool CRegexEngine::Compiler::CanMatchEmpty(int nodeIndex) const
+{
+    const auto& node = m_nodes[nodeIndex];
+    switch (node.kind)
+    {
+        case NodeKind::Char:
+        case NodeKind::Any:
+        case NodeKind::Class:
+            return false;
+        case NodeKind::Concat:
+            return std::all_of(node.children.begin(), node.children.end(), [this](int child) { return CanMatchEmpty(child); });
+        case NodeKind::Alternation:
+            return std::any_of(node.children.begin(), node.children.end(), [this](int child) { return CanMatchEmpty(child); });
+        case NodeKind::Repeat:
+            return node.min == 0 || CanMatchEmpty(node.children[0]);
+        case NodeKind::Group:
+            return CanMatchEmpty(node.children[0]);
+        default:
+            return true;
+    }
+}
+
+// emits one iteration of a repeat. Like in ECMAScript, the groups inside
+// are reset at the start of every iteration, and an optional iteration
+// that doesn't consume anything fails. Only that iteration fails: the
+// other ways through the body are still tried, see Matcher::Mark().
+void CRegexEngine::Compiler::EmitIteration(const Node& node, bool optional)
+{
+    if (node.lastGroup)
+        EmitInstruction(Op::ClearGroups, node.index * 2, (node.lastGroup + 1) * 2);
+    if (optional && CanMatchEmpty(node.children[0]))
+    {
+        int slot = (m_groupCount + 1) * 2 + m_progressSlots++;
+        EmitInstruction(Op::Save, slot);
+        int outer = m_scope;
+        m_scope   = static_cast<int>(m_engine.m_progressScopes.size());
+        m_engine.m_progressScopes.push_back({slot, outer});
+        if (++m_scopeDepth >= MaxScopeDepth)
+            Fail(CompileResult::Unsupported);
+        m_engine.m_statesPerPc = std::max<size_t>(m_engine.m_statesPerPc, size_t(1) << m_scopeDepth);
+        Emit(node.children[0]);
+        EmitInstruction(Op::CheckProgress, slot);
+        m_scope = outer;
+        --m_scopeDepth;
+    }
+    else
+        Emit(node.children[0]);
+}
+
+void CRegexEngine::Compiler::Emit(int nodeIndex)
+{
+    if (m_result != CompileResult::Ok)
+        return;
+    auto&       program = *m_program;
+    const auto& node    = m_nodes[nodeIndex];
+    switch (node.kind)
+    {
+        case NodeKind::Empty:
+            break;
+        case NodeKind::Char:
+            EmitInstruction(Op::Char, 0, 0, m_engine.m_caseSensitive ? node.ch : Fold(node.ch));
+            break;
+        case NodeKind::Any:
+            EmitInstruction(Op::Any);
+            break;
+        case NodeKind::Class:
+            EmitInstruction(Op::Class, node.index);
+            break;
+        case NodeKind::Concat:
+            if (m_reverse)
+            {
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+                    Emit(*it);
+            }
+            else
+            {
+                for (auto child : node.children)
+                    Emit(child);
+            }
+            break;
+        case NodeKind::Alternation:
+        {
+            std::vector<int> jumps;
+            for (size_t i = 0; i + 1 < node.children.size(); ++i)
+            {
+                int split = EmitInstruction(Op::Split);
+                Emit(node.children[i]);
+                jumps.push_back(EmitInstruction(Op::Jump));
+                SetSplit(split, split + 1, static_cast<int>(program.size()), true);
+            }
+            Emit(node.children.back());
+            for (auto jump : jumps)
+                program[jump].x = static_cast<int>(program.size());
+            break;
+        }
+        case NodeKind::Group:
+            EmitInstruction(Op::Save, node.index * 2);
+            Emit(node.children[0]);
+            EmitInstruction(Op::Save, node.index * 2 + 1);
+            break;
+        case NodeKind::Repeat:
+        {
+            for (int i = 0; i < node.min; ++i)
+                EmitIteration(node, false);
+            if (node.max == Unlimited)
+            {
+                int split = EmitInstruction(Op::Split);
+                EmitIteration(node, true);
+                EmitInstruction(Op::Jump, split);
+                SetSplit(split, split + 1, static_cast<int>(program.size()), node.greedy);
+            }
+            else
+            {
+                std::vector<int> splits;
+                for (int i = node.min; i < node.max && m_result == CompileResult::Ok; ++i)
+                {
+                    splits.push_back(EmitInstruction(Op::Split));
+                    EmitIteration(node, true);
+                }
+                for (auto split : splits)
+                    SetSplit(split, split + 1, static_cast<int>(program.size()), node.greedy);
+            }
+            break;
+        }
+        case NodeKind::Assertion:
+            EmitInstruction(node.op);
+            break;
+        case NodeKind::LookAhead:
+            m_pendingLookAheads.emplace_back(EmitInstruction(node.op), node.children[0]);
+            break;
+    }
+}
+
+// Runs the program on a text. Every thread of the match has its own
+// copy of the group positions, threads are kept in priority order.
+class CRegexEngine::Matcher
+{
+public:
+    Matcher(const CRegexEngine& engine, std::string_view text)
+        : m_engine(engine)
+        , m_text(text)
+        , m_buffers(GetBuffers())
+        , m_stack(m_buffers.stack)
+    {
+    }
+
+    /// only finds matches starting at or before \c lastStart
+    bool Search(size_t start, size_t end, size_t lastStart, std::vector<ptrdiff_t>& groups);
+    /// returns true if the program starting at \c pc matches at \c pos
+    bool MatchesAt(int pc, size_t pos);
+
+private:
+    struct ThreadList
+    {
+        /// prepares the list for \c stateCount thread states, see Mark()
+        void Reset(size_t stateCount)
+        {
+            if (marks.size() < stateCount)
+                marks.resize(stateCount, 0);
+            Clear();
+        }
+        void Clear()
+        {
+            pcs.clear();
+            slots.clear();
+            // marks from earlier generations don't count, so they only
+            // have to be reset when the generation wraps around
+            if (++generation == 0)
+            {
+                std::fill(marks.begin(), marks.end(), 0);
+                generation = 1;
+            }
+        }
+
+        /// adds a thread unless there already is one in the state \c mark
+        void Add(int pc, size_t mark, const ptrdiff_t* threadSlots, size_t slotCount)
+        {
+            if (marks[mark] == generation)
+                return;
+            marks[mark] = generation;
+            pcs.push_back(pc);
+            slots.insert(slots.end(), threadSlots, threadSlots + slotCount);
+        }
+
+        std::vector<int>          pcs;
+        std::vector<ptrdiff_t>    slots;
+        std::vector<unsigned int> marks; ///< the generation a state was last added in
+        unsigned int              generation = 0;
+    };
+
+    struct StackEntry
+    {
+        int       pc;
+        int       slot; ///< if >= 0, the group slot to restore
+        ptrdiff_t value;
+    };
+
+    /// buffers kept per thread, so searches don't have to allocate them again
+    struct Buffers
+    {
+        ThreadList              lists[2];
+        std::vector<StackEntry> stack;
+        std::vector<ptrdiff_t>  initialSlots;
+    };
+
+    static Buffers& GetBuffers()
+    {
+        thread_local Buffers buffers;
+        return buffers;
+    }
+
+    void   AddThread(ThreadList& list, int pc, ptrdiff_t* slots, size_t pos);
+    size_t Mark(int pc, const ptrdiff_t* slots, size_t pos) const;
+    bool   IsCandidate(size_t pos, size_t end) const;
+
+    const CRegexEngine&      m_engine;
+    std::string_view         m_text;
+    Buffers&                 m_buffers;
+    std::vector<StackEntry>& m_stack;
+};
+
+// Threads at the same instruction are the same thread for the Pike VM, the
+// one with the higher priority wins. But a thread in an iteration that
+// started at the current position fails the progress check at the end of the
+// iteration, while one in an iteration that started earlier passes it. So
+// the state of a thread is its instruction and which of the iterations it is
+// in started at the current position. Only instructions that don't consume a
+// character need that, the progress slots are all before the position after
+// consuming one.
+size_t CRegexEngine::Matcher::Mark(int pc, const ptrdiff_t* slots, size_t pos) const
+{
+    const auto statesPerPc = m_engine.m_statesPerPc;
+    size_t     mark        = static_cast<size_t>(pc) * statesPerPc;
+    const auto op          = m_engine.m_program[pc].op;
+    if (statesPerPc == 1 || op <= Op::Class || op == Op::Match)
+        return mark;
+    size_t bit = 1;
+    for (int scope = m_engine.m_scopes[pc]; scope >= 0; scope = m_engine.m_progressScopes[scope].parent)
+    {
+        if (slots[m_engine.m_progressScopes[scope].slot] == static_cast<ptrdiff_t>(pos))
+            mark += bit;
+        bit <<= 1;
+    }
+    return mark;
+}
+
+// adds the thread and follows all jumps, splits, group saves and assertions
+// right away, so the list only contains instructions that consume characters.
+// An explicit stack is used instead of recursion, nested lookaheads use the
+// part of the stack above the entries of the outer call.
+void CRegexEngine::Matcher::AddThread(ThreadList& list, int startPc, ptrdiff_t* slots, size_t pos)
+{
+    const auto& program = m_engine.m_program;
+    if (program[startPc].op <= Op::Class || program[startPc].op == Op::Match)
+    {
+        // nothing to follow, which is the case for most threads
+        list.Add(startPc, Mark(startPc, slots, pos), slots, m_engine.m_slotCount);
+        return;
+    }
+    const auto base = m_stack.size();
+    m_stack.push_back({startPc, -1, 0});
+    while (m_stack.size() > base)
+    {
+        auto entry = m_stack.back();
+        m_stack.pop_back();
+        if (entry.slot >= 0)
+        {
+            slots[entry.slot] = entry.value;
+            continue;
+        }
+        int  pc   = entry.pc;
+        auto mark = Mark(pc, slots, pos);
+        if (list.marks[mark] == list.generation)
+            continue;
+        list.marks[mark] = list.generation;
+        const auto& inst = program[pc];
+        bool        next = false;
+        switch (inst.op)
+        {
+            case Op::Jump:
+                m_stack.push_back({inst.x, -1, 0});
+                break;
+            case Op::Split:
+                m_stack.push_back({inst.y, -1, 0});
+                m_stack.push_back({inst.x, -1, 0});
+                break;
+            case Op::Save:
+                m_stack.push_back({0, inst.x, slots[inst.x]});
+                slots[inst.x] = static_cast<ptrdiff_t>(pos);
+                next          = true;
+                break;
+            case Op::ClearGroups:
+                for (int slot = inst.x; slot < inst.y; ++slot)
+                {
+                    m_stack.push_back({0, slot, slots[slot]});
+                    slots[slot] = -1;
+                }
+                next = true;
+                break;
+            case Op::CheckProgress:
+                next = slots[inst.x] != static_cast<ptrdiff_t>(pos);
+                break;
+            case Op::LineStart:
+                next = IsLineStart(m_text, pos);
+                break;
+            case Op::LineEnd:
+                next = IsLineEnd(m_text, pos);
+                break;
+            case Op::WordBoundary:
+                next = IsWordBoundary(m_text, pos);
+                break;
+            case Op::NotWordBoundary:
+                next = !IsWordBoundary(m_text, pos);
+                break;
+            case Op::LookAhead:
+                next = MatchesAt(inst.x, pos);
+                break;
+            case Op::NegativeLookAhead:
+                next = !MatchesAt(inst.x, pos);
+                break;
+            default:
+                list.pcs.push_back(pc);
+                list.slots.insert(list.slots.end(), slots, slots + m_engine.m_slotCount);
+                break;
+        }
+        if (next)
+            m_stack.push_back({pc + 1, -1, 0});
+    }
+}
+
+bool CRegexEngine::Matcher::IsCandidate(size_t pos, size_t end) const
+{
+    if (!m_engine.m_useFirstBytes)
+        return pos <= end;
+    return pos < end && m_engine.m_firstBytes[static_cast<unsigned char>(m_text[pos])];
+}
+
+size_t CRegexEngine::NextCandidate(std::string_view text, size_t from, size_t end) const
+{
+    if (from > end)
+        return npos;
+    if (!m_useFirstBytes)
+        return from;
+    if (m_singleFirstByte >= 0)
+    {
+        auto found = memchr(text.data() + from, m_singleFirstByte, end - from);
+        return found ? static_cast<const char*>(found) - text.data() : npos;
+    }
+    for (size_t pos = from; pos < end; ++pos)
+    {
+        if (m_firstBytes[static_cast<unsigned char>(text[pos])])
+            return pos;
+    }
+    return npos;
+}
+
+bool CRegexEngine::Matcher::Search(size_t start, size_t end, size_t lastStart, std::vector<ptrdiff_t>& groups)
+{
+    const auto  slotCount = m_engine.m_slotCount;
+    const auto& program   = m_engine.m_program;
+    ThreadList* current   = &m_buffers.lists[0];
+    ThreadList* next      = &m_buffers.lists[1];
+    current->Reset(program.size() * m_engine.m_statesPerPc);
+    next->Reset(program.size() * m_engine.m_statesPerPc);
+    auto& initial = m_buffers.initialSlots;
+    initial.assign(slotCount, -1);
+    bool   matched = false;
+    size_t pos     = start;
+    // the last position a thread for a new match was started at
+    size_t seeded  = npos;
+    for (;;)
+    {
+        if (current->pcs.empty())
+        {
+            if (matched)
+                break;
+            // nothing in progress: skip to where the next match could start
+            size_t from = pos;
+            if (seeded == pos)
+            {
+                if (pos >= end || pos >= lastStart)
+                    break;
+                char32_t ch = 0;
+                from        = pos + DecodeUtf8(m_text, pos, end, ch);
+            }
+            pos = m_engine.NextCandidate(m_text, from, end);
+            if (pos == npos || pos > lastStart)
+                break;
+            current->Clear();
+            AddThread(*current, 0, initial.data(), pos);
+            seeded = pos;
+            if (current->pcs.empty())
+                continue;
+        }
+
+        char32_t ch    = 0;
+        size_t   width = 0;
+        if (pos < end)
+            width = DecodeUtf8(m_text, pos, end, ch);
+        next->Clear();
+        for (size_t i = 0; i < current->pcs.size(); ++i)
+        {
+            int         pc    = current->pcs[i];
+            const auto& inst  = program[pc];
+            ptrdiff_t*  slots = current->slots.data() + i * slotCount;
+            if (inst.op == Op::Match)
+            {
+                groups.assign(slots, slots + m_engine.m_groupSlotCount);
+                matched = true;
+                // the remaining threads have a lower priority than this match
+                break;
+            }
+            if (width && m_engine.MatchesChar(inst, ch))
+                AddThread(*next, pc + 1, slots, pos + width);
+        }
+        if (pos >= end)
+            break;
+        pos += width;
+        if (!matched && pos <= lastStart && IsCandidate(pos, end))
+        {
+            // a new match starting here has the lowest priority
+            AddThread(*next, 0, initial.data(), pos);
+            seeded = pos;
+        }
+        std::swap(current, next);
+    }
+    return matched;
+}
+
+bool CRegexEngine::Matcher::MatchesAt(int startPc, size_t pos)
+{
+    const auto             slotCount = m_engine.m_slotCount;
+    const auto&            program   = m_engine.m_program;
+    ThreadList             current;
+    ThreadList             next;
+    std::vector<ptrdiff_t> slots(slotCount, -1);
+    current.Reset(program.size() * m_engine.m_statesPerPc);
+    next.Reset(program.size() * m_engine.m_statesPerPc);
+    AddThread(current, startPc, slots.data(), pos);
+    while (!current.pcs.empty())
+    {
+        char32_t ch    = 0;
+        size_t   width = 0;
+        if (pos < m_text.size())
+            width = DecodeUtf8(m_text, pos, m_text.size(), ch);
+        next.Clear();
+        for (size_t i = 0; i < current.pcs.size(); ++i)
+        {
+            const auto& inst = program[current.pcs[i]];
+            if (inst.op == Op::Match)
+                return true;
+            if (width && m_engine.MatchesChar(inst, ch))
+                AddThread(next, current.pcs[i] + 1, current.slots.data() + i * slotCount, pos + width);
+        }
+        pos += width;
+        std::swap(current, next);
+    }
+    return false;
+}
+
+// A lazily built DFA on top of the program. Its states are the ordered
+// thread lists of the Pike VM without the group positions, so it finds the
+// same matches, but a state and its transitions are only computed once.
+// The forward DFA finds where the first match ends, the DFA of the reversed
+// regex then finds where that match starts. Lookaheads and the progress
+// checks of repeats depend on more than the state, regexes with them are
+// left to the Pike VM.
+class CRegexEngine::Dfa
+{
+public:
+    enum class Result
+    {
+        NoMatch,
+        Match,
+        GaveUp, ///< too many states, the Pike VM has to do the search
+    };
+
+    /// returns the DFA of the calling thread for \c engine
+    static Dfa& Get(const CRegexEngine& engine, bool reverse);
+
+    /// finds the end of the first match that starts at or before \c lastStart
+    Result FindEnd(std::string_view text, size_t start, size_t end, size_t lastStart, size_t& matchEnd);
+    /// finds the start of the match ending at \c matchEnd that starts first
+    Result FindStart(std::string_view text, size_t start, size_t matchEnd, size_t& matchStart);
+    /// finds the first position any match ending at or after \c from can
+    /// start at, no matter if a search would find that match
+    Result FindFirstStart(std::string_view text, size_t start, size_t end, size_t from, size_t& matchStart);
+
+private:
+    // what the assertions need to know about the characters around a position
+    enum CharKind : unsigned char
+    {
+        KindNone, ///< start or end of the text
+        KindLineTerminator,
+        KindWord,
+        KindOther,
+    };
+
+    struct State
+    {
+        std::vector<int>                  pcs; ///< threads in priority order, before following jumps
+        CharKind                          prev    = KindNone; ///< the character consumed last
+        bool                              seeding = false; ///< whether new matches can still start
+        // transitions for ASCII and the other characters: the next
+        // state shifted left by one, or'ed with 1 if a match ends
+        // before the character. -1 if not computed yet.
+        int                               next[0x80];
+        std::unordered_map<char32_t, int> nextOther;
+    };
+
+    static CharKind Kind(char32_t ch);
+    static CharKind KindBefore(std::string_view text, size_t pos);
+    static CharKind KindAt(std::string_view text, size_t pos);
+    /// decodes the character before \c pos, returns its size or 0 at \c start
+    static size_t   DecodeBefore(std::string_view text, size_t start, size_t pos, char32_t& ch);
+
+    void            Reset(const CRegexEngine& engine, bool reverse);
+    Result          GiveUp();
+    int             GetState(const std::vector<int>& pcs, CharKind prev, bool seeding);
+    int             GetStartState(CharKind prev);
+    int             Transition(int state, char32_t ch);
+    int             ComputeTransition(int state, char32_t ch);
+    /// follows the jumps and assertions of the threads of \c state, returns
+    /// true if there's a match. The threads that consume a character are
+    /// added to m_expanded, up to the first match in the forward DFA.
+    bool            Expand(int state, CharKind before, CharKind after);
+
+    const CRegexEngine*                  m_engine   = nullptr;
+    const std::vector<Instruction>*      m_program  = nullptr;
+    unsigned int                         m_engineId = 0;
+    bool                                 m_reverse  = false;
+    std::vector<State>                   m_states;
+    std::unordered_map<std::string, int> m_stateIds;
+    int                                  m_startStates[KindOther + 1] = {};
+    std::vector<unsigned int>            m_marks;
+    unsigned int                         m_generation = 0;
+    std::vector<int>                     m_stack;
+    std::vector<int>                     m_expanded;
+    std::vector<int>                     m_nextPcs;
+    std::string                          m_key;
+};
+
+CRegexEngine::Dfa& CRegexEngine::Dfa::Get(const CRegexEngine& engine, bool reverse)
+{
+    thread_local Dfa dfas[2];
+    auto&            dfa = dfas[reverse ? 1 : 0];
+    if (dfa.m_engineId != engine.m_id)
+        dfa.Reset(engine, reverse);
+    // the engine may have been copied
+    dfa.m_engine  = &engine;
+    dfa.m_program = reverse ? &engine.m_reverseProgram : &engine.m_program;
+    return dfa;
+}
+
+void CRegexEngine::Dfa::Reset(const CRegexEngine& engine, bool reverse)
+{
+    m_engineId = engine.m_id;
+    m_reverse  = reverse;
+    m_states.clear();
+    m_stateIds.clear();
+    std::fill(std::begin(m_startStates), std::end(m_startStates), -1);
+    m_marks.assign(reverse ? engine.m_reverseProgram.size() : engine.m_program.size(), 0);
+    m_generation = 0;
+}
+
+CRegexEngine::Dfa::Result CRegexEngine::Dfa::GiveUp()
+{
+    // start over with an empty cache next time
+    m_engineId = 0;
+    return Result::GaveUp;
+}
+
+CRegexEngine::Dfa::CharKind CRegexEngine::Dfa::Kind(char32_t ch)
+{
+    if (IsLineTerminator(ch))
+        return KindLineTerminator;
+    return IsWordChar(ch) ? KindWord : KindOther;
+}
+
+CRegexEngine::Dfa::CharKind CRegexEngine::Dfa::KindBefore(std::string_view text, size_t pos)
+{
+    return pos == 0 ? KindNone : Kind(PreviousChar(text, pos));
+}
+
+CRegexEngine::Dfa::CharKind CRegexEngine::Dfa::KindAt(std::string_view text, size_t pos)
+{
+    if (pos >= text.size())
+        return KindNone;
+    char32_t ch = 0;
+    DecodeUtf8(text, pos, text.size(), ch);
+    return Kind(ch);
+}
+
+size_t CRegexEngine::Dfa::DecodeBefore(std::string_view text, size_t start, size_t pos, char32_t& ch)
+{
+    if (pos <= start)
+        return 0;
+    size_t charStart = pos - 1;
+    while (charStart > start && pos - charStart < 4 && (static_cast<unsigned char>(text[charStart]) & 0xC0) == 0x80)
+        --charStart;
+    size_t width = DecodeUtf8(text, charStart, pos, ch);
+    if (width != pos - charStart)
+    {
+        ch    = InvalidByteBase + static_cast<unsigned char>(text[pos - 1]);
+        width = 1;
+    }
+    return width;
+}
+
+int CRegexEngine::Dfa::GetState(const std::vector<int>& pcs, CharKind prev, bool seeding)
+{
+    m_key.assign(1, static_cast<char>(prev | (seeding ? 0x80 : 0)));
+    m_key.append(reinterpret_cast<const char*>(pcs.data()), pcs.size() * sizeof(int));
+    auto found = m_stateIds.find(m_key);
+    if (found != m_stateIds.end())
+        return found->second;
+    if (m_states.size() >= MaxDfaStates)
+        return -1;
+    m_states.emplace_back();
+    auto& state   = m_states.back();
+    state.pcs     = pcs;
+    state.prev    = prev;
+    state.seeding = seeding;
+    std::fill(std::begin(state.next), std::end(state.next), -1);
+    int index = static_cast<int>(m_states.size() - 1);
+    m_stateIds.emplace(m_key, index);
+    return index;
+}
+
+int CRegexEngine::Dfa::GetStartState(CharKind prev)
+{
+    if (m_startStates[prev] < 0)
+        m_startStates[prev] = GetState(std::vector<int>(), prev, true);
+    return m_startStates[prev];
+}
+
+bool CRegexEngine::Dfa::Expand(int stateIndex, CharKind before, CharKind after)
+{
+    const auto& program   = *m_program;
+    const auto& state     = m_states[stateIndex];
+    const bool  lineStart = before == KindNone || before == KindLineTerminator;
+    const bool  lineEnd   = after == KindNone || after == KindLineTerminator;
+    const bool  boundary  = (before == KindWord) != (after == KindWord);
+    if (++m_generation == 0)
+    {
+        std::fill(m_marks.begin(), m_marks.end(), 0);
+        m_generation = 1;
+    }
+    m_expanded.clear();
+    bool matched = false;
+    // same order as the Pike VM: the threads, then a new match at the lowest priority
+    for (size_t i = 0; i <= state.pcs.size(); ++i)
+    {
+        if (i == state.pcs.size() && !state.seeding)
+            break;
+        m_stack.assign(1, i < state.pcs.size() ? state.pcs[i] : 0);
+        while (!m_stack.empty())
+        {
+            int pc = m_stack.back();
+            m_stack.pop_back();
+            if (m_marks[pc] == m_generation)
+                continue;
+            m_marks[pc]      = m_generation;
+            const auto& inst = program[pc];
+            bool        next = false;
+            switch (inst.op)
+            {
+                case Op::Jump:
+                    m_stack.push_back(inst.x);
+                    break;
+                case Op::Split:
+                    m_stack.push_back(inst.y);
+                    m_stack.push_back(inst.x);
+                    break;
+                case Op::Save:
+                case Op::ClearGroups:
+                    next = true;
+                    break;
+                case Op::LineStart:
+                    next = lineStart;
+                    break;
+                case Op::LineEnd:
+                    next = lineEnd;
+                    break;
+                case Op::WordBoundary:
+                    next = boundary;
+                    break;
+                case Op::NotWordBoundary:
+                    next = !boundary;
+                    break;
+                case Op::Match:
+                    matched = true;
+                    // the forward DFA drops the threads with a lower priority
+                    if (!m_reverse)
+                        return true;
+                    break;
+                default:
+                    m_expanded.push_back(pc);
+                    break;
+            }
+            if (next)
+                m_stack.push_back(pc + 1);
+        }
+    }
+    return matched;
+}
+
+int CRegexEngine::Dfa::ComputeTransition(int stateIndex, char32_t ch)
+{
+    const CharKind kind    = Kind(ch);
+    const CharKind prev    = m_states[stateIndex].prev;
+    const bool     matched = m_reverse ? Expand(stateIndex, kind, prev) : Expand(stateIndex, prev, kind);
+    m_nextPcs.clear();
+    for (auto pc : m_expanded)
+    {
+        if (m_engine->MatchesChar((*m_program)[pc], ch))
+            m_nextPcs.push_back(pc + 1);
+    }
+    // a match ends the search of the forward DFA, but not of the reverse one
+    int next = GetState(m_nextPcs, kind, m_states[stateIndex].seeding && (m_reverse || !matched));
+    if (next < 0)
+        return -1;
+    return (next << 1) | (matched ? 1 : 0);
+}
+
+int CRegexEngine::Dfa::Transition(int stateIndex, char32_t ch)
+{
+    int* cached = nullptr;
+    if (ch < 0x80)
+        cached = &m_states[stateIndex].next[ch];
+    else
+    {
+        auto found = m_states[stateIndex].nextOther.find(ch);
+        if (found != m_states[stateIndex].nextOther.end())
+            return found->second;
+    }
+    if (cached && *cached >= 0)
+        return *cached;
+    int transition = ComputeTransition(stateIndex, ch);
+    // computing the transition may have added states, so don't use the pointer
+    if (transition >= 0)
+    {
+        if (ch < 0x80)
+            m_states[stateIndex].next[ch] = transition;
+        else
+            m_states[stateIndex].nextOther[ch] = transition;
+    }
+    return transition;
+}
+
+CRegexEngine::Dfa::Result CRegexEngine::Dfa::FindEnd(std::string_view text, size_t start, size_t end, size_t lastStart, size_t& matchEnd)
+{
+    size_t pos   = start;
+    int    state = GetStartState(KindBefore(text, pos));
+    bool   found = false;
+    // where the loop has to stop for more than reading the next character
+    size_t limit = lastStart < end ? lastStart + 1 : end;
+    while (state >= 0)
+    {
+        const auto& current = m_states[state];
+        if (current.seeding && current.pcs.empty() && m_engine->m_useFirstBytes)
+        {
+            // nothing in progress: skip to where the next match could start
+            size_t next = m_engine->NextCandidate(text, pos, end);
+            if (next == npos || next > lastStart)
+                break;
+            if (next != pos)
+            {
+                pos   = next;
+                state = GetStartState(KindBefore(text, pos));
+                continue;
+            }
+        }
+        if (pos >= limit && pos < end)
+        {
+            // no more matches may start from here on
+            limit     = end;
+            m_nextPcs = current.pcs;
+            state     = GetState(m_nextPcs, current.prev, false);
+            if (state >= 0 && m_states[state].pcs.empty())
+                break;
+            continue;
+        }
+        if (pos >= end)
+        {
+            if (Expand(state, current.prev, KindAt(text, pos)))
+            {
+                found    = true;
+                matchEnd = pos;
+            }
+            break;
+        }
+        // ASCII text with the transitions already known is what this
+        // loop has to be fast for
+        char32_t ch         = static_cast<unsigned char>(text[pos]);
+        size_t   width      = 1;
+        int      transition = ch < 0x80 ? current.next[ch] : -1;
+        if (transition < 0)
+        {
+            width      = DecodeUtf8(text, pos, end, ch);
+            transition = Transition(state, ch);
+            if (transition < 0)
+                return GiveUp();
+        }
+        if (transition & 1)
+        {
+            found    = true;
+            matchEnd = pos;
+        }
+        state = transition >> 1;
+        pos += width;
+        if (m_states[state].pcs.empty() && !m_states[state].seeding)
+            return found ? Result::Match : Result::NoMatch;
+    }
+    if (state < 0)
+        return GiveUp();
+    return found ? Result::Match : Result::NoMatch;
+}
+
+CRegexEngine::Dfa::Result CRegexEngine::Dfa::FindStart(std::string_view text, size_t start, size_t matchEnd, size_t& matchStart)
+{
+    const std::vector<int> firstThread{0};
+    size_t                 pos   = matchEnd;
+    int                    state = GetState(firstThread, KindAt(text, pos), false);
+    bool                   found = false;
+    while (state >= 0)
+    {
+        char32_t ch    = 0;
+        size_t   width = DecodeBefore(text, start, pos, ch);
+        if (width == 0)
+        {
+            if (Expand(state, KindBefore(text, pos), m_states[state].prev))
+            {
+                found      = true;
+                matchStart = pos;
+            }
+            break;
+        }
+        int transition = Transition(state, ch);
+        if (transition < 0)
+            return GiveUp();
+        if (transition & 1)
+        {
+            found      = true;
+            matchStart = pos;
+        }
+        state = transition >> 1;
+        pos -= width;
+        if (m_states[state].pcs.empty())
+            return found ? Result::Match : Result::NoMatch;
+    }
+    if (state < 0)
+        return GiveUp();
+    return found ? Result::Match : Result::NoMatch;
+}
+
+CRegexEngine::Dfa::Result CRegexEngine::Dfa::FindFirstStart(std::string_view text, size_t start, size_t end, size_t from, size_t& matchStart)
+{
+    // the reversed regex is searched from the end, with a new match started
+    // at every position down to from
+    size_t pos   = end;
+    int    state = GetStartState(KindAt(text, pos));
+    bool   found = false;
+    while (state >= 0)
+    {
+        if (pos < from && m_states[state].seeding)
+        {
+            m_nextPcs = m_states[state].pcs;
+            state     = GetState(m_nextPcs, m_states[state].prev, false);
+            if (state < 0)
+                break;
+        }
+        const auto& current = m_states[state];
+        if (current.pcs.empty() && !current.seeding)
+            break;
+        char32_t ch         = pos > start ? static_cast<unsigned char>(text[pos - 1]) : 0;
+        size_t   width      = 1;
+        int      transition = pos > start && ch < 0x80 ? current.next[ch] : -1;
+        if (transition < 0)
+        {
+            width = DecodeBefore(text, start, pos, ch);
+            if (width == 0)
+            {
+                if (Expand(state, KindBefore(text, pos), current.prev))
+                {
+                    found      = true;
+                    matchStart = pos;
+                }
+                break;
+            }
+            transition = Transition(state, ch);
+            if (transition < 0)
+                return GiveUp();
+        }
+        if (transition & 1)
+        {
+            found      = true;
+            matchStart = pos;
+        }
+        state = transition >> 1;
+        pos -= width;
+    }
+    if (state < 0)
+        return GiveUp();
+    return found ? Result::Match : Result::NoMatch;
+}
+
+CRegexEngine::CRegexEngine()
+{
+}
+
+CRegexEngine::~CRegexEngine()
+{
+}
+
+CRegexEngine::CompileResult CRegexEngine::Compile(std::string_view pattern, bool caseSensitive)
+{
+    m_program.clear();
+    m_reverseProgram.clear();
+    m_classes.clear();
+    m_scopes.clear();
+    m_progressScopes.clear();
+    m_statesPerPc    = 1;
+    m_id             = ++g_nextEngineId;
+    m_slotCount      = 0;
+    m_groupSlotCount = 0;
+    m_caseSensitive  = caseSensitive;
+    m_useFirstBytes  = false;
+    if (!caseSensitive)
+    {
+        // the case conversion tables are set up on first use, do that
+        // now so searches from several threads don't race for it
+        Fold(0xC0);
+        ToUpper(0xE0);
+        ToLower(0xC0);
+    }
+    Compiler compiler(*this);
+    auto     result = compiler.Compile(pattern);
+    if (result != CompileResult::Ok)
+    {
+        m_program.clear();
+        m_reverseProgram.clear();
+        m_classes.clear();
+        m_scopes.clear();
+        m_progressScopes.clear();
+        return result;
+    }
+    for (auto& cls : m_classes)
+    {
+        for (char32_t ch = 0; ch < 0x80; ++ch)
+            cls.ascii[ch] = ClassContains(cls, ch);
+    }
+    ComputeFirstBytes();
+    return result;
+}
+
+bool CRegexEngine::Search(std::string_view text, size_t start, size_t end, CRegexMatch& match) const
+{
+    if (m_program.empty())
+        return false;
+    end   = std::min<size_t>(end, text.size());
+    start = CharBoundary(text, start);
+    if (start > end)
+        return false;
+    return Search(text, start, end, end, match);
+}
+
+bool CRegexEngine::SearchBackward(std::string_view text, size_t start, size_t end, CRegexMatch& match) const
+{
+    if (m_program.empty())
+        return false;
+    end   = std::min<size_t>(end, text.size());
+    start = CharBoundary(text, start);
+    if (start >= end)
+        return false;
+    // The matches are searched in windows that grow towards the start. A
+    // match starting before a window wins if it ends at or after the best
+    // one found so far, the reversed regex tells where such a match could
+    // start. Without it, the windows have to go all the way to the start.
+    CRegexMatch candidate;
+    bool        found      = false;
+    bool        useReverse = !m_reverseProgram.empty();
+    bool        lastWindow = false;
+    size_t      windowEnd  = end;
+    size_t      windowSize = 0x1000;
+    for (;;)
+    {
+        size_t windowStart = windowEnd - start > windowSize ? WindowStart(text, start, windowEnd - windowSize) : start;
+        for (size_t pos = windowStart; pos < windowEnd && Search(text, pos, end, windowEnd - 1, candidate);)
+        {
+            size_t matchStart = candidate.Start();
+            size_t matchEnd   = candidate.End();
+            // an empty match at the end is the one the last search found
+            if ((matchEnd < end || matchStart != matchEnd) &&
+                (!found || matchEnd > static_cast<size_t>(match.End()) || (matchEnd == static_cast<size_t>(match.End()) && matchStart < static_cast<size_t>(match.Start()))))
+            {
+                match = candidate;
+                found = true;
+            }
+            // the next search starts at the next character, \r\n counts as one
+            char32_t ch = 0;
+            if (text[matchStart] == '\r' && matchStart + 1 < text.size() && text[matchStart + 1] == '\n')
+                pos = matchStart + 2;
+            else
+                pos = matchStart + DecodeUtf8(text, matchStart, text.size(), ch);
+        }
+        if (windowStart == start || lastWindow)
+            break;
+        windowEnd = windowStart;
+        windowSize *= 2;
+        if (found && useReverse)
+        {
+            size_t firstStart = 0;
+            auto   result     = Dfa::Get(*this, true).FindFirstStart(text, start, end, match.End(), firstStart);
+            if (result == Dfa::Result::NoMatch || (result == Dfa::Result::Match && firstStart >= windowEnd))
+                break;
+            if (result == Dfa::Result::Match)
+            {
+                // all the matches that could still win start in one more window
+                windowSize = windowEnd - firstStart;
+                lastWindow = true;
+            }
+            useReverse = false;
+        }
+    }
+    return found;
+}
+
+size_t CRegexEngine::WindowStart(std::string_view text, size_t start, size_t pos)
+{
+    // searches starting here see the same characters as the ones
+    // from further before
+    for (size_t i = 0; i < 3 && pos > start && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80; ++i)
+        --pos;
+    if (pos > start && text[pos] == '\n' && text[pos - 1] == '\r')
+        --pos;
+    return pos;
+}
+
+bool CRegexEngine::Search(std::string_view text, size_t start, size_t end, size_t lastStart, CRegexMatch& match) const
+{
+    match.m_searchStart = static_cast<ptrdiff_t>(start);
+    match.m_searchEnd   = static_cast<ptrdiff_t>(end);
+    if (!m_reverseProgram.empty())
+    {
+        size_t matchEnd   = 0;
+        size_t matchStart = 0;
+        auto   result     = Dfa::Get(*this, false).FindEnd(text, start, end, lastStart, matchEnd);
+        if (result == Dfa::Result::NoMatch)
+            return false;
+        if (result == Dfa::Result::Match && Dfa::Get(*this, true).FindStart(text, start, matchEnd, matchStart) == Dfa::Result::Match)
+        {
+            if (m_groupSlotCount == 2)
+            {
+                match.m_groups.assign({static_cast<ptrdiff_t>(matchStart), static_cast<ptrdiff_t>(matchEnd)});
+                return true;
+            }
+            // only the Pike VM knows the groups, but it only has to run on the match
+            start     = matchStart;
+            lastStart = matchStart;
+        }
+    }
+    Matcher matcher(*this, text);
+    return matcher.Search(start, end, lastStart, match.m_groups);
+}
+
+bool CRegexEngine::MatchesChar(const Instruction& inst, char32_t ch) const
+{
+    switch (inst.op)
+    {
+        case Op::Char:
+            return (m_caseSensitive ? ch : Fold(ch)) == inst.ch;
+        case Op::Any:
+            return ch != '\n' && ch != '\r' && ch != 0x2028 && ch != 0x2029;
+        case Op::Class:
+            return MatchesClass(m_classes[inst.x], ch);
+        default:
+            return false;
+    }
+}
+
+bool CRegexEngine::ClassContains(const CharClass& cls, char32_t ch) const
+{
+    auto contains = [&cls](char32_t c) {
+        for (const auto& [low, high] : cls.ranges)
+        {
+            if (c >= low && c <= high)
+                return true;
+        }
+        if (cls.builtins)
+        {
+            if (((cls.builtins & ClassDigit) && IsDigit(c)) ||
+                ((cls.builtins & ClassNotDigit) && !IsDigit(c)) ||
+                ((cls.builtins & ClassWord) && IsWordChar(c)) ||
+                ((cls.builtins & ClassNotWord) && !IsWordChar(c)) ||
+                ((cls.builtins & ClassSpace) && IsSpace(c)) ||
+                ((cls.builtins & ClassNotSpace) && !IsSpace(c)))
+                return true;
+        }
+        return false;
+    };
+    bool found = contains(ch);
+    if (!found && !m_caseSensitive)
+    {
+        for (auto other : {Fold(ch), ToLower(ch), ToUpper(ch)})
+        {
+            if (other != ch && contains(other))
+            {
+                found = true;
+                break;
+            }
+        }
+    }
+    return found != cls.negated;
+}
+
+void CRegexEngine::ComputeFirstBytes()
+{
+    memset(m_firstBytes, 0, sizeof(m_firstBytes));
+    m_useFirstBytes   = false;
+    m_singleFirstByte = -1;
+
+    auto addRange = [this](unsigned int low, unsigned int high) {
+        for (auto b = low; b <= high; ++b)
+            m_firstBytes[b] = true;
+    };
+    // all lead bytes of non-ASCII characters
+    auto addNonAscii = [&]() { addRange(0xC0, 0xFF); };
+    auto addAscii    = [&](char32_t ch) {
+        m_firstBytes[ch] = true;
+        if (!m_caseSensitive && ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')))
+        {
+            m_firstBytes[ToUpper(ch)] = true;
+            m_firstBytes[ToLower(ch)] = true;
+            // non-ASCII characters like the Kelvin sign fold to ASCII letters
+            addNonAscii();
+        }
+    };
+
+    std::vector<bool> visited(m_program.size());
+    std::vector<int>  stack{0};
+    while (!stack.empty())
+    {
+        int pc = stack.back();
+        stack.pop_back();
+        if (visited[pc])
+            continue;
+        visited[pc]      = true;
+        const auto& inst = m_program[pc];
+        switch (inst.op)
+        {
+            case Op::Jump:
+                stack.push_back(inst.x);
+                break;
+            case Op::Split:
+                stack.push_back(inst.x);
+                stack.push_back(inst.y);
+                break;
+            case Op::Char:
+                if (inst.ch < 0x80)
+                    addAscii(inst.ch);
+                else
+                {
+                    m_firstBytes[LeadByte(inst.ch)] = true;
+                    if (!m_caseSensitive)
+                        addNonAscii();
+                }
+                break;
+            case Op::Class:
+            {
+                const auto& cls = m_classes[inst.x];
+                if (cls.negated || (cls.builtins & (ClassNotDigit | ClassNotWord | ClassNotSpace)))
+                    return;
+                if (cls.builtins & (ClassDigit | ClassWord))
+                    addRange('0', '9');
+                if (cls.builtins & ClassWord)
+                {
+                    addRange('a', 'z');
+                    addRange('A', 'Z');
+                    m_firstBytes['_'] = true;
+                    addNonAscii();
+                }
+                if (cls.builtins & ClassSpace)
+                {
+                    addRange('\t', '\r');
+                    m_firstBytes[' '] = true;
+                    addNonAscii();
+                }
+                for (const auto& [low, high] : cls.ranges)
+                {
+                    for (auto ch = low; ch <= high && ch < 0x80; ++ch)
+                        addAscii(ch);
+                    if (high >= 0x80)
+                        addNonAscii();
+                }
+                break;
+            }
+            case Op::Any:
+            case Op::Match:
+                // can start with any character or match an empty string
+                return;
+            default:
+                // saves and assertions don't consume anything
+                stack.push_back(pc + 1);
+                break;
+        }
+    }
+    m_useFirstBytes = true;
+    int count       = 0;
+    for (int b = 0; b < 256; ++b)
+    {
+        if (m_firstBytes[b])
+        {
+            ++count;
+            m_singleFirstByte = b;
+        }
+    }
+    if (count != 1)
+        m_singleFirstByte = -1;
+}
+
+std::string CRegexEngine::Format(std::string_view text, const CRegexMatch& match, std::string_view format)
+{
+    std::string result;
+    if (match.Matched())
+        CRegexFormat(format, match.GroupCount()).Apply(text, match, result);
+    return result;
+}
+
+CRegexFormat::CRegexFormat(std::string_view format, size_t groupCount)
+    : m_format(format)
+    , m_groupCount(groupCount)
+{
+    auto addLiteral = [&](std::string_view literal) {
+        if (m_tokens.empty() || m_tokens.back().group != Literal)
+            m_tokens.push_back({Literal, m_literals.size(), 0});
+        m_literals.append(literal);
+        m_tokens.back().length += literal.size();
+    };
+    for (size_t i = 0; i < format.size(); ++i)
+    {
+        char c = format[i];
+        if (c != '$' || i + 1 >= format.size())
+        {
+            addLiteral(format.substr(i, 1));
+            continue;
+        }
+        char n = format[i + 1];
+        if (n == '$')
+            addLiteral("$");
+        else if (n == '&')
+            m_tokens.push_back({0});
+        else if (n == '`')
+            m_tokens.push_back({PrefixGroup});
+        else if (n == '\'')
+            m_tokens.push_back({SuffixGroup});
+        else if (IsDigit(n))
+        {
+            size_t group = n - '0';
+            if (i + 2 < format.size() && IsDigit(format[i + 2]))
+            {
+                size_t twoDigits = group * 10 + (format[i + 2] - '0');
+                if (twoDigits < groupCount)
+                {
+                    group = twoDigits;
+                    ++i;
+                }
+            }
+            m_tokens.push_back({group});
+        }
+        else
+        {
+            addLiteral(format.substr(i, 1));
+            continue;
+        }
+        ++i;
+    }
+}
+
+void CRegexFormat::Apply(std::string_view text, const CRegexMatch& match, std::string& result) const
+{
+    if (!match.Matched())
+        return;
+    auto append = [&](ptrdiff_t start, ptrdiff_t end) {
+        if (start >= 0 && end >= start && static_cast<size_t>(end) <= text.size())
+            result.append(text.substr(start, end - start));
+    };
+    Apply(result, [&](std::string& /*result*/, size_t group) {
+        if (group == PrefixGroup)
+            append(match.m_searchStart, match.Start());
+        else if (group == SuffixGroup)
+            append(match.End(), match.m_searchEnd);
+        else if (match.Matched(group))
+            append(match.Start(group), match.End(group));
+    });
+}
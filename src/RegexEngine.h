@@ -0,0 +1,235 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// The groups of a regex match, as byte positions in the searched text.
+class CRegexMatch
+{
+public:
+    /// number of groups, including group 0 for the whole match
+    size_t    GroupCount() const { return m_groups.size() / 2; }
+    bool      Matched(size_t group = 0) const { return group < GroupCount() && m_groups[group * 2] >= 0; }
+    ptrdiff_t Start(size_t group = 0) const { return m_groups[group * 2]; }
+    ptrdiff_t End(size_t group = 0) const { return m_groups[group * 2 + 1]; }
+
+private:
+    friend class CRegexEngine;
+    friend class CRegexFormat;
+    std::vector<ptrdiff_t> m_groups;
+    ptrdiff_t              m_searchStart = 0;
+    ptrdiff_t              m_searchEnd   = 0;
+};
+
+/// A replacement format, parsed once to fill in the groups of many matches.
+///
+/// $&, $1 - $99, $` and $' are replaced like std::match_results::format()
+/// does for the ECMAScript format, $$ is a single $. Whether $12 refers to
+/// group 12 or to group 1 followed by a '2' depends on the number of groups
+/// of the regex, so the format has to be parsed for a specific regex.
+class CRegexFormat
+{
+public:
+    /// the groups for the text before and after the match
+    static constexpr size_t PrefixGroup = static_cast<size_t>(-2);
+    static constexpr size_t SuffixGroup = static_cast<size_t>(-3);
+
+    /// parses \c format for a regex with \c groupCount groups, including group 0
+    CRegexFormat(std::string_view format, size_t groupCount);
+
+    /// true if this is \c format parsed for \c groupCount groups
+    bool IsFor(std::string_view format, size_t groupCount) const { return format == m_format && groupCount == m_groupCount; }
+
+    /// appends the format to \c result, with the groups of \c match taken from \c text
+    void Apply(std::string_view text, const CRegexMatch& match, std::string& result) const;
+    /// appends the format to \c result for any kind of match:
+    /// \c appendGroup(result, group) has to append the text of the group,
+    /// or the text before or after the match for PrefixGroup and SuffixGroup.
+    template <typename AppendGroup>
+    void Apply(std::string& result, AppendGroup appendGroup) const
+    {
+        for (const auto& token : m_tokens)
+        {
+            if (token.group == Literal)
+                result.append(m_literals, token.start, token.length);
+            else
+                appendGroup(result, token.group);
+        }
+    }
+
+private:
+    static constexpr size_t Literal = static_cast<size_t>(-1);
+
+    struct Token
+    {
+        size_t group  = Literal;
+        // the text of a literal in m_literals
+        size_t start  = 0;
+        size_t length = 0;
+    };
+
+    std::string        m_format;
+    size_t             m_groupCount = 0;
+    std::string        m_literals;
+    std::vector<Token> m_tokens;
+};
+
+/// A regex engine for ECMAScript regexes that works directly on utf8 text.
+///
+/// The compiled regex is run as a Pike VM: all threads of the match are
+/// advanced together one character at a time, so a search scans the text
+/// only once and needs neither recursion nor backtracking, no matter how
+/// long the lines are or how the regex looks. The threads are kept in
+/// priority order, so the match and groups found are the ones of an
+/// ECMAScript backtracking engine. An optional iteration of a repeat that
+/// consumes nothing fails like in ECMAScript: threads in iterations that
+/// started at the current position are told apart from the others, so the
+/// other ways through the body are still tried.
+///
+/// To make that fast, the thread lists of the Pike VM are cached as the
+/// states of a DFA that is built while searching. The DFA finds where the
+/// match ends, a DFA of the reversed regex where it starts, and the Pike VM
+/// only runs on the match itself if the groups are needed. Positions where
+/// no match can start are skipped by checking the bytes a match can start
+/// with.
+///
+/// Back references can't be matched that way, Compile() reports regexes
+/// using them as unsupported so the caller can fall back to std::regex.
+///
+/// ^ and $ match after and before every line terminator, like they do in a
+/// multiline ECMAScript regex, so between the \r and \n of a \r\n too.
+/// \w and \b use the Unicode letters and digits, case insensitive matching
+/// uses the Unicode case folding.
+class CRegexEngine
+{
+public:
+    enum class CompileResult
+    {
+        Ok,
+        Invalid,
+        Unsupported,
+    };
+
+    CRegexEngine();
+    ~CRegexEngine();
+
+    /// compiles the utf8 \c pattern. On failure the previous regex is discarded.
+    CompileResult Compile(std::string_view pattern, bool caseSensitive);
+    bool          IsCompiled() const { return !m_program.empty(); }
+    /// number of groups of the compiled regex, including group 0
+    size_t        GroupCount() const { return m_groupSlotCount / 2; }
+
+    /// searches for the first match that starts at or after \c start and
+    /// ends at or before \c end. The text outside that range is used to
+    /// decide whether ^, $, \b and lookaheads match at the range ends.
+    /// Can be called from multiple threads at once.
+    bool          Search(std::string_view text, size_t start, size_t end, CRegexMatch& match) const;
+    /// searches for the match a backward search from \c end finds: of the
+    /// first matches of searches starting at every character of the range,
+    /// the one that ends last, or the one that starts first if several do.
+    /// An empty match at \c end is not found. Only the part of the text
+    /// where a match could still end after the best one is searched, so
+    /// the search does not have to go back to \c start.
+    bool          SearchBackward(std::string_view text, size_t start, size_t end, CRegexMatch& match) const;
+
+    /// returns \c format with $&, $1 - $99, $`, $' and $$ replaced like
+    /// std::match_results::format() does for the ECMAScript format.
+    static std::string Format(std::string_view text, const CRegexMatch& match, std::string_view format);
+
+private:
+    // the ops that consume a character have to come first
+    enum class Op : unsigned char
+    {
+        Char,
+        Any,
+        Class,
+        Split,
+        Jump,
+        Save,
+        ClearGroups,
+        CheckProgress,
+        LineStart,
+        LineEnd,
+        WordBoundary,
+        NotWordBoundary,
+        LookAhead,
+        NegativeLookAhead,
+        Match,
+    };
+
+    struct Instruction
+    {
+        Op       op;
+        int      x  = 0; ///< jump target, slot or class index
+        int      y  = 0; ///< second target of a split, end of the cleared slots
+        char32_t ch = 0;
+    };
+
+    struct CharClass
+    {
+        std::vector<std::pair<char32_t, char32_t>> ranges;
+        unsigned int                               builtins = 0;
+        bool                                       negated  = false;
+        // precomputed result for ASCII characters
+        bool                                       ascii[0x80] = {};
+    };
+
+    // an optional iteration of a repeat that has to consume something
+    struct ProgressScope
+    {
+        int slot;   ///< the slot the start of the iteration is saved in
+        int parent; ///< the scope of the enclosing iteration, or -1
+    };
+
+    class Compiler;
+    class Matcher;
+    class Dfa;
+
+    /// finds the first match that starts at or before \c lastStart
+    bool   Search(std::string_view text, size_t start, size_t end, size_t lastStart, CRegexMatch& match) const;
+    size_t NextCandidate(std::string_view text, size_t from, size_t end) const;
+    static size_t WindowStart(std::string_view text, size_t start, size_t pos);
+    bool MatchesChar(const Instruction& inst, char32_t ch) const;
+    bool MatchesClass(const CharClass& cls, char32_t ch) const { return ch < 0x80 ? cls.ascii[ch] : ClassContains(cls, ch); }
+    bool ClassContains(const CharClass& cls, char32_t ch) const;
+    void ComputeFirstBytes();
+
+    std::vector<Instruction>   m_program;
+    // the program of the reversed regex, empty if the DFA can't be used
+    std::vector<Instruction>   m_reverseProgram;
+    std::vector<CharClass>     m_classes;
+    // the innermost progress scope of every instruction of m_program, or -1
+    std::vector<int>           m_scopes;
+    std::vector<ProgressScope> m_progressScopes;
+    // 1 << the deepest nesting of progress scopes, see Matcher::Mark()
+    size_t                     m_statesPerPc    = 1;
+    // identifies the compiled regex in the DFA caches of the threads
+    unsigned int               m_id             = 0;
+    // the slots of a thread: the group positions, followed by the
+    // positions the optional iterations of repeats started at
+    size_t                     m_slotCount      = 0;
+    size_t                     m_groupSlotCount = 0;
+    bool                       m_caseSensitive  = true;
+    // bytes a match can start with, only used if the regex can't match
+    // an empty string
+    bool                       m_firstBytes[256] = {};
+    bool                       m_useFirstBytes   = false;
+    int                        m_singleFirstByte = -1;
+};
@@ -0,0 +1,67 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <atomic>
+#include <array>
+#include <cstddef>
+#include <utility>
+
+/// A bounded queue for handing items from one thread to another without
+/// locks. Only one thread may push and only one thread may pop. Neither
+/// side ever waits: pushing to a full queue and popping from an empty one
+/// just fail.
+template <typename T, size_t Capacity>
+class CSPSCQueue
+{
+public:
+    CSPSCQueue() = default;
+
+    CSPSCQueue(const CSPSCQueue&) = delete;
+    CSPSCQueue& operator=(const CSPSCQueue&) = delete;
+
+    /// moves the item into the queue. Leaves the item alone and returns
+    /// false if the queue is full.
+    bool TryPush(T&& item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        m_items[tail % Capacity] = std::move(item);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// moves the oldest item out of the queue, returns false if it is empty.
+    bool TryPop(T& item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+            return false;
+        item = std::move(m_items[head % Capacity]);
+        // leave no moved-from state behind in the slot
+        m_items[head % Capacity] = T();
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::array<T, Capacity> m_items;
+    // the producer and the consumer each write one of these, keep them on
+    // different cache lines
+    alignas(64) std::atomic<size_t> m_head = 0;
+    alignas(64) std::atomic<size_t> m_tail = 0;
+};
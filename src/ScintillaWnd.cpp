@@ -658,6 +658,24 @@ LRESULT CALLBACK CScintillaWnd::WinMsgHandler(HWND hwnd, UINT uMsg, WPARAM wPara
                     break;
             }
             break;
+        case WM_OCCURRENCESFOUND:
+        {
+            // the occurrences of a document that isn't shown anymore are of no use
+            if (Call(SCI_GETDOCPOINTER) != m_markedDoc)
+            {
+                ClearSelTextMarkers();
+                return 0;
+            }
+            std::vector<size_t> lines;
+            m_selTextMarkerCount += (long)m_occurrenceScanner.TakeLines(lines);
+            const auto selTextColor = CTheme::Instance().GetThemeColor(RGB(0, 255, 0), true);
+            for (auto line : lines)
+                m_docScroll.AddLineColor(DOCSCROLLTYPE_SELTEXT, line, selTextColor);
+            SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+            // the status bar shows the number of occurrences
+            SendMessage(GetParent(*this), WM_SELTEXTMARKERSCHANGED, 0, 0);
+            return 0;
+        }
         case WM_SETCURSOR:
         {
             if (!m_bCursorShown)
@@ -1229,13 +1247,11 @@ void CScintillaWnd::MarginClick(SCNotification* pNotification)
 
 void CScintillaWnd::MarkSelectedWord(bool clear, bool edit)
 {
-    static std::string    lastSelText;
-    static Sci_PositionCR lastStopPosition = 0;
-    LRESULT               firstline        = Call(SCI_GETFIRSTVISIBLELINE);
-    LRESULT               lastline         = firstline + Call(SCI_LINESONSCREEN);
-    auto                  startstylepos    = Call(SCI_POSITIONFROMLINE, firstline);
-    startstylepos                          = max(startstylepos, 0);
-    auto endstylepos                       = Call(SCI_POSITIONFROMLINE, lastline) + Call(SCI_LINELENGTH, lastline);
+    LRESULT firstline     = Call(SCI_GETFIRSTVISIBLELINE);
+    LRESULT lastline      = firstline + Call(SCI_LINESONSCREEN);
+    auto    startstylepos = Call(SCI_POSITIONFROMLINE, firstline);
+    startstylepos         = max(startstylepos, 0);
+    auto endstylepos      = Call(SCI_POSITIONFROMLINE, lastline) + Call(SCI_LINELENGTH, lastline);
     if (endstylepos < 0)
         endstylepos = Call(SCI_GETLENGTH);
 
@@ -1250,10 +1266,7 @@ void CScintillaWnd::MarkSelectedWord(bool clear, bool edit)
     auto selTextLen = Call(SCI_GETSELTEXT);
     if ((selTextLen <= 1) || (clear)) // Includes zero terminator so 1 means 0.
     {
-        lastSelText.clear();
-        m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
-        m_selTextMarkerCount = 0;
-        SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+        ClearSelTextMarkers();
         return;
     }
     auto origSelStart = Call(SCI_GETSELECTIONSTART);
@@ -1262,10 +1275,7 @@ void CScintillaWnd::MarkSelectedWord(bool clear, bool edit)
     auto selEndLine   = Call(SCI_LINEFROMPOSITION, origSelEnd, 0);
     if (selStartLine != selEndLine)
     {
-        lastSelText.clear();
-        m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
-        m_selTextMarkerCount = 0;
-        SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+        ClearSelTextMarkers();
         return;
     }
 
@@ -1274,20 +1284,14 @@ void CScintillaWnd::MarkSelectedWord(bool clear, bool edit)
     Call(SCI_GETSELTEXT, 0, (LPARAM)seltextbuffer.get());
     if (seltextbuffer[0] == 0)
     {
-        lastSelText.clear();
-        m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
-        m_selTextMarkerCount = 0;
-        SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+        ClearSelTextMarkers();
         return;
     }
     std::string sSelText = seltextbuffer.get();
     CStringUtils::trim(sSelText);
     if (sSelText.empty())
     {
-        lastSelText.clear();
-        m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
-        m_selTextMarkerCount = 0;
-        SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+        ClearSelTextMarkers();
         return;
     }
     // don't mark the text again if it's already marked by the search feature
@@ -1316,54 +1320,64 @@ void CScintillaWnd::MarkSelectedWord(bool clear, bool edit)
     auto lineCount = Call(SCI_GETLINECOUNT);
     if ((selTextLen > 2) || (lineCount < 100000))
     {
-        auto selTextDifferent = lastSelText.compare(seltextbuffer.get());
-        if (selTextDifferent || (lastStopPosition != 0) || edit)
+        auto docPointer       = Call(SCI_GETDOCPOINTER);
+        bool selTextDifferent = m_markedSelText.compare(seltextbuffer.get()) || (m_markedDoc != docPointer);
+        if (edit)
         {
-            auto start = std::chrono::steady_clock::now();
-            if (selTextDifferent)
-            {
-                m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
-                m_selTextMarkerCount = 0;
-            }
+            // all occurrences get selected, so they're needed right away
+            m_occurrenceScanner.Cancel();
+            m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
+            m_selTextMarkerCount = 0;
             Sci_TextToFind FindText{};
-            FindText.chrg.cpMin     = lastStopPosition;
+            FindText.chrg.cpMin     = 0;
             FindText.chrg.cpMax     = Call(SCI_GETLENGTH);
             FindText.lpstrText      = seltextbuffer.get();
-            lastStopPosition        = 0;
             const auto selTextColor = CTheme::Instance().GetThemeColor(RGB(0, 255, 0), true);
             while (Call(SCI_FINDTEXT, SCFIND_MATCHCASE, (LPARAM)&FindText) >= 0)
             {
-                if (edit)
-                {
-                    if ((origSelStart != FindText.chrgText.cpMin) || (origSelEnd != FindText.chrgText.cpMax))
-                        Call(SCI_ADDSELECTION, FindText.chrgText.cpMax, FindText.chrgText.cpMin);
-                }
+                if ((origSelStart != FindText.chrgText.cpMin) || (origSelEnd != FindText.chrgText.cpMax))
+                    Call(SCI_ADDSELECTION, FindText.chrgText.cpMax, FindText.chrgText.cpMin);
                 auto line = Call(SCI_LINEFROMPOSITION, FindText.chrgText.cpMin);
                 m_docScroll.AddLineColor(DOCSCROLLTYPE_SELTEXT, line, selTextColor);
                 ++m_selTextMarkerCount;
                 if (FindText.chrg.cpMin >= FindText.chrgText.cpMax)
                     break;
                 FindText.chrg.cpMin = FindText.chrgText.cpMax;
-
-                if (!edit)
-                {
-                    // stop after 1.5 seconds - users don't want to wait for too long
-                    auto end = std::chrono::steady_clock::now();
-                    if (std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() > 1500)
-                    {
-                        lastStopPosition = FindText.chrg.cpMin;
-                        break;
-                    }
-                }
             }
-            if (edit)
-                Call(SCI_ADDSELECTION, origSelEnd, origSelStart);
+            Call(SCI_ADDSELECTION, origSelEnd, origSelStart);
+            SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+        }
+        else if (selTextDifferent)
+        {
+            m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
+            m_selTextMarkerCount = 0;
+            // the whole document is searched on a copy in the background,
+            // the markers are added as the occurrences are found (see
+            // WM_OCCURRENCESFOUND). The text is copied from both sides of
+            // the gap so the gap doesn't have to be moved.
+            auto        length = Call(SCI_GETLENGTH);
+            auto        gap    = Call(SCI_GETGAPPOSITION);
+            std::string text;
+            text.reserve(length);
+            text.append(reinterpret_cast<const char*>(Call(SCI_GETRANGEPOINTER, 0, gap)), gap);
+            text.append(reinterpret_cast<const char*>(Call(SCI_GETRANGEPOINTER, gap, length - gap)), length - gap);
+            m_occurrenceScanner.Start(*this, std::move(text), seltextbuffer.get());
             SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
         }
-        lastSelText = seltextbuffer.get();
+        m_markedSelText = seltextbuffer.get();
+        m_markedDoc     = docPointer;
     }
 }
 
+void CScintillaWnd::ClearSelTextMarkers()
+{
+    m_occurrenceScanner.Cancel();
+    m_markedSelText.clear();
+    m_docScroll.Clear(DOCSCROLLTYPE_SELTEXT);
+    m_selTextMarkerCount = 0;
+    SendMessage(*this, WM_NCPAINT, (WPARAM)1, 0);
+}
+
 void CScintillaWnd::MatchBraces(BraceMatch what)
 {
     static int lastIndicatorStart  = 0;
@@ -2409,6 +2423,15 @@ void CScintillaWnd::ReflectEvents(SCNotification* pScn)
 {
     switch (pScn->nmhdr.code)
     {
+        case SCN_MODIFIED:
+            // occurrences found in a copy of the text from before the edit
+            // would be marked on the wrong lines
+            if (pScn->modificationType & (SC_MOD_INSERTTEXT | SC_MOD_DELETETEXT))
+            {
+                m_occurrenceScanner.Cancel();
+                m_markedSelText.clear();
+            }
+            break;
         case SCN_PAINTED:
             if (m_LineToScrollToAfterPaint != -1)
             {
@@ -2611,3 +2634,14 @@ sptr_t CScintillaWnd::GetCurrentLineNumber() const
 {
     return ConstCall(SCI_LINEFROMPOSITION, ConstCall(SCI_GETCURRENTPOS));
 }
+
+CDocumentStatistics::Counts CScintillaWnd::GetDocumentStatistics(CDocumentStatistics& statistics)
+{
+    auto length = static_cast<size_t>(Call(SCI_GETLENGTH));
+    // a length that doesn't match means changes were missed
+    if (length != statistics.GetLength())
+        statistics.Reset(length);
+    return statistics.Get([this](size_t pos, size_t len) {
+        return std::string_view(reinterpret_cast<const char*>(Call(SCI_GETRANGEPOINTER, pos, len)), len);
+    });
+}
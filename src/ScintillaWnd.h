@@ -21,6 +21,8 @@
 #include "DocScroll.h"
 #include "ScrollTool.h"
 #include "AnimationManager.h"
+#include "OccurrenceScanner.h"
+#include "DocumentStatistics.h"
 
 #include <vector>
 #include <unordered_map>
@@ -121,6 +123,10 @@ public:
     sptr_t      GetCurrentLineNumber() const;
     void        VisibleLinesChanged() { m_docScroll.VisibleLinesChanged(); }
 
+    /// the counts of the current document, kept in \c statistics: only the
+    /// parts edited since the last call are counted again
+    CDocumentStatistics::Counts GetDocumentStatistics(CDocumentStatistics& statistics);
+
     LRESULT CALLBACK HandleScrollbarCustomDraw(WPARAM wParam, NMCSBCUSTOMDRAW* pCustDraw);
     void             ReflectEvents(SCNotification* pScn);
 
@@ -144,6 +150,8 @@ protected:
     bool IsBookmarkPresent(sptr_t lineno);
     void BookmarkToggle(sptr_t lineno);
 
+    void ClearSelTextMarkers();
+
 private:
     SciFnDirect             m_pSciMsg;
     sptr_t                  m_pSciWndData;
@@ -163,4 +171,8 @@ private:
     AnimationVariable       m_animVarGrayBack;
     AnimationVariable       m_animVarGraySel;
     AnimationVariable       m_animVarGrayLineNr;
+    COccurrenceScanner      m_occurrenceScanner;
+    // the text and the document the occurrences were last searched for
+    std::string             m_markedSelText;
+    sptr_t                  m_markedDoc = 0;
 };
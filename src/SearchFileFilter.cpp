@@ -0,0 +1,291 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "SearchFileFilter.h"
+#include "DocumentManager.h"
+#include "TextEncoding.h"
+#include "SmartHandle.h"
+#include "StringUtils.h"
+#include "UnicodeUtils.h"
+
+#include <algorithm>
+
+namespace
+{
+// files bigger than this are not searched by default
+constexpr __int64 DefaultMaxFileSize = 100 * 1024 * 1024; // 100 MB
+// the number of bytes at the start of a file that are sniffed
+constexpr DWORD   SniffSize          = 8 * 1024;
+
+// matches the ignore file pattern \c pattern against \c text, both lower
+// case and with '/' as separator. '*' and '?' don't match a '/', "**" does.
+bool MatchGlob(std::wstring_view pattern, std::wstring_view text)
+{
+    while (!pattern.empty())
+    {
+        wchar_t c = pattern[0];
+        if (c == '*')
+        {
+            bool any = pattern.size() > 1 && pattern[1] == '*';
+            pattern.remove_prefix(any ? 2 : 1);
+            // "**/" matches no folder at all as well
+            if (any && !pattern.empty() && pattern[0] == '/' && MatchGlob(pattern.substr(1), text))
+                return true;
+            for (size_t i = 0; i <= text.size(); ++i)
+            {
+                if (MatchGlob(pattern, text.substr(i)))
+                    return true;
+                if (i < text.size() && text[i] == '/' && !any)
+                    return false;
+            }
+            return false;
+        }
+        if (text.empty())
+            return false;
+        if (c == '?')
+        {
+            if (text[0] == '/')
+                return false;
+        }
+        else if (c == '[' && pattern.find(']', 2) != std::wstring_view::npos)
+        {
+            size_t pos    = 1;
+            bool   negate = pattern[pos] == '!' || pattern[pos] == '^';
+            if (negate)
+                ++pos;
+            bool matched = false;
+            // a ']' right at the start is part of the set
+            for (bool first = true; pos < pattern.size() && (first || pattern[pos] != ']'); first = false)
+            {
+                wchar_t low = pattern[pos++];
+                if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+                {
+                    wchar_t high = pattern[pos + 1];
+                    pos += 2;
+                    matched = matched || (text[0] >= low && text[0] <= high);
+                }
+                else
+                    matched = matched || text[0] == low;
+            }
+            if (pos >= pattern.size() || matched == negate || text[0] == '/')
+                return false;
+            // skip the set up to its closing ']'
+            pattern.remove_prefix(pos);
+        }
+        else
+        {
+            if (c == '\\' && pattern.size() > 1)
+            {
+                pattern.remove_prefix(1);
+                c = pattern[0];
+            }
+            if (c != text[0])
+                return false;
+        }
+        pattern.remove_prefix(1);
+        text.remove_prefix(1);
+    }
+    return text.empty();
+}
+
+// the number of bytes that are not part of valid UTF-8 characters
+size_t InvalidUtf8Bytes(const char* buf, size_t len)
+{
+    size_t invalid = 0;
+    size_t pos     = 0;
+    while (pos < len)
+    {
+        bool incompleteTail = false;
+        pos += CTextEncoding::Utf8ValidLength(buf + pos, len - pos, &incompleteTail);
+        // the sniffed data may end in the middle of a character
+        if (pos >= len || incompleteTail)
+            break;
+        ++invalid;
+        ++pos;
+    }
+    return invalid;
+}
+} // namespace
+
+CSearchFileFilter::CSearchFileFilter(const std::wstring& searchPath)
+{
+    auto& settings   = CIniSettings::Instance();
+    m_useIgnoreFiles = settings.GetInt64(L"searchreplace", L"useignorefiles", 1) != 0;
+    m_skipBinary     = settings.GetInt64(L"searchreplace", L"skipbinaryfiles", 1) != 0;
+    m_maxFileSize    = static_cast<unsigned __int64>(std::max<__int64>(0, settings.GetInt64(L"searchreplace", L"maxsearchfilesize", DefaultMaxFileSize)));
+
+    m_top = CStringUtils::to_lower(searchPath);
+    while (!m_top.empty() && (m_top.back() == '\\' || m_top.back() == '/'))
+        m_top.pop_back();
+    // the ignore files further up apply too if the search folder is part
+    // of a git work tree
+    for (std::wstring folder = m_top;;)
+    {
+        if (PathFileExists((folder + L"\\.git").c_str()))
+        {
+            m_top = folder;
+            break;
+        }
+        auto separator = folder.find_last_of(L"\\/");
+        if (separator == std::wstring::npos || separator == 0)
+            break;
+        folder.resize(separator);
+    }
+}
+
+bool CSearchFileFilter::IsIgnored(const std::wstring& path, bool isDir)
+{
+    if (!m_useIgnoreFiles)
+        return false;
+    auto relative = CStringUtils::to_lower(path);
+    if (relative.size() <= m_top.size() + 1 || relative.compare(0, m_top.size(), m_top) != 0)
+        return false;
+    relative.erase(0, m_top.size() + 1);
+    std::replace(relative.begin(), relative.end(), L'\\', L'/');
+    auto              nameStart = relative.find_last_of(L'/');
+    std::wstring_view name      = std::wstring_view(relative).substr(nameStart == std::wstring::npos ? 0 : nameStart + 1);
+
+    // the rules of the folders further down come later, and the last
+    // matching rule decides
+    bool   ignored    = false;
+    size_t folderSize = 0;
+    for (;;)
+    {
+        auto              folder   = path.substr(0, m_top.size() + (folderSize ? folderSize + 1 : 0));
+        std::wstring_view inFolder = std::wstring_view(relative).substr(folderSize ? folderSize + 1 : 0);
+        for (const auto& rule : GetRules(folder))
+        {
+            if (rule.dirOnly && !isDir)
+                continue;
+            if (MatchGlob(rule.pattern, rule.anchored ? inFolder : name))
+                ignored = !rule.negated;
+        }
+        auto next = relative.find(L'/', folderSize ? folderSize + 1 : 0);
+        if (next == std::wstring::npos)
+            break;
+        folderSize = next;
+    }
+    return ignored;
+}
+
+bool CSearchFileFilter::IsTooBig(unsigned __int64 size) const
+{
+    return m_maxFileSize > 0 && size > m_maxFileSize;
+}
+
+bool CSearchFileFilter::IsBinaryFile(const std::wstring& path) const
+{
+    if (!m_skipBinary)
+        return false;
+    CAutoFile hFile = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (!hFile.IsValid())
+        return false;
+    char  buf[SniffSize];
+    DWORD read = 0;
+    if (!ReadFile(hFile, buf, SniffSize, &read, nullptr))
+        return false;
+    return IsBinary(buf, read);
+}
+
+bool CSearchFileFilter::IsBinary(const char* buf, size_t len)
+{
+    bool hasBOM       = false;
+    bool inconclusive = false;
+    switch (CTextEncoding::DetectCodepage(buf, len, hasBOM, inconclusive))
+    {
+        case 1200:
+        case 1201:
+        case 12000:
+        case 12001:
+            return false;
+        default:
+            break;
+    }
+    // text that isn't UTF-16 or UTF-32 has no null bytes
+    size_t controls = 0;
+    for (size_t i = 0; i < len; ++i)
+    {
+        auto b = static_cast<unsigned char>(buf[i]);
+        if (b == 0)
+            return true;
+        if (b < 0x20 && b != '\t' && b != '\n' && b != '\r' && b != '\f' && b != '\v' && b != 0x1b)
+            ++controls;
+    }
+    if (controls > len / 16)
+        return true;
+    // text in an ANSI codepage is not valid UTF-8 either, so lots of
+    // invalid UTF-8 only counts together with some control characters
+    return InvalidUtf8Bytes(buf, len) > len / 4 && controls > len / 64;
+}
+
+const std::vector<CSearchFileFilter::Rule>& CSearchFileFilter::GetRules(const std::wstring& folder)
+{
+    auto key   = CStringUtils::to_lower(folder);
+    auto found = m_rules.find(key);
+    if (found != m_rules.end())
+        return found->second;
+    auto& rules = m_rules[key];
+    // the rules of .ignore files win over the ones of .gitignore files
+    ParseIgnoreFile(folder + L"\\.gitignore", rules);
+    ParseIgnoreFile(folder + L"\\.ignore", rules);
+    return rules;
+}
+
+void CSearchFileFilter::ParseIgnoreFile(const std::wstring& path, std::vector<Rule>& rules)
+{
+    std::string text;
+    if (!PathFileExists(path.c_str()) || !CDocumentManager::LoadFileUtf8(path, text))
+        return;
+    auto content = CUnicodeUtils::StdGetUnicode(text);
+    for (size_t lineStart = 0; lineStart < content.size();)
+    {
+        auto lineEnd = content.find(L'\n', lineStart);
+        if (lineEnd == std::wstring::npos)
+            lineEnd = content.size();
+        std::wstring line = content.substr(lineStart, lineEnd - lineStart);
+        lineStart         = lineEnd + 1;
+
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        // trailing spaces are ignored unless escaped
+        while (!line.empty() && line.back() == ' ' && !(line.size() > 1 && line[line.size() - 2] == '\\'))
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        Rule rule;
+        if (line[0] == '!')
+        {
+            rule.negated = true;
+            line.erase(0, 1);
+        }
+        if (!line.empty() && line.back() == '/')
+        {
+            rule.dirOnly = true;
+            line.pop_back();
+        }
+        if (line.empty())
+            continue;
+        // a separator at the start or in the middle ties the pattern to
+        // the folder of the ignore file
+        rule.anchored = line.find('/') != std::wstring::npos;
+        if (line[0] == '/')
+            line.erase(0, 1);
+        rule.pattern = CStringUtils::to_lower(line);
+        rules.push_back(std::move(rule));
+    }
+}
@@ -0,0 +1,73 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+
+/// Decides which files of a folder search are not worth reading.
+///
+/// Files and folders excluded by the .gitignore and .ignore files in the
+/// searched tree are skipped. The ignore files of the folders above the
+/// search folder are used too, up to the root of the git work tree the
+/// search folder is in. Files bigger than a configurable limit are skipped,
+/// and so are files that look binary when their first few KB are sniffed.
+///
+/// The settings are read from the [searchreplace] section of the ini:
+/// \c useignorefiles, \c skipbinaryfiles and \c maxsearchfilesize in
+/// bytes, where 0 means no limit.
+class CSearchFileFilter
+{
+public:
+    explicit CSearchFileFilter(const std::wstring& searchPath);
+
+    /// returns true if the ignore files exclude the file or folder.
+    /// Folders are passed before their content, as they are enumerated.
+    bool        IsIgnored(const std::wstring& path, bool isDir);
+    /// returns true if a file of \c size bytes is too big to be searched
+    bool        IsTooBig(unsigned __int64 size) const;
+    /// returns true if the start of the file looks binary. Can be called
+    /// from multiple threads.
+    bool        IsBinaryFile(const std::wstring& path) const;
+
+    /// returns true if \c buf looks like the start of a binary file rather
+    /// than text in any of the encodings BowPad can load
+    static bool IsBinary(const char* buf, size_t len);
+
+private:
+    struct Rule
+    {
+        std::wstring pattern;
+        bool         negated  = false;
+        bool         dirOnly  = false;
+        /// the pattern has to match the path relative to the folder of
+        /// the ignore file instead of just the name
+        bool         anchored = false;
+    };
+
+    const std::vector<Rule>& GetRules(const std::wstring& folder);
+    static void              ParseIgnoreFile(const std::wstring& path, std::vector<Rule>& rules);
+
+    bool                                                m_useIgnoreFiles = true;
+    bool                                                m_skipBinary     = true;
+    unsigned __int64                                    m_maxFileSize    = 0;
+    // the top most folder whose ignore files apply, lower case
+    std::wstring                                        m_top;
+    // the rules of the ignore files of every folder, by lower case path
+    std::unordered_map<std::wstring, std::vector<Rule>> m_rules;
+};
@@ -0,0 +1,142 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "SearchResultStore.h"
+#include "UnicodeUtils.h"
+
+#include <algorithm>
+
+namespace
+{
+// the number of utf16 characters the utf8 text converts to
+int UTF16Length(std::string_view text)
+{
+    int length = 0;
+    for (auto c : text)
+    {
+        auto b = static_cast<unsigned char>(c);
+        if ((b & 0xC0) != 0x80)
+            ++length;
+        // four byte sequences need a surrogate pair
+        if (b >= 0xF0)
+            ++length;
+    }
+    return length;
+}
+} // namespace
+
+void CSearchResultStore::clear()
+{
+    CSearchResultStore empty;
+    std::swap(*this, empty);
+}
+
+int CSearchResultStore::AddPath(const std::wstring& path)
+{
+    m_paths.push_back(MakePathEntry(path));
+    return static_cast<int>(m_paths.size()) - 1;
+}
+
+void CSearchResultStore::SetPath(int index, const std::wstring& path)
+{
+    // the old name stays in m_names until the store is cleared
+    m_paths[index] = MakePathEntry(path);
+}
+
+std::wstring CSearchResultStore::GetPath(int index) const
+{
+    const auto&  entry = m_paths[index];
+    std::wstring path  = m_folders[entry.folder];
+    path.append(m_names, entry.nameOffset, entry.nameLength);
+    return path;
+}
+
+void CSearchResultStore::Append(CSearchResultStore& other)
+{
+    if (m_results.empty() && m_paths.empty())
+    {
+        // nothing to adjust
+        std::swap(*this, other);
+        other.clear();
+        return;
+    }
+    std::vector<int> pathIndexes;
+    pathIndexes.reserve(other.m_paths.size());
+    for (int i = 0; i < static_cast<int>(other.m_paths.size()); ++i)
+        pathIndexes.push_back(AddPath(other.GetPath(i)));
+    m_results.reserve(m_results.size() + other.m_results.size());
+    for (auto result : other.m_results)
+    {
+        if (result.hasPath())
+            result.pathIndex = pathIndexes[result.pathIndex];
+        m_results.push_back(result);
+    }
+    other.clear();
+}
+
+std::wstring CSearchResultStore::MakeLineText(std::string_view line, int& matchStart, int& matchEnd)
+{
+    // remove EOLs
+    while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+        line.remove_suffix(1);
+    // the text might have changed since it was searched
+    matchStart   = std::clamp<int>(matchStart, 0, static_cast<int>(line.size()));
+    matchEnd     = std::clamp<int>(matchEnd, matchStart, static_cast<int>(line.size()));
+    int matchLen = matchEnd - matchStart;
+    // adjust the line positions: Scintilla uses utf8, but utf8 converted to
+    // utf16 can have different char sizes so the positions won't match anymore
+    int start                      = UTF16Length(line.substr(0, matchStart));
+    matchEnd                       = start + UTF16Length(line.substr(matchStart, matchLen));
+    matchStart                     = start;
+    int           linesize         = matchEnd - matchStart;
+    constexpr int maxResultLineLen = 255;
+    auto          lineText         = CUnicodeUtils::StdGetUnicode(std::string(line), false);
+    if (static_cast<int>(lineText.size()) > std::max<int>(linesize + 40, maxResultLineLen))
+    {
+        auto index = std::max<int>(0, matchStart - (maxResultLineLen - matchLen - 40));
+        lineText   = (index ? L"... " : L"") + lineText.substr(index, maxResultLineLen);
+        if (index)
+            index -= 4; // adjust for the "... " we inserted at the beginning
+        matchStart -= index;
+        matchEnd -= index;
+    }
+    return lineText;
+}
+
+CSearchResultStore::PathEntry CSearchResultStore::MakePathEntry(const std::wstring& path)
+{
+    auto              separator = path.find_last_of(L"\\/");
+    size_t            nameStart = separator == std::wstring::npos ? 0 : separator + 1;
+    std::wstring_view folder(path.data(), nameStart);
+
+    PathEntry entry;
+    auto      found = m_folderIndexes.find(folder);
+    if (found == m_folderIndexes.end())
+    {
+        m_folders.emplace_back(folder);
+        entry.folder = static_cast<int>(m_folders.size()) - 1;
+        // the strings in the deque don't move
+        m_folderIndexes.emplace(m_folders.back(), entry.folder);
+    }
+    else
+        entry.folder = found->second;
+    entry.nameOffset = m_names.size();
+    entry.nameLength = path.size() - nameStart;
+    m_names.append(path, nameStart, std::wstring::npos);
+    return entry;
+}
@@ -0,0 +1,109 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include "DocID.h"
+#include "scintilla.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+
+/// A search result. It only holds the position of the match, the text
+/// shown for it is made from the document or file it was found in when
+/// it's shown, see CSearchResultStore::MakeLineText().
+class CSearchResult
+{
+public:
+    DocID  docID;
+    int    pathIndex = -1;
+    sptr_t posBegin  = 0;
+    sptr_t posEnd    = 0;
+    sptr_t line      = 0;
+    /// the index of the term that matched in a multi term search
+    int    term      = -1;
+    /// the match is a function, its signature is shown instead of its line
+    bool   function  = false;
+
+    inline bool hasPath() const
+    {
+        return pathIndex != -1;
+    }
+};
+
+/// Stores search results compactly enough for searches with millions of
+/// matches.
+///
+/// The results only hold positions and line numbers. The paths are split
+/// into the folder, which is only stored once for all files in it, and the
+/// file name.
+class CSearchResultStore
+{
+public:
+    using iterator       = std::vector<CSearchResult>::iterator;
+    using const_iterator = std::vector<CSearchResult>::const_iterator;
+
+    size_t               size() const { return m_results.size(); }
+    bool                 empty() const { return m_results.empty(); }
+    CSearchResult&       operator[](size_t index) { return m_results[index]; }
+    const CSearchResult& operator[](size_t index) const { return m_results[index]; }
+    iterator             begin() { return m_results.begin(); }
+    iterator             end() { return m_results.end(); }
+    const_iterator       begin() const { return m_results.begin(); }
+    const_iterator       end() const { return m_results.end(); }
+    void                 erase(const_iterator first, const_iterator last) { m_results.erase(first, last); }
+    /// removes all results and paths and releases their memory
+    void                 clear();
+
+    void         Add(const CSearchResult& result) { m_results.push_back(result); }
+
+    int          AddPath(const std::wstring& path);
+    void         SetPath(int index, const std::wstring& path);
+    std::wstring GetPath(int index) const;
+    size_t       GetPathCount() const { return m_paths.size(); }
+
+    /// moves all results and paths of \c other to the end of this store
+    /// and leaves \c other empty. The path indexes are adjusted.
+    void Append(CSearchResultStore& other);
+
+    /// returns the text shown for a match in the utf8 text of a \c line,
+    /// with or without its EOLs. \c matchStart and \c matchEnd are the
+    /// utf8 positions of the match in the line, they're set to its utf16
+    /// positions in the returned text. Long lines are cut off around the
+    /// match.
+    static std::wstring MakeLineText(std::string_view line, int& matchStart, int& matchEnd);
+
+private:
+    struct PathEntry
+    {
+        int    folder     = -1;
+        size_t nameOffset = 0;
+        size_t nameLength = 0;
+    };
+
+    PathEntry MakePathEntry(const std::wstring& path);
+
+    std::vector<CSearchResult> m_results;
+
+    // the folders end with their separator, the file names of all
+    // paths are stored one after the other in m_names
+    std::vector<PathEntry>                     m_paths;
+    std::wstring                               m_names;
+    std::deque<std::wstring>                   m_folders;
+    std::unordered_map<std::wstring_view, int> m_folderIndexes;
+};
@@ -18,6 +18,7 @@
 #include <regex>
 #include <codecvt>
 #include <memory>
+#include <algorithm>
 #include "scintilla.h"
 #include "../ext/scintilla/lexlib/CharacterCategory.h"
 #include "../ext/scintilla/include/ILoader.h"
@@ -35,7 +36,9 @@
 #include "../ext/scintilla/src/Document.h"
 #include "../ext/scintilla/src/UniConversion.h"
 #include "UTF8DocumentIterator.h"
+#include "RegexEngine.h"
 #include <Windows.h>
+#include "RegexCache.h"
 
 #undef FindText
 
@@ -54,25 +57,16 @@ namespace Scintilla
             return std::wstring(wide.get());
         return std::wstring(wide.get(), ret);
     }
-    std::string StdGetUTF8(const std::wstring& wide, bool stopAtNull = true)
-    {
-        int len = (int)wide.size();
-        if (len == 0)
-            return std::string();
-        int size = len * 4;
-        auto narrow = std::make_unique<char[]>(size);
-        int ret = WideCharToMultiByte(CP_UTF8, 0, wide.c_str(), len, narrow.get(), size - 1, nullptr, nullptr);
-        narrow[ret] = 0;
-        if (stopAtNull)
-            return std::string(narrow.get());
-        return std::string(narrow.get(), ret);
-    }
 
 class StdRegexSearch : public RegexSearchBase
 {
 public:
     StdRegexSearch()
-        : _lastDirection(0)
+        : _engineCompileFlags(-1)
+        , _engineCompileResult(CRegexEngine::CompileResult::Invalid)
+        , _engineTextStart(0)
+        , _lastMatchByEngine(false)
+        , _lastDirection(0)
     {
     }
 
@@ -170,7 +164,8 @@ private:
         }
         void compileRegex(const char *regex, const int compileFlags);
         Match FindText(SearchParameters& search);
-        std::string SubstituteByPosition(const char *text, Sci::Position *length);
+        /// appends \c format filled in with the groups of the last match to \c result
+        void Substitute(Document* doc, const CRegexFormat& format, std::string& result);
     private:
         Match FindTextForward(SearchParameters& search);
         Match FindTextBackward(SearchParameters& search);
@@ -182,7 +177,7 @@ private:
 
         MatchResults _match;
     private:
-        Regex _regex;
+        std::shared_ptr<const Regex> _regex;
         std::string _lastRegexString;
         int _lastCompileFlags;
     };
@@ -203,9 +198,29 @@ private:
         int _direction;
     };
 
+    bool compileEngine(const char *regex, int compileFlags, bool caseSensitive);
+    Match EngineFindText(SearchParameters& search);
+    Match EngineFindTextForward(SearchParameters& search);
+    std::string_view EngineText(Document* doc) const;
+
     EncodingDependent<wchar_t, UTF8DocumentIterator> _utf8;
 
+    // regexes without back references are run by the utf8 regex engine
+    // directly on the document buffer, the others by std::wregex.
+    // Both come from the regex cache, so the documents share them.
+    std::shared_ptr<const CRegexEngine> _engine;
+    CRegexMatch _engineMatch;
+    std::string _engineRegexString;
+    int _engineCompileFlags;
+    CRegexEngine::CompileResult _engineCompileResult;
+    // document position the text passed to the engine starts at
+    Sci::Position _engineTextStart;
+    bool _lastMatchByEngine;
+
     std::string _substituted;
+    // the replacement format of the last substitution, a replace all
+    // substitutes the same one for every match
+    std::unique_ptr<CRegexFormat> _format;
 
     Match _lastMatch;
     int _lastDirection;
@@ -258,7 +273,8 @@ Sci::Position StdRegexSearch::FindText(Document* doc, Sci::Position startPositio
 
         search.regexFlags = std::regex_constants::format_first_only;
 
-        Match match = _utf8.FindText(search);
+        _lastMatchByEngine = compileEngine(regexString, search._compileFlags, caseSensitive);
+        Match match = _lastMatchByEngine ? EngineFindText(search) : _utf8.FindText(search);
 
         if (match.found())
         {
@@ -279,6 +295,50 @@ Sci::Position StdRegexSearch::FindText(Document* doc, Sci::Position startPositio
     }
 }
 
+bool StdRegexSearch::compileEngine(const char *regex, int compileFlags, bool caseSensitive)
+{
+    if (_engineCompileFlags != compileFlags || _engineRegexString != regex)
+    {
+        _engine = CRegexCache::Instance().GetEngine(regex, caseSensitive, _engineCompileResult);
+        _engineRegexString = regex;
+        _engineCompileFlags = compileFlags;
+    }
+    return _engineCompileResult == CRegexEngine::CompileResult::Ok;
+}
+
+std::string_view StdRegexSearch::EngineText(Document* doc) const
+{
+    // the text starts a few bytes before the search range so ^ and \b see the
+    // character before it. Getting the buffer only moves the gap if it is
+    // inside that text, after a replacement it is right at the search start.
+    auto length = doc->Length() - _engineTextStart;
+    return std::string_view(doc->RangePointer(_engineTextStart, length), length);
+}
+
+StdRegexSearch::Match StdRegexSearch::EngineFindText(SearchParameters& search)
+{
+    _engineTextStart = std::max<Sci::Position>(search._startPosition - 4, 0);
+    if (search._direction > 0)
+        return EngineFindTextForward(search);
+
+    // finds the same match as the series of forward searches the std::wregex
+    // backward search does, but only searches back as far as necessary
+    auto text = EngineText(search._document);
+    if (!_engine->SearchBackward(text, search._startPosition - _engineTextStart, search._endPosition - _engineTextStart, _engineMatch))
+        return Match();
+    return Match(search._document, _engineTextStart + _engineMatch.Start(), _engineTextStart + _engineMatch.End());
+}
+
+StdRegexSearch::Match StdRegexSearch::EngineFindTextForward(SearchParameters& search)
+{
+    if (search._startPosition > search._endPosition)
+        return Match();
+    auto text = EngineText(search._document);
+    if (!_engine->Search(text, search._startPosition - _engineTextStart, search._endPosition - _engineTextStart, _engineMatch))
+        return Match();
+    return Match(search._document, _engineTextStart + _engineMatch.Start(), _engineTextStart + _engineMatch.End());
+}
+
 template <class CharT, class CharacterIterator>
 StdRegexSearch::Match StdRegexSearch::EncodingDependent<CharT, CharacterIterator>::FindText(SearchParameters& search)
 {
@@ -296,7 +356,7 @@ StdRegexSearch::Match StdRegexSearch::EncodingDependent<CharT, CharacterIterator
     bool found;
 
     const bool end_reached = next_search_from_position > search._endPosition;
-    found = !end_reached && std::regex_search(CharacterIterator(search._document, next_search_from_position), endIterator, _match, _regex, search.regexFlags);
+    found = !end_reached && std::regex_search(CharacterIterator(search._document, next_search_from_position), endIterator, _match, *_regex, search.regexFlags);
 
     if (found)
         return Match(search._document, _match[0].first.Pos(), _match[0].second.Pos());
@@ -308,7 +368,7 @@ template <class CharT, class CharacterIterator>
 StdRegexSearch::Match StdRegexSearch::EncodingDependent<CharT, CharacterIterator>::FindTextBackward(SearchParameters& search)
 {
     // Change backward search into series of forward search. It is slow: search all backward becomes O(n^2) instead of O(n) (if search forward is O(n)).
-    // NOTE: Maybe we should cache results. Maybe we could reverse regex to do a real backward search, for simple regex.
+    // Only regexes the regex engine can't run end up here, see CRegexEngine::SearchBackward() for the others.
     search._direction = 1;
 
     MatchResults bestMatch;
@@ -340,7 +400,7 @@ void StdRegexSearch::EncodingDependent<CharT, CharacterIterator>::compileRegex(c
 {
     if (_lastCompileFlags != compileFlags || _lastRegexString != regex)
     {
-        _regex = Regex(StdGetUnicode(regex).c_str(), static_cast<std::regex_constants::syntax_option_type>(compileFlags));
+        _regex = CRegexCache::Instance().GetWRegex(StdGetUnicode(regex), static_cast<std::regex_constants::syntax_option_type>(compileFlags));
 
         _lastRegexString = regex;
         _lastCompileFlags = compileFlags;
@@ -371,16 +431,35 @@ bool StdRegexSearch::SearchParameters::isLineEnd(Sci::Position position)
 
 const char *StdRegexSearch::SubstituteByPosition(Document *doc, const char *text, Sci::Position *length)
 {
-    _substituted = _utf8.SubstituteByPosition(text, length);
+    size_t groupCount = _lastMatchByEngine ? _engine->GroupCount() : _utf8._match.size();
+    if (!_format || !_format->IsFor(text, groupCount))
+        _format = std::make_unique<CRegexFormat>(text, groupCount);
+    _substituted.clear();
+    if (_lastMatchByEngine)
+        _format->Apply(EngineText(doc), _engineMatch, _substituted);
+    else
+        _utf8.Substitute(doc, *_format, _substituted);
+    *length = (Sci::Position)_substituted.size();
     return _substituted.c_str();
 }
 
 template <class CharT, class CharacterIterator>
-std::string StdRegexSearch::EncodingDependent<CharT, CharacterIterator>::SubstituteByPosition(const char *text, Sci::Position *length)
+void StdRegexSearch::EncodingDependent<CharT, CharacterIterator>::Substitute(Document* doc, const CRegexFormat& format, std::string& result)
 {
-    auto s = StdGetUTF8(_match.format(StdGetUnicode(text), std::regex_constants::format_default));
-    *length = (Sci::Position)s.size();
-    return s;
+    // the groups are copied from the document directly, the utf8 text is
+    // never converted to utf16 and back
+    format.Apply(result, [&](std::string& out, size_t group) {
+        const auto& sub = group == CRegexFormat::PrefixGroup   ? _match.prefix()
+                          : group == CRegexFormat::SuffixGroup ? _match.suffix()
+                                                               : _match[group];
+        if (!sub.matched)
+            return;
+        auto start = sub.first.Pos();
+        auto len   = sub.second.Pos() - start;
+        auto size  = out.size();
+        out.resize(size + len);
+        doc->GetCharRange(out.data() + size, start, len);
+    });
 }
 
 };
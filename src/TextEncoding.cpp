@@ -0,0 +1,712 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "TextEncoding.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#    define TEXTENCODING_SIMD
+#    include <intrin.h>
+// gcc and clang only allow the AVX2 intrinsics in functions built for AVX2
+#    ifdef __GNUC__
+#        define TEXTENCODING_AVX2 __attribute__((target("avx2")))
+#    else
+#        define TEXTENCODING_AVX2
+#    endif
+#endif
+
+namespace
+{
+constexpr char32_t ReplacementChar = 0xFFFD;
+
+enum class Utf8Status
+{
+    Ok,
+    Invalid,
+    Incomplete
+};
+
+inline unsigned int Load16(const char* p, bool bigEndian)
+{
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    return bigEndian ? (b[0] << 8) | b[1] : (b[1] << 8) | b[0];
+}
+
+inline char32_t Load32(const char* p, bool bigEndian)
+{
+    auto b = reinterpret_cast<const unsigned char*>(p);
+    if (bigEndian)
+        return (char32_t(b[0]) << 24) | (char32_t(b[1]) << 16) | (char32_t(b[2]) << 8) | b[3];
+    return (char32_t(b[3]) << 24) | (char32_t(b[2]) << 16) | (char32_t(b[1]) << 8) | b[0];
+}
+
+inline void Store16(char* p, unsigned int value, bool bigEndian)
+{
+    if (bigEndian)
+    {
+        p[0] = static_cast<char>(value >> 8);
+        p[1] = static_cast<char>(value);
+    }
+    else
+    {
+        p[0] = static_cast<char>(value);
+        p[1] = static_cast<char>(value >> 8);
+    }
+}
+
+inline void Store32(char* p, char32_t value, bool bigEndian)
+{
+    if (bigEndian)
+    {
+        p[0] = static_cast<char>(value >> 24);
+        p[1] = static_cast<char>(value >> 16);
+        p[2] = static_cast<char>(value >> 8);
+        p[3] = static_cast<char>(value);
+    }
+    else
+    {
+        p[0] = static_cast<char>(value);
+        p[1] = static_cast<char>(value >> 8);
+        p[2] = static_cast<char>(value >> 16);
+        p[3] = static_cast<char>(value >> 24);
+    }
+}
+
+inline size_t EncodeUtf8(char32_t cp, char* dest)
+{
+    if (cp < 0x80)
+    {
+        dest[0] = static_cast<char>(cp);
+        return 1;
+    }
+    if (cp < 0x800)
+    {
+        dest[0] = static_cast<char>(0xC0 | (cp >> 6));
+        dest[1] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 2;
+    }
+    if (cp < 0x10000)
+    {
+        dest[0] = static_cast<char>(0xE0 | (cp >> 12));
+        dest[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        dest[2] = static_cast<char>(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    dest[0] = static_cast<char>(0xF0 | (cp >> 18));
+    dest[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    dest[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    dest[3] = static_cast<char>(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// decodes the character at pos and advances pos past it. Invalid data is
+// skipped by its maximal subpart, i.e. every invalid sequence results in
+// exactly one replacement character.
+inline Utf8Status DecodeUtf8(const unsigned char* src, size_t len, size_t& pos, char32_t& cp)
+{
+    const unsigned int lead = src[pos];
+    if (lead < 0x80)
+    {
+        cp = lead;
+        ++pos;
+        return Utf8Status::Ok;
+    }
+    size_t       trailCount = 0;
+    unsigned int lo         = 0x80;
+    unsigned int hi         = 0xBF;
+    if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        trailCount = 1;
+        cp         = lead & 0x1F;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        trailCount = 2;
+        cp         = lead & 0x0F;
+        if (lead == 0xE0)
+            lo = 0xA0; // overlong
+        else if (lead == 0xED)
+            hi = 0x9F; // surrogates
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        trailCount = 3;
+        cp         = lead & 0x07;
+        if (lead == 0xF0)
+            lo = 0x90; // overlong
+        else if (lead == 0xF4)
+            hi = 0x8F; // > U+10FFFF
+    }
+    else
+    {
+        ++pos;
+        return Utf8Status::Invalid;
+    }
+    size_t p = pos + 1;
+    for (size_t i = 0; i < trailCount; ++i, ++p)
+    {
+        if (p >= len)
+        {
+            pos = p;
+            return Utf8Status::Incomplete;
+        }
+        const unsigned int trail = src[p];
+        if (trail < lo || trail > hi)
+        {
+            pos = p;
+            return Utf8Status::Invalid;
+        }
+        lo = 0x80;
+        hi = 0xBF;
+        cp = (cp << 6) | (trail & 0x3F);
+    }
+    pos = p;
+    return Utf8Status::Ok;
+}
+
+#ifdef TEXTENCODING_SIMD
+bool HasAvx2()
+{
+    static const bool hasAvx2 = []() {
+        int info[4] = {};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+            return false;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx     = (info[2] & (1 << 28)) != 0;
+        // the OS must save the ymm registers on context switches
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return hasAvx2;
+}
+
+inline __m128i SwapBytes16(__m128i v)
+{
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+inline __m128i SwapBytes32(__m128i v)
+{
+    return SwapBytes16(_mm_or_si128(_mm_slli_epi32(v, 16), _mm_srli_epi32(v, 16)));
+}
+
+TEXTENCODING_AVX2 inline __m256i SwapBytes16(__m256i v)
+{
+    return _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8));
+}
+
+// The ASCII kernels convert as many blocks as they can and return the
+// number of source bytes converted; they stop at the first block that
+// contains a non-ASCII character.
+
+size_t AsciiUtf16ToUtf8Sse2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    const __m128i mask = _mm_set1_epi16(static_cast<short>(0xFF80));
+    size_t        pos  = 0;
+    for (; pos + 32 <= len; pos += 32)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 16));
+        if (bigEndian)
+        {
+            a = SwapBytes16(a);
+            b = SwapBytes16(b);
+        }
+        const __m128i high = _mm_and_si128(_mm_or_si128(a, b), mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) != 0xFFFF)
+            break;
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + pos / 2), _mm_packus_epi16(a, b));
+    }
+    return pos;
+}
+
+TEXTENCODING_AVX2 size_t AsciiUtf16ToUtf8Avx2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    const __m256i mask = _mm256_set1_epi16(static_cast<short>(0xFF80));
+    size_t        pos  = 0;
+    for (; pos + 64 <= len; pos += 64)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos + 32));
+        if (bigEndian)
+        {
+            a = SwapBytes16(a);
+            b = SwapBytes16(b);
+        }
+        if (!_mm256_testz_si256(_mm256_or_si256(a, b), mask))
+            break;
+        // packus works on the 128-bit lanes, so the quadwords end up interleaved
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + pos / 2), packed);
+    }
+    return pos;
+}
+
+size_t AsciiUtf32ToUtf8Sse2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    const __m128i mask = _mm_set1_epi32(static_cast<int>(0xFFFFFF80));
+    size_t        pos  = 0;
+    for (; pos + 64 <= len; pos += 64)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 16));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 32));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos + 48));
+        if (bigEndian)
+        {
+            a = SwapBytes32(a);
+            b = SwapBytes32(b);
+            c = SwapBytes32(c);
+            d = SwapBytes32(d);
+        }
+        const __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), mask);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(high, _mm_setzero_si128())) != 0xFFFF)
+            break;
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + pos / 4), packed);
+    }
+    return pos;
+}
+
+size_t AsciiUtf8ToUtf16Sse2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t        pos  = 0;
+    for (; pos + 16 <= len; pos += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos));
+        if (_mm_movemask_epi8(v))
+            break;
+        char* out = dest + pos * 2;
+        if (bigEndian)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(zero, v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(zero, v));
+        }
+        else
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(v, zero));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(v, zero));
+        }
+    }
+    return pos;
+}
+
+TEXTENCODING_AVX2 size_t AsciiUtf8ToUtf16Avx2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    size_t pos = 0;
+    for (; pos + 32 <= len; pos += 32)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos));
+        if (_mm256_movemask_epi8(v))
+            break;
+        __m256i lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1));
+        if (bigEndian)
+        {
+            lo = SwapBytes16(lo);
+            hi = SwapBytes16(hi);
+        }
+        char* out = dest + pos * 2;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), lo);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32), hi);
+    }
+    return pos;
+}
+
+size_t AsciiUtf8ToUtf32Sse2(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t        pos  = 0;
+    for (; pos + 16 <= len; pos += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos));
+        if (_mm_movemask_epi8(v))
+            break;
+        __m128i words[2];
+        __m128i dwords[4];
+        if (bigEndian)
+        {
+            words[0]  = _mm_unpacklo_epi8(zero, v);
+            words[1]  = _mm_unpackhi_epi8(zero, v);
+            dwords[0] = _mm_unpacklo_epi16(zero, words[0]);
+            dwords[1] = _mm_unpackhi_epi16(zero, words[0]);
+            dwords[2] = _mm_unpacklo_epi16(zero, words[1]);
+            dwords[3] = _mm_unpackhi_epi16(zero, words[1]);
+        }
+        else
+        {
+            words[0]  = _mm_unpacklo_epi8(v, zero);
+            words[1]  = _mm_unpackhi_epi8(v, zero);
+            dwords[0] = _mm_unpacklo_epi16(words[0], zero);
+            dwords[1] = _mm_unpackhi_epi16(words[0], zero);
+            dwords[2] = _mm_unpacklo_epi16(words[1], zero);
+            dwords[3] = _mm_unpackhi_epi16(words[1], zero);
+        }
+        char* out = dest + pos * 4;
+        for (int i = 0; i < 4; ++i)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * 16), dwords[i]);
+    }
+    return pos;
+}
+
+size_t AsciiLengthSse2(const char* src, size_t len)
+{
+    size_t pos = 0;
+    for (; pos + 16 <= len; pos += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + pos))))
+            break;
+    }
+    return pos;
+}
+
+TEXTENCODING_AVX2 size_t AsciiLengthAvx2(const char* src, size_t len)
+{
+    size_t pos = 0;
+    for (; pos + 32 <= len; pos += 32)
+    {
+        if (_mm256_movemask_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + pos))))
+            break;
+    }
+    return pos;
+}
+#endif
+
+// the dispatchers below return 0 on platforms without a vectorized kernel
+
+inline size_t AsciiUtf16ToUtf8(const char* src, size_t len, bool bigEndian, char* dest)
+{
+#ifdef TEXTENCODING_SIMD
+    if (HasAvx2())
+        return AsciiUtf16ToUtf8Avx2(src, len, bigEndian, dest);
+    return AsciiUtf16ToUtf8Sse2(src, len, bigEndian, dest);
+#else
+    return 0;
+#endif
+}
+
+inline size_t AsciiUtf32ToUtf8(const char* src, size_t len, bool bigEndian, char* dest)
+{
+#ifdef TEXTENCODING_SIMD
+    return AsciiUtf32ToUtf8Sse2(src, len, bigEndian, dest);
+#else
+    return 0;
+#endif
+}
+
+inline size_t AsciiUtf8ToUtf16(const char* src, size_t len, bool bigEndian, char* dest)
+{
+#ifdef TEXTENCODING_SIMD
+    if (HasAvx2())
+        return AsciiUtf8ToUtf16Avx2(src, len, bigEndian, dest);
+    return AsciiUtf8ToUtf16Sse2(src, len, bigEndian, dest);
+#else
+    return 0;
+#endif
+}
+
+inline size_t AsciiUtf8ToUtf32(const char* src, size_t len, bool bigEndian, char* dest)
+{
+#ifdef TEXTENCODING_SIMD
+    return AsciiUtf8ToUtf32Sse2(src, len, bigEndian, dest);
+#else
+    return 0;
+#endif
+}
+
+inline size_t AsciiLength(const char* src, size_t len)
+{
+#ifdef TEXTENCODING_SIMD
+    if (HasAvx2())
+        return AsciiLengthAvx2(src, len);
+    return AsciiLengthSse2(src, len);
+#else
+    return 0;
+#endif
+}
+
+// after a vectorized kernel stopped at a non-ASCII character, this many
+// source bytes are converted with scalar code before trying the kernel again,
+// so text with many non-ASCII characters doesn't check every block twice.
+constexpr size_t ScalarRun = 64;
+
+// counts the null bytes at even and odd offsets and checks for bytes >= 0x80
+void ScanBytes(const char* buf, size_t len, size_t& evenNulls, size_t& oddNulls, bool& hasHighBytes)
+{
+    evenNulls         = 0;
+    oddNulls          = 0;
+    unsigned int high = 0;
+    size_t       pos  = 0;
+#ifdef TEXTENCODING_SIMD
+    const __m128i zero    = _mm_setzero_si128();
+    __m128i       highAcc = _mm_setzero_si128();
+    for (; pos + 16 <= len; pos += 16)
+    {
+        const __m128i v     = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + pos));
+        const auto    nulls = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+        evenNulls += std::popcount(nulls & 0x5555u);
+        oddNulls += std::popcount(nulls & 0xAAAAu);
+        highAcc = _mm_or_si128(highAcc, v);
+    }
+    high = _mm_movemask_epi8(highAcc);
+#endif
+    for (; pos < len; ++pos)
+    {
+        if (buf[pos] == 0)
+        {
+            if (pos & 1)
+                ++oddNulls;
+            else
+                ++evenNulls;
+        }
+        high |= static_cast<unsigned char>(buf[pos]) & 0x80;
+    }
+    hasHighBytes = high != 0;
+}
+} // namespace
+
+size_t CTextEncoding::Utf8ValidLength(const char* src, size_t len, bool* incompleteTail)
+{
+    auto   s   = reinterpret_cast<const unsigned char*>(src);
+    size_t pos = 0;
+    if (incompleteTail)
+        *incompleteTail = false;
+    while (pos < len)
+    {
+        pos += AsciiLength(src + pos, len - pos);
+        const size_t runEnd = std::min<size_t>(pos + ScalarRun, len);
+        while (pos < runEnd)
+        {
+            size_t   next = pos;
+            char32_t cp   = 0;
+            auto     st   = DecodeUtf8(s, len, next, cp);
+            if (st != Utf8Status::Ok)
+            {
+                if (incompleteTail)
+                    *incompleteTail = st == Utf8Status::Incomplete;
+                return pos;
+            }
+            pos = next;
+        }
+    }
+    return pos;
+}
+
+size_t CTextEncoding::Utf8CompleteLength(const char* src, size_t len)
+{
+    // at most three continuation bytes can follow the lead byte
+    size_t start = len;
+    while (start > 0 && len - start < 3 && (static_cast<unsigned char>(src[start - 1]) & 0xC0) == 0x80)
+        --start;
+    if (start == 0)
+        return len;
+    auto   lead   = static_cast<unsigned char>(src[start - 1]);
+    size_t needed = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+    return (len - start + 1) < needed ? start - 1 : len;
+}
+
+size_t CTextEncoding::Utf16ToUtf8(const char* src, size_t len, bool bigEndian, char* dest, size_t* srcUsed)
+{
+    len &= ~size_t(1);
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len)
+    {
+        const size_t ascii = AsciiUtf16ToUtf8(src + pos, len - pos, bigEndian, dest + out);
+        pos += ascii;
+        out += ascii / 2;
+        const size_t runEnd = std::min<size_t>(pos + ScalarRun, len);
+        while (pos < runEnd)
+        {
+            char32_t cp = Load16(src + pos, bigEndian);
+            pos += 2;
+            if ((cp & 0xFC00) == 0xD800)
+            {
+                if (pos + 2 <= len)
+                {
+                    const unsigned int trail = Load16(src + pos, bigEndian);
+                    if ((trail & 0xFC00) == 0xDC00)
+                    {
+                        cp = 0x10000 + ((cp & 0x3FF) << 10) + (trail & 0x3FF);
+                        pos += 2;
+                    }
+                    else
+                        cp = ReplacementChar;
+                }
+                else if (srcUsed)
+                {
+                    // the trail surrogate may be in the next block
+                    *srcUsed = pos - 2;
+                    return out;
+                }
+                else
+                    cp = ReplacementChar;
+            }
+            else if ((cp & 0xFC00) == 0xDC00)
+                cp = ReplacementChar;
+            out += EncodeUtf8(cp, dest + out);
+        }
+    }
+    if (srcUsed)
+        *srcUsed = pos;
+    return out;
+}
+
+size_t CTextEncoding::Utf32ToUtf8(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    len &= ~size_t(3);
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len)
+    {
+        const size_t ascii = AsciiUtf32ToUtf8(src + pos, len - pos, bigEndian, dest + out);
+        pos += ascii;
+        out += ascii / 4;
+        const size_t runEnd = std::min<size_t>(pos + ScalarRun, len);
+        for (; pos < runEnd; pos += 4)
+        {
+            char32_t cp = Load32(src + pos, bigEndian);
+            if (cp >= 0x110000 || (cp & 0xFFFFF800) == 0xD800)
+                cp = ReplacementChar;
+            out += EncodeUtf8(cp, dest + out);
+        }
+    }
+    return out;
+}
+
+size_t CTextEncoding::Utf8ToUtf16(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    auto   s   = reinterpret_cast<const unsigned char*>(src);
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len)
+    {
+        const size_t ascii = AsciiUtf8ToUtf16(src + pos, len - pos, bigEndian, dest + out);
+        pos += ascii;
+        out += ascii * 2;
+        const size_t runEnd = std::min<size_t>(pos + ScalarRun, len);
+        while (pos < runEnd)
+        {
+            char32_t cp = 0;
+            if (DecodeUtf8(s, len, pos, cp) != Utf8Status::Ok)
+                cp = ReplacementChar;
+            if (cp >= 0x10000)
+            {
+                cp -= 0x10000;
+                Store16(dest + out, 0xD800 | (cp >> 10), bigEndian);
+                Store16(dest + out + 2, 0xDC00 | (cp & 0x3FF), bigEndian);
+                out += 4;
+            }
+            else
+            {
+                Store16(dest + out, cp, bigEndian);
+                out += 2;
+            }
+        }
+    }
+    return out;
+}
+
+size_t CTextEncoding::Utf8ToUtf32(const char* src, size_t len, bool bigEndian, char* dest)
+{
+    auto   s   = reinterpret_cast<const unsigned char*>(src);
+    size_t pos = 0;
+    size_t out = 0;
+    while (pos < len)
+    {
+        const size_t ascii = AsciiUtf8ToUtf32(src + pos, len - pos, bigEndian, dest + out);
+        pos += ascii;
+        out += ascii * 4;
+        const size_t runEnd = std::min<size_t>(pos + ScalarRun, len);
+        while (pos < runEnd)
+        {
+            char32_t cp = 0;
+            if (DecodeUtf8(s, len, pos, cp) != Utf8Status::Ok)
+                cp = ReplacementChar;
+            Store32(dest + out, cp, bigEndian);
+            out += 4;
+        }
+    }
+    return out;
+}
+
+int CTextEncoding::DetectCodepage(const char* buf, size_t len, bool& hasBOM, bool& inconclusive)
+{
+    auto b       = reinterpret_cast<const unsigned char*>(buf);
+    hasBOM       = false;
+    inconclusive = false;
+    // UTF-32 first: the UTF-32LE BOM starts with the UTF-16LE BOM
+    if (len >= 4 && b[0] == 0x00 && b[1] == 0x00 && b[2] == 0xFE && b[3] == 0xFF)
+    {
+        hasBOM = true;
+        return 12001; // UTF32_BE
+    }
+    if (len >= 4 && b[0] == 0xFF && b[1] == 0xFE && b[2] == 0x00 && b[3] == 0x00)
+    {
+        hasBOM = true;
+        return 12000; // UTF32_LE
+    }
+    if (len >= 2 && b[0] == 0xFF && b[1] == 0xFE)
+    {
+        hasBOM = true;
+        return 1200; // UTF16_LE
+    }
+    if (len >= 2 && b[0] == 0xFE && b[1] == 0xFF)
+    {
+        hasBOM = true;
+        return 1201; // UTF16_BE
+    }
+    if (len >= 3 && b[0] == 0xEF && b[1] == 0xBB && b[2] == 0xBF)
+    {
+        hasBOM = true;
+        return CP_UTF8;
+    }
+
+    size_t evenNulls    = 0;
+    size_t oddNulls     = 0;
+    bool   hasHighBytes = false;
+    ScanBytes(buf, len, evenNulls, oddNulls, hasHighBytes);
+    // UTF-16 without a BOM: text with mostly latin characters has the
+    // high byte of most characters set to zero, but hardly any low bytes.
+    const size_t units = len / 2;
+    if (units > 0)
+    {
+        if (oddNulls > units / 2 && evenNulls < units / 16)
+            return 1200; // UTF16_LE
+        if (evenNulls > units / 2 && oddNulls < units / 16)
+            return 1201; // UTF16_BE
+    }
+    if (!hasHighBytes)
+    {
+        // plain ASCII: any codepage will do
+        inconclusive = true;
+        return CP_ACP;
+    }
+    // the data is only a block of the file, the last character may be cut off
+    bool incompleteTail = false;
+    if (Utf8ValidLength(buf, len, &incompleteTail) == len || incompleteTail)
+        return CP_UTF8;
+    return CP_ACP;
+}
@@ -0,0 +1,55 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <cstddef>
+
+/// Conversions between UTF-8 and UTF-16/UTF-32 in either byte order.
+///
+/// All buffers are byte buffers without any alignment requirements, so data
+/// read from a file can be passed in directly. Runs of ASCII characters are
+/// converted with SSE2 or AVX2 if the CPU supports it, everything else with
+/// scalar code. Invalid characters are replaced with U+FFFD.
+class CTextEncoding
+{
+public:
+    /// returns the length of the valid UTF-8 at the start of \c src.
+    /// If \c incompleteTail is given, it is set to true if the data ends
+    /// with an incomplete but otherwise valid character.
+    static size_t Utf8ValidLength(const char* src, size_t len, bool* incompleteTail = nullptr);
+    /// returns the length of the UTF-8 data without the character at its
+    /// end if that one is cut off, so the data can be split there.
+    static size_t Utf8CompleteLength(const char* src, size_t len);
+
+    /// converts UTF-16 to UTF-8. \c dest must have room for len / 2 * 3 bytes.
+    /// If \c srcUsed is given, a lead surrogate at the end of the data is not
+    /// converted since its trail surrogate could follow in the next block,
+    /// and \c srcUsed is set to the number of bytes converted.
+    /// Returns the number of bytes written to \c dest.
+    static size_t Utf16ToUtf8(const char* src, size_t len, bool bigEndian, char* dest, size_t* srcUsed = nullptr);
+    /// converts UTF-32 to UTF-8. \c dest must have room for \c len bytes.
+    static size_t Utf32ToUtf8(const char* src, size_t len, bool bigEndian, char* dest);
+    /// converts UTF-8 to UTF-16. \c dest must have room for len * 2 bytes.
+    static size_t Utf8ToUtf16(const char* src, size_t len, bool bigEndian, char* dest);
+    /// converts UTF-8 to UTF-32. \c dest must have room for len * 4 bytes.
+    static size_t Utf8ToUtf32(const char* src, size_t len, bool bigEndian, char* dest);
+
+    /// guesses the codepage of the data: BOMs are checked first, then the
+    /// distribution of null bytes for UTF-16 without a BOM and finally
+    /// whether the data is valid UTF-8.
+    /// Pure ASCII returns CP_ACP and sets \c inconclusive.
+    static int DetectCodepage(const char* buf, size_t len, bool& hasBOM, bool& inconclusive);
+};
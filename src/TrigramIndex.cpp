@@ -0,0 +1,287 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "TrigramIndex.h"
+#include "scintilla.h"
+
+#include <algorithm>
+
+namespace
+{
+// texts with more distinct trigrams than this get them sorted by
+// scanning the whole bitmap of all possible trigrams
+constexpr size_t BitmapScanThreshold = 16 * 1024;
+
+inline unsigned char FoldByte(char c)
+{
+    auto b = static_cast<unsigned char>(c);
+    return (b >= 'A' && b <= 'Z') ? static_cast<unsigned char>(b - 'A' + 'a') : b;
+}
+
+// returns true if a case insensitive search for the byte could match
+// characters that are not the same byte when folded: non-ASCII characters
+// are folded differently, and U+212A KELVIN SIGN, U+017F LATIN SMALL LETTER
+// LONG S and U+0130 LATIN CAPITAL LETTER I WITH DOT ABOVE fold to ASCII letters.
+inline bool HasOtherCaseForms(unsigned char b)
+{
+    return b >= 0x80 || b == 'k' || b == 's' || b == 'i';
+}
+
+std::vector<unsigned int> ExtractTrigrams(std::string_view text)
+{
+    // one bit for every possible trigram, kept per thread since it's
+    // too big to be allocated for every file. It's all zero between calls.
+    thread_local std::vector<unsigned __int64> bitmap((1 << 24) / 64);
+
+    std::vector<unsigned int> trigrams;
+    if (text.size() < 3)
+        return trigrams;
+    unsigned int trigram = FoldByte(text[0]) << 8 | FoldByte(text[1]);
+    for (size_t i = 2; i < text.size(); ++i)
+    {
+        trigram    = ((trigram << 8) | FoldByte(text[i])) & 0xFFFFFF;
+        auto& bits = bitmap[trigram / 64];
+        auto  bit  = 1ULL << (trigram % 64);
+        if ((bits & bit) == 0)
+        {
+            bits |= bit;
+            trigrams.push_back(trigram);
+        }
+    }
+    if (trigrams.size() < BitmapScanThreshold)
+    {
+        std::sort(trigrams.begin(), trigrams.end());
+        for (auto t : trigrams)
+            bitmap[t / 64] = 0;
+    }
+    else
+    {
+        // with that many trigrams, collecting them from the bitmap
+        // is faster than sorting them
+        trigrams.clear();
+        for (size_t i = 0; i < bitmap.size(); ++i)
+        {
+            if (bitmap[i] == 0)
+                continue;
+            // scan 32 bits at a time, _BitScanForward64 is not available on x86
+            for (unsigned int half = 0; half < 2; ++half)
+            {
+                auto          bits = static_cast<unsigned long>(bitmap[i] >> (half * 32));
+                unsigned long bit  = 0;
+                while (_BitScanForward(&bit, bits))
+                {
+                    trigrams.push_back(static_cast<unsigned int>(i * 64 + half * 32 + bit));
+                    bits &= bits - 1;
+                }
+            }
+            bitmap[i] = 0;
+        }
+    }
+    trigrams.shrink_to_fit();
+    return trigrams;
+}
+
+// returns the literal strings every match of the ECMAScript regex must
+// contain. Only the parts outside of groups are used, so alternatives and
+// optional groups don't have to be analyzed. If the regex has alternatives
+// on the top level, nothing is returned.
+std::vector<std::string> RequiredRegexLiterals(const std::string& regex)
+{
+    std::vector<std::string> literals;
+    std::string              current;
+    int                      depth = 0;
+    auto                     flush = [&]() {
+        if (current.size() >= 3)
+            literals.push_back(current);
+        current.clear();
+    };
+    const size_t len = regex.size();
+    for (size_t i = 0; i < len;)
+    {
+        std::string atom;
+        char        c = regex[i];
+        if (c == '\\')
+        {
+            if (i + 1 >= len)
+                return {};
+            char escaped = regex[i + 1];
+            i += 2;
+            if (isalnum(static_cast<unsigned char>(escaped)))
+            {
+                // character classes, assertions, back references
+                // and character codes
+                if (escaped == 'x')
+                    i += 2;
+                else if (escaped == 'u')
+                    i += 4;
+                else if (escaped == 'c')
+                    i += 1;
+                else if (isdigit(static_cast<unsigned char>(escaped)))
+                {
+                    while (i < len && isdigit(static_cast<unsigned char>(regex[i])))
+                        ++i;
+                }
+                if (depth == 0)
+                    flush();
+                continue;
+            }
+            atom = escaped;
+        }
+        else if (c == '[')
+        {
+            size_t end = i + 1;
+            while (end < len && regex[end] != ']')
+                end += regex[end] == '\\' ? 2 : 1;
+            if (end >= len)
+                return {};
+            i = end + 1;
+            if (depth == 0)
+                flush();
+            continue;
+        }
+        else if (c == '(')
+        {
+            if (depth == 0)
+                flush();
+            ++depth;
+            ++i;
+            continue;
+        }
+        else if (c == ')')
+        {
+            if (--depth < 0)
+                return {};
+            ++i;
+            continue;
+        }
+        else if (c == '|')
+        {
+            if (depth == 0)
+                return {};
+            ++i;
+            continue;
+        }
+        else if (c == '{')
+        {
+            auto end = regex.find('}', i);
+            if (end == std::string::npos)
+                return {};
+            i = end + 1;
+            if (depth == 0)
+                flush();
+            continue;
+        }
+        else if (c == '.' || c == '^' || c == '$' || c == '*' || c == '+' || c == '?')
+        {
+            ++i;
+            if (depth == 0)
+                flush();
+            continue;
+        }
+        else
+        {
+            // a whole utf8 character
+            size_t end = i + 1;
+            while (end < len && (static_cast<unsigned char>(regex[end]) & 0xC0) == 0x80)
+                ++end;
+            atom = regex.substr(i, end - i);
+            i    = end;
+        }
+        if (depth > 0)
+            continue;
+        char next = i < len ? regex[i] : 0;
+        if (next == '*' || next == '?' || next == '{')
+        {
+            // the atom is optional
+            flush();
+            continue;
+        }
+        current += atom;
+        if (next == '+')
+            flush();
+    }
+    if (depth != 0)
+        return {};
+    flush();
+    return literals;
+}
+
+} // namespace
+
+CTrigramIndex::CTrigramIndex(const std::wstring& rootPath)
+    : m_rootPath(rootPath)
+{
+    while (!m_rootPath.empty() && m_rootPath.back() == '\\')
+        m_rootPath.pop_back();
+}
+
+std::vector<unsigned int> CTrigramIndex::GetQuery(const std::string& searchFor, int searchFlags)
+{
+    std::vector<std::string> literals;
+    if (searchFlags & SCFIND_REGEXP)
+        literals = RequiredRegexLiterals(searchFor);
+    else
+        literals.push_back(searchFor);
+
+    bool                      caseSensitive = (searchFlags & SCFIND_MATCHCASE) != 0;
+    std::vector<unsigned int> query;
+    for (const auto& literal : literals)
+    {
+        for (size_t i = 0; i + 3 <= literal.size(); ++i)
+        {
+            auto b0 = FoldByte(literal[i]);
+            auto b1 = FoldByte(literal[i + 1]);
+            auto b2 = FoldByte(literal[i + 2]);
+            if (!caseSensitive && (HasOtherCaseForms(b0) || HasOtherCaseForms(b1) || HasOtherCaseForms(b2)))
+                continue;
+            query.push_back(b0 << 16 | b1 << 8 | b2);
+        }
+    }
+    std::sort(query.begin(), query.end());
+    query.erase(std::unique(query.begin(), query.end()), query.end());
+    return query;
+}
+
+CTrigramIndex::LookupResult CTrigramIndex::Lookup(const std::wstring& path, const FileStamp& stamp, const std::vector<unsigned int>& query)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto                        it = m_entries.find(path);
+    if (it == m_entries.end())
+        return LookupResult::NotIndexed;
+    auto& entry      = it->second;
+    entry.generation = m_generation;
+    if (entry.stamp.size != stamp.size || entry.stamp.writeTime != stamp.writeTime)
+        return LookupResult::NotIndexed;
+    for (auto trigram : query)
+    {
+        if (!std::binary_search(entry.trigrams.begin(), entry.trigrams.end(), trigram))
+            return LookupResult::NoMatch;
+    }
+    return LookupResult::MayMatch;
+}
+
+void CTrigramIndex::Update(const std::wstring& path, const FileStamp& stamp, std::string_view text)
+{
+    auto                        trigrams = ExtractTrigrams(text);
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto&                       entry = m_entries[path];
+    entry.stamp                       = stamp;
+    entry.trigrams                    = std::move(trigrams);
+    entry.generation                  = m_generation;
+    m_modified                        = true;
+}
@@ -0,0 +1,91 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+/// An index of the trigrams in the files below a search folder.
+///
+/// A file can only contain a search string if it contains all the trigrams
+/// of that string, so searches can skip the files that don't without even
+/// reading them. The index stores the trigrams of the utf8 text of every file
+/// together with the size and the last write time the file had when it was
+/// indexed. Files that changed since then are reported as not indexed, the
+/// search has to read them anyway and updates the index with their content.
+///
+/// Trigrams are stored with ASCII letters lowercased, so the same index works
+/// for case sensitive and insensitive searches.
+///
+/// The index of every search folder is saved in its own file in the data
+/// folder and kept in memory for the last folder searched.
+class CTrigramIndex
+{
+public:
+    /// size and last write time of a file, to find out if it changed
+    struct FileStamp
+    {
+        unsigned __int64 size      = 0;
+        unsigned __int64 writeTime = 0;
+    };
+
+    enum class LookupResult
+    {
+        NotIndexed, ///< the file is not in the index or changed since
+        NoMatch,    ///< the file can't contain the search string
+        MayMatch,   ///< the file contains all trigrams of the search string
+    };
+
+    explicit CTrigramIndex(const std::wstring& rootPath);
+
+    /// returns the index for \c rootPath, loaded from disk if necessary
+    static std::shared_ptr<CTrigramIndex> Get(const std::wstring& rootPath);
+    /// returns the trigrams a file must contain to match the search.
+    /// For regexes, only the literal text every match has to contain is
+    /// used. Returns an empty vector if the index can't narrow the search.
+    static std::vector<unsigned int>      GetQuery(const std::string& searchFor, int searchFlags);
+    static bool                           GetFileStamp(const std::wstring& path, FileStamp& stamp);
+
+    LookupResult                          Lookup(const std::wstring& path, const FileStamp& stamp, const std::vector<unsigned int>& query);
+    /// indexes the utf8 \c text of the file at \c path. Can be called from
+    /// multiple threads.
+    void                                  Update(const std::wstring& path, const FileStamp& stamp, std::string_view text);
+    /// saves the index if it changed. If \c prune is true, files that were
+    /// not looked up since the index was fetched with Get() and don't exist
+    /// anymore are removed first.
+    bool                                  Save(bool prune);
+
+private:
+    struct Entry
+    {
+        FileStamp                 stamp;
+        std::vector<unsigned int> trigrams;
+        unsigned int              generation = 0;
+    };
+
+    std::wstring GetIndexPath() const;
+    bool         Load();
+
+    std::wstring                            m_rootPath;
+    std::mutex                              m_mutex;
+    std::unordered_map<std::wstring, Entry> m_entries;
+    unsigned int                            m_generation = 0;
+    bool                                    m_modified   = false;
+};
@@ -0,0 +1,240 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// loading and saving the trigram index, and the file stamps it compares
+
+#include "stdafx.h"
+#include "TrigramIndex.h"
+#include "AppUtils.h"
+#include "PathUtils.h"
+#include "StringUtils.h"
+
+#include <fstream>
+
+namespace
+{
+constexpr char         IndexMagic[4] = {'B', 'P', 'T', 'I'};
+constexpr unsigned int IndexVersion  = 1;
+
+unsigned __int64 HashPath(const std::wstring& path)
+{
+    // FNV-1a
+    unsigned __int64 hash = 14695981039346656037ULL;
+    for (auto c : path)
+    {
+        hash ^= static_cast<unsigned __int64>(towlower(c));
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+template <typename T>
+void WriteValue(std::ostream& stream, T value)
+{
+    stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool ReadValue(std::istream& stream, T& value)
+{
+    return !!stream.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+
+void WriteString(std::ostream& stream, const std::wstring& str)
+{
+    WriteValue(stream, static_cast<unsigned int>(str.size()));
+    stream.write(reinterpret_cast<const char*>(str.data()), str.size() * sizeof(wchar_t));
+}
+
+bool ReadString(std::istream& stream, std::wstring& str)
+{
+    unsigned int size = 0;
+    if (!ReadValue(stream, size) || size > 0x8000)
+        return false;
+    str.resize(size);
+    return !!stream.read(reinterpret_cast<char*>(str.data()), size * sizeof(wchar_t));
+}
+
+// the sorted trigrams are stored as the differences between
+// them, in 7 bit chunks
+void WriteTrigrams(std::ostream& stream, const std::vector<unsigned int>& trigrams)
+{
+    std::string  buffer;
+    unsigned int last = 0;
+    for (auto trigram : trigrams)
+    {
+        auto delta = trigram - last;
+        last       = trigram;
+        while (delta >= 0x80)
+        {
+            buffer += static_cast<char>((delta & 0x7F) | 0x80);
+            delta >>= 7;
+        }
+        buffer += static_cast<char>(delta);
+    }
+    WriteValue(stream, static_cast<unsigned int>(trigrams.size()));
+    WriteValue(stream, static_cast<unsigned int>(buffer.size()));
+    stream.write(buffer.data(), buffer.size());
+}
+
+bool ReadTrigrams(std::istream& stream, std::vector<unsigned int>& trigrams)
+{
+    unsigned int count = 0;
+    unsigned int size  = 0;
+    if (!ReadValue(stream, count) || !ReadValue(stream, size) || count > (1 << 24) || size > count * 4)
+        return false;
+    std::string buffer(size, '\0');
+    if (!stream.read(buffer.data(), size))
+        return false;
+    trigrams.clear();
+    trigrams.reserve(count);
+    unsigned int last  = 0;
+    unsigned int delta = 0;
+    int          shift = 0;
+    for (auto c : buffer)
+    {
+        delta |= static_cast<unsigned int>(c & 0x7F) << shift;
+        shift += 7;
+        if ((c & 0x80) == 0)
+        {
+            last += delta;
+            trigrams.push_back(last);
+            delta = 0;
+            shift = 0;
+        }
+    }
+    return trigrams.size() == count && shift == 0;
+}
+} // namespace
+
+std::shared_ptr<CTrigramIndex> CTrigramIndex::Get(const std::wstring& rootPath)
+{
+    // only the index of the last searched folder is kept in memory
+    static std::mutex                     cacheMutex;
+    static std::shared_ptr<CTrigramIndex> cachedIndex;
+
+    auto                        index = std::make_shared<CTrigramIndex>(rootPath);
+    std::lock_guard<std::mutex> lk(cacheMutex);
+    if (cachedIndex && _wcsicmp(cachedIndex->m_rootPath.c_str(), index->m_rootPath.c_str()) == 0)
+        index = cachedIndex;
+    else
+    {
+        index->Load();
+        cachedIndex = index;
+    }
+    std::lock_guard<std::mutex> indexLock(index->m_mutex);
+    ++index->m_generation;
+    return index;
+}
+
+bool CTrigramIndex::GetFileStamp(const std::wstring& path, FileStamp& stamp)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data = {};
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+        return false;
+    stamp.size      = static_cast<unsigned __int64>(data.nFileSizeHigh) << 32 | data.nFileSizeLow;
+    stamp.writeTime = static_cast<unsigned __int64>(data.ftLastWriteTime.dwHighDateTime) << 32 | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
+
+std::wstring CTrigramIndex::GetIndexPath() const
+{
+    return CAppUtils::GetDataPath() + CStringUtils::Format(L"\\searchindex\\%016llx.idx", HashPath(m_rootPath));
+}
+
+bool CTrigramIndex::Load()
+{
+    std::ifstream stream(GetIndexPath(), std::ios::binary);
+    if (!stream)
+        return false;
+    char         magic[sizeof(IndexMagic)] = {};
+    unsigned int version                   = 0;
+    std::wstring root;
+    unsigned int count = 0;
+    if (!stream.read(magic, sizeof(magic)) || memcmp(magic, IndexMagic, sizeof(magic)) != 0 ||
+        !ReadValue(stream, version) || version != IndexVersion ||
+        !ReadString(stream, root) || _wcsicmp(root.c_str(), m_rootPath.c_str()) != 0 ||
+        !ReadValue(stream, count))
+        return false;
+    std::unordered_map<std::wstring, Entry> entries;
+    entries.reserve(count);
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        std::wstring path;
+        Entry        entry;
+        if (!ReadString(stream, path) ||
+            !ReadValue(stream, entry.stamp.size) || !ReadValue(stream, entry.stamp.writeTime) ||
+            !ReadTrigrams(stream, entry.trigrams))
+            return false;
+        entries[path] = std::move(entry);
+    }
+    m_entries = std::move(entries);
+    return true;
+}
+
+bool CTrigramIndex::Save(bool prune)
+{
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (prune)
+    {
+        for (auto it = m_entries.begin(); it != m_entries.end();)
+        {
+            if (it->second.generation != m_generation && !PathFileExists(it->first.c_str()))
+            {
+                it         = m_entries.erase(it);
+                m_modified = true;
+            }
+            else
+                ++it;
+        }
+    }
+    if (!m_modified)
+        return true;
+
+    auto indexPath = GetIndexPath();
+    CPathUtils::CreateRecursiveDirectory(CPathUtils::GetParentDirectory(indexPath));
+    auto tempPath = indexPath + L".tmp";
+    {
+        std::ofstream stream(tempPath, std::ios::binary | std::ios::trunc);
+        if (!stream)
+            return false;
+        stream.write(IndexMagic, sizeof(IndexMagic));
+        WriteValue(stream, IndexVersion);
+        WriteString(stream, m_rootPath);
+        WriteValue(stream, static_cast<unsigned int>(m_entries.size()));
+        for (const auto& [path, entry] : m_entries)
+        {
+            WriteString(stream, path);
+            WriteValue(stream, entry.stamp.size);
+            WriteValue(stream, entry.stamp.writeTime);
+            WriteTrigrams(stream, entry.trigrams);
+        }
+        if (!stream.flush())
+        {
+            stream.close();
+            DeleteFile(tempPath.c_str());
+            return false;
+        }
+    }
+    if (!MoveFileEx(tempPath.c_str(), indexPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath.c_str());
+        return false;
+    }
+    m_modified = false;
+    return true;
+}
@@ -32,7 +32,7 @@
 #include "ILexer.h"
 #include "../ext/scintilla/src/RESearch.h"
 #include "../ext/scintilla/src/Document.h"
-#include "../ext/scintilla/src/uniconversion.h"
+#include "../ext/scintilla/src/UniConversion.h"
 #include "../ext/scintilla/src/Position.h"
 
 class UTF8DocumentIterator
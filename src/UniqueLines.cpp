@@ -0,0 +1,164 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "UniqueLines.h"
+#include "../ext/scintilla/src/CaseConvert.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#    define UNIQUELINES_PREFETCH
+#    include <intrin.h>
+#endif
+
+namespace
+{
+// the slot of the line this far ahead is fetched into the cache while the
+// current line is looked up
+constexpr size_t PrefetchDistance = 16;
+} // namespace
+
+CUniqueLines::CUniqueLines(bool ignoreCase, bool ignoreWhitespace)
+    : m_ignoreCase(ignoreCase)
+    , m_ignoreWhitespace(ignoreWhitespace)
+{
+}
+
+std::vector<size_t> CUniqueLines::Find(const std::vector<std::string_view>& lines) const
+{
+    struct Slot
+    {
+        // the upper half of the hash, to skip most comparisons of lines
+        // that only share the slot
+        unsigned int tag   = 0;
+        // the index of the line plus one, 0 for an empty slot
+        unsigned int index = 0;
+    };
+    // open addressing with linear probing, the table is kept less than
+    // three quarters full
+    size_t capacity = 16;
+    while (capacity < lines.size() + lines.size() / 2)
+        capacity *= 2;
+    std::vector<Slot>   slots(capacity);
+    std::vector<size_t> unique;
+    unique.reserve(lines.size());
+
+    // the table doesn't fit into the cache for big documents: the hashes
+    // are computed first, so the slots can be fetched ahead of time
+    std::string                   keyBuffer;
+    std::string                   otherBuffer;
+    std::vector<unsigned __int64> hashes(lines.size());
+    for (size_t i = 0; i < lines.size(); ++i)
+        hashes[i] = Hash(GetKey(lines[i], keyBuffer));
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+#ifdef UNIQUELINES_PREFETCH
+        if (i + PrefetchDistance < lines.size())
+            _mm_prefetch(reinterpret_cast<const char*>(&slots[hashes[i + PrefetchDistance] & (capacity - 1)]), _MM_HINT_T0);
+#endif
+        auto             hash   = hashes[i];
+        auto             tag    = static_cast<unsigned int>(hash >> 32);
+        std::string_view key;
+        bool             hasKey = false;
+        for (size_t pos = hash & (capacity - 1);; pos = (pos + 1) & (capacity - 1))
+        {
+            auto& slot = slots[pos];
+            if (slot.index == 0)
+            {
+                slot.tag   = tag;
+                slot.index = static_cast<unsigned int>(i + 1);
+                unique.push_back(i);
+                break;
+            }
+            if (slot.tag != tag)
+                continue;
+            // most duplicates are identical, their keys are the same anyway
+            if (lines[slot.index - 1] == lines[i])
+                break;
+            if (!hasKey)
+            {
+                key    = GetKey(lines[i], keyBuffer);
+                hasKey = true;
+            }
+            if (GetKey(lines[slot.index - 1], otherBuffer) == key)
+                break;
+        }
+    }
+    return unique;
+}
+
+std::string_view CUniqueLines::GetKey(std::string_view line, std::string& buffer) const
+{
+    if (!m_ignoreCase && !m_ignoreWhitespace)
+        return line;
+    // folding the case makes a character up to three times longer
+    buffer.resize(m_ignoreCase ? line.size() * Scintilla::maxExpansionCaseConversion + 1 : line.size());
+    char* const start = buffer.data();
+    char*       out   = start;
+    // whitespace is only added once something follows it
+    bool space = false;
+    for (size_t pos = 0; pos < line.size();)
+    {
+        auto c = static_cast<unsigned char>(line[pos]);
+        if (m_ignoreWhitespace && (c == ' ' || c == '\t'))
+        {
+            space = out != start;
+            ++pos;
+            continue;
+        }
+        if (space)
+        {
+            *out++ = ' ';
+            space  = false;
+        }
+        if (c < 0x80 || !m_ignoreCase)
+        {
+            *out++ = (m_ignoreCase && c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : static_cast<char>(c);
+            ++pos;
+            continue;
+        }
+        // a run of non-ascii bytes only has whole characters, fold it at once
+        size_t end = pos;
+        while (end < line.size() && static_cast<unsigned char>(line[end]) >= 0x80)
+            ++end;
+        out += Scintilla::CaseConvertString(out, buffer.data() + buffer.size() - out, line.data() + pos, end - pos, Scintilla::CaseConversionFold);
+        pos = end;
+    }
+    return std::string_view(start, out - start);
+}
+
+unsigned __int64 CUniqueLines::Hash(std::string_view key)
+{
+    // eight bytes at a time, each mixed in with a multiplication
+    constexpr unsigned __int64 multiplier = 0x9E3779B97F4A7C15ULL;
+    unsigned __int64           hash       = key.size() * multiplier;
+    size_t                     pos        = 0;
+    for (; pos + 8 <= key.size(); pos += 8)
+    {
+        unsigned __int64 word;
+        memcpy(&word, key.data() + pos, 8);
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+    unsigned __int64 tail = 0;
+    if (pos < key.size())
+        memcpy(&tail, key.data() + pos, key.size() - pos);
+    hash = (hash ^ tail) * multiplier;
+    // the table index is taken from the low bits, the tag from the high ones
+    return hash ^ (hash >> 32);
+}
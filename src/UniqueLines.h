@@ -0,0 +1,47 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// Finds the lines of utf8 text that don't repeat an earlier line, without
+/// sorting them.
+///
+/// The lines are looked up in a hash set of views into the text, in one
+/// pass. Lines are only copied to compute their keys when case or
+/// whitespace is ignored, and then into a buffer that is reused.
+class CUniqueLines
+{
+public:
+    /// with \c ignoreWhitespace, leading and trailing spaces and tabs are
+    /// ignored and every run of them inside a line counts as one space
+    CUniqueLines(bool ignoreCase, bool ignoreWhitespace);
+
+    /// returns the indexes of the lines that aren't the same as an earlier
+    /// line, in their order
+    std::vector<size_t> Find(const std::vector<std::string_view>& lines) const;
+
+private:
+    /// returns the key of \c line, which is in \c buffer unless it's the
+    /// line itself
+    std::string_view        GetKey(std::string_view line, std::string& buffer) const;
+    static unsigned __int64 Hash(std::string_view key);
+
+    bool m_ignoreCase;
+    bool m_ignoreWhitespace;
+};
@@ -0,0 +1,209 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct NoWorkerContext
+{
+};
+
+/// A thread pool where every worker has its own task queue. Workers take
+/// tasks from the front of their own queue and, only once that is empty,
+/// steal from the back of the other queues, so long running tasks don't
+/// leave the other threads idle. Each queue has its own lock, which is
+/// hardly ever contended: only a stealing worker takes it besides the owner.
+/// The workers that run out of work sleep until new tasks are submitted.
+///
+/// Every worker owns an instance of \c Context which is created and destroyed
+/// on the worker thread itself. That makes it possible to keep objects that
+/// have thread affinity (e.g. a scratch Scintilla window) around for all the
+/// tasks a worker runs.
+template <typename Context = NoWorkerContext>
+class CWorkStealingPool
+{
+public:
+    using Task = std::function<void(Context&)>;
+
+    explicit CWorkStealingPool(size_t threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::thread::hardware_concurrency();
+        if (threadCount == 0)
+            threadCount = 1;
+        for (size_t i = 0; i < threadCount; ++i)
+            m_queues.push_back(std::make_unique<WorkQueue>());
+        for (size_t i = 0; i < threadCount; ++i)
+            m_threads.emplace_back(&CWorkStealingPool::WorkerThread, this, i);
+    }
+
+    ~CWorkStealingPool()
+    {
+        Wait();
+        m_shutdown = true;
+        {
+            // the sleeping workers check m_shutdown with the lock held
+            std::lock_guard<std::mutex> lk(m_sleepMutex);
+        }
+        m_workAvailable.notify_all();
+        for (auto& t : m_threads)
+            t.join();
+    }
+
+    CWorkStealingPool(const CWorkStealingPool&) = delete;
+    CWorkStealingPool& operator=(const CWorkStealingPool&) = delete;
+
+    size_t GetThreadCount() const { return m_threads.size(); }
+
+    /// Queues a task. If called from one of the workers, the task goes to
+    /// that worker's own queue, otherwise the queues are filled round robin.
+    void Submit(Task task)
+    {
+        size_t index = (t_pool == this) ? t_workerIndex : (m_nextQueue++ % m_queues.size());
+        ++m_pending;
+        {
+            auto&                       queue = *m_queues[index];
+            std::lock_guard<std::mutex> lk(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+            ++m_queued;
+        }
+        if (m_sleeping > 0)
+        {
+            {
+                // a worker that is about to sleep either sees the new task
+                // or is already waiting when the notification comes
+                std::lock_guard<std::mutex> lk(m_sleepMutex);
+            }
+            m_workAvailable.notify_one();
+        }
+    }
+
+    /// Blocks until all queued tasks have finished.
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lk(m_doneMutex);
+        m_allDone.wait(lk, [this]() { return m_pending == 0; });
+    }
+
+    /// Drops all tasks which haven't been started yet.
+    void Cancel()
+    {
+        size_t dropped = 0;
+        for (auto& q : m_queues)
+        {
+            std::lock_guard<std::mutex> lk(q->mutex);
+            m_queued -= q->tasks.size();
+            dropped += q->tasks.size();
+            q->tasks.clear();
+        }
+        if (dropped)
+            FinishTasks(dropped);
+    }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool PopTask(size_t index, Task& task)
+    {
+        {
+            auto&                       own = *m_queues[index];
+            std::lock_guard<std::mutex> lk(own.mutex);
+            if (!own.tasks.empty())
+            {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                --m_queued;
+                return true;
+            }
+        }
+        for (size_t i = 1; i < m_queues.size() && m_queued > 0; ++i)
+        {
+            auto&                       other = *m_queues[(index + i) % m_queues.size()];
+            std::lock_guard<std::mutex> lk(other.mutex);
+            if (!other.tasks.empty())
+            {
+                task = std::move(other.tasks.back());
+                other.tasks.pop_back();
+                --m_queued;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void FinishTasks(size_t count)
+    {
+        if (m_pending.fetch_sub(count) == count)
+        {
+            {
+                std::lock_guard<std::mutex> lk(m_doneMutex);
+            }
+            m_allDone.notify_all();
+        }
+    }
+
+    void WorkerThread(size_t index)
+    {
+        t_pool        = this;
+        t_workerIndex = index;
+        Context context;
+        for (;;)
+        {
+            Task task;
+            if (PopTask(index, task))
+            {
+                task(context);
+                task = nullptr;
+                FinishTasks(1);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m_sleepMutex);
+            ++m_sleeping;
+            m_workAvailable.wait(lk, [this]() { return m_shutdown || m_queued > 0; });
+            --m_sleeping;
+            if (m_shutdown && m_queued == 0)
+                break;
+        }
+        t_pool = nullptr;
+    }
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread>                m_threads;
+    std::atomic<size_t>                     m_pending{0}; // queued and running tasks
+    std::atomic<size_t>                     m_queued{0};  // tasks waiting in the queues
+    std::atomic<size_t>                     m_nextQueue{0};
+    std::atomic<bool>                       m_shutdown{false};
+    // only used to let idle workers and Wait() sleep
+    std::mutex                              m_sleepMutex;
+    std::condition_variable                 m_workAvailable;
+    std::atomic<size_t>                     m_sleeping{0};
+    std::mutex                              m_doneMutex;
+    std::condition_variable                 m_allDone;
+
+    static inline thread_local CWorkStealingPool* t_pool        = nullptr;
+    static inline thread_local size_t             t_workerIndex = 0;
+};
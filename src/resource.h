@@ -200,6 +200,7 @@
 #define IDD_REGEXCAPTUREDLG             247
 #define IDS_NO_PLUGINS_AVAILABLE        248
 #define IDD_COMMANDPALETTE              248
+#define IDD_REMOVEDUPLICATESDLG         249
 #define IDS_STATUS_CURPOS               249
 #define IDS_STATUS_CURPOSLONG           250
 #define IDS_STATUSSELECTIONLONG         251
@@ -217,6 +218,18 @@
 #define IDS_IMPORTBPLEX_OPEN            263
 #define IDS_COMMANDPALETTE_FILTERCUE    264
 #define IDS_ADDTOQAT                    265
+#define IDS_ERR_LARGEFILESAVE           266
+#define IDS_REPLACEALLINDIR             267
+#define IDS_REPLACEDCOUNTINFILES        268
+#define IDS_REPLACEINFILESFAILED        269
+#define IDS_REPLACEINFILESSTOPPED       270
+#define IDS_TT_MULTITERMS               271
+#define IDS_REGEXCAPTURE_RUNNING        272
+#define IDS_REGEXCAPTURE_DONE           273
+#define IDS_STATUSTTDOCSTATS            274
+#define IDS_REPLACEDCOUNTINFILESSKIPPED 275
+#define IDS_OPENCANCELLED               276
+#define IDS_SORTINGFILE                 277
 #define IDC_SEARCHCOMBO                 1000
 #define IDC_FINDBTN                     1001
 #define IDC_REPLACECOMBO                1002
@@ -342,6 +355,10 @@
 #define IDC_RESULTS                     1110
 #define IDC_CHECK1                      1113
 #define IDC_HIDE                        1113
+#define IDC_REPLACEALLINDIRBTN          1114
+#define IDC_MULTITERMS                  1115
+#define IDC_DEDUPE_CASE_CHECK           1116
+#define IDC_DEDUPE_WHITESPACE_CHECK     1117
 #define IDC_STATIC                      -1
 
 // Next default values for new objects
@@ -349,9 +366,9 @@
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
-#define _APS_NEXT_RESOURCE_VALUE        249
+#define _APS_NEXT_RESOURCE_VALUE        250
 #define _APS_NEXT_COMMAND_VALUE         32773
-#define _APS_NEXT_CONTROL_VALUE         1114
+#define _APS_NEXT_CONTROL_VALUE         1118
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
 #endif
@@ -16,6 +16,12 @@
 //
 #pragma once
 
+#ifdef BOWPAD_PORTABLE
+// the tests and benchmarks build the classes that don't need the UI on their
+// own, see tests/compat
+#    include "../tests/compat/stdafx.h"
+#else
+
 #include "targetver.h"
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
@@ -73,3 +79,10 @@
 #define WM_STATUSBAR_MSG    (WM_APP + 12)
 #define WM_THREADRESULTREADY    (WM_APP + 13)
 #define WM_CANHIDECURSOR    (WM_APP + 14)
+#define WM_LARGEFILEWINDOW  (WM_APP + 15)
+#define WM_OCCURRENCESFOUND (WM_APP + 16)
+#define WM_SELTEXTMARKERSCHANGED (WM_APP + 17)
+#define WM_REGEXCAPTUREBATCH (WM_APP + 18)
+#define WM_SORTFILEPROGRESS (WM_APP + 19)
+
+#endif // BOWPAD_PORTABLE
@@ -0,0 +1,240 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// CBufferSearch has to find exactly what Scintilla finds in a document with the
+// same content, so these tests run both on the same texts and compare.
+
+#include "stdafx.h"
+#include "Test.h"
+#include "BufferSearch.h"
+
+#include "../ext/scintilla/lexlib/CharacterCategory.h"
+#include "../ext/scintilla/include/ILoader.h"
+#include "../ext/scintilla/include/ILexer.h"
+#include "../ext/scintilla/include/Platform.h"
+#include "../ext/scintilla/src/Position.h"
+#include "../ext/scintilla/src/SplitVector.h"
+#include "../ext/scintilla/src/Partitioning.h"
+#include "../ext/scintilla/src/RunStyles.h"
+#include "../ext/scintilla/src/CellBuffer.h"
+#include "../ext/scintilla/src/CharClassify.h"
+#include "../ext/scintilla/src/Decoration.h"
+#include "../ext/scintilla/src/CaseFolder.h"
+#include "../ext/scintilla/src/Document.h"
+
+#include <memory>
+#include <random>
+
+using namespace Scintilla;
+
+namespace
+{
+struct Match
+{
+    sptr_t      start     = 0;
+    sptr_t      end       = 0;
+    sptr_t      line      = 0;
+    sptr_t      lineStart = 0;
+    std::string lineText;
+
+    bool operator==(const Match& other) const
+    {
+        return start == other.start && end == other.end && line == other.line &&
+               lineStart == other.lineStart && lineText == other.lineText;
+    }
+};
+
+std::ostream& operator<<(std::ostream& stream, const std::vector<Match>& matches)
+{
+    stream << matches.size() << " matches";
+    for (const auto& match : matches)
+        stream << " [" << match.start << "," << match.end << " line " << match.line << "]";
+    return stream;
+}
+
+std::unique_ptr<Document> CreateDocument(const std::string& text)
+{
+    auto doc = std::make_unique<Document>(SC_DOCUMENTOPTION_DEFAULT);
+    doc->SetDBCSCodePage(SC_CP_UTF8);
+    doc->SetCaseFolder(new CaseFolderUnicode());
+    doc->InsertString(0, text.c_str(), text.size());
+    return doc;
+}
+
+// all matches the same way the find dialog collects them: the line of a match
+// is the one of its first character that isn't a line ending
+std::vector<Match> FindAllInDocument(Document& doc, const std::string& searchFor, int flags)
+{
+    std::vector<Match> matches;
+    Sci::Position      minPos = 0;
+    Sci::Position      maxPos = doc.Length();
+    for (;;)
+    {
+        Sci::Position length = searchFor.size();
+        auto          pos    = doc.FindText(minPos, maxPos, searchFor.c_str(), flags, &length);
+        if (pos < 0)
+            break;
+        Match match;
+        match.start   = pos;
+        match.end     = pos + length;
+        auto linePos  = pos;
+        while (doc.CharAt(linePos) == '\r' || doc.CharAt(linePos) == '\n')
+            ++linePos;
+        match.line      = doc.LineFromPosition(linePos);
+        match.lineStart = doc.LineStart(match.line);
+        for (auto i = match.lineStart; i < doc.LineStart(match.line + 1); ++i)
+            match.lineText += doc.CharAt(i);
+        matches.push_back(match);
+        if (minPos >= match.end)
+            break;
+        minPos = match.end + 1;
+    }
+    return matches;
+}
+
+std::vector<Match> FindAllInBuffer(const std::string& text, const std::string& searchFor, int flags)
+{
+    std::vector<Match> matches;
+    CBufferSearch      search(searchFor, flags);
+    CTextLines         lines(text);
+    sptr_t             minPos = 0;
+    sptr_t             maxPos = static_cast<sptr_t>(text.size());
+    for (;;)
+    {
+        sptr_t matchEnd = 0;
+        auto   pos      = search.FindText(text, minPos, maxPos, matchEnd);
+        if (pos < 0)
+            break;
+        Match match;
+        match.start  = pos;
+        match.end    = matchEnd;
+        auto linePos = pos;
+        while (lines.CharAt(linePos) == '\r' || lines.CharAt(linePos) == '\n')
+            ++linePos;
+        match.line      = lines.LineFromPosition(linePos);
+        match.lineStart = lines.PositionFromLine(match.line);
+        match.lineText  = std::string(lines.GetLine(match.line));
+        matches.push_back(match);
+        if (minPos >= match.end)
+            break;
+        minPos = match.end + 1;
+    }
+    return matches;
+}
+
+template <size_t N>
+std::string RandomText(std::mt19937& rng, const char* const (&pieces)[N], size_t maxPieces)
+{
+    std::string text;
+    auto        count = rng() % (maxPieces + 1);
+    for (size_t i = 0; i < count; ++i)
+        text += pieces[rng() % N];
+    return text;
+}
+
+void CompareSearches(const std::string& text, const std::string& searchFor, int flags)
+{
+    auto doc = CreateDocument(text);
+    CHECK_EQUAL(FindAllInDocument(*doc, searchFor, flags), FindAllInBuffer(text, searchFor, flags));
+}
+} // namespace
+
+TEST(BufferSearch, TextLines)
+{
+    CTextLines lines("one\r\ntwo\rthree\nfour");
+    CHECK_EQUAL(19, lines.GetLength());
+    CHECK_EQUAL(0, lines.LineFromPosition(4));
+    CHECK_EQUAL(1, lines.LineFromPosition(5));
+    CHECK_EQUAL(2, lines.LineFromPosition(9));
+    CHECK_EQUAL(3, lines.LineFromPosition(19));
+    CHECK_EQUAL(15, lines.PositionFromLine(3));
+    CHECK_EQUAL(std::string("two\r"), std::string(lines.GetLine(1)));
+    CHECK_EQUAL(std::string("four"), std::string(lines.GetLine(3)));
+    CHECK_EQUAL(0, lines.CharAt(-1));
+    CHECK_EQUAL(0, lines.CharAt(19));
+}
+
+TEST(BufferSearch, InvalidRegex)
+{
+    CBufferSearch search("a(b", SCFIND_REGEXP | SCFIND_CXX11REGEX);
+    CHECK(!search.IsValid());
+    sptr_t matchEnd = 0;
+    CHECK_EQUAL(-2, search.FindText("a(b", 0, 3, matchEnd));
+}
+
+TEST(BufferSearch, Literal)
+{
+    // case folding, word boundaries and invalid UTF-8 are where the two
+    // searches could go apart
+    static const char* const pieces[] = {"a", "A", "b", "foo", "Foo", "FOO", "\r", "\n", "\r\n", " ", "_", "\xc3\xa9", "\xc3\x89",
+                                         "\xc3\x9f", "SS", "\xc7\x86", "\xc7\x84", "\xe2\x82", "\xff", "\xe6\x97\xa5\xe6\x9c\xac", "K",
+                                         "\xe2\x84\xaa", "-", "x1", ".", "\xc5\xbf", "s", "\xc4\xb0", "i"};
+    static const char* const patterns[] = {"", "a", "foo", "Foo", "oo", "\xc3\xa9", "\xc3\x89", "ss", "\xc3\x9f", "k", "SS", "\xe6\x97\xa5",
+                                           "\xe6\x97\xa5\xe6\x9c\xac", "x", "\xe2\x84\xaa", "i", "\xc4\xb0", "a b", "-", "\xc5\xbf"};
+    static const int         flagSets[] = {0, SCFIND_MATCHCASE, SCFIND_WHOLEWORD, SCFIND_WORDSTART,
+                                   SCFIND_MATCHCASE | SCFIND_WHOLEWORD, SCFIND_MATCHCASE | SCFIND_WORDSTART};
+    std::mt19937             rng(42);
+    for (int i = 0; i < 500; ++i)
+    {
+        auto text = RandomText(rng, pieces, 60);
+        for (const char* pattern : patterns)
+        {
+            for (int flags : flagSets)
+                CompareSearches(text, pattern, flags);
+        }
+    }
+}
+
+TEST(BufferSearch, Regex)
+{
+    static const char* const pieces[]   = {"a", "b", "foo", "\r", "\n", "\r\n", " ", "\xc3\xa9", "x1", "E", "\t"};
+    static const char* const patterns[] = {"^foo", "foo$", "^a", "b$", "^$", "a.*$", "^.*b", "o\\s*$", "^\\w+$", "E$",
+                                           "x\\d$", "^", "$", "a|b", "(fo+)\\s", "\\bb", "[^a]+", "\xc3\xa9+", ".", "\\n", "\\r?\\n"};
+    std::mt19937             rng(7);
+    for (int i = 0; i < 300; ++i)
+    {
+        auto text = RandomText(rng, pieces, 30);
+        for (const char* pattern : patterns)
+        {
+            CompareSearches(text, pattern, SCFIND_REGEXP | SCFIND_CXX11REGEX);
+            CompareSearches(text, pattern, SCFIND_REGEXP | SCFIND_CXX11REGEX | SCFIND_MATCHCASE);
+        }
+    }
+}
+
+TEST(BufferSearch, RangeLimits)
+{
+    // a search limited to a part of the text must not look past its end
+    const std::string text = "foo bar foo\nbar foo";
+    CBufferSearch     search("foo", 0);
+    sptr_t            matchEnd = 0;
+    CHECK_EQUAL(8, search.FindText(text, 1, 11, matchEnd));
+    CHECK_EQUAL(11, matchEnd);
+    CHECK_EQUAL(-1, search.FindText(text, 1, 10, matchEnd));
+    auto doc   = CreateDocument(text);
+    Sci::Position length = 3;
+    CHECK_EQUAL(-1, doc->FindText(1, 10, "foo", 0, &length));
+}
+
+TEST(BufferSearch, ReplaceAll)
+{
+    // the format uses the ECMAScript syntax, same as the replace in a document
+    CBufferSearch search("(\\w+)@(\\w+)", SCFIND_REGEXP | SCFIND_CXX11REGEX);
+    std::string   result;
+    CHECK_EQUAL(2, search.ReplaceAll("me@home, you@work", "$2 at $1", result));
+    CHECK_EQUAL(std::string("home at me, work at you"), result);
+}
@@ -0,0 +1,173 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "stdafx.h"
+#include "Test.h"
+#include "DocumentStatistics.h"
+
+#include <iterator>
+#include <random>
+#include <string>
+
+namespace
+{
+// the counts like "characters 5, words 2, lines 2, empty 0, paragraphs 1"
+std::string Describe(const CDocumentStatistics::Counts& counts)
+{
+    return "characters " + std::to_string(counts.characters) + ", words " + std::to_string(counts.words) +
+           ", lines " + std::to_string(counts.lines) + ", empty " + std::to_string(counts.emptyLines) +
+           ", paragraphs " + std::to_string(counts.paragraphs);
+}
+
+CDocumentStatistics::TextFunc TextOf(const std::string& text)
+{
+    return [&text](size_t pos, size_t length) { return std::string_view(text).substr(pos, length); };
+}
+
+// counts \c text from scratch
+std::string Count(const std::string& text)
+{
+    CDocumentStatistics statistics;
+    statistics.Reset(text.size());
+    return Describe(statistics.Get(TextOf(text)));
+}
+
+// counts \c text one line at a time, the way the summary defines the counts
+std::string CountLines(const std::string& text)
+{
+    const std::string_view separators = "!\"$%&'()*+,-./:;=?[\\]^{|}";
+    CDocumentStatistics::Counts counts;
+    bool                        inWord    = false;
+    bool                        content   = false;
+    bool                        lastEmpty = true;
+    auto                        endLine   = [&]() {
+        ++counts.lines;
+        counts.emptyLines += content ? 0 : 1;
+        counts.paragraphs += content && lastEmpty ? 1 : 0;
+        lastEmpty = !content;
+        content   = false;
+    };
+    for (size_t pos = 0; pos < text.size(); ++pos)
+    {
+        const char c     = text[pos];
+        const bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+        const bool word  = !space && separators.find(c) == std::string_view::npos;
+        counts.characters += (static_cast<unsigned char>(c) & 0xC0) != 0x80 ? 1 : 0;
+        counts.words += word && !inWord ? 1 : 0;
+        inWord  = word;
+        content = content || !space;
+        if (c == '\n' || (c == '\r' && (pos + 1 == text.size() || text[pos + 1] != '\n')))
+            endLine();
+    }
+    // the last line, empty if the text ends with a line end
+    endLine();
+    return Describe(counts);
+}
+} // namespace
+
+TEST(DocumentStatistics, Counts)
+{
+    CHECK_EQUAL(std::string("characters 0, words 0, lines 1, empty 1, paragraphs 0"), Count(""));
+    CHECK_EQUAL(std::string("characters 11, words 3, lines 1, empty 0, paragraphs 1"), Count("one, two(3)"));
+    // characters are code points, not bytes
+    CHECK_EQUAL(std::string("characters 6, words 2, lines 1, empty 0, paragraphs 1"), Count("\xc3\xa4h \xf0\x9f\x98\x80\xe6\x97\xa5."));
+    // "\r\n", "\n" and a single "\r" end a line, the line after the last
+    // line end counts too
+    CHECK_EQUAL(std::string("characters 7, words 3, lines 4, empty 1, paragraphs 1"), Count("a\r\nb\rc\n"));
+    CHECK_EQUAL(std::string("characters 2, words 0, lines 3, empty 3, paragraphs 0"), Count("\r\r"));
+}
+
+TEST(DocumentStatistics, Paragraphs)
+{
+    // a paragraph is a run of lines that aren't empty, lines of just spaces
+    // and tabs count as empty
+    CHECK_EQUAL(std::string("characters 3, words 2, lines 2, empty 0, paragraphs 1"), Count("a\nb"));
+    CHECK_EQUAL(std::string("characters 4, words 2, lines 3, empty 1, paragraphs 2"), Count("a\n\nb"));
+    CHECK_EQUAL(std::string("characters 8, words 2, lines 4, empty 2, paragraphs 2"), Count("a\n \t\r\nb\n"));
+    CHECK_EQUAL(std::string("characters 3, words 1, lines 3, empty 2, paragraphs 1"), Count("\n\na"));
+    // punctuation is content, even though it isn't a word
+    CHECK_EQUAL(std::string("characters 4, words 1, lines 3, empty 1, paragraphs 2"), Count("-\n\na"));
+    for (const char* text : {"", "a\nb", "a\n\nb", "a\n \t\r\nb\n", "\n\na", "-\n\na", " x \r\r\n\r\ny\n\nz"})
+        CHECK_EQUAL(CountLines(text), Count(text));
+}
+
+TEST(DocumentStatistics, CrLfAtBlockEnd)
+{
+    // the first block ends after the line end that follows its first 64 kB,
+    // which is "\r\n" here. Splitting it or joining it again must be seen
+    // by the block before and the block after.
+    std::string         text = std::string(64 * 1024 - 2, 'a') + "\r\nb\nc";
+    CDocumentStatistics statistics;
+    statistics.Reset(text.size());
+    CHECK_EQUAL(CountLines(text), Describe(statistics.Get(TextOf(text))));
+
+    const size_t lf = 64 * 1024 - 1;
+    text.insert(lf, "x");
+    statistics.Inserted(lf, 1);
+    CHECK_EQUAL(CountLines(text), Describe(statistics.Get(TextOf(text))));
+    text.erase(lf, 1);
+    statistics.Deleted(lf, 1);
+    CHECK_EQUAL(CountLines(text), Describe(statistics.Get(TextOf(text))));
+
+    // a "\r" at the end of a block becomes "\r\n" with the next block
+    text.erase(lf, 1);
+    statistics.Deleted(lf, 1);
+    CHECK_EQUAL(CountLines(text), Describe(statistics.Get(TextOf(text))));
+    text.insert(lf, "\n");
+    statistics.Inserted(lf, 1);
+    CHECK_EQUAL(CountLines(text), Describe(statistics.Get(TextOf(text))));
+    CHECK_EQUAL(std::string("characters 65539, words 3, lines 3, empty 0, paragraphs 1"), Describe(statistics.Get(TextOf(text))));
+}
+
+TEST(DocumentStatistics, EditRandom)
+{
+    static const char* const pieces[] = {"a", "word", " ", "\t", ".", "\r", "\n", "\r\n", "\n\n", "\xc3\xa4", "\xf0\x9f\x98\x80"};
+    std::mt19937             rng(42);
+    // a few blocks of text
+    std::string text;
+    while (text.size() < 150 * 1024)
+        text += pieces[rng() % std::size(pieces)];
+    CDocumentStatistics statistics;
+    statistics.Reset(text.size());
+    for (int i = 0; i < 1000; ++i)
+    {
+        // half of the edits close to where the blocks end
+        size_t pos = rng() % (text.size() + 1);
+        if (rng() % 2)
+            pos = std::min<size_t>(text.size(), (1 + rng() % 2) * 64 * 1024 + rng() % 64);
+        if (rng() % 2)
+        {
+            std::string piece;
+            for (auto count = 1 + rng() % 3; count > 0; --count)
+                piece += pieces[rng() % std::size(pieces)];
+            text.insert(pos, piece);
+            statistics.Inserted(pos, piece.size());
+        }
+        else
+        {
+            size_t length = std::min<size_t>(text.size() - pos, rng() % 8);
+            text.erase(pos, length);
+            statistics.Deleted(pos, length);
+        }
+        // several edits may happen before the counts are asked for
+        if (rng() % 3 == 0)
+            continue;
+        CHECK_EQUAL(text.size(), statistics.GetLength());
+        CHECK_EQUAL(Count(text), Describe(statistics.Get(TextOf(text))));
+        if (i % 100 == 0)
+            CHECK_EQUAL(CountLines(text), Count(text));
+    }
+}
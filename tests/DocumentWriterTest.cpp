@@ -0,0 +1,87 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "stdafx.h"
+#include "Test.h"
+#include "DocumentWriter.h"
+#include "TextEncoding.h"
+
+#include <string>
+
+namespace
+{
+// a text of more than one block, with a character of four bytes right
+// where the first block of 4 MB ends
+std::string MixedText()
+{
+    std::string text(4 * 1024 * 1024 - 2, 'a');
+    text += "\xf0\x9f\x98\x80";
+    while (text.size() < 10 * 1024 * 1024)
+        text += "line \xc3\xa4\xe6\x97\xa5\xf0\x9f\x98\x80 text\r\n";
+    return text;
+}
+
+std::string Write(const std::string& text, int encoding, bool hasBOM)
+{
+    std::string result;
+    DWORD       err = CDocumentWriter::Write(text.data(), text.size(), encoding, hasBOM, [&](const char* data, size_t len) -> DWORD {
+        result.append(data, len);
+        return 0;
+    });
+    CHECK_EQUAL(0UL, err);
+    return result;
+}
+} // namespace
+
+TEST(DocumentWriter, Utf8)
+{
+    auto text = MixedText();
+    CHECK(Write(text, CP_UTF8, false) == text);
+    CHECK(Write(text, CP_UTF8, true) == "\xEF\xBB\xBF" + text);
+    CHECK(Write("", CP_UTF8, false).empty());
+}
+
+TEST(DocumentWriter, Utf16AndUtf32)
+{
+    auto        text = MixedText();
+    std::string expected(text.size() * 4, '\0');
+    for (int encoding : {1200, 1201})
+    {
+        expected.resize(CTextEncoding::Utf8ToUtf16(text.data(), text.size(), encoding == 1201, expected.data()));
+        CHECK(Write(text, encoding, false) == expected);
+        expected.resize(text.size() * 4);
+    }
+    for (int encoding : {12000, 12001})
+    {
+        expected.resize(CTextEncoding::Utf8ToUtf32(text.data(), text.size(), encoding == 12001, expected.data()));
+        // UTF-32 always gets a BOM
+        auto written = Write(text, encoding, false);
+        CHECK_EQUAL(expected.size() + 4, written.size());
+        CHECK(written.substr(4) == expected);
+        expected.resize(text.size() * 4);
+    }
+}
+
+TEST(DocumentWriter, StopsAtWriteError)
+{
+    auto   text   = MixedText();
+    size_t writes = 0;
+    DWORD  err    = CDocumentWriter::Write(text.data(), text.size(), 1200, false, [&](const char*, size_t) -> DWORD {
+        return ++writes == 2 ? 112 : 0; // ERROR_DISK_FULL
+    });
+    CHECK_EQUAL(112UL, err);
+    CHECK_EQUAL(size_t(2), writes);
+}
@@ -0,0 +1,66 @@
+# The classes of BowPad that don't need the Windows UI, built on their own for
+# the tests and benchmarks. Include this file from a CMakeLists.txt and link
+# against bowpad_portable.
+
+set(BOWPAD_ROOT ${CMAKE_CURRENT_LIST_DIR}/..)
+set(BOWPAD_SCINTILLA ${BOWPAD_ROOT}/ext/scintilla)
+
+find_package(Threads REQUIRED)
+
+add_library(bowpad_portable STATIC
+    ${BOWPAD_ROOT}/src/BufferSearch.cpp
+    ${BOWPAD_ROOT}/src/DocumentStatistics.cpp
+    ${BOWPAD_ROOT}/src/DocumentWriter.cpp
+    ${BOWPAD_ROOT}/src/LineSorter.cpp
+    ${BOWPAD_ROOT}/src/RegexCache.cpp
+    ${BOWPAD_ROOT}/src/RegexEngine.cpp
+    ${BOWPAD_ROOT}/src/SearchResultStore.cpp
+    ${BOWPAD_ROOT}/src/StdRegexSearch.cpp
+    ${BOWPAD_ROOT}/src/TextEncoding.cpp
+    ${BOWPAD_ROOT}/src/TrigramIndex.cpp
+    ${BOWPAD_ROOT}/src/UniqueLines.cpp
+    # the parts of Scintilla a document without a window needs
+    ${BOWPAD_SCINTILLA}/lexlib/CharacterCategory.cxx
+    ${BOWPAD_SCINTILLA}/src/CaseConvert.cxx
+    ${BOWPAD_SCINTILLA}/src/CaseFolder.cxx
+    ${BOWPAD_SCINTILLA}/src/CellBuffer.cxx
+    ${BOWPAD_SCINTILLA}/src/CharClassify.cxx
+    ${BOWPAD_SCINTILLA}/src/DBCS.cxx
+    ${BOWPAD_SCINTILLA}/src/Decoration.cxx
+    ${BOWPAD_SCINTILLA}/src/Document.cxx
+    ${BOWPAD_SCINTILLA}/src/PerLine.cxx
+    ${BOWPAD_SCINTILLA}/src/RESearch.cxx
+    ${BOWPAD_SCINTILLA}/src/RunStyles.cxx
+    ${BOWPAD_SCINTILLA}/src/UniConversion.cxx
+    ${CMAKE_CURRENT_LIST_DIR}/compat/ScintillaPlatform.cpp)
+
+# CMappedFile needs the structured exception handling of MSVC on Windows,
+# elsewhere it uses mmap()
+if(MSVC OR NOT WIN32)
+    target_sources(bowpad_portable PRIVATE
+        ${BOWPAD_ROOT}/src/DocumentLoader.cpp
+        ${BOWPAD_ROOT}/src/MappedFile.cpp)
+endif()
+
+target_compile_features(bowpad_portable PUBLIC cxx_std_20)
+# BowPad builds Scintilla with its own regex search, see StdRegexSearch.cpp
+target_compile_definitions(bowpad_portable PUBLIC BOWPAD_PORTABLE SCI_OWNREGEX)
+target_include_directories(bowpad_portable PUBLIC
+    ${CMAKE_CURRENT_LIST_DIR}/compat
+    ${BOWPAD_ROOT}/src
+    ${BOWPAD_SCINTILLA}/include
+    ${BOWPAD_SCINTILLA}/lexlib
+    ${BOWPAD_SCINTILLA}/src)
+target_link_libraries(bowpad_portable PUBLIC Threads::Threads)
+
+if(MSVC)
+    target_compile_options(bowpad_portable PUBLIC /utf-8 /EHsc)
+    # SmartHandle.h
+    target_include_directories(bowpad_portable PUBLIC ${BOWPAD_ROOT}/ext/sktoolslib)
+else()
+    target_include_directories(bowpad_portable PUBLIC ${CMAKE_CURRENT_LIST_DIR}/compat/posix)
+    # the SIMD code paths are written for the MSVC defines
+    if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(x86_64|AMD64|amd64)$")
+        target_compile_definitions(bowpad_portable PUBLIC _M_X64=100)
+    endif()
+endif()
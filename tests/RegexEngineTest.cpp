@@ -0,0 +1,247 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "Test.h"
+#include "RegexEngine.h"
+
+#include <iterator>
+#include <random>
+
+namespace
+{
+// the groups of a match like "[0,3][1,2]null", or "" if nothing was found
+std::string Groups(const CRegexMatch& match)
+{
+    std::string result;
+    for (size_t i = 0; i < match.GroupCount(); ++i)
+    {
+        if (match.Matched(i))
+            result += "[" + std::to_string(match.Start(i)) + "," + std::to_string(match.End(i)) + "]";
+        else
+            result += "null";
+    }
+    return result;
+}
+
+std::string Search(const char* pattern, bool caseSensitive, std::string_view text, size_t start, size_t end)
+{
+    CRegexEngine engine;
+    if (engine.Compile(pattern, caseSensitive) != CRegexEngine::CompileResult::Ok)
+        return "not compiled";
+    CRegexMatch match;
+    return engine.Search(text, start, end, match) ? Groups(match) : std::string();
+}
+
+std::string SearchBackward(const CRegexEngine& engine, std::string_view text, size_t start, size_t end)
+{
+    CRegexMatch match;
+    return engine.SearchBackward(text, start, end, match) ? Groups(match) : std::string();
+}
+
+// SearchBackward() the slow way, as it is defined: of the first matches of
+// searches starting at every character, the one that ends last and of those
+// the one that starts first. \r\n counts as one character.
+std::string SearchBackwardEverywhere(const CRegexEngine& engine, std::string_view text, size_t start, size_t end)
+{
+    CRegexMatch best;
+    bool        found = false;
+    for (size_t pos = start; pos < end;)
+    {
+        CRegexMatch match;
+        if (engine.Search(text, pos, end, match) && (match.End() < static_cast<ptrdiff_t>(end) || match.Start() != match.End()) &&
+            (!found || match.End() > best.End() || (match.End() == best.End() && match.Start() < best.Start())))
+        {
+            best  = match;
+            found = true;
+        }
+        pos += text[pos] == '\r' && pos + 1 < text.size() && text[pos + 1] == '\n' ? 2 : 1;
+        while (pos < end && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80)
+            ++pos;
+    }
+    return found ? Groups(best) : std::string();
+}
+} // namespace
+
+TEST(RegexEngine, Search)
+{
+    // the expected matches are the ones JavaScript finds with the flags "gm"
+    // and "gmi", converted to byte positions
+    struct SearchCase
+    {
+        const char* pattern;
+        bool        caseSensitive;
+        const char* text;
+        size_t      start;
+        const char* expected;
+    };
+    static const SearchCase cases[] = {
+        {"^",                                  true,  "a\r\nb",                                   1, "[2,2]"},
+        {"^",                                  true,  "a\r\nb",                                   2, "[2,2]"},
+        {"$",                                  true,  "a\r\nb",                                   0, "[1,1]"},
+        {"$",                                  true,  "a\r\nb",                                   2, "[2,2]"},
+        {"^b",                                 true,  "a\r\nb",                                   0, "[3,4]"},
+        {"a$",                                 true,  "a\r\nb",                                   0, "[0,1]"},
+        {"^$",                                 true,  "a\r\n\r\nb",                               0, "[2,2]"},
+        {"^$",                                 true,  "a\n\nb",                                   0, "[2,2]"},
+        {"^\\w+$",                             true,  "one\rtwo\nthree",                          1, "[4,7]"},
+        {"\\r$",                               true,  "x\r\n",                                    0, "[1,2]"},
+        {"^\\n",                               true,  "x\r\n",                                    0, "[2,3]"},
+        {"^.*$",                               true,  "ab\xe2\x80\xa8" "cd",                      1, "[5,7]"},
+        {"$",                                  true,  "ab\xe2\x80\xa9" "cd",                      0, "[2,2]"},
+        {"a.c",                                true,  "a\nc abc",                                 0, "[4,7]"},
+        {"(a)|b",                              true,  "xxb",                                      0, "[2,3]null"},
+        {"(a)?b",                              true,  "xxb",                                      0, "[2,3]null"},
+        {"(a|ab)(c|bcd)(d*)",                  true,  "abcd",                                     0, "[0,4][0,1][1,4][4,4]"},
+        {"(a*)*",                              true,  "b",                                        0, "[0,0]null"},
+        {"(a*)+",                              true,  "b",                                        0, "[0,0][0,0]"},
+        {"(?:a|)*b",                           true,  "aab",                                      0, "[0,3]"},
+        {"((?:c*)*(?:c*|.?)|(?:\\B|(?!x)*))+", true,  "cxc",                                      0, "[0,3][2,3]"},
+        {"((?:c*)*(?:c*|.?)|(?:\\B|(?!x)*))+", true,  "abcc",                                     1, "[1,4][2,4]"},
+        {"((a*)*|b)*c",                        true,  "aabbc",                                    0, "[0,5][3,4]null"},
+        // only the iteration that consumes nothing fails, not the whole path
+        {"(.*?)+b?",                           true,  "ba",                                       0, "[0,2][1,2]"},
+        {"(.*?)+b?",                           true,  "aab",                                      0, "[0,3][2,3]"},
+        {"(.*?)+b?",                           true,  "foo bar",                                  0, "[0,7][6,7]"},
+        {"(a*?)+b",                            true,  "aab",                                      0, "[0,3][1,2]"},
+        {"b{0,2}(|.??(b*?))*",                 true,  "babb",                                     0, "[0,4][3,4][3,4]"},
+        {"(?=a)*b",                            true,  "xb",                                       0, "[1,2]"},
+        {"(?!a)+b",                            true,  "ab b",                                     0, "[1,2]"},
+        {"(?=\\d{2})\\d",                      true,  "1 23",                                     0, "[2,3]"},
+        {"a(?!b)",                             true,  "ab ac",                                    0, "[3,4]"},
+        {"\\bfoo\\b",                          true,  "foobar foo",                               0, "[7,10]"},
+        {"\\Bo",                               true,  "o foo",                                    0, "[3,4]"},
+        {"a+?",                                true,  "aaa",                                      0, "[0,1]"},
+        {"a{2,3}",                             true,  "aaaa",                                     0, "[0,3]"},
+        {"a{2,}?",                             true,  "aaaa",                                     0, "[0,2]"},
+        {"[^a-c]+",                            true,  "abcdef",                                   0, "[3,6]"},
+        {"[\\w.]+",                            true,  "a.b c",                                    0, "[0,3]"},
+        {"\\x41\\u0042",                       true,  "xAB",                                      0, "[1,3]"},
+        {"\xc3\xa9+",                          false, "\xc3\x89\xc3\xa9x",                        0, "[0,4]"},
+        {"STRASSE",                            false, "stra\xc3\x9f" "e strasse",                 0, "[8,15]"},
+        {"\xce\x99",                           false, "\xce\xb9",                                 0, "[0,2]"},
+        // unlike JavaScript without the u flag, \\w knows the Unicode letters
+        // and . matches a whole character outside the BMP
+        {"\\w+",                               true,  "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e abc", 0, "[0,9]"},
+        {"\\d",                                true,  "\xd9\xa3 3",                               0, "[3,4]"},
+        {".",                                  true,  "\xf0\x9f\x98\x80x",                        0, "[0,4]"},
+    };
+    for (const auto& test : cases)
+    {
+        std::string text = test.text;
+        CHECK_EQUAL(std::string(test.expected), Search(test.pattern, test.caseSensitive, text, test.start, text.size()));
+    }
+}
+
+TEST(RegexEngine, SearchRange)
+{
+    // the text outside the range decides about the assertions at its ends
+    CHECK_EQUAL(std::string(), Search("^b", true, "ab", 1, 2));
+    CHECK_EQUAL(std::string("[2,3]"), Search("^b", true, "a\nb", 2, 3));
+    CHECK_EQUAL(std::string(), Search("a$", true, "ab", 0, 1));
+    CHECK_EQUAL(std::string("[0,1]"), Search("a$", true, "a\r\n", 0, 1));
+    CHECK_EQUAL(std::string(), Search("\\bb", true, "ab", 1, 2));
+    CHECK_EQUAL(std::string("[0,1]"), Search("a(?=b)", true, "abc", 0, 1));
+    // matches have to end inside the range
+    CHECK_EQUAL(std::string(), Search("abc", true, "abc", 0, 2));
+    CHECK_EQUAL(std::string("[0,2]"), Search("ab?c?", true, "abc", 0, 2));
+}
+
+TEST(RegexEngine, Compile)
+{
+    CRegexEngine engine;
+    CHECK(engine.Compile("a(b", true) == CRegexEngine::CompileResult::Invalid);
+    CHECK(!engine.IsCompiled());
+    CHECK(engine.Compile("a{3,2}", true) == CRegexEngine::CompileResult::Invalid);
+    CHECK(engine.Compile("(?=a){3,2}", true) == CRegexEngine::CompileResult::Invalid);
+    // back references and quantified ^, $ and \b are left to std::regex
+    CHECK(engine.Compile("(a)\\1", true) == CRegexEngine::CompileResult::Unsupported);
+    CHECK(engine.Compile("^*", true) == CRegexEngine::CompileResult::Unsupported);
+    // and so are too deeply nested repeats that can match nothing
+    auto nested = [](int depth) {
+        std::string pattern = "a*";
+        for (int i = 0; i < depth; ++i)
+            pattern = "(?:" + pattern + ")*";
+        return pattern;
+    };
+    CHECK(engine.Compile(nested(16), true) == CRegexEngine::CompileResult::Unsupported);
+    CHECK(engine.Compile(nested(8), true) == CRegexEngine::CompileResult::Ok);
+    CHECK(engine.Compile("(a)(?:b|c)", true) == CRegexEngine::CompileResult::Ok);
+    CHECK_EQUAL(size_t(2), engine.GroupCount());
+}
+
+TEST(RegexEngine, SearchBackward)
+{
+    CRegexEngine engine;
+    engine.Compile("a+", true);
+    // the match that ends last, not the last one that starts
+    CHECK_EQUAL(std::string("[4,6]"), SearchBackward(engine, "aaa aa b", 0, 8));
+    CHECK_EQUAL(std::string("[0,3]"), SearchBackward(engine, "aaa aa b", 0, 4));
+    CHECK_EQUAL(std::string("[4,5]"), SearchBackward(engine, "aaa aa b", 4, 5));
+    CHECK_EQUAL(std::string(), SearchBackward(engine, "aaa aa b", 6, 8));
+    // of the matches ending last the one starting first, not the shortest
+    CHECK_EQUAL(std::string("[1,3]"), SearchBackward(engine, "aaa aa b", 1, 3));
+    engine.Compile("^", true);
+    // no empty match at the end of the range
+    CHECK_EQUAL(std::string("[2,2]"), SearchBackward(engine, "a\nb", 0, 3));
+    CHECK_EQUAL(std::string("[0,0]"), SearchBackward(engine, "a\nb", 0, 2));
+    engine.Compile("$", true);
+    CHECK_EQUAL(std::string("[2,2]"), SearchBackward(engine, "ab\r\ncd", 0, 4));
+    engine.Compile("b|ab", true);
+    CHECK_EQUAL(std::string("[0,2]"), SearchBackward(engine, "ab", 0, 2));
+}
+
+TEST(RegexEngine, SearchBackwardRandom)
+{
+    static const char* const atoms[] = {"a", "b", ".", "\\w", "\\s", "[ab]", "(a|b)", "(a*)", "(ab|a)", "^", "$", "\\b",
+                                        "(?=a)", "(?!b)", "\\n", "\\r?\\n", "(?:a|)", "\xc3\xa9"};
+    static const char* const quantifiers[] = {"", "", "*", "+", "?", "*?", "{1,2}"};
+    static const char* const pieces[]      = {"a", "b", "ab", " ", "\r", "\n", "\r\n", "\xc3\xa9"};
+    std::mt19937             rng(42);
+    for (int i = 0; i < 3000; ++i)
+    {
+        std::string pattern;
+        for (auto count = 1 + rng() % 4; count > 0; --count)
+        {
+            pattern += atoms[rng() % std::size(atoms)];
+            if (pattern.back() != '^' && pattern.back() != '$' && pattern.back() != 'b')
+                pattern += quantifiers[rng() % std::size(quantifiers)];
+        }
+        std::string text;
+        for (auto count = rng() % 12; count > 0; --count)
+            text += pieces[rng() % std::size(pieces)];
+        CRegexEngine engine;
+        if (engine.Compile(pattern, rng() % 2 == 0) != CRegexEngine::CompileResult::Ok)
+            continue;
+        auto start = text.empty() ? 0 : rng() % text.size();
+        while (start > 0 && (static_cast<unsigned char>(text[start]) & 0xC0) == 0x80)
+            --start;
+        CHECK_EQUAL(SearchBackwardEverywhere(engine, text, start, text.size()), SearchBackward(engine, text, start, text.size()));
+    }
+}
+
+TEST(RegexEngine, Format)
+{
+    CRegexEngine engine;
+    engine.Compile("(\\w+)@(\\w+)", true);
+    CRegexMatch       match;
+    const std::string text = "mail me@home now";
+    CHECK(engine.Search(text, 0, text.size(), match));
+    CHECK_EQUAL(std::string("home at me"), CRegexEngine::Format(text, match, "$2 at $1"));
+    // a group the regex doesn't have is empty, like std::regex does it
+    CHECK_EQUAL(std::string("[me@home] [mail ] [ now] $ []"), CRegexEngine::Format(text, match, "[$&] [$`] [$'] $$ [$3]"));
+}
@@ -0,0 +1,69 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <sstream>
+#include <string>
+#include <vector>
+
+// A minimal test framework: TEST() registers a function, CHECK() and
+// CHECK_EQUAL() report failures and carry on, so one run shows all of them.
+
+namespace Test
+{
+using TestFunc = void (*)();
+
+struct TestCase
+{
+    std::string suite;
+    std::string name;
+    TestFunc    func;
+};
+
+std::vector<TestCase>& Registry();
+bool                   Register(const char* suite, const char* name, TestFunc func);
+void                   Fail(const char* file, int line, const std::string& message);
+
+template <typename T>
+std::string ToString(const T& value)
+{
+    std::ostringstream stream;
+    stream << value;
+    return stream.str();
+}
+} // namespace Test
+
+#define TEST(suite, name)                                                            \
+    static void suite##_##name();                                                    \
+    static bool suite##_##name##_registered = Test::Register(#suite, #name, suite##_##name); \
+    static void suite##_##name()
+
+#define CHECK(condition)                                  \
+    do                                                    \
+    {                                                     \
+        if (!(condition))                                 \
+            Test::Fail(__FILE__, __LINE__, #condition);   \
+    } while (false)
+
+#define CHECK_EQUAL(expected, actual)                                                                              \
+    do                                                                                                             \
+    {                                                                                                              \
+        const auto& expectedValue = (expected);                                                                    \
+        const auto& actualValue   = (actual);                                                                      \
+        if (!(expectedValue == actualValue))                                                                       \
+            Test::Fail(__FILE__, __LINE__, std::string(#actual) + " is " + Test::ToString(actualValue) +          \
+                                               ", expected " + Test::ToString(expectedValue));                     \
+    } while (false)
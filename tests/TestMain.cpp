@@ -0,0 +1,71 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "Test.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace
+{
+int         g_failures = 0;
+std::string g_current;
+} // namespace
+
+namespace Test
+{
+std::vector<TestCase>& Registry()
+{
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+bool Register(const char* suite, const char* name, TestFunc func)
+{
+    Registry().push_back({suite, name, func});
+    return true;
+}
+
+void Fail(const char* file, int line, const std::string& message)
+{
+    ++g_failures;
+    // only the first few failures of a test, a broken loop reports too many
+    static std::string lastTest;
+    static int         failuresInTest = 0;
+    failuresInTest                    = lastTest == g_current ? failuresInTest + 1 : 1;
+    lastTest                          = g_current;
+    if (failuresInTest <= 10)
+        printf("%s(%d): %s: %s\n", file, line, g_current.c_str(), message.c_str());
+}
+} // namespace Test
+
+// runs all tests, or the ones of the suites given on the command line
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> suites(argv + 1, argv + argc);
+    int                      run = 0;
+    for (const auto& test : Test::Registry())
+    {
+        if (!suites.empty() && std::find(suites.begin(), suites.end(), test.suite) == suites.end())
+            continue;
+        g_current = test.suite + "." + test.name;
+        test.func();
+        ++run;
+    }
+    printf("%d tests run, %d failures\n", run, g_failures);
+    return run == 0 || g_failures ? 1 : 0;
+}
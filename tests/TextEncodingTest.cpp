@@ -0,0 +1,223 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "stdafx.h"
+#include "Test.h"
+#include "TextEncoding.h"
+
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <string>
+
+namespace
+{
+// a text of \c cp in all three encodings, the UTF-16 and UTF-32 ones in both
+// byte orders, built one code point at a time
+struct EncodedText
+{
+    std::string utf8;
+    std::string utf16[2];
+    std::string utf32[2];
+
+    void Append(char32_t cp)
+    {
+        if (cp < 0x80)
+            utf8 += static_cast<char>(cp);
+        else if (cp < 0x800)
+            utf8 += {static_cast<char>(0xC0 | (cp >> 6)), static_cast<char>(0x80 | (cp & 0x3F))};
+        else if (cp < 0x10000)
+            utf8 += {static_cast<char>(0xE0 | (cp >> 12)), static_cast<char>(0x80 | ((cp >> 6) & 0x3F)), static_cast<char>(0x80 | (cp & 0x3F))};
+        else
+            utf8 += {static_cast<char>(0xF0 | (cp >> 18)), static_cast<char>(0x80 | ((cp >> 12) & 0x3F)),
+                     static_cast<char>(0x80 | ((cp >> 6) & 0x3F)), static_cast<char>(0x80 | (cp & 0x3F))};
+        if (cp < 0x10000)
+            AppendUnit(cp, 2);
+        else
+        {
+            AppendUnit(0xD800 | ((cp - 0x10000) >> 10), 2);
+            AppendUnit(0xDC00 | ((cp - 0x10000) & 0x3FF), 2);
+        }
+        AppendUnit(cp, 4);
+    }
+
+private:
+    void AppendUnit(char32_t unit, int size)
+    {
+        auto& little = size == 2 ? utf16[0] : utf32[0];
+        auto& big    = size == 2 ? utf16[1] : utf32[1];
+        for (int i = 0; i < size; ++i)
+        {
+            little += static_cast<char>(unit >> (8 * i));
+            big += static_cast<char>(unit >> (8 * (size - 1 - i)));
+        }
+    }
+};
+
+// runs of ASCII long enough for the vectorized code, between characters of
+// every length, the surrogates and the last code point
+EncodedText MixedText()
+{
+    static const char32_t others[] = {0x80, 0xE4, 0x7FF, 0x800, 0x20AC, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x1F600, 0x10FFFF};
+    std::mt19937          rng(42);
+    EncodedText           text;
+    for (int i = 0; i < 2000; ++i)
+    {
+        for (auto count = rng() % 100; count > 0; --count)
+            text.Append(0x20 + rng() % 0x5F);
+        text.Append(others[rng() % std::size(others)]);
+    }
+    return text;
+}
+
+std::string Utf8ToUtf16(const std::string& text, bool bigEndian)
+{
+    std::string result(text.size() * 2, '\0');
+    result.resize(CTextEncoding::Utf8ToUtf16(text.data(), text.size(), bigEndian, result.data()));
+    return result;
+}
+
+std::string Utf8ToUtf32(const std::string& text, bool bigEndian)
+{
+    std::string result(text.size() * 4, '\0');
+    result.resize(CTextEncoding::Utf8ToUtf32(text.data(), text.size(), bigEndian, result.data()));
+    return result;
+}
+
+std::string Utf16ToUtf8(const std::string& text, bool bigEndian)
+{
+    std::string result(text.size() / 2 * 3, '\0');
+    result.resize(CTextEncoding::Utf16ToUtf8(text.data(), text.size(), bigEndian, result.data()));
+    return result;
+}
+
+std::string Utf32ToUtf8(const std::string& text, bool bigEndian)
+{
+    std::string result(text.size(), '\0');
+    result.resize(CTextEncoding::Utf32ToUtf8(text.data(), text.size(), bigEndian, result.data()));
+    return result;
+}
+
+// the code points of \c text like "41 FFFD"
+std::string CodePoints(const std::string& text)
+{
+    std::string result;
+    auto        utf32 = Utf8ToUtf32(text, false);
+    for (size_t pos = 0; pos + 4 <= utf32.size(); pos += 4)
+    {
+        char cp[16];
+        snprintf(cp, sizeof(cp), "%s%X", result.empty() ? "" : " ",
+                 static_cast<unsigned>(static_cast<unsigned char>(utf32[pos])) | (static_cast<unsigned char>(utf32[pos + 1]) << 8) |
+                     (static_cast<unsigned char>(utf32[pos + 2]) << 16) | (static_cast<unsigned>(static_cast<unsigned char>(utf32[pos + 3])) << 24));
+        result += cp;
+    }
+    return result;
+}
+} // namespace
+
+TEST(TextEncoding, RoundTrip)
+{
+    auto text = MixedText();
+    for (int bigEndian = 0; bigEndian < 2; ++bigEndian)
+    {
+        CHECK(Utf8ToUtf16(text.utf8, bigEndian) == text.utf16[bigEndian]);
+        CHECK(Utf8ToUtf32(text.utf8, bigEndian) == text.utf32[bigEndian]);
+        CHECK(Utf16ToUtf8(text.utf16[bigEndian], bigEndian) == text.utf8);
+        CHECK(Utf32ToUtf8(text.utf32[bigEndian], bigEndian) == text.utf8);
+    }
+    // the vectorized code must stop where the data does
+    for (size_t len = 0; len < 200; ++len)
+    {
+        const std::string ascii(len, 'x');
+        CHECK(Utf16ToUtf8(Utf8ToUtf16(ascii, false), false) == ascii);
+        CHECK(Utf32ToUtf8(Utf8ToUtf32(ascii, true), true) == ascii);
+    }
+}
+
+TEST(TextEncoding, SplitSurrogate)
+{
+    EncodedText text;
+    for (char32_t cp : {U'a', U'\x1F600', U'\x1F600', U'b', U'\x10FFFF', U'\xE4'})
+        text.Append(cp);
+    for (int bigEndian = 0; bigEndian < 2; ++bigEndian)
+    {
+        const auto& utf16 = text.utf16[bigEndian];
+        // the data may be cut anywhere, even inside a code unit: converting
+        // the rest from what wasn't used gives the whole text
+        for (size_t cut = 0; cut <= utf16.size(); ++cut)
+        {
+            std::string first(utf16.size() * 3, '\0');
+            size_t      used = 0;
+            first.resize(CTextEncoding::Utf16ToUtf8(utf16.data(), cut, bigEndian, first.data(), &used));
+            CHECK(used <= cut && cut - used <= 3);
+            CHECK(first + Utf16ToUtf8(utf16.substr(used), bigEndian) == text.utf8);
+        }
+        // the lead surrogate of the first emoji ends at byte 4
+        size_t used = 0;
+        char   dest[16];
+        CHECK_EQUAL(size_t(1), CTextEncoding::Utf16ToUtf8(utf16.data(), 4, bigEndian, dest, &used));
+        CHECK_EQUAL(size_t(2), used);
+        // without srcUsed there is no next block, it's invalid
+        CHECK_EQUAL(std::string("61 FFFD"), CodePoints(Utf16ToUtf8(utf16.substr(0, 4), bigEndian)));
+    }
+}
+
+TEST(TextEncoding, Utf8CompleteLength)
+{
+    // "a", U+00E4, U+20AC and U+1F600: one, two, three and four bytes
+    const std::string text = "a\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80";
+    const size_t      ends[] = {0, 1, 1, 3, 3, 3, 6, 6, 6, 6, 10};
+    for (size_t len = 0; len <= text.size(); ++len)
+        CHECK_EQUAL(ends[len], CTextEncoding::Utf8CompleteLength(text.data(), len));
+    // a character without the bytes it needs is only held back at the end
+    CHECK_EQUAL(size_t(2), CTextEncoding::Utf8CompleteLength("\xe2" "a", 2));
+    // more continuation bytes than a character can have aren't held back
+    CHECK_EQUAL(size_t(5), CTextEncoding::Utf8CompleteLength("a\x80\x80\x80\x80", 5));
+    CHECK_EQUAL(size_t(0), CTextEncoding::Utf8CompleteLength("\xf0\x9f\x98", 3));
+
+    bool incompleteTail = false;
+    CHECK_EQUAL(size_t(6), CTextEncoding::Utf8ValidLength(text.data(), 8, &incompleteTail));
+    CHECK(incompleteTail);
+    CHECK_EQUAL(size_t(1), CTextEncoding::Utf8ValidLength("a\xff\xc3\xa4", 4, &incompleteTail));
+    CHECK(!incompleteTail);
+}
+
+TEST(TextEncoding, InvalidCharacters)
+{
+    // every maximal invalid sequence is one U+FFFD, like the Unicode standard
+    // recommends: a byte that can't start a character, an overlong form, a
+    // surrogate, a code point beyond U+10FFFF and a cut off character
+    CHECK_EQUAL(std::string("61 FFFD 62"), CodePoints("a\xff" "b"));
+    CHECK_EQUAL(std::string("FFFD FFFD 61"), CodePoints("\xc0\xaf" "a"));
+    CHECK_EQUAL(std::string("FFFD FFFD FFFD"), CodePoints("\xed\xa0\x80"));
+    CHECK_EQUAL(std::string("FFFD FFFD FFFD FFFD"), CodePoints("\xf4\x90\x80\x80"));
+    CHECK_EQUAL(std::string("FFFD 61 FFFD"), CodePoints("\xe2\x82" "a\xf0\x9f\x98"));
+    CHECK_EQUAL(std::string("FFFD 20AC"), CodePoints("\x80\xe2\x82\xac"));
+    for (int bigEndian = 0; bigEndian < 2; ++bigEndian)
+    {
+        CHECK_EQUAL(std::string("FFFD FFFD FFFD"), CodePoints(Utf16ToUtf8(Utf8ToUtf16("\xed\xa0\x80", bigEndian), bigEndian)));
+        CHECK(Utf8ToUtf16("\xf0\x9f\x98", bigEndian) == (bigEndian ? std::string("\xff\xfd", 2) : std::string("\xfd\xff", 2)));
+    }
+
+    // a lone trail surrogate, a lead surrogate without its trail and a
+    // code unit cut in half
+    CHECK_EQUAL(std::string("FFFD 61"), CodePoints(Utf16ToUtf8(std::string("\x00\xdc\x61\x00", 4), false)));
+    CHECK_EQUAL(std::string("FFFD 61"), CodePoints(Utf16ToUtf8(std::string("\xd8\x3d\x00\x61", 4), true)));
+    CHECK_EQUAL(std::string("61"), CodePoints(Utf16ToUtf8(std::string("\x61\x00\x62", 3), false)));
+    // surrogates and code points beyond U+10FFFF in UTF-32
+    CHECK_EQUAL(std::string("FFFD FFFD 10FFFF"), CodePoints(Utf32ToUtf8(std::string("\x00\xd8\x00\x00\x00\x00\x11\x00\xff\xff\x10\x00", 12), false)));
+    CHECK_EQUAL(std::string("FFFD 61"), CodePoints(Utf32ToUtf8(std::string("\xff\xff\xff\xff\x00\x00\x00\x61", 8), true)));
+}
@@ -0,0 +1,135 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#include "stdafx.h"
+#include "Test.h"
+#include "UniqueLines.h"
+#include "../ext/scintilla/src/CaseConvert.h"
+
+#include <iterator>
+#include <random>
+#include <string>
+#include <unordered_set>
+
+namespace
+{
+// the indexes of the unique lines like "0 1 3"
+std::string Unique(const CUniqueLines& uniqueLines, const std::vector<std::string_view>& lines)
+{
+    std::string result;
+    for (auto index : uniqueLines.Find(lines))
+        result += (result.empty() ? "" : " ") + std::to_string(index);
+    return result;
+}
+
+std::string Unique(bool ignoreCase, bool ignoreWhitespace, const std::vector<std::string_view>& lines)
+{
+    return Unique(CUniqueLines(ignoreCase, ignoreWhitespace), lines);
+}
+
+// the unique lines found with std::unordered_set, the keys made on their own
+std::string UniqueReference(bool ignoreCase, bool ignoreWhitespace, const std::vector<std::string_view>& lines)
+{
+    std::unordered_set<std::string> seen;
+    std::string                     result;
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        std::string key(lines[i]);
+        if (ignoreWhitespace)
+        {
+            std::string trimmed;
+            for (char c : key)
+            {
+                if (c == '\t')
+                    c = ' ';
+                if (c != ' ' || (!trimmed.empty() && trimmed.back() != ' '))
+                    trimmed += c;
+            }
+            if (!trimmed.empty() && trimmed.back() == ' ')
+                trimmed.pop_back();
+            key = trimmed;
+        }
+        if (ignoreCase)
+            key = Scintilla::CaseConvertString(key, Scintilla::CaseConversionFold);
+        if (seen.insert(key).second)
+            result += (result.empty() ? "" : " ") + std::to_string(i);
+    }
+    return result;
+}
+} // namespace
+
+TEST(UniqueLines, Order)
+{
+    CHECK_EQUAL(std::string("0 1 3"), Unique(false, false, {"b", "a", "b", "c", "a"}));
+    CHECK_EQUAL(std::string("0 1"), Unique(false, false, {"", "x", "", "x"}));
+    CHECK_EQUAL(std::string(""), Unique(false, false, {}));
+    // without the options, lines only differing in case or whitespace differ
+    CHECK_EQUAL(std::string("0 1 2"), Unique(false, false, {"a b", "A b", "a  b"}));
+}
+
+TEST(UniqueLines, IgnoreCase)
+{
+    CHECK_EQUAL(std::string("0 2"), Unique(true, false, {"Line", "lINE", "line 2", "LINE"}));
+    // non-ascii characters are folded too, even to more characters
+    CHECK_EQUAL(std::string("0 3"), Unique(true, false, {"\xc3\x84pfel", "\xc3\xa4PFEL", "\xc3\x84PFEL", "Apfel"}));
+    CHECK_EQUAL(std::string("0"), Unique(true, false, {"Stra\xc3\x9f" "e", "STRASSE", "strasse"}));
+    CHECK_EQUAL(std::string("0 2"), Unique(true, false, {"\xce\xa3\xce\x91\xce\xa3", "\xcf\x83\xce\xb1\xcf\x82", "\xd0\x96"}));
+    // whitespace still counts
+    CHECK_EQUAL(std::string("0 1"), Unique(true, false, {"A b", "a  B"}));
+}
+
+TEST(UniqueLines, IgnoreWhitespace)
+{
+    // leading and trailing spaces and tabs are ignored
+    CHECK_EQUAL(std::string("0 3"), Unique(false, true, {"a b", "  a b", "a b\t \t", "ab"}));
+    // every run inside a line is one space
+    CHECK_EQUAL(std::string("0 4"), Unique(false, true, {"a b c", "a  b\tc", "a \t b \t\tc", "\ta\t\tb c ", "a bc"}));
+    // a line of just whitespace is the same as an empty line
+    CHECK_EQUAL(std::string("0 1"), Unique(false, true, {"", "x", "   ", "\t", " \t "}));
+    // the case still counts
+    CHECK_EQUAL(std::string("0 2"), Unique(false, true, {"a B", " a\tB", "A B"}));
+    CHECK_EQUAL(std::string("0 2"), Unique(true, true, {"a B", " A\t b ", "\xc3\xa4", "\t\xc3\x84 "}));
+}
+
+TEST(UniqueLines, HashCollisions)
+{
+    // these have the same tag and, in tables up to 256 slots, the same slot:
+    // they're told apart by their text only
+    const std::vector<std::string_view> colliding = {"line 5546", "line 4390430", "line 5546", "line 4390430"};
+    CHECK_EQUAL(std::string("0 1"), Unique(false, false, colliding));
+    CHECK_EQUAL(std::string("0 1"), Unique(true, true, colliding));
+    CHECK_EQUAL(std::string("0 1"), Unique(true, false, {"LINE 5546", "line 4390430", "line 5546", "Line 4390430"}));
+    CHECK_EQUAL(std::string("0 1"), Unique(false, true, {" line  5546", "line 4390430", "line 5546 ", "line\t4390430"}));
+
+    // short lines of few characters, so most of them are repeated in some
+    // form: many lines share the tag of an earlier line without being the
+    // same text, which only their keys tell apart
+    static const char* const pieces[] = {"a", "A", "b", " ", "\t", "\xc3\xa4", "\xc3\x84", "\xc3\x9f", "ss", "SS"};
+    std::mt19937             rng(42);
+    std::vector<std::string> texts(50000);
+    for (auto& text : texts)
+    {
+        for (auto count = rng() % 7; count > 0; --count)
+            text += pieces[rng() % std::size(pieces)];
+    }
+    std::vector<std::string_view> lines(texts.begin(), texts.end());
+    for (int options = 0; options < 4; ++options)
+    {
+        const bool ignoreCase       = (options & 1) != 0;
+        const bool ignoreWhitespace = (options & 2) != 0;
+        CHECK_EQUAL(UniqueReference(ignoreCase, ignoreWhitespace, lines), Unique(ignoreCase, ignoreWhitespace, lines));
+    }
+}
@@ -0,0 +1,108 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+#include "stdafx.h"
+#include "Test.h"
+#include "WorkStealingPool.h"
+
+#include <chrono>
+#include <set>
+
+namespace
+{
+struct CountingContext
+{
+    int tasks = 0;
+};
+} // namespace
+
+TEST(WorkStealingPool, RunsAllTasks)
+{
+    std::atomic<long> sum{0};
+    for (int run = 0; run < 20; ++run)
+    {
+        CWorkStealingPool<> pool(4);
+        for (int i = 0; i < 5000; ++i)
+        {
+            pool.Submit([&sum, &pool, i](NoWorkerContext&) {
+                sum += i;
+                // tasks submitted by a worker go to its own queue
+                if (i % 100 == 0)
+                    pool.Submit([&sum](NoWorkerContext&) { sum += 1; });
+            });
+        }
+        pool.Wait();
+    }
+    CHECK_EQUAL(20L * (5000L * 4999L / 2 + 50), sum.load());
+}
+
+TEST(WorkStealingPool, Stealing)
+{
+    // all tasks are submitted from one worker, the others have to steal them
+    CWorkStealingPool<>       pool(4);
+    std::mutex                mutex;
+    std::set<std::thread::id> threads;
+    pool.Submit([&](NoWorkerContext&) {
+        for (int i = 0; i < 64; ++i)
+        {
+            pool.Submit([&](NoWorkerContext&) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                std::lock_guard<std::mutex> lk(mutex);
+                threads.insert(std::this_thread::get_id());
+            });
+        }
+    });
+    pool.Wait();
+    CHECK(threads.size() > 1);
+}
+
+TEST(WorkStealingPool, Context)
+{
+    std::atomic<int> total{0};
+    {
+        CWorkStealingPool<CountingContext> pool(3);
+        for (int i = 0; i < 300; ++i)
+            pool.Submit([&](CountingContext& context) {
+                ++context.tasks;
+                ++total;
+            });
+        pool.Wait();
+    }
+    CHECK_EQUAL(300, total.load());
+}
+
+TEST(WorkStealingPool, Cancel)
+{
+    CWorkStealingPool<> pool(2);
+    std::atomic<bool>   release{false};
+    std::atomic<int>    started{0};
+    for (int i = 0; i < 100; ++i)
+    {
+        pool.Submit([&](NoWorkerContext&) {
+            ++started;
+            while (!release)
+                std::this_thread::yield();
+        });
+    }
+    while (started < 2)
+        std::this_thread::yield();
+    pool.Cancel();
+    release = true;
+    // Wait() must not block on the dropped tasks
+    pool.Wait();
+    CHECK(started < 100);
+}
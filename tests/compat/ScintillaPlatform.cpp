@@ -0,0 +1,39 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+
+// Scintilla's document classes only need these two of the platform layer
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "Platform.h"
+
+namespace Scintilla
+{
+void Platform::DebugPrintf(const char* /*format*/, ...)
+{
+}
+
+void Platform::Assert(const char* c, const char* file, int line)
+{
+    fprintf(stderr, "Assertion [%s] failed at %s %d\n", c, file, line);
+    abort();
+}
+} // namespace Scintilla
@@ -0,0 +1,35 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+#include <windows.h>
+
+#include <string>
+
+// the one function of the sktoolslib class the portable classes use
+class CUnicodeUtils
+{
+public:
+    static std::wstring StdGetUnicode(const std::string& multibyte, bool /*stopAtNull*/ = true)
+    {
+        if (multibyte.empty())
+            return std::wstring();
+        std::wstring wide(multibyte.size(), L'\0');
+        int          len = MultiByteToWideChar(CP_UTF8, 0, multibyte.data(), static_cast<int>(multibyte.size()), wide.data(), static_cast<int>(wide.size()));
+        wide.resize(len);
+        return wide;
+    }
+};
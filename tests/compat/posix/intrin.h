@@ -0,0 +1,48 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+
+// the MSVC intrinsics the portable classes use, for gcc and clang
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#undef __cpuid
+
+inline void __cpuid(int info[4], int leaf)
+{
+    __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+}
+
+// cpuid.h has its own __cpuidex since gcc 11 and clang 15
+#if (defined(__clang__) && __clang_major__ < 15) || (!defined(__clang__) && __GNUC__ < 11)
+inline void __cpuidex(int info[4], int leaf, int subLeaf)
+{
+    __cpuid_count(leaf, subLeaf, info[0], info[1], info[2], info[3]);
+}
+#endif
+
+// the compiler's own version needs the xsave target
+inline unsigned long long BowPadXgetbv(unsigned int index)
+{
+    unsigned int eax = 0;
+    unsigned int edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+}
+#undef _xgetbv
+#define _xgetbv BowPadXgetbv
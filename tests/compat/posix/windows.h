@@ -0,0 +1,192 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+
+// The few parts of the Windows API the portable classes use, for building the
+// tests and benchmarks on other systems.
+
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+
+using BOOL  = int;
+using BYTE  = unsigned char;
+using UINT  = unsigned int;
+using DWORD = unsigned long;
+
+#define __int64 long long
+
+#define CP_ACP  0
+#define CP_UTF8 65001
+
+#define MB_ERR_INVALID_CHARS 0x08
+
+#define NORM_IGNORECASE       0x00000001
+#define SORT_DIGITSASNUMBERS  0x00000008
+#define LINGUISTIC_IGNORECASE 0x00000010
+#define LCMAP_SORTKEY         0x00000400
+
+#define ERROR_NOT_ENOUGH_MEMORY      8L
+#define ERROR_READ_FAULT             30L
+#define ERROR_NO_UNICODE_TRANSLATION 1113L
+#define ERROR_CANCELLED              1223L
+
+inline DWORD& LastError()
+{
+    thread_local DWORD error = 0;
+    return error;
+}
+
+inline DWORD GetLastError() { return LastError(); }
+inline void  SetLastError(DWORD error) { LastError() = error; }
+
+// a HANDLE is a file descriptor here
+using HANDLE = void*;
+
+inline HANDLE FileHandle(int fd) { return reinterpret_cast<HANDLE>(static_cast<intptr_t>(fd)); }
+inline int    FileDescriptor(HANDLE hFile) { return static_cast<int>(reinterpret_cast<intptr_t>(hFile)); }
+
+inline BOOL ReadFile(HANDLE hFile, void* buffer, DWORD toRead, DWORD* read, void* /*overlapped*/)
+{
+    ssize_t len;
+    do
+        len = ::read(FileDescriptor(hFile), buffer, toRead);
+    while (len < 0 && errno == EINTR);
+    if (len < 0)
+    {
+        SetLastError(ERROR_READ_FAULT);
+        return false;
+    }
+    *read = static_cast<DWORD>(len);
+    return true;
+}
+
+// converts UTF-8 to UTF-16 like Windows does, wchar_t may have 32 bits here
+// but gets UTF-16 code units all the same. Every byte that is not part of a
+// valid sequence becomes U+FFFD, or fails the conversion with
+// MB_ERR_INVALID_CHARS. Every other codepage is taken as Latin-1.
+inline int MultiByteToWideChar(UINT codePage, DWORD flags, const char* src, int srcLen, wchar_t* dst, int dstLen)
+{
+    const auto* s     = reinterpret_cast<const unsigned char*>(src);
+    int         count = 0;
+    auto        put   = [&](unsigned int c) {
+        if (dstLen && count < dstLen)
+            dst[count] = static_cast<wchar_t>(c);
+        ++count;
+    };
+    if (codePage != CP_UTF8)
+    {
+        for (int i = 0; i < srcLen; ++i)
+            put(s[i]);
+        return count;
+    }
+    for (int i = 0; i < srcLen;)
+    {
+        unsigned int c     = s[i];
+        int          extra = c >= 0xF0 && c <= 0xF4 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 && c < 0xE0 ? 1 : 0;
+        if (c >= 0x80 && extra == 0)
+        {
+            if (flags & MB_ERR_INVALID_CHARS)
+            {
+                SetLastError(ERROR_NO_UNICODE_TRANSLATION);
+                return 0;
+            }
+            put(0xFFFD);
+            ++i;
+            continue;
+        }
+        unsigned int value = extra ? c & (0x3F >> extra) : c;
+        int          n     = 1;
+        for (; n <= extra && i + n < srcLen && (s[i + n] & 0xC0) == 0x80; ++n)
+            value = (value << 6) | (s[i + n] & 0x3F);
+        if (n <= extra || (extra == 2 && (value < 0x800 || (value >= 0xD800 && value < 0xE000))) ||
+            (extra == 3 && (value < 0x10000 || value > 0x10FFFF)))
+        {
+            if (flags & MB_ERR_INVALID_CHARS)
+            {
+                SetLastError(ERROR_NO_UNICODE_TRANSLATION);
+                return 0;
+            }
+            put(0xFFFD);
+            ++i;
+            continue;
+        }
+        if (value >= 0x10000)
+        {
+            put(0xD800 + ((value - 0x10000) >> 10));
+            put(0xDC00 + ((value - 0x10000) & 0x3FF));
+        }
+        else
+            put(value);
+        i += n;
+    }
+    return count;
+}
+
+// converts UTF-16 code units to UTF-8 for CP_UTF8, every other codepage is
+// taken as Latin-1 with '?' for the characters it doesn't have.
+inline int WideCharToMultiByte(UINT codePage, DWORD /*flags*/, const wchar_t* src, int srcLen, char* dst, int dstLen, const char* /*defaultChar*/, int* /*usedDefaultChar*/)
+{
+    int  count = 0;
+    auto put   = [&](unsigned int c) {
+        if (dstLen && count < dstLen)
+            dst[count] = static_cast<char>(c);
+        ++count;
+    };
+    for (int i = 0; i < srcLen; ++i)
+    {
+        unsigned int c = static_cast<unsigned int>(src[i]) & 0xFFFF;
+        if (codePage != CP_UTF8)
+        {
+            put(c < 0x100 ? c : '?');
+            continue;
+        }
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < srcLen && (src[i + 1] & 0xFC00) == 0xDC00)
+            c = 0x10000 + ((c - 0xD800) << 10) + ((static_cast<unsigned int>(src[++i]) & 0xFFFF) - 0xDC00);
+        else if (c >= 0xD800 && c < 0xE000)
+            c = 0xFFFD;
+        if (c < 0x80)
+            put(c);
+        else if (c < 0x800)
+        {
+            put(0xC0 | (c >> 6));
+            put(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            put(0xE0 | (c >> 12));
+            put(0x80 | ((c >> 6) & 0x3F));
+            put(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            put(0xF0 | (c >> 18));
+            put(0x80 | ((c >> 12) & 0x3F));
+            put(0x80 | ((c >> 6) & 0x3F));
+            put(0x80 | (c & 0x3F));
+        }
+    }
+    return count;
+}
+
+inline unsigned char _BitScanForward(unsigned long* index, unsigned long mask)
+{
+    if (mask == 0)
+        return 0;
+    *index = static_cast<unsigned long>(__builtin_ctzl(mask));
+    return 1;
+}
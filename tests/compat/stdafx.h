@@ -0,0 +1,58 @@
+﻿// This file is part of BowPad.
+//
+// Copyright (C) 2020 - Stefan Kueng
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// See <http://www.gnu.org/licenses/> for a copy of the full license text
+//
+#pragma once
+
+// The tests and benchmarks build the classes that don't need the BowPad UI
+// on their own, without sktoolslib. src/stdafx.h includes this header instead
+// of the real one when BOWPAD_PORTABLE is defined.
+
+#include <windows.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// the settings are never set, so all classes use their defaults
+class CIniSettings
+{
+public:
+    static CIniSettings& Instance()
+    {
+        static CIniSettings instance;
+        return instance;
+    }
+
+    __int64 GetInt64(const wchar_t* /*section*/, const wchar_t* /*key*/, __int64 def) const { return def; }
+};
+
+class CTraceToOutputDebugString
+{
+public:
+    static CTraceToOutputDebugString& Instance()
+    {
+        static CTraceToOutputDebugString instance;
+        return instance;
+    }
+
+    template <typename... Args>
+    void operator()(const wchar_t* /*format*/, Args...)
+    {
+    }
+};